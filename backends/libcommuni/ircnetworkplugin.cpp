@@ -54,6 +54,31 @@ IRCNetworkPlugin::IRCNetworkPlugin(Config *config, Swift::QtEventLoop *loop, con
 	else {
 		m_identify = "NickServ identify $name $password";
 	}
+
+	m_sharedChannels = CONFIG_BOOL(config, "service.irc_shared_channels");
+}
+
+ParticipantTable *IRCNetworkPlugin::getParticipantTable(const std::string &hostname) {
+	ParticipantTable *&table = m_participantTables[hostname];
+	if (!table) {
+		table = new ParticipantTable();
+	}
+	table->addSession();
+	return table;
+}
+
+void IRCNetworkPlugin::releaseParticipantTable(ParticipantTable *table) {
+	if (!table->removeSession()) {
+		return;
+	}
+
+	for (std::map<std::string, ParticipantTable *>::iterator it = m_participantTables.begin(); it != m_participantTables.end(); it++) {
+		if (it->second == table) {
+			m_participantTables.erase(it);
+			break;
+		}
+	}
+	delete table;
 }
 
 void IRCNetworkPlugin::tryNextServer() {
@@ -97,6 +122,9 @@ MyIrcSession *IRCNetworkPlugin::createSession(const std::string &user, const std
 	session->setRealName(FROM_UTF8(nickname));
 	session->setHost(FROM_UTF8(hostname));
 	session->setPort(6667);
+	if (m_sharedChannels) {
+		session->setParticipantTable(getParticipantTable(hostname));
+	}
 // 	session->setEncoding("UTF8");
 
 	if (!password.empty()) {
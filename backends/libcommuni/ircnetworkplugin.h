@@ -56,11 +56,17 @@ class IRCNetworkPlugin : public QObject, public NetworkPlugin {
 		MyIrcSession *createSession(const std::string &user, const std::string &hostname, const std::string &nickname, const std::string &password, const std::string &suffix = "");
 		std::string getSessionName(const std::string &user, const std::string &legacyName);
 		std::string getTargetName(const std::string &legacyName);
+		ParticipantTable *getParticipantTable(const std::string &hostname);
+		// Deletes the table once no session uses it.
+		void releaseParticipantTable(ParticipantTable *table);
 
 	private:
 		Config *config;
 		QTcpSocket *m_socket;
 		std::map<std::string, MyIrcSession *> m_sessions;
+		// hostname -> participant table shared by sessions connected to that server
+		std::map<std::string, ParticipantTable *> m_participantTables;
+		bool m_sharedChannels;
 		std::vector<std::string> m_servers;
 		int m_currentServer;
 		std::string m_identify;
@@ -0,0 +1,198 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2013, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "participanttable.h"
+#include <algorithm>
+
+bool ParticipantTable::subscribe(const std::string &channel, MyIrcSession *session) {
+	Subscribers &subscribers = m_channels[channel].subscribers;
+	if (std::find(subscribers.begin(), subscribers.end(), session) != subscribers.end()) {
+		return false;
+	}
+	subscribers.push_back(session);
+	return true;
+}
+
+void ParticipantTable::removeChannel(std::map<std::string, Channel>::iterator it) {
+	for (Participants::const_iterator p = it->second.participants.begin(); p != it->second.participants.end(); p++) {
+		std::map<std::string, std::set<std::string> >::iterator n = m_nicknames.find(p->first);
+		if (n == m_nicknames.end())
+			continue;
+		n->second.erase(it->first);
+		if (n->second.empty()) {
+			m_nicknames.erase(n);
+		}
+	}
+	m_channels.erase(it);
+}
+
+void ParticipantTable::unsubscribe(const std::string &channel, MyIrcSession *session) {
+	std::map<std::string, Channel>::iterator it = m_channels.find(channel);
+	if (it == m_channels.end())
+		return;
+
+	it->second.subscribers.remove(session);
+	if (it->second.subscribers.empty()) {
+		removeChannel(it);
+	}
+}
+
+void ParticipantTable::unsubscribeAll(MyIrcSession *session) {
+	std::map<std::string, Channel>::iterator it = m_channels.begin();
+	while (it != m_channels.end()) {
+		std::map<std::string, Channel>::iterator current = it++;
+		current->second.subscribers.remove(session);
+		if (current->second.subscribers.empty()) {
+			removeChannel(current);
+		}
+	}
+}
+
+const ParticipantTable::Subscribers &ParticipantTable::getSubscribers(const std::string &channel) const {
+	std::map<std::string, Channel>::const_iterator it = m_channels.find(channel);
+	if (it == m_channels.end())
+		return m_noSubscribers;
+	return it->second.subscribers;
+}
+
+bool ParticipantTable::isReader(const std::string &channel, MyIrcSession *session) const {
+	const Subscribers &subscribers = getSubscribers(channel);
+	return !subscribers.empty() && subscribers.front() == session;
+}
+
+bool ParticipantTable::hasParticipant(const std::string &channel, const std::string &nickname) const {
+	return getParticipant(channel, nickname) != NULL;
+}
+
+const ParticipantTable::Participant *ParticipantTable::getParticipant(const std::string &channel, const std::string &nickname) const {
+	std::map<std::string, Channel>::const_iterator it = m_channels.find(channel);
+	if (it == m_channels.end())
+		return NULL;
+
+	Participants::const_iterator p = it->second.participants.find(nickname);
+	if (p == it->second.participants.end())
+		return NULL;
+	return &p->second;
+}
+
+const ParticipantTable::Participants &ParticipantTable::getParticipants(const std::string &channel) const {
+	std::map<std::string, Channel>::const_iterator it = m_channels.find(channel);
+	if (it == m_channels.end())
+		return m_noParticipants;
+	return it->second.participants;
+}
+
+bool ParticipantTable::addParticipant(const std::string &channel, const std::string &nickname, bool op) {
+	std::map<std::string, Channel>::iterator it = m_channels.find(channel);
+	if (it == m_channels.end())
+		return false;
+
+	Participants::iterator p = it->second.participants.find(nickname);
+	if (p != it->second.participants.end()) {
+		if (p->second.isOp() == op)
+			return false;
+		p->second.setOp(op);
+		return true;
+	}
+
+	it->second.participants.insert(std::make_pair(nickname, Participant(op)));
+	m_nicknames[nickname].insert(channel);
+	return true;
+}
+
+bool ParticipantTable::removeParticipant(const std::string &channel, const std::string &nickname) {
+	std::map<std::string, Channel>::iterator it = m_channels.find(channel);
+	if (it == m_channels.end())
+		return false;
+
+	if (it->second.participants.erase(nickname) == 0)
+		return false;
+
+	std::map<std::string, std::set<std::string> >::iterator n = m_nicknames.find(nickname);
+	if (n != m_nicknames.end()) {
+		n->second.erase(channel);
+		if (n->second.empty()) {
+			m_nicknames.erase(n);
+		}
+	}
+	return true;
+}
+
+ParticipantTable::Participant *ParticipantTable::findParticipant(const std::string &channel, const std::string &nickname) {
+	std::map<std::string, Channel>::iterator it = m_channels.find(channel);
+	if (it == m_channels.end())
+		return NULL;
+
+	Participants::iterator p = it->second.participants.find(nickname);
+	if (p == it->second.participants.end())
+		return NULL;
+	return &p->second;
+}
+
+bool ParticipantTable::setOp(const std::string &channel, const std::string &nickname, bool op) {
+	Participant *participant = findParticipant(channel, nickname);
+	if (!participant || participant->isOp() == op)
+		return false;
+	participant->setOp(op);
+	return true;
+}
+
+bool ParticipantTable::setAway(const std::string &channel, const std::string &nickname, bool away) {
+	Participant *participant = findParticipant(channel, nickname);
+	if (!participant || participant->isAway() == away)
+		return false;
+	participant->setAway(away);
+	return true;
+}
+
+std::vector<std::string> ParticipantTable::removeNickname(const std::string &nickname) {
+	std::vector<std::string> channels;
+	std::map<std::string, std::set<std::string> >::iterator n = m_nicknames.find(nickname);
+	if (n == m_nicknames.end())
+		return channels;
+
+	channels.assign(n->second.begin(), n->second.end());
+	m_nicknames.erase(n);
+
+	for (std::vector<std::string>::const_iterator it = channels.begin(); it != channels.end(); it++) {
+		m_channels[*it].participants.erase(nickname);
+	}
+	return channels;
+}
+
+std::vector<std::string> ParticipantTable::renameNickname(const std::string &nickname, const std::string &newNickname) {
+	std::vector<std::string> channels;
+	std::map<std::string, std::set<std::string> >::iterator n = m_nicknames.find(nickname);
+	if (n == m_nicknames.end() || nickname == newNickname)
+		return channels;
+
+	channels.assign(n->second.begin(), n->second.end());
+	m_nicknames.erase(n);
+
+	std::set<std::string> &newChannels = m_nicknames[newNickname];
+	for (std::vector<std::string>::const_iterator it = channels.begin(); it != channels.end(); it++) {
+		Participants &participants = m_channels[*it].participants;
+		Participants::iterator p = participants.find(nickname);
+		participants[newNickname] = p->second;
+		participants.erase(p);
+		newChannels.insert(*it);
+	}
+	return channels;
+}
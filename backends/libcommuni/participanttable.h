@@ -0,0 +1,129 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2013, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef PARTICIPANTTABLE_H
+#define PARTICIPANTTABLE_H
+
+#include <string>
+#include <map>
+#include <set>
+#include <list>
+#include <vector>
+
+class MyIrcSession;
+
+/// Participants of IRC channels on single IRC server.
+///
+/// Every channel has list of subscribed sessions. Participants are tracked
+/// only for channels with at least one subscriber. The table can be shared
+/// by all sessions connected to the same server. In that case the channel
+/// is tracked only once and every change is reported just once (methods
+/// return false if the same IRC message has been already handled by another
+/// session), so the session which handles the change first forwards it to
+/// all subscribers.
+class ParticipantTable {
+	public:
+		class Participant {
+			public:
+				Participant(bool op = false, bool away = false) : m_op(op), m_away(away) {};
+
+				void setOp(bool op) { m_op = op; }
+				bool isOp() const { return m_op; }
+				void setAway(bool away) { m_away = away; }
+				bool isAway() const { return m_away; }
+
+			private:
+				bool m_op;
+				bool m_away;
+		};
+
+		typedef std::map<std::string, Participant> Participants;
+		typedef std::list<MyIrcSession *> Subscribers;
+
+		ParticipantTable() : m_sessions(0) {}
+		virtual ~ParticipantTable() {}
+
+		/// Counts sessions which use the table, so the shared table can be
+		/// deleted once the last of them is destroyed.
+		void addSession() { m_sessions++; }
+
+		/// Returns true if no session uses the table anymore.
+		bool removeSession() { return --m_sessions == 0; }
+
+		/// Subscribes session to channel. Returns false if it's already subscribed.
+		bool subscribe(const std::string &channel, MyIrcSession *session);
+
+		/// Unsubscribes session from channel. Channel is forgotten
+		/// once the last subscriber unsubscribes.
+		void unsubscribe(const std::string &channel, MyIrcSession *session);
+
+		/// Unsubscribes session from all channels.
+		void unsubscribeAll(MyIrcSession *session);
+
+		const Subscribers &getSubscribers(const std::string &channel) const;
+
+		/// Returns true if session is the first subscriber of channel. Only this
+		/// session has to ask IRC server for information about the channel.
+		bool isReader(const std::string &channel, MyIrcSession *session) const;
+
+		bool hasParticipant(const std::string &channel, const std::string &nickname) const;
+
+		/// Returns participant or NULL if there's no such participant.
+		const Participant *getParticipant(const std::string &channel, const std::string &nickname) const;
+
+		const Participants &getParticipants(const std::string &channel) const;
+
+		/// Returns true if participant is new or its op flag changed.
+		bool addParticipant(const std::string &channel, const std::string &nickname, bool op);
+
+		/// Returns true if participant has been in the channel.
+		bool removeParticipant(const std::string &channel, const std::string &nickname);
+
+		/// Returns true if participant is in the channel and the flag changed.
+		bool setOp(const std::string &channel, const std::string &nickname, bool op);
+		bool setAway(const std::string &channel, const std::string &nickname, bool away);
+
+		/// Removes nickname from all channels (QUIT) and returns those channels.
+		std::vector<std::string> removeNickname(const std::string &nickname);
+
+		/// Renames nickname in all channels (NICK) and returns those channels.
+		std::vector<std::string> renameNickname(const std::string &nickname, const std::string &newNickname);
+
+		size_t getChannelCount() const { return m_channels.size(); }
+
+	private:
+		struct Channel {
+			Subscribers subscribers;
+			Participants participants;
+		};
+
+		void removeChannel(std::map<std::string, Channel>::iterator it);
+		Participant *findParticipant(const std::string &channel, const std::string &nickname);
+
+		std::map<std::string, Channel> m_channels;
+		// nickname -> channels where the nickname is, so QUIT and NICK
+		// don't have to check all channels.
+		std::map<std::string, std::set<std::string> > m_nicknames;
+		Subscribers m_noSubscribers;
+		Participants m_noParticipants;
+		int m_sessions;
+};
+
+#endif // PARTICIPANTTABLE_H
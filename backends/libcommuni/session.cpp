@@ -46,6 +46,8 @@ MyIrcSession::MyIrcSession(const std::string &user, IRCNetworkPlugin *np, const
 	this->suffix = suffix;
 	m_connected = false;
 	rooms = 0;
+	m_participants = new ParticipantTable();
+	m_ownParticipants = true;
 	connect(this, SIGNAL(disconnected()), SLOT(on_disconnected()));
 	connect(this, SIGNAL(socketError(QAbstractSocket::SocketError)), SLOT(on_socketError(QAbstractSocket::SocketError)));
 	connect(this, SIGNAL(connected()), SLOT(on_connected()));
@@ -58,6 +60,63 @@ MyIrcSession::MyIrcSession(const std::string &user, IRCNetworkPlugin *np, const
 
 MyIrcSession::~MyIrcSession() {
 	delete m_awayTimer;
+	m_participants->unsubscribeAll(this);
+	if (m_ownParticipants) {
+		delete m_participants;
+	}
+	else {
+		np->releaseParticipantTable(m_participants);
+	}
+}
+
+// Channels in IRC messages are lowercased before we look them up in the participant table.
+static std::string lowerChannel(const std::string &channel) {
+	return TO_UTF8(FROM_UTF8(channel).toLower());
+}
+
+void MyIrcSession::addAutoJoinChannel(const std::string &channel, const std::string &password) {
+	m_autoJoin[channel] = boost::make_shared<AutoJoinChannel>(channel, password, 12 + m_autoJoin.size());
+}
+
+void MyIrcSession::removeAutoJoinChannel(const std::string &channel) {
+	m_autoJoin.erase(channel);
+	m_participants->unsubscribe(lowerChannel(channel), this);
+}
+
+void MyIrcSession::setParticipantTable(ParticipantTable *participants) {
+	m_participants->unsubscribeAll(this);
+	if (m_ownParticipants) {
+		delete m_participants;
+	}
+	m_participants = participants;
+	m_ownParticipants = false;
+}
+
+void MyIrcSession::sendParticipantChanged(const std::string &channel, const std::string &nickname, int flags, pbnetwork::StatusType status, const std::string &statusMessage, const std::string &newname) {
+	const ParticipantTable::Subscribers &subscribers = m_participants->getSubscribers(channel);
+	for (ParticipantTable::Subscribers::const_iterator it = subscribers.begin(); it != subscribers.end(); it++) {
+		np->handleParticipantChanged((*it)->user, nickname, channel + (*it)->suffix, flags, status, statusMessage, newname);
+	}
+}
+
+void MyIrcSession::sendParticipantList(const std::string &channel, const std::list<NetworkPlugin::Participant> &participants) {
+	const ParticipantTable::Subscribers &subscribers = m_participants->getSubscribers(channel);
+	for (ParticipantTable::Subscribers::const_iterator it = subscribers.begin(); it != subscribers.end(); it++) {
+		np->handleParticipantList((*it)->user, channel + (*it)->suffix, participants);
+	}
+}
+
+void MyIrcSession::sendParticipants(const std::string &channel) {
+	const ParticipantTable::Participants &participants = m_participants->getParticipants(channel);
+	if (participants.empty()) {
+		return;
+	}
+
+	std::list<NetworkPlugin::Participant> list;
+	for (ParticipantTable::Participants::const_iterator it = participants.begin(); it != participants.end(); it++) {
+		list.push_back(NetworkPlugin::Participant(it->first, it->second.isOp(), it->second.isAway() ? pbnetwork::STATUS_AWAY : pbnetwork::STATUS_ONLINE));
+	}
+	np->handleParticipantList(user, channel + suffix, list);
 }
 
 void MyIrcSession::on_connected() {
@@ -109,6 +168,8 @@ void MyIrcSession::on_socketError(QAbstractSocket::SocketError error) {
 		np->handleDisconnected(user, 0, reason);
 		np->tryNextServer();
 	}
+	m_participants->unsubscribeAll(this);
+	m_namesReplies.clear();
 	m_connected = false;
 }
 
@@ -117,6 +178,8 @@ void MyIrcSession::on_disconnected() {
 		np->handleDisconnected(user, 0, "");
 		np->tryNextServer();
 	}
+	m_participants->unsubscribeAll(this);
+	m_namesReplies.clear();
 	m_connected = false;
 }
 
@@ -138,20 +201,52 @@ bool MyIrcSession::correctNickname(std::string &nickname) {
 void MyIrcSession::on_joined(IrcMessage *message) {
 	IrcJoinMessage *m = (IrcJoinMessage *) message;
 	std::string nickname = TO_UTF8(m->sender().name());
+	std::string channel = TO_UTF8(m->channel().toLower());
 	bool op = correctNickname(nickname);
-	getIRCBuddy(TO_UTF8(m->channel().toLower()), nickname).setOp(op);
-	np->handleParticipantChanged(user, nickname, TO_UTF8(m->channel().toLower()) + suffix, op, pbnetwork::STATUS_ONLINE);
-	LOG4CXX_INFO(logger, user << ": " << nickname << " joined " << TO_UTF8(m->channel().toLower()) + suffix);
+
+	// We are subscribed only once the server confirms we are in the channel.
+	// When the participant table is shared, other sessions could already
+	// fill it, so their members wouldn't be reported to us again.
+	if (nickname == TO_UTF8(nickName())) {
+		m_participants->subscribe(channel, this);
+		sendParticipants(channel);
+	}
+
+	if (m_participants->addParticipant(channel, nickname, op)) {
+		sendParticipantChanged(channel, nickname, op, pbnetwork::STATUS_ONLINE);
+	}
+	LOG4CXX_INFO(logger, user << ": " << nickname << " joined " << channel + suffix);
 }
 
 
 void MyIrcSession::on_parted(IrcMessage *message) {
 	IrcPartMessage *m = (IrcPartMessage *) message;
 	std::string nickname = TO_UTF8(m->sender().name());
+	std::string channel = TO_UTF8(m->channel().toLower());
 	bool op = correctNickname(nickname);
-	removeIRCBuddy(TO_UTF8(m->channel().toLower()), nickname);
-	LOG4CXX_INFO(logger, user << ": " << nickname << " parted " << TO_UTF8(m->channel().toLower()) + suffix);
-	np->handleParticipantChanged(user, nickname, TO_UTF8(m->channel().toLower()) + suffix, op, pbnetwork::STATUS_NONE, TO_UTF8(m->reason()));
+	LOG4CXX_INFO(logger, user << ": " << nickname << " parted " << channel + suffix);
+	if (m_participants->removeParticipant(channel, nickname)) {
+		sendParticipantChanged(channel, nickname, op, pbnetwork::STATUS_NONE, TO_UTF8(m->reason()));
+	}
+
+	if (nickname == TO_UTF8(nickName())) {
+		m_participants->unsubscribe(channel, this);
+	}
+}
+
+void MyIrcSession::on_kicked(IrcMessage *message) {
+	IrcKickMessage *m = (IrcKickMessage *) message;
+	std::string nickname = TO_UTF8(m->user());
+	std::string channel = TO_UTF8(m->channel().toLower());
+	bool op = correctNickname(nickname);
+	LOG4CXX_INFO(logger, user << ": " << nickname << " kicked from " << channel + suffix);
+	if (m_participants->removeParticipant(channel, nickname)) {
+		sendParticipantChanged(channel, nickname, op, pbnetwork::STATUS_NONE, TO_UTF8(m->reason()));
+	}
+
+	if (nickname == TO_UTF8(nickName())) {
+		m_participants->unsubscribe(channel, this);
+	}
 }
 
 void MyIrcSession::on_quit(IrcMessage *message) {
@@ -159,13 +254,10 @@ void MyIrcSession::on_quit(IrcMessage *message) {
 	std::string nickname = TO_UTF8(m->sender().name());
 	bool op = correctNickname(nickname);
 
-	for(AutoJoinMap::iterator it = m_autoJoin.begin(); it != m_autoJoin.end(); it++) {
-		if (!hasIRCBuddy(it->second->getChannel(), nickname)) {
-			continue;
-		}
-		removeIRCBuddy(it->second->getChannel(), nickname);
-		LOG4CXX_INFO(logger, user << ": " << nickname << " quit " << it->second->getChannel() + suffix);
-		np->handleParticipantChanged(user, nickname, it->second->getChannel() + suffix, op, pbnetwork::STATUS_NONE, TO_UTF8(m->reason()));
+	std::vector<std::string> channels = m_participants->removeNickname(nickname);
+	for (std::vector<std::string>::const_iterator it = channels.begin(); it != channels.end(); it++) {
+		LOG4CXX_INFO(logger, user << ": " << nickname << " quit " << *it + suffix);
+		sendParticipantChanged(*it, nickname, op, pbnetwork::STATUS_NONE, TO_UTF8(m->reason()));
 	}
 }
 
@@ -173,14 +265,13 @@ void MyIrcSession::on_nickChanged(IrcMessage *message) {
 	IrcNickMessage *m = (IrcNickMessage *) message;
 	std::string nickname = TO_UTF8(m->sender().name());
 	correctNickname(nickname);
+	std::string newNickname = TO_UTF8(m->nick());
 
-	for(AutoJoinMap::iterator it = m_autoJoin.begin(); it != m_autoJoin.end(); it++) {
-		if (!hasIRCBuddy(it->second->getChannel(), nickname)) {
-			continue;
-		}
-		IRCBuddy &buddy = getIRCBuddy(it->second->getChannel(), nickname);
-		LOG4CXX_INFO(logger, user << ": " << nickname << " changed nickname to " << TO_UTF8(m->nick()));
-		np->handleParticipantChanged(user, nickname, it->second->getChannel() + suffix,(int) buddy.isOp(), pbnetwork::STATUS_ONLINE, "", TO_UTF8(m->nick()));
+	std::vector<std::string> channels = m_participants->renameNickname(nickname, newNickname);
+	for (std::vector<std::string>::const_iterator it = channels.begin(); it != channels.end(); it++) {
+		const ParticipantTable::Participant *participant = m_participants->getParticipant(*it, newNickname);
+		LOG4CXX_INFO(logger, user << ": " << nickname << " changed nickname to " << newNickname);
+		sendParticipantChanged(*it, nickname, (int) participant->isOp(), pbnetwork::STATUS_ONLINE, "", newNickname);
 	}
 }
 
@@ -195,18 +286,17 @@ void MyIrcSession::on_modeChanged(IrcMessage *message) {
 
 	correctNickname(nickname);
 
-	if (!hasIRCBuddy(TO_UTF8(m->target().toLower()), nickname)) {
+	std::string channel = TO_UTF8(m->target().toLower());
+	const ParticipantTable::Participant *participant = m_participants->getParticipant(channel, nickname);
+	if (!participant) {
 		return;
 	}
-	IRCBuddy &buddy = getIRCBuddy(TO_UTF8(m->target().toLower()), nickname);
-	if (mode == "+o") {
-		buddy.setOp(true);
-	}
-	else {
-		buddy.setOp(false);
+
+	if (!m_participants->setOp(channel, nickname, mode == "+o")) {
+		return;
 	}
-	
-	np->handleParticipantChanged(user, nickname, TO_UTF8(m->target().toLower()) + suffix,(int) buddy.isOp(), pbnetwork::STATUS_ONLINE, "");
+
+	sendParticipantChanged(channel, nickname, (int) participant->isOp(), participant->isAway() ? pbnetwork::STATUS_AWAY : pbnetwork::STATUS_ONLINE, "");
 
 	LOG4CXX_INFO(logger, user << ": " << nickname << " changed mode to " << mode << " in " << TO_UTF8(m->target().toLower()));
 }
@@ -257,7 +347,7 @@ void MyIrcSession::on_messageReceived(IrcMessage *message) {
 		std::string nickname = TO_UTF8(m->sender().name());
 		correctNickname(nickname);
 		if (m_pms.find(nickname) != m_pms.end()) {
-			if (hasIRCBuddy(m_pms[nickname], nickname)) {
+			if (m_participants->hasParticipant(m_pms[nickname], nickname)) {
 				LOG4CXX_INFO(logger, nickname);
 				np->handleMessage(user, m_pms[nickname] + suffix, TO_UTF8(msg), nickname, TO_UTF8(html), "", false, true);
 				return;
@@ -304,17 +394,11 @@ void MyIrcSession::on_numericMessageReceived(IrcMessage *message) {
 		case 352: {
 			channel = parameters[1].toLower();
 			nick = TO_UTF8(parameters[5]);
-			IRCBuddy &buddy = getIRCBuddy(TO_UTF8(channel), nick);
+			bool away = parameters[6].toUpper().startsWith("G");
 
-			if (parameters[6].toUpper().startsWith("G")) {
-				if (!buddy.isAway()) {
-					buddy.setAway(true);
-					np->handleParticipantChanged(user, nick, TO_UTF8(channel) + suffix, buddy.isOp(), pbnetwork::STATUS_AWAY);
-				}
-			}
-			else if (buddy.isAway()) {
-				buddy.setAway(false);
-				np->handleParticipantChanged(user, nick, TO_UTF8(channel) + suffix, buddy.isOp(), pbnetwork::STATUS_ONLINE);
+			if (m_participants->setAway(TO_UTF8(channel), nick, away)) {
+				const ParticipantTable::Participant *participant = m_participants->getParticipant(TO_UTF8(channel), nick);
+				sendParticipantChanged(TO_UTF8(channel), nick, participant->isOp(), away ? pbnetwork::STATUS_AWAY : pbnetwork::STATUS_ONLINE);
 			}
 			break;
 		}
@@ -327,18 +411,35 @@ void MyIrcSession::on_numericMessageReceived(IrcMessage *message) {
 				bool op = 0;
 				std::string nickname = TO_UTF8(members.at(i));
 				op = correctNickname(nickname);
-				IRCBuddy &buddy = getIRCBuddy(TO_UTF8(channel), nickname);
-				buddy.setOp(op);
-				np->handleParticipantChanged(user, nickname, TO_UTF8(channel) + suffix, buddy.isOp(), pbnetwork::STATUS_ONLINE);
+				if (m_participants->addParticipant(TO_UTF8(channel), nickname, op)) {
+					m_namesReplies[TO_UTF8(channel)].push_back(NetworkPlugin::Participant(nickname, op));
+				}
 			}
 
 			break;
-		case 366:
-			// ask /who to get away states
+		case 366: {
 			channel = parameters[1].toLower();
+			std::map<std::string, std::list<NetworkPlugin::Participant> >::iterator names = m_namesReplies.find(TO_UTF8(channel));
+			if (names != m_namesReplies.end()) {
+				sendParticipantList(TO_UTF8(channel), names->second);
+				m_namesReplies.erase(names);
+			}
+
+			// ask /who to get away states
+			if (!m_participants->isReader(TO_UTF8(channel), this)) {
+				break;
+			}
 			LOG4CXX_INFO(logger, user << "Asking /who for channel " << TO_UTF8(channel));
 			sendCommand(IrcCommand::createWho(channel));
 			break;
+		}
+		case 471:
+		case 473:
+		case 474:
+		case 475:
+			// Channel is full, invite only, we are banned or the key is wrong.
+			m_participants->unsubscribe(TO_UTF8(parameters[1].toLower()), this);
+			break;
 		case 432:
 			np->handleDisconnected(user, pbnetwork::CONNECTION_ERROR_INVALID_USERNAME, "Erroneous Nickname");
 			break;
@@ -384,7 +485,8 @@ void MyIrcSession::on_numericMessageReceived(IrcMessage *message) {
 
 void MyIrcSession::awayTimeout() {
 	for(AutoJoinMap::iterator it = m_autoJoin.begin(); it != m_autoJoin.end(); it++) {
-		if (it->second->shouldAskWho()) {
+		// Only one session per channel asks when participant table is shared.
+		if (it->second->shouldAskWho() && m_participants->isReader(lowerChannel(it->first), this)) {
 			LOG4CXX_INFO(logger, "The time has come. Asking /who " << it->second->getChannel() << " again to get current away states.");
 			sendCommand(IrcCommand::createWho(FROM_UTF8(it->second->getChannel())));
 		}
@@ -411,7 +513,7 @@ void MyIrcSession::on_noticeMessageReceived(IrcMessage *message) {
 			return;
 		}
 		if (m_pms.find(nickname) != m_pms.end()) {
-			if (hasIRCBuddy(m_pms[nickname], nickname)) {
+			if (m_participants->hasParticipant(m_pms[nickname], nickname)) {
 				LOG4CXX_INFO(logger, nickname);
 				np->handleMessage(user, m_pms[nickname] + suffix, TO_UTF8(msg), nickname, "", "", false, true);
 				return;
@@ -438,6 +540,9 @@ void MyIrcSession::onMessageReceived(IrcMessage *message) {
 		case IrcMessage::Part:
 			on_parted(message);
 			break;
+		case IrcMessage::Kick:
+			on_kicked(message);
+			break;
 		case IrcMessage::Quit:
 			on_quit(message);
 			break;
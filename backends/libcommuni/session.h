@@ -29,6 +29,8 @@
 #include <QTimer>
 #endif
 
+#include "participanttable.h"
+
 using namespace Transport;
 
 class IRCNetworkPlugin;
@@ -62,34 +64,18 @@ public:
 			int m_currentAwayTick;
 	};
 
-	class IRCBuddy {
-		public:
-			IRCBuddy(bool op = false, bool away = false) : m_op(op), m_away(away) {};
-
-			void setOp(bool op) { m_op = op; }
-			bool isOp() { return m_op; }
-			void setAway(bool away) { m_away = away; }
-			bool isAway() { return m_away; }
-		
-		private:
-			bool m_op;
-			bool m_away;
-	};
-
 	typedef std::map<std::string, boost::shared_ptr<AutoJoinChannel> > AutoJoinMap;
-	typedef std::map<std::string, std::map<std::string, IRCBuddy> > IRCBuddyMap;
 
 	MyIrcSession(const std::string &user, IRCNetworkPlugin *np, const std::string &suffix = "", QObject* parent = 0);
 	virtual ~MyIrcSession();
 
-	void addAutoJoinChannel(const std::string &channel, const std::string &password) {
-		m_autoJoin[channel] = boost::make_shared<AutoJoinChannel>(channel, password, 12 + m_autoJoin.size());
-	}
+	// Uses participant table shared with other sessions connected to the
+	// same server instead of the session's own one.
+	void setParticipantTable(ParticipantTable *participants);
 
-	void removeAutoJoinChannel(const std::string &channel) {
-		m_autoJoin.erase(channel);
-		removeIRCBuddies(channel);
-	}
+	void addAutoJoinChannel(const std::string &channel, const std::string &password);
+
+	void removeAutoJoinChannel(const std::string &channel);
 
 	// We are sending PM message. On XMPP side, user is sending PM using the particular channel,
 	// for example #room@irc.freenode.org/hanzz. On IRC side, we are forwarding this message
@@ -107,26 +93,20 @@ public:
 		return m_identify;
 	}
 
-	bool hasIRCBuddy(const std::string &channel, const std::string &name) {
-		return m_buddies[channel].find(name) != m_buddies[channel].end();
-	}
-
-	IRCBuddy &getIRCBuddy(const std::string &channel, const std::string &name) {
-		return m_buddies[channel][name];
-	}
+	bool correctNickname(std::string &nickname);
 
-	void removeIRCBuddy(const std::string &channel, const std::string &name) {
-		m_buddies[channel].erase(name);
-	}
+	// Forwards participant change to all users subscribed to the channel.
+	void sendParticipantChanged(const std::string &channel, const std::string &nickname, int flags, pbnetwork::StatusType status, const std::string &statusMessage = "", const std::string &newname = "");
 
-	void removeIRCBuddies(const std::string &channel) {
-		m_buddies.erase(channel);
-	}
+	// Forwards list of new participants to all users subscribed to the channel.
+	void sendParticipantList(const std::string &channel, const std::list<NetworkPlugin::Participant> &participants);
 
-	bool correctNickname(std::string &nickname);
+	// Sends all known participants of the channel to this session's user.
+	void sendParticipants(const std::string &channel);
 
 	void on_joined(IrcMessage *message);
 	void on_parted(IrcMessage *message);
+	void on_kicked(IrcMessage *message);
 	void on_quit(IrcMessage *message);
 	void on_nickChanged(IrcMessage *message);
 	void on_modeChanged(IrcMessage *message);
@@ -156,7 +136,10 @@ protected:
 	std::list<std::string> m_rooms;
 	std::list<std::string> m_names;
 	std::map<std::string, std::string> m_pms;
-	IRCBuddyMap m_buddies;
+	ParticipantTable *m_participants;
+	bool m_ownParticipants;
+	// Participants received in 353 replies, sent together once 366 is received.
+	std::map<std::string, std::list<NetworkPlugin::Participant> > m_namesReplies;
 	QTimer *m_awayTimer;
 };
 
@@ -0,0 +1,178 @@
+#include "participanttable.h"
+#include <vector>
+#include <string>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+// Sessions are used only as subscriber identifiers by ParticipantTable.
+#define SESSION1 ((MyIrcSession *) 1)
+#define SESSION2 ((MyIrcSession *) 2)
+
+class ParticipantTableTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(ParticipantTableTest);
+	CPPUNIT_TEST(subscribe);
+	CPPUNIT_TEST(addParticipant);
+	CPPUNIT_TEST(addParticipantNotSubscribed);
+	CPPUNIT_TEST(addParticipantShared);
+	CPPUNIT_TEST(removeParticipant);
+	CPPUNIT_TEST(setOpAway);
+	CPPUNIT_TEST(removeNickname);
+	CPPUNIT_TEST(renameNickname);
+	CPPUNIT_TEST(unsubscribe);
+	CPPUNIT_TEST(unsubscribeAll);
+	CPPUNIT_TEST(sessions);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		ParticipantTable *table;
+
+		void setUp (void) {
+			table = new ParticipantTable();
+		}
+
+		void tearDown (void) {
+			delete table;
+		}
+
+		void subscribe() {
+			CPPUNIT_ASSERT(table->subscribe("#room", SESSION1));
+			CPPUNIT_ASSERT(!table->subscribe("#room", SESSION1));
+			CPPUNIT_ASSERT(table->subscribe("#room", SESSION2));
+
+			CPPUNIT_ASSERT_EQUAL(2, (int) table->getSubscribers("#room").size());
+			CPPUNIT_ASSERT(table->isReader("#room", SESSION1));
+			CPPUNIT_ASSERT(!table->isReader("#room", SESSION2));
+			CPPUNIT_ASSERT(!table->isReader("#other", SESSION1));
+		}
+
+		void addParticipant() {
+			table->subscribe("#room", SESSION1);
+			CPPUNIT_ASSERT(table->addParticipant("#room", "hanzz", false));
+			CPPUNIT_ASSERT(!table->addParticipant("#room", "hanzz", false));
+			CPPUNIT_ASSERT(table->addParticipant("#room", "hanzz", true));
+
+			const ParticipantTable::Participant *participant = table->getParticipant("#room", "hanzz");
+			CPPUNIT_ASSERT(participant);
+			CPPUNIT_ASSERT(participant->isOp());
+			CPPUNIT_ASSERT(!participant->isAway());
+			CPPUNIT_ASSERT_EQUAL(1, (int) table->getParticipants("#room").size());
+		}
+
+		void addParticipantNotSubscribed() {
+			CPPUNIT_ASSERT(!table->addParticipant("#room", "hanzz", false));
+			CPPUNIT_ASSERT(!table->hasParticipant("#room", "hanzz"));
+			CPPUNIT_ASSERT_EQUAL(0, (int) table->getChannelCount());
+		}
+
+		void addParticipantShared() {
+			table->subscribe("#room", SESSION1);
+			table->subscribe("#room", SESSION2);
+
+			// Both sessions receive the same JOIN, but only the first one
+			// should forward it.
+			CPPUNIT_ASSERT(table->addParticipant("#room", "hanzz", false));
+			CPPUNIT_ASSERT(!table->addParticipant("#room", "hanzz", false));
+			CPPUNIT_ASSERT(table->removeParticipant("#room", "hanzz"));
+			CPPUNIT_ASSERT(!table->removeParticipant("#room", "hanzz"));
+		}
+
+		void removeParticipant() {
+			table->subscribe("#room", SESSION1);
+			table->addParticipant("#room", "hanzz", false);
+			CPPUNIT_ASSERT(table->removeParticipant("#room", "hanzz"));
+			CPPUNIT_ASSERT(!table->hasParticipant("#room", "hanzz"));
+			CPPUNIT_ASSERT(table->removeNickname("hanzz").empty());
+		}
+
+		void setOpAway() {
+			table->subscribe("#room", SESSION1);
+			table->addParticipant("#room", "hanzz", false);
+
+			CPPUNIT_ASSERT(table->setAway("#room", "hanzz", true));
+			CPPUNIT_ASSERT(!table->setAway("#room", "hanzz", true));
+			CPPUNIT_ASSERT(table->getParticipant("#room", "hanzz")->isAway());
+
+			CPPUNIT_ASSERT(table->setOp("#room", "hanzz", true));
+			CPPUNIT_ASSERT(!table->setOp("#room", "hanzz", true));
+			CPPUNIT_ASSERT(table->getParticipant("#room", "hanzz")->isOp());
+
+			CPPUNIT_ASSERT(!table->setAway("#room", "unknown", true));
+			CPPUNIT_ASSERT(!table->hasParticipant("#room", "unknown"));
+		}
+
+		void removeNickname() {
+			table->subscribe("#room", SESSION1);
+			table->subscribe("#room2", SESSION1);
+			table->subscribe("#room3", SESSION1);
+			table->addParticipant("#room", "hanzz", false);
+			table->addParticipant("#room2", "hanzz", false);
+			table->addParticipant("#room3", "other", false);
+
+			std::vector<std::string> channels = table->removeNickname("hanzz");
+			CPPUNIT_ASSERT_EQUAL(2, (int) channels.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("#room"), channels[0]);
+			CPPUNIT_ASSERT_EQUAL(std::string("#room2"), channels[1]);
+			CPPUNIT_ASSERT(!table->hasParticipant("#room", "hanzz"));
+			CPPUNIT_ASSERT(!table->hasParticipant("#room2", "hanzz"));
+			CPPUNIT_ASSERT(table->hasParticipant("#room3", "other"));
+
+			CPPUNIT_ASSERT(table->removeNickname("hanzz").empty());
+		}
+
+		void renameNickname() {
+			table->subscribe("#room", SESSION1);
+			table->subscribe("#room2", SESSION1);
+			table->addParticipant("#room", "hanzz", true);
+			table->addParticipant("#room2", "hanzz", false);
+
+			std::vector<std::string> channels = table->renameNickname("hanzz", "hanzz_");
+			CPPUNIT_ASSERT_EQUAL(2, (int) channels.size());
+			CPPUNIT_ASSERT(!table->hasParticipant("#room", "hanzz"));
+			CPPUNIT_ASSERT(table->getParticipant("#room", "hanzz_")->isOp());
+			CPPUNIT_ASSERT(!table->getParticipant("#room2", "hanzz_")->isOp());
+
+			// The same NICK received by another session.
+			CPPUNIT_ASSERT(table->renameNickname("hanzz", "hanzz_").empty());
+			CPPUNIT_ASSERT_EQUAL(2, (int) table->removeNickname("hanzz_").size());
+		}
+
+		void unsubscribe() {
+			table->subscribe("#room", SESSION1);
+			table->subscribe("#room", SESSION2);
+			table->addParticipant("#room", "hanzz", false);
+
+			table->unsubscribe("#room", SESSION1);
+			CPPUNIT_ASSERT(table->isReader("#room", SESSION2));
+			CPPUNIT_ASSERT(table->hasParticipant("#room", "hanzz"));
+
+			table->unsubscribe("#room", SESSION2);
+			CPPUNIT_ASSERT_EQUAL(0, (int) table->getChannelCount());
+			CPPUNIT_ASSERT(!table->hasParticipant("#room", "hanzz"));
+			CPPUNIT_ASSERT(table->removeNickname("hanzz").empty());
+		}
+
+		void unsubscribeAll() {
+			table->subscribe("#room", SESSION1);
+			table->subscribe("#room2", SESSION1);
+			table->subscribe("#room2", SESSION2);
+			table->addParticipant("#room", "hanzz", false);
+			table->addParticipant("#room2", "hanzz", false);
+
+			table->unsubscribeAll(SESSION1);
+			CPPUNIT_ASSERT_EQUAL(1, (int) table->getChannelCount());
+			CPPUNIT_ASSERT(table->isReader("#room2", SESSION2));
+
+			std::vector<std::string> channels = table->removeNickname("hanzz");
+			CPPUNIT_ASSERT_EQUAL(1, (int) channels.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("#room2"), channels[0]);
+		}
+
+		void sessions() {
+			table->addSession();
+			table->addSession();
+			CPPUNIT_ASSERT(!table->removeSession());
+			CPPUNIT_ASSERT(table->removeSession());
+		}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (ParticipantTableTest);
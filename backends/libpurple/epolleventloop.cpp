@@ -0,0 +1,409 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "epolleventloop.h"
+
+#include "transport/logging.h"
+
+DEFINE_LOGGER(logger, "EpollEventLoop");
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+#define MAX_EVENTS 64
+
+struct EpollWatch {
+	gint fd;
+	PurpleInputCondition condition;
+	PurpleInputFunction function;
+	gpointer data;
+};
+
+// All watches added for single fd. Epoll allows to register fd only once,
+// so we register union of events all watches are interested in.
+struct EpollFd {
+	uint32_t events;
+	std::vector<guint> watches;
+};
+
+struct EpollTimer {
+	guint interval;
+	GSourceFunc function;
+	gpointer data;
+	bool queued;
+	std::multimap<guint64, guint>::iterator position;
+};
+
+static int epollFd = -1;
+static int timerFd = -1;
+static guint lastHandle = 0;
+static std::map<guint, EpollWatch> watches;
+static std::map<gint, EpollFd> fds;
+static std::map<guint, EpollTimer> timers;
+// Timers ordered by time (in ms) they should fire at.
+static std::multimap<guint64, guint> timerQueue;
+// Time timerfd is armed to, 0 if it's not armed.
+static guint64 armedTime = 0;
+// Fds of glib sources followed by epollFd itself.
+static std::vector<GPollFD> glibFds(1);
+
+static guint64 getTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static guint nextHandle() {
+	do {
+		lastHandle++;
+	} while (lastHandle == 0 || watches.find(lastHandle) != watches.end() || timers.find(lastHandle) != timers.end());
+	return lastHandle;
+}
+
+static void updateFd(gint fd) {
+	std::map<gint, EpollFd>::iterator it = fds.find(fd);
+	if (it == fds.end())
+		return;
+
+	if (it->second.watches.empty()) {
+		// Fails when fd has been already closed, which is OK.
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+		fds.erase(it);
+		return;
+	}
+
+	uint32_t events = 0;
+	for (std::vector<guint>::const_iterator w = it->second.watches.begin(); w != it->second.watches.end(); w++) {
+		const EpollWatch &watch = watches[*w];
+		if (watch.condition & PURPLE_INPUT_READ)
+			events |= EPOLLIN;
+		if (watch.condition & PURPLE_INPUT_WRITE)
+			events |= EPOLLOUT;
+	}
+
+	if (events == it->second.events)
+		return;
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+
+	int op = it->second.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	int ret = epoll_ctl(epollFd, op, fd, &ev);
+	// Closed fd is removed from epoll set automatically, so the fd number
+	// can be reused by another socket we don't know about yet and vice versa.
+	if (ret == -1 && errno == ENOENT) {
+		ret = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+	}
+	else if (ret == -1 && errno == EEXIST) {
+		ret = epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+	}
+
+	if (ret == -1) {
+		LOG4CXX_ERROR(logger, "Unable to watch fd " << fd << ": " << strerror(errno));
+	}
+	it->second.events = events;
+}
+
+static guint epoll_input_add(gint fd, PurpleInputCondition condition, PurpleInputFunction function, gpointer data) {
+	guint handle = nextHandle();
+	EpollWatch &watch = watches[handle];
+	watch.fd = fd;
+	watch.condition = condition;
+	watch.function = function;
+	watch.data = data;
+
+	std::map<gint, EpollFd>::iterator it = fds.find(fd);
+	if (it == fds.end()) {
+		it = fds.insert(std::make_pair(fd, EpollFd())).first;
+		it->second.events = 0;
+	}
+	it->second.watches.push_back(handle);
+	updateFd(fd);
+
+	return handle;
+}
+
+static gboolean epoll_input_remove(guint handle) {
+	std::map<guint, EpollWatch>::iterator it = watches.find(handle);
+	if (it == watches.end())
+		return FALSE;
+
+	gint fd = it->second.fd;
+	watches.erase(it);
+
+	std::vector<guint> &fdWatches = fds[fd].watches;
+	for (std::vector<guint>::iterator w = fdWatches.begin(); w != fdWatches.end(); w++) {
+		if (*w == handle) {
+			fdWatches.erase(w);
+			break;
+		}
+	}
+	updateFd(fd);
+	return TRUE;
+}
+
+static void armTimer() {
+	if (timerQueue.empty())
+		return;
+
+	guint64 time = timerQueue.begin()->first;
+	if (armedTime != 0 && armedTime <= time)
+		return;
+
+	// Zero it_value disarms the timer.
+	if (time == 0)
+		time = 1;
+
+	struct itimerspec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = time / 1000;
+	spec.it_value.tv_nsec = (time % 1000) * 1000000;
+	if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+		LOG4CXX_ERROR(logger, "Unable to arm timer: " << strerror(errno));
+		return;
+	}
+	armedTime = time;
+}
+
+static void queueTimer(guint handle, EpollTimer &timer) {
+	timer.position = timerQueue.insert(std::make_pair(getTime() + timer.interval, handle));
+	timer.queued = true;
+}
+
+static guint epoll_timeout_add(guint interval, GSourceFunc function, gpointer data) {
+	guint handle = nextHandle();
+	EpollTimer &timer = timers[handle];
+	timer.interval = interval;
+	timer.function = function;
+	timer.data = data;
+	queueTimer(handle, timer);
+	armTimer();
+	return handle;
+}
+
+static guint epoll_timeout_add_seconds(guint interval, GSourceFunc function, gpointer data) {
+	return epoll_timeout_add(interval * 1000, function, data);
+}
+
+static gboolean epoll_timeout_remove(guint handle) {
+	std::map<guint, EpollTimer>::iterator it = timers.find(handle);
+	if (it == timers.end())
+		return FALSE;
+
+	// Timerfd stays armed; the wakeup will just find nothing to do.
+	if (it->second.queued)
+		timerQueue.erase(it->second.position);
+	timers.erase(it);
+	return TRUE;
+}
+
+static void runTimers() {
+	uint64_t expirations;
+	while (read(timerFd, &expirations, sizeof(expirations)) > 0) {}
+	armedTime = 0;
+
+	// Timers which want to run again are queued after the loop, otherwise
+	// zero interval timer would never let us leave it.
+	std::vector<guint> again;
+	guint64 now = getTime();
+	while (!timerQueue.empty() && timerQueue.begin()->first <= now) {
+		guint handle = timerQueue.begin()->second;
+		timerQueue.erase(timerQueue.begin());
+
+		std::map<guint, EpollTimer>::iterator it = timers.find(handle);
+		it->second.queued = false;
+		GSourceFunc function = it->second.function;
+		gpointer data = it->second.data;
+
+		gboolean repeat = function(data);
+
+		// Callback could remove the timer itself.
+		it = timers.find(handle);
+		if (it == timers.end())
+			continue;
+
+		if (repeat) {
+			again.push_back(handle);
+		}
+		else {
+			timers.erase(it);
+		}
+	}
+
+	for (std::vector<guint>::const_iterator h = again.begin(); h != again.end(); h++) {
+		std::map<guint, EpollTimer>::iterator it = timers.find(*h);
+		if (it != timers.end() && !it->second.queued) {
+			queueTimer(*h, it->second);
+		}
+	}
+
+	armTimer();
+}
+
+static void dispatchFd(gint fd, uint32_t events) {
+	std::map<gint, EpollFd>::iterator it = fds.find(fd);
+	if (it == fds.end())
+		return;
+
+	// Same conditions as READ_COND and WRITE_COND in glib based loop.
+	int cond = 0;
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		cond |= PURPLE_INPUT_READ;
+	if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		cond |= PURPLE_INPUT_WRITE;
+
+	// Callbacks can add or remove watches, so iterate over copy.
+	std::vector<guint> handles = it->second.watches;
+	for (std::vector<guint>::const_iterator h = handles.begin(); h != handles.end(); h++) {
+		std::map<guint, EpollWatch>::const_iterator w = watches.find(*h);
+		if (w == watches.end() || !(w->second.condition & cond))
+			continue;
+
+		PurpleInputFunction function = w->second.function;
+		gpointer data = w->second.data;
+		function(data, fd, (PurpleInputCondition) (w->second.condition & cond));
+	}
+}
+
+static PurpleEventLoopUiOps epollEventLoopOps =
+{
+	epoll_timeout_add,
+	epoll_timeout_remove,
+	epoll_input_add,
+	epoll_input_remove,
+	NULL,
+	epoll_timeout_add_seconds,
+
+	NULL,
+	NULL,
+	NULL
+};
+
+PurpleEventLoopUiOps * getEpollEventLoopUiOps() {
+	if (epollFd != -1)
+		return &epollEventLoopOps;
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd == -1) {
+		LOG4CXX_ERROR(logger, "epoll_create1 failed: " << strerror(errno));
+		return NULL;
+	}
+
+	timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timerFd == -1) {
+		LOG4CXX_ERROR(logger, "timerfd_create failed: " << strerror(errno));
+		close(epollFd);
+		epollFd = -1;
+		return NULL;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = timerFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+
+	// We dispatch default main context ourselves in epollEventLoopIteration.
+	g_main_context_acquire(g_main_context_default());
+
+	return &epollEventLoopOps;
+}
+
+bool epollEventLoopIteration(bool block) {
+	if (epollFd == -1)
+		return false;
+
+	// Some prpls add glib sources directly. We wait for them together with
+	// epollFd, which becomes readable once any of our fds or timerfd is
+	// ready, so neither of them can starve the other.
+	GMainContext *context = g_main_context_default();
+	gint priority;
+	gboolean ready = g_main_context_prepare(context, &priority);
+
+	gint timeout;
+	gint nfds;
+	while ((nfds = g_main_context_query(context, priority, &timeout, &glibFds[0], glibFds.size() - 1)) >= (gint) glibFds.size()) {
+		glibFds.resize(nfds + 1);
+	}
+
+	if (!block || ready) {
+		timeout = 0;
+	}
+
+	glibFds[nfds].fd = epollFd;
+	glibFds[nfds].events = G_IO_IN;
+	glibFds[nfds].revents = 0;
+	if (g_poll(&glibFds[0], nfds + 1, timeout) == -1 && errno != EINTR) {
+		LOG4CXX_ERROR(logger, "g_poll failed: " << strerror(errno));
+	}
+
+	if (glibFds[nfds].revents & G_IO_IN) {
+		struct epoll_event events[MAX_EVENTS];
+		int n = epoll_wait(epollFd, events, MAX_EVENTS, 0);
+		if (n == -1 && errno != EINTR) {
+			LOG4CXX_ERROR(logger, "epoll_wait failed: " << strerror(errno));
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.fd == timerFd) {
+				runTimers();
+			}
+			else {
+				dispatchFd(events[i].data.fd, events[i].events);
+			}
+		}
+	}
+
+	if (g_main_context_check(context, priority, &glibFds[0], nfds)) {
+		g_main_context_dispatch(context);
+	}
+
+	return true;
+}
+
+void epollEventLoopRun() {
+	while (epollEventLoopIteration(true)) {}
+}
+
+#else /* __linux__ */
+
+PurpleEventLoopUiOps * getEpollEventLoopUiOps() {
+	LOG4CXX_ERROR(logger, "epoll based event loop is supported only on Linux");
+	return NULL;
+}
+
+bool epollEventLoopIteration(bool block) {
+	return false;
+}
+
+void epollEventLoopRun() {
+}
+
+#endif /* __linux__ */
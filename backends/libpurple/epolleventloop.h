@@ -0,0 +1,41 @@
+/**
+ * XMPP - libpurple transport
+ *
+ * Copyright (C) 2009, Jan Kaluza <hanzz@soc.pidgin.im>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef _HI_EPOLL_EVENTLOOP_H
+#define _HI_EPOLL_EVENTLOOP_H
+
+#include <glib.h>
+#include "purple.h"
+#include "eventloop.h"
+
+/// Returns epoll based event loop UI ops or NULL if epoll is not available.
+/// Sockets are watched directly by epoll and all timeouts share single
+/// timerfd, so adding a watch doesn't allocate GIOChannel. Sources added
+/// to default GMainContext are still dispatched by this loop.
+PurpleEventLoopUiOps * getEpollEventLoopUiOps();
+
+/// Waits for events (only if block is true) and dispatches them.
+/// Returns false if epoll event loop has not been initialized.
+bool epollEventLoopIteration(bool block);
+
+/// Runs epoll event loop forever.
+void epollEventLoopRun();
+
+#endif
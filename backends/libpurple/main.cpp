@@ -15,6 +15,7 @@
 #include "transport/config.h"
 #include "transport/logging.h"
 #include "geventloop.h"
+#include "epolleventloop.h"
 
 // #include "valgrind/memcheck.h"
 #if !defined(__FreeBSD__) && !defined(__APPLE__)
@@ -97,6 +98,16 @@ struct NodeCache {
 	int timer;
 };
 
+// Buddy state as it was last sent to Spectrum 2 main process.
+struct BuddySnapshot {
+	std::string alias;
+	std::vector<std::string> groups;
+	int status;
+	std::string statusMessage;
+	std::string iconHash;
+	bool blocked;
+};
+
 bool caching = true;
 
 static void *notify_user_info(PurpleConnection *gc, const char *who, PurpleNotifyUserInfo *user_info);
@@ -195,7 +206,8 @@ static std::string getAlias(PurpleBuddy *m_buddy) {
 class SpectrumNetworkPlugin : public NetworkPlugin {
 	public:
 		SpectrumNetworkPlugin() : NetworkPlugin() {
-
+			m_enablePrivacyLists = CONFIG_BOOL(config, "service.enable_privacy_lists");
+			m_batching = false;
 		}
 
 		void handleExitRequest() {
@@ -205,7 +217,7 @@ class SpectrumNetworkPlugin : public NetworkPlugin {
 
 		void getProtocolAndName(const std::string &legacyName, std::string &name, std::string &protocol) {
 			name = legacyName;
-			protocol = CONFIG_STRING(config, "service.protocol");
+			protocol = config->getSnapshot()->protocol;
 			if (protocol == "any") {
 				protocol = name.substr(0, name.find("."));
 				name = name.substr(name.find(".") + 1);
@@ -383,7 +395,7 @@ class SpectrumNetworkPlugin : public NetworkPlugin {
 			purple_account_set_enabled_wrapped(account, "spectrum", TRUE);
 
 #if PURPLE_MAJOR_VERSION >= 2 && PURPLE_MINOR_VERSION >= 7
-			if (CONFIG_BOOL(config, "service.enable_privacy_lists")) {
+			if (m_enablePrivacyLists) {
 				purple_account_set_privacy_type_wrapped(account, PURPLE_PRIVACY_DENY_USERS);
 			}
 #endif
@@ -404,6 +416,7 @@ class SpectrumNetworkPlugin : public NetworkPlugin {
 					delete cache;
 					account->ui_data = NULL;
 				}
+				m_buddySnapshots.erase(account);
 				if (purple_account_get_int_wrapped(account, "version", 0) != 0) {
 					std::string data = stringOf(purple_account_get_int_wrapped(account, "version", 0));
 					g_file_set_contents ("gfire.cfg", data.c_str(), data.size(), NULL);
@@ -512,13 +525,14 @@ class SpectrumNetworkPlugin : public NetworkPlugin {
 		void handleVCardRequest(const std::string &user, const std::string &legacyName, unsigned int id) {
 			PurpleAccount *account = m_sessions[user];
 			if (account) {
+				ConfigSnapshot::ref snapshot = config->getSnapshot();
 				std::string name = legacyName;
-				if (CONFIG_STRING(config, "service.protocol") == "any" && legacyName.find("prpl-") == 0) {
+				if (snapshot->protocol == "any" && legacyName.find("prpl-") == 0) {
 					name = name.substr(name.find(".") + 1);
 				}
 				m_vcards[user + name] = id;
 
-				if (CONFIG_BOOL(config, "backend.no_vcard_fetch") && name != purple_account_get_username_wrapped(account)) {
+				if (snapshot->noVCardFetch && name != purple_account_get_username_wrapped(account)) {
 					PurpleNotifyUserInfo *user_info = purple_notify_user_info_new_wrapped();
 					notify_user_info(purple_account_get_connection_wrapped(account), name.c_str(), user_info);
 					purple_notify_user_info_destroy_wrapped(user_info);
@@ -603,7 +617,7 @@ class SpectrumNetworkPlugin : public NetworkPlugin {
 		}
 
 		void handleBuddyBlockToggled(const std::string &user, const std::string &buddyName, bool blocked) {
-			if (CONFIG_BOOL(config, "service.enable_privacy_lists")) {
+			if (m_enablePrivacyLists) {
 				PurpleAccount *account = m_sessions[user];
 				if (account) {
 					if (blocked) {
@@ -718,7 +732,26 @@ class SpectrumNetworkPlugin : public NetworkPlugin {
 			purple_xfer_ui_ready_wrapped(xfer);
 		}
 
+		// Frames sent between startBatch() and flushBatch() are written
+		// to the socket at once.
+		void startBatch() {
+			m_batching = true;
+		}
+
+		void flushBatch() {
+			m_batching = false;
+			if (m_batch.empty())
+				return;
+			std::string data;
+			data.swap(m_batch);
+			sendData(data);
+		}
+
 		void sendData(const std::string &string) {
+			if (m_batching) {
+				m_batch += string;
+				return;
+			}
 #ifdef WIN32
 			::send(main_socket, string.c_str(), string.size(), 0);
 #else
@@ -745,6 +778,10 @@ class SpectrumNetworkPlugin : public NetworkPlugin {
 
 		std::map<std::string, PurpleAccount *> m_sessions;
 		std::map<PurpleAccount *, std::string> m_accounts;
+		std::map<PurpleAccount *, std::map<std::string, BuddySnapshot> > m_buddySnapshots;
+		bool m_enablePrivacyLists;
+		bool m_batching;
+		std::string m_batch;
 		std::map<std::string, unsigned int> m_vcards;
 		std::map<std::string, authRequest *> m_authRequests;
 		std::map<unsigned long, PurpleXfer *> m_xfers;
@@ -858,9 +895,11 @@ void buddyListNewNode(PurpleBlistNode *node);
 static gboolean new_node_cache(void *data) {
 	NodeCache *cache = (NodeCache *) data;
 	caching = false;
+	np->startBatch();
 	for (std::map<PurpleBlistNode *, int>::const_iterator it = cache->nodes.begin(); it != cache->nodes.end(); it++) {
 		buddyListNewNode(it->first);
 	}
+	np->flushBatch();
 	caching = true;
 
 	cache->account->ui_data = NULL;
@@ -875,6 +914,13 @@ static void buddyNodeRemoved(PurpleBuddyList *list, PurpleBlistNode *node) {
 	PurpleBuddy *buddy = (PurpleBuddy *) node;
 	PurpleAccount *account = purple_buddy_get_account_wrapped(buddy);
 
+	// Forget what we sent for this buddy, so it's sent again once the
+	// buddy is re-added or its remaining nodes are updated.
+	std::map<PurpleAccount *, std::map<std::string, BuddySnapshot> >::iterator snapshots = np->m_buddySnapshots.find(account);
+	if (snapshots != np->m_buddySnapshots.end() && purple_buddy_get_name_wrapped(buddy)) {
+		snapshots->second.erase(purple_buddy_get_name_wrapped(buddy));
+	}
+
 	if (!account->ui_data) {
 		return;
 	}
@@ -903,8 +949,12 @@ void buddyListNewNode(PurpleBlistNode *node) {
 	}
 	
 
+	const char *name = purple_buddy_get_name_wrapped(buddy);
+	if (!name)
+		return;
+
 	std::vector<std::string> groups = getGroups(buddy);
-	LOG4CXX_INFO(logger, "Buddy updated " << np->m_accounts[account] << " " << purple_buddy_get_name_wrapped(buddy) << " " << getAlias(buddy) << " group (" << groups.size() << ")=" << groups[0]);
+	std::string alias = getAlias(buddy);
 
 	// Status
 	pbnetwork::StatusType status = pbnetwork::STATUS_NONE;
@@ -916,7 +966,7 @@ void buddyListNewNode(PurpleBlistNode *node) {
 	PurplePluginProtocolInfo *prpl_info = PURPLE_PLUGIN_PROTOCOL_INFO(prpl);
 
 	bool blocked = false;
-	if (CONFIG_BOOL(config, "service.enable_privacy_lists")) {
+	if (np->m_enablePrivacyLists) {
 		if (prpl_info && prpl_info->tooltip_text) {
 			PurpleNotifyUserInfo *user_info = purple_notify_user_info_new_wrapped();
 			prpl_info->tooltip_text(buddy, user_info, true);
@@ -939,19 +989,42 @@ void buddyListNewNode(PurpleBlistNode *node) {
 		}
 
 		if (!blocked) {
-			blocked = purple_privacy_check_wrapped(account, purple_buddy_get_name_wrapped(buddy)) == false;
+			blocked = purple_privacy_check_wrapped(account, name) == false;
 		}
 		else {
-			bool purpleBlocked = purple_privacy_check_wrapped(account, purple_buddy_get_name_wrapped(buddy)) == false;
+			bool purpleBlocked = purple_privacy_check_wrapped(account, name) == false;
 			if (blocked != purpleBlocked) {
-				purple_privacy_deny_wrapped(account, purple_buddy_get_name_wrapped(buddy), FALSE, FALSE);
+				purple_privacy_deny_wrapped(account, name, FALSE, FALSE);
 			}
 		}
 	}
 
-	np->handleBuddyChanged(np->m_accounts[account], purple_buddy_get_name_wrapped(buddy), getAlias(buddy), getGroups(buddy), status, message, getIconHash(buddy),
-		blocked
-	);
+	std::string iconHash = getIconHash(buddy);
+
+	// Send the buddy only if something changed since the last time.
+	std::map<std::string, BuddySnapshot>::iterator it = np->m_buddySnapshots[account].find(name);
+	if (it != np->m_buddySnapshots[account].end()) {
+		BuddySnapshot &snapshot = it->second;
+		if (snapshot.status == status && snapshot.blocked == blocked && snapshot.alias == alias
+			&& snapshot.statusMessage == message && snapshot.iconHash == iconHash && snapshot.groups == groups) {
+			return;
+		}
+	}
+	else {
+		it = np->m_buddySnapshots[account].insert(std::make_pair(std::string(name), BuddySnapshot())).first;
+	}
+
+	BuddySnapshot &snapshot = it->second;
+	snapshot.alias = alias;
+	snapshot.groups = groups;
+	snapshot.status = status;
+	snapshot.statusMessage = message;
+	snapshot.iconHash = iconHash;
+	snapshot.blocked = blocked;
+
+	LOG4CXX_INFO(logger, "Buddy updated " << np->m_accounts[account] << " " << name << " " << alias << " group (" << groups.size() << ")=" << groups[0]);
+
+	np->handleBuddyChanged(np->m_accounts[account], name, alias, groups, status, message, iconHash, blocked);
 }
 
 static void buddyListUpdate(PurpleBuddyList *list, PurpleBlistNode *node) {
@@ -1065,6 +1138,8 @@ static void conv_write_im(PurpleConversation *conv, const char *who, const char
 static void conv_chat_add_users(PurpleConversation *conv, GList *cbuddies, gboolean new_arrivals) {
 	PurpleAccount *account = purple_conversation_get_account_wrapped(conv);
 
+	// Initial list of participants can be large, so it's sent in one message.
+	std::list<NetworkPlugin::Participant> participants;
 	GList *l = cbuddies;
 	while (l != NULL) {
 		PurpleConvChatBuddy *cb = (PurpleConvChatBuddy *)l->data;
@@ -1086,10 +1161,14 @@ static void conv_chat_add_users(PurpleConversation *conv, GList *cbuddies, gbool
 // 			item->addAttribute("role", "participant");
 		}
 
-		np->handleParticipantChanged(np->m_accounts[account], name, purple_conversation_get_name_wrapped(conv), (int) flags, pbnetwork::STATUS_ONLINE);
+		participants.push_back(NetworkPlugin::Participant(name, flags));
 
 		l = l->next;
 	}
+
+	if (!participants.empty()) {
+		np->handleParticipantList(np->m_accounts[account], purple_conversation_get_name_wrapped(conv), participants);
+	}
 }
 
 static void conv_chat_remove_users(PurpleConversation *conv, GList *users) {
@@ -1652,6 +1731,9 @@ static void gotAttention(PurpleAccount *account, const char *who, PurpleConversa
 	np->handleAttention(np->m_accounts[account], w, "");
 }
 
+// Event loop chosen in initPurple(): "glib", "libev" or "epoll".
+static std::string eventLoop;
+
 static bool initPurple() {
 	bool ret;
 
@@ -1681,13 +1763,29 @@ static bool initPurple() {
 // 	purple_debug_set_verbose_wrapped(true);
 
 	purple_core_set_ui_ops_wrapped(&coreUiOps);
-	if (CONFIG_STRING_DEFAULTED(config, "service.eventloop", "") == "libev") {
-		LOG4CXX_INFO(logger, "Will use libev based event loop");
+	eventLoop = CONFIG_STRING_DEFAULTED(config, "service.eventloop", "glib");
+	PurpleEventLoopUiOps *eventLoopOps = NULL;
+	if (eventLoop == "epoll") {
+		eventLoopOps = getEpollEventLoopUiOps();
+		if (!eventLoopOps) {
+			LOG4CXX_ERROR(logger, "epoll based event loop is not available, falling back to glib");
+			eventLoop = "glib";
+		}
 	}
-	else {
-		LOG4CXX_INFO(logger, "Will use glib based event loop");
+	if (eventLoop != "epoll" && eventLoop != "libev") {
+		eventLoop = "glib";
+	}
+#ifndef WITH_LIBEVENT
+	if (eventLoop == "libev") {
+		LOG4CXX_ERROR(logger, "Backend is compiled without libev support, falling back to glib");
+		eventLoop = "glib";
+	}
+#endif
+	if (!eventLoopOps) {
+		eventLoopOps = getEventLoopUiOps(eventLoop == "libev");
 	}
-	purple_eventloop_set_ui_ops_wrapped(getEventLoopUiOps(CONFIG_STRING_DEFAULTED(config, "service.eventloop", "") == "libev"));
+	LOG4CXX_INFO(logger, "Will use " << eventLoop << " based event loop");
+	purple_eventloop_set_ui_ops_wrapped(eventLoopOps);
 
 	ret = purple_core_init_wrapped("spectrum");
 	if (ret) {
@@ -1812,26 +1910,21 @@ int main(int argc, char **argv) {
 	purple_timeout_add_seconds_wrapped(30, pingTimeout, NULL);
  
 	np = new SpectrumNetworkPlugin();
-	bool libev = CONFIG_STRING_DEFAULTED(config, "service.eventloop", "") == "libev";
 
-	GMainLoop *m_loop;
-#ifdef WITH_LIBEVENT
-	if (!libev) {
-		m_loop = g_main_loop_new(NULL, FALSE);
-	}
-	else {
-		event_init();
-	}
-#endif
-	m_loop = g_main_loop_new(NULL, FALSE);
-	if (m_loop) {
-		g_main_loop_run(m_loop);
+	if (eventLoop == "epoll") {
+		epollEventLoopRun();
 	}
 #ifdef WITH_LIBEVENT
-	else {
+	else if (eventLoop == "libev") {
 		event_loop(0);
 	}
 #endif
+	else {
+		GMainLoop *m_loop = g_main_loop_new(NULL, FALSE);
+		if (m_loop) {
+			g_main_loop_run(m_loop);
+		}
+	}
 
 	return 0;
 }
@@ -0,0 +1,206 @@
+#include "geventloop.h"
+#include "epolleventloop.h"
+#include <vector>
+#include <iostream>
+#include <unistd.h>
+#include <time.h>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+static int readCount;
+static int tickCount;
+
+static void handleRead(gpointer data, gint fd, PurpleInputCondition cond) {
+	char c;
+	if (read(fd, &c, 1) == 1) {
+		readCount++;
+	}
+}
+
+static gboolean handleChannel(GIOChannel *source, GIOCondition condition, gpointer data) {
+	handleRead(data, g_io_channel_unix_get_fd(source), PURPLE_INPUT_READ);
+	return TRUE;
+}
+
+static gboolean handleTick(gpointer data) {
+	tickCount++;
+	return tickCount < *((int *) data);
+}
+
+static gboolean handleTimeout(gpointer data) {
+	*((bool *) data) = true;
+	return FALSE;
+}
+
+// CPU time used by the process in seconds.
+static double getCPUTime() {
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+class EventLoopTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(EventLoopTest);
+	CPPUNIT_TEST(input);
+	CPPUNIT_TEST(inputRemove);
+	CPPUNIT_TEST(timeout);
+	CPPUNIT_TEST(timeoutRemove);
+	CPPUNIT_TEST(glibSource);
+	CPPUNIT_TEST(glibInput);
+	CPPUNIT_TEST(benchmarkWakeup);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		PurpleEventLoopUiOps *ops;
+		std::vector<int> pipes;
+
+		void setUp (void) {
+			readCount = 0;
+			tickCount = 0;
+			ops = getEpollEventLoopUiOps();
+			CPPUNIT_ASSERT(ops);
+		}
+
+		void tearDown (void) {
+			for (std::vector<int>::const_iterator it = pipes.begin(); it != pipes.end(); it++) {
+				close(*it);
+			}
+			pipes.clear();
+		}
+
+		void createPipe(int &readFd, int &writeFd) {
+			int fds[2];
+			CPPUNIT_ASSERT_EQUAL(0, pipe(fds));
+			readFd = fds[0];
+			writeFd = fds[1];
+			pipes.push_back(fds[0]);
+			pipes.push_back(fds[1]);
+		}
+
+		void input() {
+			int r, w;
+			createPipe(r, w);
+			guint handle = ops->input_add(r, PURPLE_INPUT_READ, handleRead, NULL);
+
+			CPPUNIT_ASSERT_EQUAL(1, (int) write(w, "x", 1));
+			epollEventLoopIteration(true);
+			CPPUNIT_ASSERT_EQUAL(1, readCount);
+
+			epollEventLoopIteration(false);
+			CPPUNIT_ASSERT_EQUAL(1, readCount);
+
+			CPPUNIT_ASSERT(ops->input_remove(handle));
+		}
+
+		void inputRemove() {
+			int r, w;
+			createPipe(r, w);
+			guint handle1 = ops->input_add(r, PURPLE_INPUT_READ, handleRead, NULL);
+			guint handle2 = ops->input_add(r, PURPLE_INPUT_READ, handleRead, NULL);
+			CPPUNIT_ASSERT(handle1 != handle2);
+			CPPUNIT_ASSERT(ops->input_remove(handle1));
+			CPPUNIT_ASSERT(!ops->input_remove(handle1));
+
+			CPPUNIT_ASSERT_EQUAL(2, (int) write(w, "xx", 2));
+			epollEventLoopIteration(true);
+			CPPUNIT_ASSERT_EQUAL(1, readCount);
+
+			CPPUNIT_ASSERT(ops->input_remove(handle2));
+			epollEventLoopIteration(false);
+			CPPUNIT_ASSERT_EQUAL(1, readCount);
+		}
+
+		void timeout() {
+			int ticks = 3;
+			ops->timeout_add(10, handleTick, &ticks);
+			while (tickCount < ticks) {
+				epollEventLoopIteration(true);
+			}
+			epollEventLoopIteration(false);
+			CPPUNIT_ASSERT_EQUAL(3, tickCount);
+		}
+
+		void timeoutRemove() {
+			int ticks = 1;
+			bool called = false;
+			guint handle = ops->timeout_add(5, handleTimeout, &called);
+			ops->timeout_add(20, handleTick, &ticks);
+			CPPUNIT_ASSERT(ops->timeout_remove(handle));
+			CPPUNIT_ASSERT(!ops->timeout_remove(handle));
+
+			while (tickCount == 0) {
+				epollEventLoopIteration(true);
+			}
+			CPPUNIT_ASSERT(!called);
+		}
+
+		void glibSource() {
+			bool called = false;
+			g_timeout_add(5, handleTimeout, &called);
+			while (!called) {
+				epollEventLoopIteration(true);
+			}
+		}
+
+		void glibInput() {
+			int r, w;
+			createPipe(r, w);
+			GIOChannel *channel = g_io_channel_unix_new(r);
+			guint handle = g_io_add_watch(channel, G_IO_IN, handleChannel, NULL);
+
+			CPPUNIT_ASSERT_EQUAL(1, (int) write(w, "x", 1));
+			epollEventLoopIteration(true);
+			CPPUNIT_ASSERT_EQUAL(1, readCount);
+
+			g_source_remove(handle);
+			g_io_channel_unref(channel);
+		}
+
+		// Compares CPU time per wakeup of glib and epoll loop with 200
+		// watched fds.
+		void benchmarkWakeup() {
+			const int count = 200;
+			const int wakeups = 50000;
+			std::vector<int> writeFds;
+			std::vector<guint> handles;
+			for (int i = 0; i < count; i++) {
+				int r, w;
+				createPipe(r, w);
+				writeFds.push_back(w);
+			}
+
+			PurpleEventLoopUiOps *glibOps = getEventLoopUiOps(false);
+			for (int i = 0; i < count; i++) {
+				handles.push_back(glibOps->input_add(pipes[i * 2], PURPLE_INPUT_READ, handleRead, NULL));
+			}
+			double start = getCPUTime();
+			for (int i = 0; i < wakeups; i++) {
+				CPPUNIT_ASSERT_EQUAL(1, (int) write(writeFds[i % count], "x", 1));
+				g_main_context_iteration(NULL, TRUE);
+			}
+			double glibTime = getCPUTime() - start;
+			for (int i = 0; i < count; i++) {
+				glibOps->input_remove(handles[i]);
+			}
+			handles.clear();
+
+			for (int i = 0; i < count; i++) {
+				handles.push_back(ops->input_add(pipes[i * 2], PURPLE_INPUT_READ, handleRead, NULL));
+			}
+			start = getCPUTime();
+			for (int i = 0; i < wakeups; i++) {
+				CPPUNIT_ASSERT_EQUAL(1, (int) write(writeFds[i % count], "x", 1));
+				epollEventLoopIteration(true);
+			}
+			double epollTime = getCPUTime() - start;
+			for (int i = 0; i < count; i++) {
+				ops->input_remove(handles[i]);
+			}
+
+			std::cerr << " glib: " << glibTime * 1000000 / wakeups << " us/wakeup";
+			std::cerr << " epoll: " << epollTime * 1000000 / wakeups << " us/wakeup";
+			CPPUNIT_ASSERT_EQUAL(wakeups * 2, readCount);
+		}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (EventLoopTest);
@@ -35,6 +35,8 @@
 #include "transport/conversation.h"
 #include "transport/networkplugin.h"
 #include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
 #include "sys/wait.h"
 #include "sys/signal.h"
 // #include "valgrind/memcheck.h"
@@ -55,6 +57,9 @@ Skype::Skype(SkypePlugin *np, const std::string &user, const std::string &userna
 	m_timer = -1;
 	m_counter = 0;
 	m_np = np;
+	m_skypeDB = NULL;
+	m_commandID = 0;
+	m_pendingGroups = 0;
 }
 
 static gboolean load_skype_buddies(gpointer data) {
@@ -105,6 +110,8 @@ void Skype::login() {
 	}
 
 	m_db += "/" + getUsername() + "/main.db";
+	delete m_skypeDB;
+	m_skypeDB = new SkypeDB(m_db);
 
 	if (m_connection == NULL) {
 		LOG4CXX_INFO(logger, "Creating DBUS connection.");
@@ -200,40 +207,52 @@ bool Skype::loadSkypeBuddies() {
 
 	m_np->handleConnected(m_user);
 
-	std::map<std::string, std::string> group_map;
+	// Ask for users of all groups at once and load the buddies once all
+	// responses are received.
+	m_groups.clear();
+	m_pendingGroups = 0;
 	std::string groups = send_command("SEARCH GROUPS CUSTOM");
 	if (groups.find(' ') != std::string::npos) {
 		groups = groups.substr(groups.find(' ') + 1);
 		std::vector<std::string> grps;
 		boost::split(grps, groups, boost::is_any_of(","));
+		std::vector<std::string> properties;
+		properties.push_back("USERS");
 		BOOST_FOREACH(std::string grp, grps) {
-			std::vector<std::string> data;
-			std::string name = send_command("GET GROUP " + grp + " DISPLAYNAME");
-
-			if (name.find("ERROR") == 0) {
+			boost::trim(grp);
+			if (grp.empty()) {
 				continue;
 			}
+			m_pendingGroups++;
+			get_properties_async("GROUP", grp, properties, boost::bind(&Skype::handleGroupUsers, this, grp, _1));
+		}
+	}
 
-			boost::split(data, name, boost::is_any_of(" "));
-			name = GET_RESPONSE_DATA(name, "DISPLAYNAME");
+	if (m_pendingGroups == 0) {
+		loadBuddies();
+	}
+	return FALSE;
+}
 
-			std::string users = send_command("GET GROUP " + data[1] + " USERS");
-			try {
-				users = GET_RESPONSE_DATA(users, "USERS");
-			}
-			catch (std::out_of_range& oor) {
-				continue;
-			}
-			boost::split(data, users, boost::is_any_of(","));
-			BOOST_FOREACH(std::string u, data) {
-				group_map[u] = grp;
-			}
+void Skype::handleGroupUsers(const std::string &group, const std::vector<std::string> &values) {
+	if (!values[0].empty()) {
+		std::vector<std::string> data;
+		boost::split(data, values[0], boost::is_any_of(","));
+		BOOST_FOREACH(std::string u, data) {
+			boost::trim(u);
+			m_groups[u] = group;
 		}
 	}
 
+	if (--m_pendingGroups == 0) {
+		loadBuddies();
+	}
+}
+
+void Skype::loadBuddies() {
 	// Try to load skype buddies from database, if it fails
 	// fallback to old method.
-	if (!SkypeDB::loadBuddies(m_np, m_db, m_user, group_map)) {
+	if (!m_skypeDB || !m_skypeDB->loadBuddies(m_np, m_user, m_groups)) {
 		std::string friends = send_command("GET AUTH_CONTACTS_PROFILES");
 
 		char **full_friends_list = g_strsplit((strchr(friends.c_str(), ' ')+1), ";", 0);
@@ -272,8 +291,8 @@ bool Skype::loadSkypeBuddies() {
 				}
 
 				std::vector<std::string> groups;
-				if (group_map.find(buddy) != group_map.end()) {
-					groups.push_back(group_map[buddy]);
+				if (m_groups.find(buddy) != m_groups.end()) {
+					groups.push_back(m_groups[buddy]);
 				}
 				m_np->handleBuddyChanged(m_user, buddy, alias, groups, status, mood_text);
 			}
@@ -281,9 +300,8 @@ bool Skype::loadSkypeBuddies() {
 		g_strfreev(full_friends_list);
 	}
 
-	send_command("SET AUTOAWAY OFF");
-	send_command("SET USERSTATUS ONLINE");
-	return FALSE;
+	send_command_async("SET AUTOAWAY OFF");
+	send_command_async("SET USERSTATUS ONLINE");
 }
 
 void Skype::logout() {
@@ -292,7 +310,10 @@ void Skype::logout() {
 			send_command("SET USERSTATUS INVISIBLE");
 			send_command("SET USERSTATUS OFFLINE");
 			sleep(2);
+			// Pending asynchronous calls are cancelled together with the proxy.
 			g_object_unref(m_proxy);
+			m_proxy = NULL;
+			m_commands.clear();
 		}
 		LOG4CXX_INFO(logger,  m_username << ": Terminating Skype instance (SIGTERM)");
 		kill((int) m_pid, SIGTERM);
@@ -302,6 +323,9 @@ void Skype::logout() {
 		kill((int) m_pid, SIGKILL);
 		m_pid = 0;
 	}
+
+	delete m_skypeDB;
+	m_skypeDB = NULL;
 }
 
 std::string Skype::send_command(const std::string &message) {
@@ -332,6 +356,111 @@ std::string Skype::send_command(const std::string &message) {
 	return str ? std::string(str) : std::string();
 }
 
+struct PendingCommand {
+	Skype *skype;
+	int id;
+};
+
+static void skype_command_response(DBusGProxy *proxy, DBusGProxyCall *call, gpointer data) {
+	PendingCommand *command = (PendingCommand *) data;
+	GError *error = NULL;
+	gchar *str = NULL;
+
+	if (!dbus_g_proxy_end_call(proxy, call, &error, G_TYPE_STRING, &str, G_TYPE_INVALID)) {
+		if (error && error->message) {
+			LOG4CXX_INFO(logger,  command->skype->getUsername() << ": DBUS Error: " << error->message);
+			g_error_free(error);
+		}
+		else {
+			LOG4CXX_INFO(logger,  command->skype->getUsername() << ": DBUS no response");
+		}
+	}
+
+	std::string response = str ? std::string(str) : std::string();
+	g_free(str);
+	command->skype->handleCommandResponse(command->id, response);
+}
+
+static void skype_command_destroy(gpointer data) {
+	delete (PendingCommand *) data;
+}
+
+void Skype::send_command_async(const std::string &message, ResponseCallback callback) {
+	if (!m_proxy) {
+		if (callback) {
+			callback("");
+		}
+		return;
+	}
+
+	PendingCommand *command = new PendingCommand;
+	command->skype = this;
+	command->id = ++m_commandID;
+	if (callback) {
+		m_commands[command->id] = callback;
+	}
+
+	std::string msg = "#" + boost::lexical_cast<std::string>(command->id) + " " + message;
+	LOG4CXX_INFO(logger, "Sending: '" << msg << "'");
+	dbus_g_proxy_begin_call(m_proxy, "Invoke", skype_command_response, command, skype_command_destroy,
+							G_TYPE_STRING, msg.c_str(), G_TYPE_INVALID);
+}
+
+void Skype::handleCommandResponse(int id, const std::string &response) {
+	// Response is "#<id> <response>". Skype can also send it as notification,
+	// so the ID from response is preferred.
+	std::string data = response;
+	if (!data.empty() && data[0] == '#') {
+		size_t pos = data.find(' ');
+		try {
+			id = boost::lexical_cast<int>(data.substr(1, pos == std::string::npos ? std::string::npos : pos - 1));
+		}
+		catch (boost::bad_lexical_cast &) {
+		}
+		data = pos == std::string::npos ? "" : data.substr(pos + 1);
+	}
+
+	std::map<int, ResponseCallback>::iterator it = m_commands.find(id);
+	if (it == m_commands.end()) {
+		return;
+	}
+
+	LOG4CXX_INFO(logger,  m_username << ": DBUS:'" << response << "'");
+	ResponseCallback callback = it->second;
+	m_commands.erase(it);
+	callback(data);
+}
+
+struct PendingProperties {
+	std::vector<std::string> properties;
+	std::vector<std::string> values;
+	int remaining;
+	Skype::PropertiesCallback callback;
+};
+
+static void handlePropertyResponse(boost::shared_ptr<PendingProperties> pending, int i, const std::string &response) {
+	// "USER <which> FULLNAME <value>"
+	std::string property = pending->properties[i] + " ";
+	size_t pos = response.find(property);
+	pending->values[i] = pos != std::string::npos ? response.substr(pos + property.size()) : "";
+
+	if (--pending->remaining == 0) {
+		pending->callback(pending->values);
+	}
+}
+
+void Skype::get_properties_async(const std::string &object, const std::string &which, const std::vector<std::string> &properties, PropertiesCallback callback) {
+	boost::shared_ptr<PendingProperties> pending = boost::make_shared<PendingProperties>();
+	pending->properties = properties;
+	pending->values.resize(properties.size());
+	pending->remaining = properties.size();
+	pending->callback = callback;
+
+	for (size_t i = 0; i < properties.size(); i++) {
+		send_command_async("GET " + object + " " + which + " " + properties[i], boost::bind(&handlePropertyResponse, pending, i, _1));
+	}
+}
+
 void Skype::handleSkypeMessage(std::string &message) {
 	std::vector<std::string> cmd;
 	boost::split(cmd, message, boost::is_any_of(" "));
@@ -341,44 +470,27 @@ void Skype::handleSkypeMessage(std::string &message) {
 			return;
 		}
 
+		// Lots of these are received right after login, so the properties
+		// are asked asynchronously and the responses are handled in
+		// handleBuddyProperties.
+		std::vector<std::string> properties;
+		properties.push_back("FULLNAME");
+		properties.push_back("MOOD_TEXT");
+		properties.push_back("ONLINESTATUS");
+
 		if (cmd[2] == "ONLINESTATUS") {
 			if (cmd[3] == "SKYPEOUT" || cmd[3] == "UNKNOWN") {
 				return;
 			}
 			else {
-				pbnetwork::StatusType status = getStatus(cmd[3]);
-				GET_PROPERTY(mood_text, "USER", cmd[1], "MOOD_TEXT");
-				GET_PROPERTY(alias, "USER", cmd[1], "FULLNAME");
-
-				std::vector<std::string> groups;
-				m_np->handleBuddyChanged(getUser(), cmd[1], alias, groups, status, mood_text);
+				get_properties_async("USER", cmd[1], properties, boost::bind(&Skype::handleBuddyProperties, this, cmd[1], "", true, _1));
 			}
 		}
-		else if (cmd[2] == "MOOD_TEXT") {
-			GET_PROPERTY(st, "USER", cmd[1], "ONLINESTATUS");
-			pbnetwork::StatusType status = getStatus(st);
-
-			std::string mood_text = GET_RESPONSE_DATA(message, "MOOD_TEXT");
-
-			std::vector<std::string> groups;
-			m_np->handleBuddyChanged(getUser(), cmd[1], "", groups, status, mood_text);
-		}
-		else if (cmd[2] == "BUDDYSTATUS" && cmd[3] == "3") {
-			GET_PROPERTY(mood_text, "USER", cmd[1], "MOOD_TEXT");
-			GET_PROPERTY(st, "USER", cmd[1], "ONLINESTATUS");
-			pbnetwork::StatusType status = getStatus(st);
-
-			std::vector<std::string> groups;
-			m_np->handleBuddyChanged(getUser(), cmd[1], "", groups, status, mood_text);
+		else if (cmd[2] == "MOOD_TEXT" || (cmd[2] == "BUDDYSTATUS" && cmd[3] == "3")) {
+			get_properties_async("USER", cmd[1], properties, boost::bind(&Skype::handleBuddyProperties, this, cmd[1], "", false, _1));
 		}
 		else if (cmd[2] == "FULLNAME") {
-			GET_PROPERTY(alias, "USER", cmd[1], "FULLNAME");
-			GET_PROPERTY(mood_text, "USER", cmd[1], "MOOD_TEXT");
-			GET_PROPERTY(st, "USER", cmd[1], "ONLINESTATUS");
-			pbnetwork::StatusType status = getStatus(st);
-
-			std::vector<std::string> groups;
-			m_np->handleBuddyChanged(getUser(), cmd[1], alias, groups, status, mood_text);
+			get_properties_async("USER", cmd[1], properties, boost::bind(&Skype::handleBuddyProperties, this, cmd[1], "", true, _1));
 		}
 		else if(cmd[2] == "RECEIVEDAUTHREQUEST") {
 			m_np->handleAuthorization(getUser(), cmd[1]);
@@ -410,27 +522,10 @@ void Skype::handleSkypeMessage(std::string &message) {
 // 			}
 // 		}
 		if (cmd[2] == "NROFUSERS" && cmd[3] != "0") {
-			GET_PROPERTY(grp, "GROUP", cmd[1], "DISPLAYNAME");
-			std::string users = send_command("GET GROUP " + cmd[1] + " USERS");
-			try {
-				users = GET_RESPONSE_DATA(users, "USERS");
-			}
-			catch (std::out_of_range& oor) {
-				return;
-			}
-
-			std::vector<std::string> data;
-			boost::split(data, users, boost::is_any_of(","));
-			BOOST_FOREACH(std::string u, data) {
-				GET_PROPERTY(alias, "USER", u, "FULLNAME");
-				GET_PROPERTY(mood_text, "USER", u, "MOOD_TEXT");
-				GET_PROPERTY(st, "USER", u, "ONLINESTATUS");
-				pbnetwork::StatusType status = getStatus(st);
-
-				std::vector<std::string> groups;
-				groups.push_back(grp);
-				m_np->handleBuddyChanged(getUser(), u, alias, groups, status, mood_text);
-			}
+			std::vector<std::string> properties;
+			properties.push_back("DISPLAYNAME");
+			properties.push_back("USERS");
+			get_properties_async("GROUP", cmd[1], properties, boost::bind(&Skype::handleGroupChanged, this, cmd[1], _1));
 		}
 	}
 	else if (cmd[0] == "CHATMESSAGE") {
@@ -470,6 +565,38 @@ void Skype::handleSkypeMessage(std::string &message) {
 	}
 }
 
+void Skype::handleGroupChanged(const std::string &group, const std::vector<std::string> &values) {
+	const std::string &grp = values[0];
+	const std::string &users = values[1];
+	if (users.empty()) {
+		return;
+	}
+
+	std::vector<std::string> properties;
+	properties.push_back("FULLNAME");
+	properties.push_back("MOOD_TEXT");
+	properties.push_back("ONLINESTATUS");
+
+	std::vector<std::string> data;
+	boost::split(data, users, boost::is_any_of(","));
+	BOOST_FOREACH(std::string u, data) {
+		boost::trim(u);
+		get_properties_async("USER", u, properties, boost::bind(&Skype::handleBuddyProperties, this, u, grp, true, _1));
+	}
+}
+
+void Skype::handleBuddyProperties(const std::string &buddy, const std::string &group, bool sendAlias, const std::vector<std::string> &values) {
+	const std::string &alias = values[0];
+	const std::string &mood_text = values[1];
+	pbnetwork::StatusType status = getStatus(values[2]);
+
+	std::vector<std::string> groups;
+	if (!group.empty()) {
+		groups.push_back(group);
+	}
+	m_np->handleBuddyChanged(getUser(), buddy, sendAlias ? alias : "", groups, status, mood_text);
+}
+
 DBusHandlerResult Skype::dbusMessageReceived(DBusConnection *connection, DBusMessage *message) {
 	DBusMessageIter iterator;
 	gchar *message_temp;
@@ -487,7 +614,12 @@ DBusHandlerResult Skype::dbusMessageReceived(DBusConnection *connection, DBusMes
 		dbus_message_iter_get_basic(&iterator, &message_temp);
 		std::string m(message_temp);
 		LOG4CXX_INFO(logger,"DBUS message: " << m);
-		handleSkypeMessage(m);
+		if (!m.empty() && m[0] == '#') {
+			handleCommandResponse(0, m);
+		}
+		else {
+			handleSkypeMessage(m);
+		}
 	} while(dbus_message_iter_has_next(&iterator) && dbus_message_iter_next(&iterator));
 	
 	dbus_message_unref(message);
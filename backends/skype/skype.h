@@ -25,6 +25,9 @@
 #include "sqlite3.h"
 #include <iostream>
 #include <map>
+#include <vector>
+#include <boost/function.hpp>
+#include "transport/protocol.pb.h"
 
 #define GET_RESPONSE_DATA(RESP, DATA) ((RESP.find(std::string(DATA) + " ") != std::string::npos) ? RESP.substr(RESP.find(DATA) + strlen(DATA) + 1) : "");
 #define GET_PROPERTY(VAR, OBJ, WHICH, PROP) std::string VAR = send_command(std::string("GET ") + OBJ + " " + WHICH + " " + PROP); \
@@ -36,6 +39,7 @@
 					}
 
 class SkypePlugin;
+class SkypeDB;
 
 class Skype {
 	public:
@@ -49,8 +53,25 @@ class Skype {
 
 		void logout();
 
+		typedef boost::function<void (const std::string &response)> ResponseCallback;
+		typedef boost::function<void (const std::vector<std::string> &values)> PropertiesCallback;
+
 		std::string send_command(const std::string &message);
 
+		/// Sends command without waiting for the response. Commands are prefixed
+		/// with "#<id>" and the response with the same ID is passed to callback,
+		/// so more commands can be sent before the first response arrives.
+		void send_command_async(const std::string &message, ResponseCallback callback = ResponseCallback());
+
+		/// Asks for all properties at once and calls callback with their values
+		/// (in the same order) once all responses are received.
+		void get_properties_async(const std::string &object, const std::string &which, const std::vector<std::string> &properties, PropertiesCallback callback);
+
+		/// Returns main.db of this account.
+		SkypeDB *getDB() {
+			return m_skypeDB;
+		}
+
 		const std::string &getUser() {
 			return m_user;
 		}
@@ -70,11 +91,17 @@ class Skype {
 
 		void handleSkypeMessage(std::string &message);
 
+		void handleCommandResponse(int id, const std::string &response);
+
 		DBusHandlerResult dbusMessageReceived(DBusConnection *connection, DBusMessage *message);
 
 	private:
 		std::string createSkypeDirectory();
 		bool spawnSkype(const std::string &db_path);
+		void handleGroupUsers(const std::string &group, const std::vector<std::string> &values);
+		void loadBuddies();
+		void handleGroupChanged(const std::string &group, const std::vector<std::string> &values);
+		void handleBuddyProperties(const std::string &buddy, const std::string &group, bool sendAlias, const std::vector<std::string> &values);
 
 		std::string m_username;
 		std::string m_password;
@@ -88,5 +115,9 @@ class Skype {
 		std::map<std::string, std::string> m_groups;
 		SkypePlugin *m_np;
 		std::string m_db;
+		SkypeDB *m_skypeDB;
+		int m_commandID;
+		std::map<int, ResponseCallback> m_commands;
+		int m_pendingGroups;
 };
 
@@ -44,8 +44,8 @@
 
 // Prepare the SQL statement
 #define PREP_STMT(sql, str) \
-	if(sqlite3_prepare_v2(db, std::string(str).c_str(), -1, &sql, NULL)) { \
-		LOG4CXX_ERROR(logger, str<< (sqlite3_errmsg(db) == NULL ? "" : sqlite3_errmsg(db))); \
+	if(sqlite3_prepare_v2(m_db, std::string(str).c_str(), -1, &sql, NULL)) { \
+		LOG4CXX_ERROR(logger, str<< (sqlite3_errmsg(m_db) == NULL ? "" : sqlite3_errmsg(m_db))); \
 		sql = NULL; \
 	}
 
@@ -67,101 +67,139 @@
 #define GET_STR(STATEMENT)	(const char *) sqlite3_column_text(STATEMENT, STATEMENT##_id_get++)
 #define GET_BLOB(STATEMENT)	(const void *) sqlite3_column_blob(STATEMENT, STATEMENT##_id_get++)
 #define EXECUTE_STATEMENT(STATEMENT, NAME) 	if(sqlite3_step(STATEMENT) != SQLITE_DONE) {\
-		LOG4CXX_ERROR(logger, NAME<< (sqlite3_errmsg(db) == NULL ? "" : sqlite3_errmsg(db)));\
+		LOG4CXX_ERROR(logger, NAME<< (sqlite3_errmsg(m_db) == NULL ? "" : sqlite3_errmsg(m_db)));\
 			}
 
 using namespace Transport;
 
 DEFINE_LOGGER(logger, "SkypeDB");
 
-namespace SkypeDB {
+SkypeDB::SkypeDB(const std::string &path) : m_path(path) {
+	m_db = NULL;
+	m_getAvatar = NULL;
+	m_getAvatarTimestamp = NULL;
+	m_getBuddies = NULL;
+}
 
-bool getAvatar(const std::string &db_path, const std::string &name, std::string &photo) {
-	bool ret = false;
-	sqlite3 *db;
-	LOG4CXX_INFO(logger, "Opening database " << db_path);
-	if (sqlite3_open(db_path.c_str(), &db)) {
-		sqlite3_close(db);
-		LOG4CXX_ERROR(logger, "Can't open database");
+SkypeDB::~SkypeDB() {
+	FINALIZE_STMT(m_getAvatar);
+	FINALIZE_STMT(m_getAvatarTimestamp);
+	FINALIZE_STMT(m_getBuddies);
+	if (m_db) {
+		sqlite3_close(m_db);
 	}
-	else {
-		sqlite3_stmt *stmt;
-		PREP_STMT(stmt, "SELECT avatar_image FROM Contacts WHERE skypename=?");
-		if (stmt) {
-			BEGIN(stmt);
-			BIND_STR(stmt, name);
-			if(sqlite3_step(stmt) == SQLITE_ROW) {
-				int size = sqlite3_column_bytes(stmt, 0);
-				const void *data = sqlite3_column_blob(stmt, 0);
-				photo = std::string((const char *)data + 1, size - 1);
-				ret = true;
-			}
-			else {
-				LOG4CXX_ERROR(logger, (sqlite3_errmsg(db) == NULL ? "" : sqlite3_errmsg(db)));
-			}
+}
 
-			int ret;
-			while((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
-			}
-			FINALIZE_STMT(stmt);
+bool SkypeDB::open() {
+	if (m_db) {
+		return true;
+	}
+
+	LOG4CXX_INFO(logger, "Opening database " << m_path);
+	// Do not create the database, Skype creates it once it's logged in.
+	if (sqlite3_open_v2(m_path.c_str(), &m_db, SQLITE_OPEN_READWRITE, NULL)) {
+		LOG4CXX_ERROR(logger, "Can't open database " << (sqlite3_errmsg(m_db) == NULL ? "" : sqlite3_errmsg(m_db)));
+		sqlite3_close(m_db);
+		m_db = NULL;
+		return false;
+	}
+
+	PREP_STMT(m_getAvatar, "SELECT avatar_image FROM Contacts WHERE skypename=?");
+	// Older Skype versions don't have this column, avatars are not cached then.
+	PREP_STMT(m_getAvatarTimestamp, "SELECT avatar_timestamp FROM Contacts WHERE skypename=?");
+	PREP_STMT(m_getBuddies, "select skypename, displayname, mood_text from Contacts;");
+	return true;
+}
+
+bool SkypeDB::getAvatar(const std::string &name, std::string &photo) {
+	if (!open()) {
+		return false;
+	}
+
+	int timestamp = -1;
+	if (m_getAvatarTimestamp) {
+		BEGIN(m_getAvatarTimestamp);
+		BIND_STR(m_getAvatarTimestamp, name);
+		if (sqlite3_step(m_getAvatarTimestamp) != SQLITE_ROW) {
+			sqlite3_reset(m_getAvatarTimestamp);
+			return false;
 		}
-		else {
-			LOG4CXX_ERROR(logger, "Can't create prepared statement");
-			LOG4CXX_ERROR(logger, (sqlite3_errmsg(db) == NULL ? "" : sqlite3_errmsg(db)));
+		timestamp = GET_INT(m_getAvatarTimestamp);
+		sqlite3_reset(m_getAvatarTimestamp);
+
+		std::map<std::string, Avatar>::const_iterator it = m_avatars.find(name);
+		if (it != m_avatars.end() && it->second.timestamp == timestamp) {
+			photo = it->second.data;
+			return !photo.empty();
 		}
-		sqlite3_close(db);
 	}
-	return ret;
-}
 
-bool loadBuddies(SkypePlugin *np, const std::string &db_path, std::string &user, std::map<std::string, std::string> &group_map) {
+	if (!m_getAvatar) {
+		return false;
+	}
+
 	bool ret = false;
-	sqlite3 *db;
-	LOG4CXX_INFO(logger, "Opening database " << db_path);
-	if (sqlite3_open(db_path.c_str(), &db)) {
-		sqlite3_close(db);
-		LOG4CXX_ERROR(logger, "Can't open database");
+	BEGIN(m_getAvatar);
+	BIND_STR(m_getAvatar, name);
+	if (sqlite3_step(m_getAvatar) == SQLITE_ROW) {
+		int size = sqlite3_column_bytes(m_getAvatar, 0);
+		const void *data = sqlite3_column_blob(m_getAvatar, 0);
+		if (data && size > 1) {
+			photo = std::string((const char *)data + 1, size - 1);
+			ret = true;
+		}
 	}
 	else {
-		sqlite3_stmt *stmt;
-// 		aliases, fullname, 
-		PREP_STMT(stmt, "select skypename, displayname, mood_text from Contacts;");
-		if (stmt) {
-			BEGIN(stmt);
-			int ret2;
-			while((ret2 = sqlite3_step(stmt)) == SQLITE_ROW) {
-				const char *d;
-				d = (const char *) sqlite3_column_text(stmt, 0);
-				if (!d) {
-					continue;
-				}
-
-				ret = true;
-
-				std::string buddy = d;
-				d = (const char *) sqlite3_column_text(stmt, 1);
-				std::string alias = d ? d : buddy;
-				d = (const char *) sqlite3_column_text(stmt, 2);
-				std::string mood_text = d ? d : "";
-
-				std::vector<std::string> groups;
-				if (group_map.find(buddy) != group_map.end()) {
-					groups.push_back(group_map[buddy]);
-				}
-				np->handleBuddyChanged(user, buddy, alias, groups, pbnetwork::STATUS_NONE, mood_text);
-			}
-			if (ret2 != SQLITE_DONE) {
-				FINALIZE_STMT(stmt);
-				ret = false;
-			}
-		}
-		else {
-			LOG4CXX_ERROR(logger, "Can't create prepared statement");
-			LOG4CXX_ERROR(logger, (sqlite3_errmsg(db) == NULL ? "" : sqlite3_errmsg(db)));
-		}
-		sqlite3_close(db);
+		LOG4CXX_ERROR(logger, (sqlite3_errmsg(m_db) == NULL ? "" : sqlite3_errmsg(m_db)));
+	}
+	sqlite3_reset(m_getAvatar);
+
+	if (timestamp != -1) {
+		Avatar &avatar = m_avatars[name];
+		avatar.timestamp = timestamp;
+		avatar.data = ret ? photo : "";
 	}
 	return ret;
 }
 
+bool SkypeDB::loadBuddies(SkypePlugin *np, const std::string &user, std::map<std::string, std::string> &group_map) {
+	if (!open()) {
+		return false;
+	}
+
+	if (!m_getBuddies) {
+		LOG4CXX_ERROR(logger, "Can't create prepared statement");
+		return false;
+	}
+
+	bool ret = false;
+	BEGIN(m_getBuddies);
+	int ret2;
+	while((ret2 = sqlite3_step(m_getBuddies)) == SQLITE_ROW) {
+		const char *d;
+		d = (const char *) sqlite3_column_text(m_getBuddies, 0);
+		if (!d) {
+			continue;
+		}
+
+		ret = true;
+
+		std::string buddy = d;
+		d = (const char *) sqlite3_column_text(m_getBuddies, 1);
+		std::string alias = d ? d : buddy;
+		d = (const char *) sqlite3_column_text(m_getBuddies, 2);
+		std::string mood_text = d ? d : "";
+
+		std::vector<std::string> groups;
+		if (group_map.find(buddy) != group_map.end()) {
+			groups.push_back(group_map[buddy]);
+		}
+		np->handleBuddyChanged(user, buddy, alias, groups, pbnetwork::STATUS_NONE, mood_text);
+	}
+	if (ret2 != SQLITE_DONE) {
+		LOG4CXX_ERROR(logger, (sqlite3_errmsg(m_db) == NULL ? "" : sqlite3_errmsg(m_db)));
+		ret = false;
+	}
+	sqlite3_reset(m_getBuddies);
+	return ret;
 }
@@ -28,8 +28,34 @@
 
 class SkypePlugin;
 
-namespace SkypeDB {
-	bool getAvatar(const std::string &db, const std::string &name, std::string &avatar);
-	bool loadBuddies(SkypePlugin *np, const std::string &db, std::string &user, std::map<std::string, std::string> &group_map);
-}
+/// Skype's main.db of single account. The database is opened on the first
+/// use and kept open together with prepared statements until the account
+/// logs out.
+class SkypeDB {
+	public:
+		SkypeDB(const std::string &path);
+
+		virtual ~SkypeDB();
+
+		/// Returns avatar of buddy. Avatars are cached and loaded from database
+		/// again only when their avatar_timestamp changes.
+		bool getAvatar(const std::string &name, std::string &avatar);
+
+		bool loadBuddies(SkypePlugin *np, const std::string &user, std::map<std::string, std::string> &group_map);
+
+	private:
+		bool open();
+
+		struct Avatar {
+			int timestamp;
+			std::string data;
+		};
+
+		std::string m_path;
+		sqlite3 *m_db;
+		sqlite3_stmt *m_getAvatar;
+		sqlite3_stmt *m_getAvatarTimestamp;
+		sqlite3_stmt *m_getBuddies;
+		std::map<std::string, Avatar> m_avatars;
+};
 
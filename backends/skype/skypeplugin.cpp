@@ -185,33 +185,33 @@ void SkypePlugin::handleStatusChangeRequest(const std::string &user, int status,
 			st = "ONLINE";
 			break;
 	}
-	skype->send_command("SET USERSTATUS " + st);
+	skype->send_command_async("SET USERSTATUS " + st);
 
 	if (!statusMessage.empty()) {
-		skype->send_command("SET PROFILE MOOD_TEXT " + statusMessage);
+		skype->send_command_async("SET PROFILE MOOD_TEXT " + statusMessage);
 	}
 }
 
 void SkypePlugin::handleBuddyUpdatedRequest(const std::string &user, const std::string &buddyName, const std::string &alias, const std::vector<std::string> &groups) {
 	Skype *skype = m_sessions[user];
 	if (skype) {
-		skype->send_command("SET USER " + buddyName + " BUDDYSTATUS 2 Please authorize me");
-		skype->send_command("SET USER " + buddyName + " ISAUTHORIZED TRUE");
+		skype->send_command_async("SET USER " + buddyName + " BUDDYSTATUS 2 Please authorize me");
+		skype->send_command_async("SET USER " + buddyName + " ISAUTHORIZED TRUE");
 	}
 }
 
 void SkypePlugin::handleBuddyRemovedRequest(const std::string &user, const std::string &buddyName, const std::vector<std::string> &groups) {
 	Skype *skype = m_sessions[user];
 	if (skype) {
-		skype->send_command("SET USER " + buddyName + " BUDDYSTATUS 1");
-		skype->send_command("SET USER " + buddyName + " ISAUTHORIZED FALSE");
+		skype->send_command_async("SET USER " + buddyName + " BUDDYSTATUS 1");
+		skype->send_command_async("SET USER " + buddyName + " ISAUTHORIZED FALSE");
 	}
 }
 
 void SkypePlugin::handleMessageSendRequest(const std::string &user, const std::string &legacyName, const std::string &message, const std::string &xhtml, const std::string &id) {
 	Skype *skype = m_sessions[user];
 	if (skype) {
-		skype->send_command("MESSAGE " + legacyName + " " + message);
+		skype->send_command_async("MESSAGE " + legacyName + " " + message);
 	}
 	
 }
@@ -234,8 +234,13 @@ void SkypePlugin::handleVCardRequest(const std::string &user, const std::string
 		const gchar *userfiles[] = {"user256", "user1024", "user4096", "user16384", "user32768", "user65536",
 									"profile256", "profile1024", "profile4096", "profile16384", "profile32768", 
 									NULL};
+		// Avatars from main.db are cached, so try it before reading the .dbb files.
+		if (skype->getDB()) {
+			skype->getDB()->getAvatar(name, photo);
+		}
+
 		char *username = g_strdup_printf("\x03\x10%s", name.c_str());
-		for (fh = 0; userfiles[fh]; fh++) {
+		for (fh = 0; photo.empty() && userfiles[fh]; fh++) {
 			filename = g_strconcat("/tmp/skype/", skype->getUsername().c_str(), "/", skype->getUsername().c_str(), "/", userfiles[fh], ".dbb", NULL);
 			std::cout << "getting filename:" << filename << "\n";
 			if (g_file_get_contents(filename, &image_data, &image_data_len, NULL))
@@ -279,11 +284,6 @@ void SkypePlugin::handleVCardRequest(const std::string &user, const std::string
 		}
 		g_free(username);
 
-		if (photo.empty()) {
-			std::string db_path = std::string("/tmp/skype/") + skype->getUsername() + "/" + skype->getUsername() + "/main.db";
-			SkypeDB::getAvatar(db_path, name, photo);
-		}
-
 		std::string alias;
 		std::cout << skype->getUsername() << " " << name << "\n";
 		if (skype->getUsername() == name) {
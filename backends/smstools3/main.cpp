@@ -23,6 +23,12 @@
 #include "sys/signal.h"
 #include <fstream>
 #include <streambuf>
+#include <boost/thread.hpp>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <errno.h>
+#include <string.h>
+#endif
 
 Swift::SimpleEventLoop *loop_;
 
@@ -49,9 +55,19 @@ class SMSNetworkPlugin : public NetworkPlugin {
 		boost::shared_ptr<Swift::Connection> m_conn;
 		Swift::Timer::ref m_timer;
 		int m_internalUser;
+		// GSM number -> buddy of INTERNAL_USER with the XMPP user JID as alias.
+		std::map<std::string, BuddyInfo> m_numbers;
+		std::string m_incomingDir;
+		int m_inotify;
+		boost::thread *m_watcher;
+		boost::mutex m_scanMutex;
+		bool m_scanPending;
 
 		SMSNetworkPlugin(Config *config, Swift::SimpleEventLoop *loop, const std::string &host, int port) : NetworkPlugin() {
 			this->config = config;
+			m_inotify = -1;
+			m_watcher = NULL;
+			m_scanPending = false;
 			m_factories = new Swift::BoostNetworkFactories(loop);
 			m_conn = m_factories->getConnectionFactory()->createConnection();
 			m_conn->onDataRead.connect(boost::bind(&SMSNetworkPlugin::_handleDataRead, this, _1));
@@ -61,9 +77,10 @@ class SMSNetworkPlugin : public NetworkPlugin {
 
 			LOG4CXX_INFO(logger, "Starting the plugin.");
 
-			m_timer = m_factories->getTimerFactory()->createTimer(5000);
-			m_timer->onTick.connect(boost::bind(&SMSNetworkPlugin::handleSMSDir, this));
-			m_timer->start();
+			m_incomingDir = "/var/spool/sms/incoming/";
+			if (CONFIG_HAS_KEY(config, "backend.incoming_dir")) {
+				m_incomingDir = CONFIG_STRING(config, "backend.incoming_dir");
+			}
 
 			// We're reusing our database model here. Buddies of user with JID INTERNAL_USER are there
 			// to match received GSM messages from number N with the XMPP users who sent message to number N.
@@ -76,42 +93,112 @@ class SMSNetworkPlugin : public NetworkPlugin {
 			storageBackend->setUser(info);
 			storageBackend->getUser(INTERNAL_USER, info);
 			m_internalUser = info.id;
+
+			// Load the numbers just once, handleSMS then doesn't have to
+			// load the whole roster for every SMS.
+			std::list<BuddyInfo> roster;
+			storageBackend->getBuddies(m_internalUser, roster);
+			BOOST_FOREACH(BuddyInfo &b, roster) {
+				m_numbers[b.legacyName] = b;
+			}
+
+			m_timer = m_factories->getTimerFactory()->createTimer(5000);
+			m_timer->onTick.connect(boost::bind(&SMSNetworkPlugin::handleSMSDir, this));
+			if (!watchSMSDir()) {
+				LOG4CXX_INFO(logger, "Checking directory " << m_incomingDir << " for incoming SMS every 5 seconds.");
+			}
+
+			// There could be SMS received while we were not running, so the
+			// directory is checked once also when inotify is used.
+			m_timer->start();
+		}
+
+		// Watches the incoming directory using inotify, so SMS are handled
+		// immediately. Returns false if inotify is not available and the
+		// directory has to be checked periodically.
+		bool watchSMSDir() {
+#ifdef __linux__
+			m_inotify = inotify_init();
+			if (m_inotify == -1) {
+				LOG4CXX_ERROR(logger, "Can't initialize inotify: " << strerror(errno) << ".");
+				return false;
+			}
+
+			if (inotify_add_watch(m_inotify, m_incomingDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+				LOG4CXX_ERROR(logger, "Can't watch directory " << m_incomingDir << ": " << strerror(errno) << ".");
+				close(m_inotify);
+				m_inotify = -1;
+				return false;
+			}
+
+			LOG4CXX_INFO(logger, "Watching directory " << m_incomingDir << " for incoming SMS.");
+			m_watcher = new boost::thread(boost::bind(&SMSNetworkPlugin::readSMSDirEvents, this));
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		// Runs in m_watcher thread.
+		void readSMSDirEvents() {
+#ifdef __linux__
+			char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+			while (true) {
+				ssize_t len = read(m_inotify, buffer, sizeof(buffer));
+				if (len <= 0) {
+					if (len == -1 && errno == EINTR) {
+						continue;
+					}
+					LOG4CXX_ERROR(logger, "Can't read inotify events: " << strerror(errno) << ".");
+					break;
+				}
+
+				// The whole directory is checked in the main thread, so burst of
+				// SMS is handled by single handleSMSDir call.
+				boost::mutex::scoped_lock lock(m_scanMutex);
+				if (!m_scanPending) {
+					m_scanPending = true;
+					loop_->postEvent(boost::bind(&SMSNetworkPlugin::handleSMSDir, this));
+				}
+			}
+#endif
 		}
 
 
 		void handleSMS(const std::string &sms) {
 			LOG4CXX_INFO(logger, "Handling SMS " << sms << ".")
-			std::ifstream t(sms.c_str());
+			std::ifstream t(sms.c_str(), std::ios::in | std::ios::binary);
 			std::string str;
 
 			t.seekg(0, std::ios::end);
-			str.reserve(t.tellg());
+			std::streamoff size = t.tellg();
 			t.seekg(0, std::ios::beg);
+			if (size > 0) {
+				str.resize(size);
+				t.read(&str[0], size);
+				str.resize(t.gcount());
+			}
 
-			str.assign((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
-
+			// Headers are separated from the message by empty line.
 			std::string from = "";
 			std::string msg = "";
-			while(str.find("\n") != std::string::npos) {
-				std::string line = str.substr(0, str.find("\n"));
-				if (line.find("From: ") == 0) {
-					from = line.substr(strlen("From: "));
-				}
-				else if (line.empty()) {
-					msg = str.substr(1);
+			std::string::size_type pos = 0;
+			std::string::size_type end;
+			while ((end = str.find('\n', pos)) != std::string::npos) {
+				if (end == pos) {
+					msg = str.substr(pos + 1);
 					break;
 				}
-				str = str.substr(str.find("\n") + 1);
+				if (str.compare(pos, strlen("From: "), "From: ") == 0) {
+					from = str.substr(pos + strlen("From: "), end - pos - strlen("From: "));
+				}
+				pos = end + 1;
 			}
 
-			std::list<BuddyInfo> roster;
-			storageBackend->getBuddies(m_internalUser, roster);
-
 			std::string to;
-			BOOST_FOREACH(BuddyInfo &b, roster) {
-				if (b.legacyName == from) {
-					to = b.alias;
-				}
+			std::map<std::string, BuddyInfo>::const_iterator it = m_numbers.find(from);
+			if (it != m_numbers.end()) {
+				to = it->second.alias;
 			}
 
 			if (to.empty()) {
@@ -123,27 +210,65 @@ class SMSNetworkPlugin : public NetworkPlugin {
 		}
 
 		void handleSMSDir() {
-			std::string dir = "/var/spool/sms/incoming/";
-			if (CONFIG_HAS_KEY(config, "backend.incoming_dir")) {
-				dir = CONFIG_STRING(config, "backend.incoming_dir");
+			{
+				// Events received from now on have to trigger another check.
+				boost::mutex::scoped_lock lock(m_scanMutex);
+				m_scanPending = false;
 			}
-			LOG4CXX_INFO(logger, "Checking directory " << dir << " for incoming SMS.");
 
-			path p(dir);
-			directory_iterator end_itr;
-			for (directory_iterator itr(p); itr != end_itr; ++itr) {
+			LOG4CXX_INFO(logger, "Checking directory " << m_incomingDir << " for incoming SMS.");
 
-				try {
-					if (is_regular(itr->path())) {
-						handleSMS(itr->path().string());
-						remove(itr->path());
+			try {
+				path p(m_incomingDir);
+				directory_iterator end_itr;
+				for (directory_iterator itr(p); itr != end_itr; ++itr) {
+
+					try {
+						if (is_regular(itr->path())) {
+							handleSMS(itr->path().string());
+							remove(itr->path());
+						}
+					}
+					catch (const filesystem_error& ex) {
+						LOG4CXX_ERROR(logger, "Error when removing the SMS: " << ex.what() << ".");
 					}
 				}
-				catch (const filesystem_error& ex) {
-					LOG4CXX_ERROR(logger, "Error when removing the SMS: " << ex.what() << ".");
+			}
+			catch (const filesystem_error& ex) {
+				LOG4CXX_ERROR(logger, "Error when checking directory " << m_incomingDir << ": " << ex.what() << ".");
+			}
+
+			if (m_inotify == -1) {
+				m_timer->start();
+			}
+		}
+
+		// Creates GSM Number - XMPP user pair to match the potential response and send it to the proper JID.
+		void associateNumber(const std::string &number, const std::string &user) {
+			std::map<std::string, BuddyInfo>::iterator it = m_numbers.find(number);
+			if (it != m_numbers.end()) {
+				if (it->second.alias != user) {
+					it->second.alias = user;
+					storageBackend->updateBuddy(m_internalUser, it->second);
 				}
+				return;
 			}
-			m_timer->start();
+
+			BuddyInfo info;
+			info.legacyName = number;
+			info.alias = user;
+			info.subscription = "both";
+			info.flags = 0;
+			info.id = storageBackend->addBuddy(m_internalUser, info);
+			m_numbers[number] = info;
+		}
+
+		// Remove trailing +, because smstools doesn't use it in "From: " field for received messages.
+		std::string normalizeNumber(const std::string &number) {
+			if (number.find("+") == 0) {
+				return number.substr(1);
+			}
+			return number;
 		}
 
 		void sendSMS(const std::string &to, const std::string &msg) {
@@ -194,20 +319,8 @@ class SMSNetworkPlugin : public NetworkPlugin {
 		}
 
 		void handleMessageSendRequest(const std::string &user, const std::string &legacyName, const std::string &message, const std::string &xhtml = "", const std::string &id = "") {
-			// Remove trailing +, because smstools doesn't use it in "From: " field for received messages.
-			std::string n = legacyName;
-			if (n.find("+") == 0) {
-				n = n.substr(1);
-			}
-
-			// Create GSM Number - XMPP user pair to match the potential response and send it to the proper JID.
-			BuddyInfo info;
-			info.legacyName = n;
-			info.alias = user;
-			info.id = -1;
-			info.subscription = "both";
-			info.flags = 0;
-			storageBackend->addBuddy(m_internalUser, info);
+			std::string n = normalizeNumber(legacyName);
+			associateNumber(n, user);
 
 			LOG4CXX_INFO(logger, "Sending SMS from " << user << " to " << n << ".");
 			sendSMS(n, message);
@@ -221,11 +334,17 @@ class SMSNetworkPlugin : public NetworkPlugin {
 
 		void handleBuddyUpdatedRequest(const std::string &user, const std::string &buddyName, const std::string &alias, const std::vector<std::string> &groups) {
 			LOG4CXX_INFO(logger, user << ": Added buddy " << buddyName << ".");
+			associateNumber(normalizeNumber(buddyName), user);
 			handleBuddyChanged(user, buddyName, alias, groups, pbnetwork::STATUS_ONLINE);
 		}
 
 		void handleBuddyRemovedRequest(const std::string &user, const std::string &buddyName, const std::vector<std::string> &groups) {
-
+			std::map<std::string, BuddyInfo>::iterator it = m_numbers.find(normalizeNumber(buddyName));
+			if (it != m_numbers.end() && it->second.alias == user) {
+				LOG4CXX_INFO(logger, user << ": Removed buddy " << buddyName << ".");
+				storageBackend->removeBuddy(it->second.id);
+				m_numbers.erase(it);
+			}
 		}
 
 
@@ -269,7 +388,7 @@ int main (int argc, char* argv[]) {
 
 	Logging::initBackendLogging(cfg);
 
-	StorageBackend *storageBackend = StorageBackend::createBackend(cfg, error);
+	storageBackend = StorageBackend::createBackend(cfg, error);
 	if (storageBackend == NULL) {
 		if (!error.empty()) {
 			std::cerr << error << "\n";
@@ -0,0 +1,239 @@
+#include "HTTPEngine.h"
+#include "transport/logging.h"
+#include <boost/bind.hpp>
+DEFINE_LOGGER(logger, "HTTPEngine")
+
+// curl_multi_poll can be woken up by curl_multi_wakeup since 7.68.0.
+// Older versions have to check for new requests periodically.
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define HAVE_CURL_MULTI_POLL 1
+#endif
+#define POLL_TIMEOUT 50
+// CURLM_ADDED_ALREADY has been added in 7.32.1.
+#if LIBCURL_VERSION_NUM >= 0x072001
+#define HAVE_CURLM_ADDED_ALREADY 1
+#endif
+
+HTTPEngine *HTTPEngine::defaultEngine = NULL;
+
+struct BlockingRequest {
+	boost::mutex lock;
+	boost::condition_variable finished;
+	bool done;
+	CURLcode code;
+};
+
+static void handleBlockingRequestFinished(BlockingRequest *req, CURLcode code)
+{
+	boost::mutex::scoped_lock l(req->lock);
+	req->code = code;
+	req->done = true;
+	req->finished.notify_one();
+}
+
+HTTPEngine::HTTPEngine()
+{
+	stopped = false;
+	multi = curl_multi_init();
+
+	share = curl_share_init();
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+	curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+	thread = new boost::thread(boost::bind(&HTTPEngine::run, this));
+}
+
+HTTPEngine::~HTTPEngine()
+{
+	{
+		boost::mutex::scoped_lock l(lock);
+		stopped = true;
+	}
+	wakeUp();
+	thread->join();
+	delete thread;
+
+	// Let the waiting callers know their requests won't finish.
+	for (std::map<CURL *, Callback>::iterator it = running.begin(); it != running.end(); it++) {
+		curl_multi_remove_handle(multi, it->first);
+		it->second(CURLE_ABORTED_BY_CALLBACK);
+	}
+	for (std::vector<Request>::iterator it = pending.begin(); it != pending.end(); it++) {
+		it->callback(CURLE_ABORTED_BY_CALLBACK);
+	}
+
+	curl_multi_cleanup(multi);
+	curl_share_cleanup(share);
+
+	if (defaultEngine == this) {
+		defaultEngine = NULL;
+	}
+}
+
+void HTTPEngine::lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	static_cast<HTTPEngine *>(userptr)->shareLocks[data].lock();
+}
+
+void HTTPEngine::unlockShare(CURL *handle, curl_lock_data data, void *userptr)
+{
+	static_cast<HTTPEngine *>(userptr)->shareLocks[data].unlock();
+}
+
+void HTTPEngine::setup(CURL *handle)
+{
+	curl_easy_setopt(handle, CURLOPT_SHARE, share);
+}
+
+void HTTPEngine::setupDefault(CURL *handle)
+{
+	if (defaultEngine) {
+		defaultEngine->setup(handle);
+	}
+}
+
+void HTTPEngine::wakeUp()
+{
+#ifdef HAVE_CURL_MULTI_POLL
+	curl_multi_wakeup(multi);
+#endif
+	requestAvailable.notify_one();
+}
+
+void HTTPEngine::perform(CURL *handle, Callback callback)
+{
+	{
+		boost::mutex::scoped_lock l(lock);
+		Request req;
+		req.handle = handle;
+		req.callback = callback;
+		pending.push_back(req);
+	}
+	wakeUp();
+}
+
+CURLcode HTTPEngine::perform(CURL *handle)
+{
+	BlockingRequest req;
+	req.done = false;
+	req.code = CURLE_OK;
+	perform(handle, boost::bind(handleBlockingRequestFinished, &req, _1));
+
+	boost::mutex::scoped_lock l(req.lock);
+	while (!req.done) {
+		req.finished.wait(l);
+	}
+	return req.code;
+}
+
+CURLcode HTTPEngine::performDefault(CURL *handle)
+{
+	if (defaultEngine) {
+		return defaultEngine->perform(handle);
+	}
+	return curl_easy_perform(handle);
+}
+
+int HTTPEngine::getRequestCount()
+{
+	boost::mutex::scoped_lock l(lock);
+	return pending.size() + running.size();
+}
+
+void HTTPEngine::run()
+{
+	while (true) {
+		std::vector<Request> requests;
+		std::vector<Request> duplicates;
+		{
+			boost::mutex::scoped_lock l(lock);
+			// Nothing to do, so sleep until there's new request.
+			while (!stopped && pending.empty() && running.empty()) {
+				requestAvailable.wait(l);
+			}
+			if (stopped) {
+				return;
+			}
+			// One handle can't run twice at the same time. The second request
+			// would overwrite the callback of the first one.
+			for (std::vector<Request>::iterator it = pending.begin(); it != pending.end(); it++) {
+				if (running.find(it->handle) != running.end()) {
+					duplicates.push_back(*it);
+					continue;
+				}
+				running[it->handle] = it->callback;
+				requests.push_back(*it);
+			}
+			pending.clear();
+		}
+
+		for (std::vector<Request>::iterator it = duplicates.begin(); it != duplicates.end(); it++) {
+			LOG4CXX_ERROR(logger, "Can't add request: handle is already running");
+			it->callback(CURLE_FAILED_INIT);
+		}
+
+		for (std::vector<Request>::iterator it = requests.begin(); it != requests.end(); it++) {
+			CURLMcode rc = curl_multi_add_handle(multi, it->handle);
+			if (rc != CURLM_OK) {
+				LOG4CXX_ERROR(logger, "Can't add request: " << curl_multi_strerror(rc));
+#ifdef HAVE_CURLM_ADDED_ALREADY
+				// The handle is used by multi handle outside of HTTPEngine, so the
+				// result would never be delivered to this request.
+				if (rc == CURLM_ADDED_ALREADY) {
+					LOG4CXX_ERROR(logger, "Handle passed to HTTPEngine must not be used by other multi handle");
+				}
+#endif
+				{
+					boost::mutex::scoped_lock l(lock);
+					running.erase(it->handle);
+				}
+				it->callback(CURLE_FAILED_INIT);
+			}
+		}
+
+		int active;
+		curl_multi_perform(multi, &active);
+
+		CURLMsg *msg;
+		int left;
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+
+			CURL *handle = msg->easy_handle;
+			CURLcode code = msg->data.result;
+			curl_multi_remove_handle(multi, handle);
+
+			Callback callback;
+			{
+				boost::mutex::scoped_lock l(lock);
+				std::map<CURL *, Callback>::iterator it = running.find(handle);
+				if (it != running.end()) {
+					callback = it->second;
+					running.erase(it);
+				}
+			}
+			if (!callback) {
+				LOG4CXX_ERROR(logger, "Finished request has no callback");
+				continue;
+			}
+			// The handle can be reused or freed by the callback.
+			callback(code);
+		}
+
+		if (active != 0) {
+#ifdef HAVE_CURL_MULTI_POLL
+			curl_multi_poll(multi, NULL, 0, 1000, NULL);
+#else
+			curl_multi_wait(multi, NULL, 0, POLL_TIMEOUT, NULL);
+#endif
+		}
+	}
+}
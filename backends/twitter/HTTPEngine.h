@@ -0,0 +1,83 @@
+#ifndef HTTPENGINE_H
+#define HTTPENGINE_H
+
+#include "curl/curl.h"
+#include "libtwitcurl/twitcurl.h"
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <map>
+#include <vector>
+
+/*
+ * HTTPEngine runs all HTTP requests of the process in one thread using
+ * the curl_multi interface. Requests share connections, DNS cache and TLS
+ * sessions, so polling thousands of users doesn't open thousands of
+ * connections and doesn't do thousands of TLS handshakes.
+ *
+ * The request is prepared as normal curl_easy handle and passed to perform().
+ * The asynchronous perform() calls the callback in HTTPEngine thread when the
+ * request is finished. The blocking perform() waits for the result and is
+ * meant to be used from ThreadPool workers. It must not be called from the
+ * callback, because it would block the HTTPEngine thread. The handle must not
+ * be passed to perform() again until its request is finished, such request
+ * fails with CURLE_FAILED_INIT.
+ *
+ * twitCurl uses HTTPEngine when it's set as its transport. HTTPRequest uses
+ * the default HTTPEngine (if it's set) through HTTPEngine::performDefault().
+ * Both fall back to curl_easy_perform otherwise.
+ */
+class HTTPEngine : public twitCurlTransport
+{
+	public:
+	typedef boost::function<void (CURLcode)> Callback;
+
+	HTTPEngine();
+	~HTTPEngine();
+
+	/* Configures the handle to use shared DNS cache and TLS sessions. */
+	virtual void setup(CURL *handle);
+
+	/* Starts the request, callback is called from HTTPEngine thread. */
+	void perform(CURL *handle, Callback callback);
+
+	/* Performs the request and waits for the result. */
+	virtual CURLcode perform(CURL *handle);
+
+	/* Number of requests which are not finished yet. */
+	int getRequestCount();
+
+	static void setDefault(HTTPEngine *engine) { defaultEngine = engine; }
+	static HTTPEngine *getDefault() { return defaultEngine; }
+
+	/* setup() and perform() using the default HTTPEngine or plain curl_easy_* functions. */
+	static void setupDefault(CURL *handle);
+	static CURLcode performDefault(CURL *handle);
+
+	private:
+	struct Request {
+		CURL *handle;
+		Callback callback;
+	};
+
+	void run();
+	void wakeUp();
+	static void lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+	static void unlockShare(CURL *handle, curl_lock_data data, void *userptr);
+
+	CURLM *multi;
+	CURLSH *share;
+	boost::mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+	boost::thread *thread;
+	boost::mutex lock;
+	boost::condition_variable requestAvailable;
+	std::vector<Request> pending;
+	std::map<CURL *, Callback> running;
+	bool stopped;
+
+	static HTTPEngine *defaultEngine;
+};
+
+#endif
@@ -5,7 +5,7 @@ bool HTTPRequest::init()
 {
 	curlhandle = curl_easy_init();
 	if(curlhandle) {
-		curlhandle = curl_easy_init();
+		HTTPEngine::setupDefault(curlhandle);
 		curl_easy_setopt(curlhandle, CURLOPT_PROXY, NULL);
 		curl_easy_setopt(curlhandle, CURLOPT_PROXYUSERPWD, NULL);
 		curl_easy_setopt(curlhandle, CURLOPT_PROXYAUTH, (long)CURLAUTH_ANY);
@@ -60,7 +60,7 @@ bool HTTPRequest::GET(std::string url, 	std::string &data)
 		curl_easy_setopt(curlhandle, CURLOPT_URL, url.c_str());
 		
 		/* Send http request and return status*/
-		if(CURLE_OK == curl_easy_perform(curlhandle)) {
+		if(CURLE_OK == HTTPEngine::performDefault(curlhandle)) {
 			data = callbackdata;
 			return true;
 		}
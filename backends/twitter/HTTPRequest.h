@@ -3,6 +3,7 @@
 
 #include "curl/curl.h"
 #include "transport/logging.h"
+#include "HTTPEngine.h"
 #include <iostream>
 #include <sstream>
 #include <string.h>
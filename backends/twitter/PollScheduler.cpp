@@ -0,0 +1,203 @@
+#include "PollScheduler.h"
+#include "transport/logging.h"
+#include <boost/bind.hpp>
+#include <ctime>
+#include <algorithm>
+DEFINE_LOGGER(logger, "PollScheduler")
+
+// Number of one second slots in the wheel. Entries due later than that
+// share the slot with earlier ones and are skipped until they are due.
+#define WHEEL_SIZE 512
+
+// Poll which didn't finish in this many intervals is considered lost.
+#define LOST_POLL_INTERVALS 10
+
+PollScheduler::PollScheduler(Swift::TimerFactory *timerFactory, int interval, int minInterval, int maxInterval)
+{
+	this->now = 0;
+	this->minInterval = std::max(1, minInterval);
+	this->maxInterval = std::max(this->minInterval, maxInterval);
+	this->interval = std::min(std::max(interval, this->minInterval), this->maxInterval);
+	wheel.resize(WHEEL_SIZE);
+
+	if (timerFactory) {
+		timer = timerFactory->createTimer(1000);
+		timer->onTick.connect(boost::bind(&PollScheduler::tick, this));
+		timer->start();
+	}
+}
+
+PollScheduler::~PollScheduler()
+{
+	if (timer) {
+		timer->stop();
+		timer->onTick.disconnect(boost::bind(&PollScheduler::tick, this));
+	}
+
+	for (std::map<std::string, UserEntries>::iterator it = users.begin(); it != users.end(); it++) {
+		delete it->second.entries[Timeline];
+		delete it->second.entries[DirectMessages];
+	}
+}
+
+unsigned long PollScheduler::findFreeSlot(int interval)
+{
+	int range = std::min(interval, WHEEL_SIZE);
+	unsigned long best = now + 1;
+	size_t bestSize = wheel[best % WHEEL_SIZE].size();
+	for (int i = 2; i <= range && bestSize != 0; i++) {
+		size_t size = wheel[(now + i) % WHEEL_SIZE].size();
+		if (size < bestSize) {
+			best = now + i;
+			bestSize = size;
+		}
+	}
+	return best;
+}
+
+void PollScheduler::schedule(Entry *entry, unsigned long due)
+{
+	entry->due = due;
+	std::list<Entry *> &slot = wheel[due % WHEEL_SIZE];
+	slot.push_back(entry);
+}
+
+void PollScheduler::unschedule(Entry *entry)
+{
+	wheel[entry->due % WHEEL_SIZE].remove(entry);
+}
+
+void PollScheduler::addUser(const std::string &user)
+{
+	if (users.find(user) != users.end()) {
+		return;
+	}
+
+	UserEntries &e = users[user];
+	for (int type = Timeline; type <= DirectMessages; type++) {
+		Entry *entry = new Entry;
+		entry->user = user;
+		entry->type = (Type) type;
+		entry->interval = interval;
+		entry->lastPoll = now;
+		entry->rateLimitDelay = 0;
+		entry->polling = false;
+		e.entries[type] = entry;
+		schedule(entry, findFreeSlot(interval));
+	}
+}
+
+void PollScheduler::removeUser(const std::string &user)
+{
+	std::map<std::string, UserEntries>::iterator it = users.find(user);
+	if (it == users.end()) {
+		return;
+	}
+
+	for (int type = Timeline; type <= DirectMessages; type++) {
+		unschedule(it->second.entries[type]);
+		delete it->second.entries[type];
+	}
+	users.erase(it);
+}
+
+int PollScheduler::getInterval(const std::string &user, Type type)
+{
+	std::map<std::string, UserEntries>::iterator it = users.find(user);
+	if (it == users.end()) {
+		return 0;
+	}
+	return it->second.entries[type]->interval;
+}
+
+void PollScheduler::tick()
+{
+	now++;
+
+	// Handlers of onPoll can add or remove users, so at first just collect
+	// the entries which are due and reschedule them.
+	std::vector<std::pair<std::string, Type> > due;
+	std::list<Entry *> &slot = wheel[now % WHEEL_SIZE];
+	for (std::list<Entry *>::iterator it = slot.begin(); it != slot.end(); ) {
+		Entry *entry = *it;
+		if (entry->due > now) {
+			it++;
+			continue;
+		}
+		it = slot.erase(it);
+
+		// Previous poll is still running, don't send another one unless
+		// we think it has been lost.
+		if (entry->polling && now - entry->lastPoll < (unsigned long) entry->interval * LOST_POLL_INTERVALS) {
+			schedule(entry, now + entry->interval);
+			continue;
+		}
+
+		entry->polling = true;
+		entry->lastPoll = now;
+		// handlePollFinished moves the entry according to the result.
+		schedule(entry, now + entry->interval);
+		due.push_back(std::make_pair(entry->user, entry->type));
+	}
+
+	for (std::vector<std::pair<std::string, Type> >::iterator it = due.begin(); it != due.end(); it++) {
+		if (users.find(it->first) != users.end()) {
+			onPoll(it->first, it->second);
+		}
+	}
+
+	if (timer) {
+		timer->start();
+	}
+}
+
+void PollScheduler::handlePollFinished(const std::string &user, Type type, bool activity)
+{
+	std::map<std::string, UserEntries>::iterator it = users.find(user);
+	if (it == users.end()) {
+		return;
+	}
+
+	Entry *entry = it->second.entries[type];
+	entry->polling = false;
+	if (activity) {
+		entry->interval = std::max(minInterval, entry->interval / 2);
+	}
+	else {
+		entry->interval = std::min(maxInterval, entry->interval + std::max(1, entry->interval / 4));
+	}
+
+	unsigned long delay = std::max((unsigned long) entry->interval, entry->rateLimitDelay);
+	entry->rateLimitDelay = 0;
+
+	unsigned long due = entry->lastPoll + delay;
+	if (due <= now) {
+		due = now + 1;
+	}
+
+	unschedule(entry);
+	schedule(entry, due);
+}
+
+void PollScheduler::handleRateLimit(const std::string &user, Type type, int remaining, long reset)
+{
+	std::map<std::string, UserEntries>::iterator it = users.find(user);
+	if (it == users.end()) {
+		return;
+	}
+
+	long left = reset - (long) time(NULL);
+	if (left <= 0) {
+		return;
+	}
+
+	Entry *entry = it->second.entries[type];
+	if (remaining <= 0) {
+		LOG4CXX_WARN(logger, user << ": Rate limit exceeded, next poll in " << left << " seconds");
+		entry->rateLimitDelay = left + 1;
+	}
+	else {
+		// Spread the remaining requests over the rest of the window.
+		entry->rateLimitDelay = (left + remaining - 1) / remaining;
+	}
+}
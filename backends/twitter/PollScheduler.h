@@ -0,0 +1,79 @@
+#ifndef POLLSCHEDULER_H
+#define POLLSCHEDULER_H
+
+#include "Swiften/Network/TimerFactory.h"
+#include "Swiften/Network/Timer.h"
+#include <boost/signal.hpp>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+
+/*
+ * PollScheduler decides when timeline and direct messages of every user
+ * are polled. Users are kept in a timing wheel with one second slots and
+ * new users are put into the least loaded slot, so polls are spread
+ * over the whole interval instead of being sent at once.
+ *
+ * Every user has its own interval. It's shortened when the poll returns
+ * something new and prolonged when it doesn't, within [minInterval, maxInterval].
+ * When Twitter reports the rate limit, the interval is at least long enough
+ * to not exhaust the remaining requests before the limit is reset.
+ */
+class PollScheduler
+{
+	public:
+	enum Type { Timeline = 0, DirectMessages = 1 };
+
+	PollScheduler(Swift::TimerFactory *timerFactory, int interval, int minInterval, int maxInterval);
+	~PollScheduler();
+
+	/* Starts polling of the user. */
+	void addUser(const std::string &user);
+
+	/* Stops polling of the user. */
+	void removeUser(const std::string &user);
+
+	/* Has to be called when the poll emitted by onPoll is finished. */
+	void handlePollFinished(const std::string &user, Type type, bool activity);
+
+	/* Called with x-rate-limit-* values of the poll response. */
+	void handleRateLimit(const std::string &user, Type type, int remaining, long reset);
+
+	/* Moves the wheel by one slot. Called every second by the timer. */
+	void tick();
+
+	int getInterval(const std::string &user, Type type);
+	int getUserCount() { return users.size(); }
+
+	boost::signal<void (const std::string &user, Type type)> onPoll;
+
+	private:
+	struct Entry {
+		std::string user;
+		Type type;
+		int interval;
+		unsigned long due;
+		unsigned long lastPoll;
+		unsigned long rateLimitDelay;
+		bool polling;
+	};
+
+	struct UserEntries {
+		Entry *entries[2];
+	};
+
+	void schedule(Entry *entry, unsigned long due);
+	void unschedule(Entry *entry);
+	unsigned long findFreeSlot(int interval);
+
+	Swift::Timer::ref timer;
+	std::vector<std::list<Entry *> > wheel;
+	std::map<std::string, UserEntries> users;
+	unsigned long now;
+	int interval;
+	int minInterval;
+	int maxInterval;
+};
+
+#endif
@@ -5,17 +5,33 @@ DEFINE_LOGGER(logger, "DirectMessageRequest")
 void DirectMessageRequest::run() 
 {
 	replyMsg = "";
-	if(username != "") success = twitObj->directMessageSend(username, data, false);
-	else success = twitObj->directMessageGet(data); /* data will contain sinceId */
+	if(username != "") {
+		success = twitObj->directMessageSend(username, data, false);
+		if(success) twitObj->getLastWebResponse( replyMsg );
+		return;
+	}
+
+	// Direct messages are parsed while the response is being received.
+	TwitterStreamParser parser(TwitterStreamParser::DIRECT_MESSAGES);
+	twitObj->setDataCallback(TwitterStreamParser::feedCallback, &parser);
+	success = twitObj->directMessageGet(data); /* data will contain sinceId */
+	twitObj->setDataCallback(NULL, NULL);
 
 	if(success) {
-		twitObj->getLastWebResponse( replyMsg );
-		if(username == "" ) messages = getDirectMessages( replyMsg );
+		parser.finish();
+		messages.swap(parser.getDirectMessages());
+		replyMsg = parser.getResponse();
 	}
 }
 
 void DirectMessageRequest::finalize()
 {
+	int remaining;
+	long reset;
+	if(rateLimitCallBack && twitObj->getLastRateLimit(remaining, reset)) {
+		rateLimitCallBack(user, remaining, reset);
+	}
+
 	Error error;
 	if(!success) {
 		std::string curlerror;
@@ -24,9 +40,10 @@ void DirectMessageRequest::finalize()
 		LOG4CXX_ERROR(logger, user << " Curl error: " << curlerror);
 		callBack(user, username, messages, error);
 	} else {
-		error = getErrorMessage(replyMsg);
+		if(!replyMsg.empty()) error = getErrorMessage(replyMsg);
 		if(error.getMessage().length()) LOG4CXX_ERROR(logger,  user << " - " << error.getMessage())
-		else LOG4CXX_INFO(logger, user << " - " << replyMsg)
+		else if(username != "") LOG4CXX_INFO(logger, user << " - " << replyMsg)
+		else LOG4CXX_INFO(logger, user << " - " << messages.size() << " direct messages")
 		callBack(user, username, messages, error);	
 	}
 }
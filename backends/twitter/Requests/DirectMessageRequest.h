@@ -20,16 +20,19 @@ class DirectMessageRequest : public Thread
 	std::string replyMsg;
 	boost::function< void (std::string&, std::string &, std::vector<DirectMessage>&, Error&) > callBack;
 	std::vector<DirectMessage> messages;
+	boost::function< void (std::string&, int, long) > rateLimitCallBack;
 	bool success;
 
 	public:
 	DirectMessageRequest(twitCurl *obj, const std::string &_user, const std::string & _username, const std::string &_data,
-			     		boost::function< void (std::string&, std::string &, std::vector<DirectMessage>&, Error&) >  cb) {
+			     		boost::function< void (std::string&, std::string &, std::vector<DirectMessage>&, Error&) >  cb,
+			     		boost::function< void (std::string&, int, long) > rateLimitCb = 0) {
 		twitObj = obj->clone();
 		data = _data;
 		user = _user;
 		username = _username;
 		callBack = cb;
+		rateLimitCallBack = rateLimitCb;
 	}
 
 	~DirectMessageRequest() {
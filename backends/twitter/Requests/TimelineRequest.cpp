@@ -4,19 +4,29 @@ void TimelineRequest::run()
 {	
 	LOG4CXX_INFO(logger, "Sending timeline request for user " << userRequested)
 	
+	// Tweets are parsed while the response is being received.
+	TwitterStreamParser parser(TwitterStreamParser::STATUSES);
+	twitObj->setDataCallback(TwitterStreamParser::feedCallback, &parser);
+
 	if(userRequested != "") success = twitObj->timelineUserGet(false, false, 20, userRequested, false);
 	else success = twitObj->timelineHomeGet(since_id);
-	
+
+	twitObj->setDataCallback(NULL, NULL);
 	if(!success) return;
 	
-	replyMsg = ""; 
-	twitObj->getLastWebResponse( replyMsg );
-	//LOG4CXX_INFO(logger, user << " - " << replyMsg.length() << " " << replyMsg << "\n" );
-	tweets = getTimeline(replyMsg);
+	parser.finish();
+	tweets.swap(parser.getStatuses());
+	replyMsg = parser.getResponse();
 }
 
 void TimelineRequest::finalize()
 {
+	int remaining;
+	long reset;
+	if(rateLimitCallBack && twitObj->getLastRateLimit(remaining, reset)) {
+		rateLimitCallBack(user, remaining, reset);
+	}
+
 	Error error;
 	if(!success) {
 		std::string curlerror;
@@ -25,7 +35,7 @@ void TimelineRequest::finalize()
 		LOG4CXX_ERROR(logger,  user << " - Curl error: " << curlerror)
 		callBack(user, userRequested, tweets, error);
 	} else {
-		error = getErrorMessage(replyMsg);
+		if(!replyMsg.empty()) error = getErrorMessage(replyMsg);
 		if(error.getMessage().length()) LOG4CXX_ERROR(logger,  user << " - " << error.getMessage())
 		callBack(user, userRequested, tweets, error);
 	} 
@@ -21,15 +21,18 @@ class TimelineRequest : public Thread
 	bool success;
 	boost::function< void (std::string&, std::string&, std::vector<Status> &, Error&) > callBack;
 	std::vector<Status> tweets;
+	boost::function< void (std::string&, int, long) > rateLimitCallBack;
 
 	public:
 	TimelineRequest(twitCurl *obj, const std::string &_user, const std::string &_user2, const std::string &_since_id,
-					boost::function< void (std::string&, std::string&, std::vector<Status> &, Error&) > cb) {
+					boost::function< void (std::string&, std::string&, std::vector<Status> &, Error&) > cb,
+					boost::function< void (std::string&, int, long) > rateLimitCb = 0) {
 		twitObj = obj->clone();
 		user = _user;
 		userRequested = _user2;
 		since_id = _since_id;
 		callBack = cb;
+		rateLimitCallBack = rateLimitCb;
 	}
 
 	~TimelineRequest() {
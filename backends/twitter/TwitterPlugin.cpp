@@ -74,26 +74,39 @@ TwitterPlugin::TwitterPlugin(Config *config, Swift::SimpleEventLoop *loop, Stora
 	m_conn->onDataRead.connect(boost::bind(&TwitterPlugin::_handleDataRead, this, _1));
 	m_conn->connect(Swift::HostAddressPort(Swift::HostAddress(host), port));
 
+	// All HTTP requests share connections, DNS cache and TLS sessions
+	// and are handled by single HTTPEngine thread.
+	httpEngine = new HTTPEngine();
+	HTTPEngine::setDefault(httpEngine);
+
 	tp = new ThreadPool(loop_, 10);
 		
-	tweet_timer = m_factories->getTimerFactory()->createTimer(90000);
-	message_timer = m_factories->getTimerFactory()->createTimer(90000);
-
-	tweet_timer->onTick.connect(boost::bind(&TwitterPlugin::pollForTweets, this));
-	message_timer->onTick.connect(boost::bind(&TwitterPlugin::pollForDirectMessages, this));
-
-	tweet_timer->start();
-	message_timer->start();
+	// Timelines and direct messages of users are polled at different times
+	// to spread the load over the whole poll interval.
+	pollScheduler = new PollScheduler(m_factories->getTimerFactory(), CONFIG_INT(config, "twitter.poll_interval"),
+		CONFIG_INT(config, "twitter.poll_interval_min"), CONFIG_INT(config, "twitter.poll_interval_max"));
+	pollScheduler->onPoll.connect(boost::bind(&TwitterPlugin::handlePoll, this, _1, _2));
+
+	// Last tweet/DM IDs are stored in the database in batches.
+	flush_timer = m_factories->getTimerFactory()->createTimer(std::max(1, CONFIG_INT(config, "twitter.last_id_flush_interval")) * 1000);
+	flush_timer->onTick.connect(boost::bind(&TwitterPlugin::handleFlushTimeout, this));
+	flush_timer->start();
 	
 	LOG4CXX_INFO(logger, "Starting the plugin.");
 }
 
 TwitterPlugin::~TwitterPlugin() 
 {
+	flush_timer->stop();
+	flush_timer->onTick.disconnect(boost::bind(&TwitterPlugin::handleFlushTimeout, this));
+	flushLastIDs();
+	delete pollScheduler;
+
 	delete storagebackend;
 	std::set<std::string>::iterator it;
 	for(it = onlineUsers.begin() ; it != onlineUsers.end() ; it++) delete userdb[*it].sessions;
 	delete tp;
+	delete httpEngine;
 }
 
 // Send data to NetworkPlugin server
@@ -156,7 +169,11 @@ void TwitterPlugin::handleLoginRequest(const std::string &user, const std::strin
 // User logging out
 void TwitterPlugin::handleLogoutRequest(const std::string &user, const std::string &legacyName) 
 {
+	pollScheduler->removeUser(user);
+
 	if (userdb.count(user)) {
+		boost::mutex::scoped_lock lock(userlock);
+		flushLastIDsUnsafe(user);
 		delete userdb[user].sessions;
 		userdb[user].sessions = NULL;
 		userdb[user].connectionState = DISCONNECTED;
@@ -196,6 +213,16 @@ void TwitterPlugin::handleLeaveRoomRequest(const std::string &user, const std::s
 	}
 }
 
+// Queues request sent by the user. Requests are dropped when the ThreadPool
+// queue is full, so let the user know the command has not been executed.
+void TwitterPlugin::queueRequest(const std::string &user, Thread *t)
+{
+	if(!tp->runAsThread(t)) {
+		handleMessage(user, userdb[user].twitterMode == CHATROOM ? adminChatRoom : adminLegacyName,
+						"Too many requests are being processed. Try again later.", userdb[user].twitterMode == CHATROOM ? adminNickName : "");
+	}
+}
+
 // Messages to be sent to Twitter 
 void TwitterPlugin::handleMessageSendRequest(const std::string &user, const std::string &legacyName, const std::string &message, const std::string &xhtml, const std::string &/*id*/) 
 {
@@ -213,31 +240,31 @@ void TwitterPlugin::handleMessageSendRequest(const std::string &user, const std:
 		/***********************************************************************/
 		
 		if(cmd == "#pin") 
-			tp->runAsThread(new PINExchangeProcess(np, userdb[user].sessions, user, data));
+			queueRequest(user, new PINExchangeProcess(np, userdb[user].sessions, user, data));
 		else if(cmd == "#help") 
-			tp->runAsThread(new HelpMessageRequest(user, CONFIG_STRING(config, "service.jid"), boost::bind(&TwitterPlugin::helpMessageResponse, this, _1, _2)));
+			queueRequest(user, new HelpMessageRequest(user, CONFIG_STRING(config, "service.jid"), boost::bind(&TwitterPlugin::helpMessageResponse, this, _1, _2)));
 		else if(cmd[0] == '@') {
 			std::string username = cmd.substr(1); 
-			tp->runAsThread(new DirectMessageRequest(userdb[user].sessions, user, username, data,
+			queueRequest(user, new DirectMessageRequest(userdb[user].sessions, user, username, data,
 												     boost::bind(&TwitterPlugin::directMessageResponse, this, _1, _2, _3, _4)));
 		}
 		else if(cmd == "#status") 
-			tp->runAsThread(new StatusUpdateRequest(userdb[user].sessions, user, data,
+			queueRequest(user, new StatusUpdateRequest(userdb[user].sessions, user, data,
 														boost::bind(&TwitterPlugin::statusUpdateResponse, this, _1, _2)));
 		else if(cmd == "#timeline") 
-			tp->runAsThread(new TimelineRequest(userdb[user].sessions, user, data, "",
+			queueRequest(user, new TimelineRequest(userdb[user].sessions, user, data, "",
 														boost::bind(&TwitterPlugin::displayTweets, this, _1, _2, _3, _4)));
 		else if(cmd == "#friends") 
-			tp->runAsThread(new FetchFriends(userdb[user].sessions, user,
+			queueRequest(user, new FetchFriends(userdb[user].sessions, user,
 													   boost::bind(&TwitterPlugin::displayFriendlist, this, _1, _2, _3, _4)));
 		else if(cmd == "#follow") 
-			tp->runAsThread(new CreateFriendRequest(userdb[user].sessions, user, data.substr(0,data.find('@')),
+			queueRequest(user, new CreateFriendRequest(userdb[user].sessions, user, data.substr(0,data.find('@')),
 													   boost::bind(&TwitterPlugin::createFriendResponse, this, _1, _2, _3, _4)));
 		else if(cmd == "#unfollow") 
-			tp->runAsThread(new DestroyFriendRequest(userdb[user].sessions, user, data.substr(0,data.find('@')),
+			queueRequest(user, new DestroyFriendRequest(userdb[user].sessions, user, data.substr(0,data.find('@')),
 													   boost::bind(&TwitterPlugin::deleteFriendResponse, this, _1, _2, _3)));
 		else if(cmd == "#retweet") 
-			tp->runAsThread(new RetweetRequest(userdb[user].sessions, user, data,
+			queueRequest(user, new RetweetRequest(userdb[user].sessions, user, data,
 													   boost::bind(&TwitterPlugin::RetweetResponse, this, _1, _2)));
 		else if(cmd == "#mode") {
 			int m = 0;
@@ -253,7 +280,7 @@ void TwitterPlugin::handleMessageSendRequest(const std::string &user, const std:
 			setTwitterMode(user, m);
 			if((userdb[user].twitterMode == SINGLECONTACT || userdb[user].twitterMode == CHATROOM) && prevm == MULTIPLECONTACT) clearRoster(user);
 			else if(userdb[user].twitterMode == MULTIPLECONTACT) 
-				tp->runAsThread(new FetchFriends(userdb[user].sessions, user, boost::bind(&TwitterPlugin::populateRoster, this, _1, _2, _3, _4)));
+				queueRequest(user, new FetchFriends(userdb[user].sessions, user, boost::bind(&TwitterPlugin::populateRoster, this, _1, _2, _3, _4)));
 
 			handleMessage(user, userdb[user].twitterMode == CHATROOM ? adminChatRoom : adminLegacyName,
 								std::string("Changed mode to ") + data, userdb[user].twitterMode == CHATROOM ? adminNickName : "");
@@ -264,11 +291,11 @@ void TwitterPlugin::handleMessageSendRequest(const std::string &user, const std:
 		else if(userdb[user].twitterMode == CHATROOM) {
 			std::string buddy = message.substr(0, message.find(":"));
 			if(userdb[user].buddies.count(buddy) == 0) {
-				tp->runAsThread(new StatusUpdateRequest(userdb[user].sessions, user, message,
+				queueRequest(user, new StatusUpdateRequest(userdb[user].sessions, user, message,
 														boost::bind(&TwitterPlugin::statusUpdateResponse, this, _1, _2)));
 			} else {
 				data = message.substr(message.find(":")+1); //Can parse better??:P
-				tp->runAsThread(new DirectMessageRequest(userdb[user].sessions, user, buddy, data,
+				queueRequest(user, new DirectMessageRequest(userdb[user].sessions, user, buddy, data,
 												 		 boost::bind(&TwitterPlugin::directMessageResponse, this, _1, _2, _3, _4)));
 			}
 		}
@@ -280,7 +307,7 @@ void TwitterPlugin::handleMessageSendRequest(const std::string &user, const std:
 		std::string buddy = legacyName;
 		if(userdb[user].twitterMode == CHATROOM) buddy = legacyName.substr(legacyName.find("/") + 1);
 		if(legacyName != "twitter") {
-			tp->runAsThread(new DirectMessageRequest(userdb[user].sessions, user, buddy, message,
+			queueRequest(user, new DirectMessageRequest(userdb[user].sessions, user, buddy, message,
 												 boost::bind(&TwitterPlugin::directMessageResponse, this, _1, _2, _3, _4)));
 		}
 	}
@@ -323,38 +350,63 @@ void TwitterPlugin::handleVCardRequest(const std::string &user, const std::strin
 		&& userdb[user].buddiesInfo[legacyName].getProfileImgURL().length()) {
 		if(userdb[user].buddiesImgs.count(legacyName) == 0) {
 			tp->runAsThread(new ProfileImageRequest(config, user, legacyName, userdb[user].buddiesInfo[legacyName].getProfileImgURL(), id,
-													boost::bind(&TwitterPlugin::profileImageResponse, this, _1, _2, _3, _4, _5)));
+													boost::bind(&TwitterPlugin::profileImageResponse, this, _1, _2, _3, _4, _5)), ThreadPool::Background);
 		}
 		handleVCard(user, id, legacyName, legacyName, "", userdb[user].buddiesImgs[legacyName]);
 	}
 }
 
-void TwitterPlugin::pollForTweets()
+void TwitterPlugin::handlePoll(const std::string &user, PollScheduler::Type type)
+{
+	if (type == PollScheduler::Timeline) {
+		pollForTweets(user);
+	}
+	else {
+		pollForDirectMessages(user);
+	}
+}
+
+void TwitterPlugin::pollForTweets(const std::string &user)
 {
 	boost::mutex::scoped_lock lock(userlock);
-	std::set<std::string>::iterator it = onlineUsers.begin();
-	while(it != onlineUsers.end()) {
-		std::string user = *it;
-		tp->runAsThread(new TimelineRequest(userdb[user].sessions, user, "", getMostRecentTweetIDUnsafe(user),
-											boost::bind(&TwitterPlugin::displayTweets, this, _1, _2, _3, _4)));
-		it++;
+	if(onlineUsers.count(user) == 0) {
+		pollScheduler->handlePollFinished(user, PollScheduler::Timeline, false);
+		return;
+	}
+
+	bool queued = tp->runAsThread(new TimelineRequest(userdb[user].sessions, user, "", getMostRecentTweetIDUnsafe(user),
+										boost::bind(&TwitterPlugin::timelinePollResponse, this, _1, _2, _3, _4),
+										boost::bind(&PollScheduler::handleRateLimit, pollScheduler, _1, PollScheduler::Timeline, _2, _3)), ThreadPool::Background);
+	if(!queued) {
+		pollScheduler->handlePollFinished(user, PollScheduler::Timeline, false);
 	}
-	tweet_timer->start();
 }
 
-void TwitterPlugin::pollForDirectMessages()
+void TwitterPlugin::pollForDirectMessages(const std::string &user)
 {
 	boost::mutex::scoped_lock lock(userlock);
-	std::set<std::string>::iterator it = onlineUsers.begin();
-	while(it != onlineUsers.end()) {
-		std::string user = *it;
-		tp->runAsThread(new DirectMessageRequest(userdb[user].sessions, user, "", getMostRecentDMIDUnsafe(user),
-											boost::bind(&TwitterPlugin::directMessageResponse, this, _1, _2, _3, _4)));
-		it++;
+	if(onlineUsers.count(user) == 0) {
+		pollScheduler->handlePollFinished(user, PollScheduler::DirectMessages, false);
+		return;
+	}
+
+	bool queued = tp->runAsThread(new DirectMessageRequest(userdb[user].sessions, user, "", getMostRecentDMIDUnsafe(user),
+										boost::bind(&TwitterPlugin::directMessagePollResponse, this, _1, _2, _3, _4),
+										boost::bind(&PollScheduler::handleRateLimit, pollScheduler, _1, PollScheduler::DirectMessages, _2, _3)), ThreadPool::Background);
+	if(!queued) {
+		pollScheduler->handlePollFinished(user, PollScheduler::DirectMessages, false);
 	}
-	message_timer->start();
 }
 
+void TwitterPlugin::handleFlushTimeout()
+{
+	flushLastIDs();
+
+	LOG4CXX_INFO(logger, "Polling " << pollScheduler->getUserCount() << " users. ThreadPool: " << tp->getQueuedCount() << " queued, "
+		<< tp->getActiveThreadCount() << " running, " << tp->getCompletedCount() << " completed, " << tp->getDroppedCount() << " dropped, average wait "
+		<< tp->getAverageWaitTime() << " s (max " << tp->getMaxWaitTime() << " s), average run " << tp->getAverageRunTime() << " s")
+	flush_timer->start();
+}
 
 bool TwitterPlugin::getUserOAuthKeyAndSecret(const std::string user, std::string &key, std::string &secret) 
 {
@@ -462,6 +514,7 @@ void TwitterPlugin::initUserSession(const std::string user, const std::string le
 	LOG4CXX_INFO(logger, username + "  " + passwd)
 
 	userdb[user].sessions = new twitCurl();	
+	userdb[user].sessions->setTransport(httpEngine);
 	if(CONFIG_HAS_KEY(config,"proxy.server")) {			
 		std::string ip = CONFIG_STRING(config,"proxy.server");
 
@@ -522,22 +575,68 @@ void TwitterPlugin::pinExchangeComplete(const std::string user, const std::strin
 	}
 
 	onlineUsers.insert(user);
+	loadLastIDsUnsafe(user);
+	pollScheduler->addUser(user);
+}	
+
+void TwitterPlugin::loadLastIDsUnsafe(const std::string user)
+{
 	userdb[user].mostRecentTweetID = "";
 	userdb[user].mostRecentDirectMessageID = "";
-}	
+	userdb[user].tweetIDChanged = false;
+	userdb[user].directMessageIDChanged = false;
 
-void TwitterPlugin::updateLastTweetID(const std::string user, const std::string ID)
+	UserInfo info;
+	if(storagebackend->getUser(user, info) == false) {
+		LOG4CXX_ERROR(logger, "Didn't find entry for " << user << " in the database!")
+		return;
+	}
+
+	int type;
+	storagebackend->getUserSetting(info.id, "twitter_last_tweet", type, userdb[user].mostRecentTweetID);
+	storagebackend->getUserSetting(info.id, "twitter_last_dm", type, userdb[user].mostRecentDirectMessageID);
+}
+
+void TwitterPlugin::flushLastIDsUnsafe(const std::string user)
 {
-	boost::mutex::scoped_lock lock(userlock);	
-	userdb[user].mostRecentTweetID = ID;
+	if(dirtyUsers.erase(user) == 0) return;
 
+	UserData &data = userdb[user];
 	UserInfo info;
 	if(storagebackend->getUser(user, info) == false) {
 		LOG4CXX_ERROR(logger, "Didn't find entry for " << user << " in the database!")
 		return;
 	}
 
-	storagebackend->updateUserSetting((long)info.id, "twitter_last_tweet", ID);
+	if(data.tweetIDChanged) {
+		storagebackend->updateUserSetting((long)info.id, "twitter_last_tweet", data.mostRecentTweetID);
+		data.tweetIDChanged = false;
+	}
+	if(data.directMessageIDChanged) {
+		storagebackend->updateUserSetting((long)info.id, "twitter_last_dm", data.mostRecentDirectMessageID);
+		data.directMessageIDChanged = false;
+	}
+}
+
+void TwitterPlugin::flushLastIDs()
+{
+	boost::mutex::scoped_lock lock(userlock);
+	std::set<std::string> users = dirtyUsers;
+
+	if(users.size()) LOG4CXX_INFO(logger, "Storing last tweet/DM IDs of " << users.size() << " users")
+	for(std::set<std::string>::iterator it = users.begin(); it != users.end(); it++) {
+		flushLastIDsUnsafe(*it);
+	}
+}
+
+void TwitterPlugin::updateLastTweetID(const std::string user, const std::string ID)
+{
+	boost::mutex::scoped_lock lock(userlock);	
+	if(userdb[user].mostRecentTweetID == ID) return;
+
+	userdb[user].mostRecentTweetID = ID;
+	userdb[user].tweetIDChanged = true;
+	dirtyUsers.insert(user);
 }
 
 std::string TwitterPlugin::getMostRecentTweetIDUnsafe(const std::string user)
@@ -545,16 +644,6 @@ std::string TwitterPlugin::getMostRecentTweetIDUnsafe(const std::string user)
 	std::string ID = "";
 	if(onlineUsers.count(user)) {
 		ID = userdb[user].mostRecentTweetID;
-		if (ID.empty()) {
-			int type;
-			UserInfo info;
-			if(storagebackend->getUser(user, info) == false) {
-				LOG4CXX_ERROR(logger, "Didn't find entry for " << user << " in the database!")
-			}
-			else {
-				storagebackend->getUserSetting(info.id, "twitter_last_tweet", type, ID);
-			}
-		}
 	}
 	return ID;
 }
@@ -568,31 +657,17 @@ std::string TwitterPlugin::getMostRecentTweetID(const std::string user)
 void TwitterPlugin::updateLastDMID(const std::string user, const std::string ID)
 {
 	boost::mutex::scoped_lock lock(userlock);	
-	userdb[user].mostRecentDirectMessageID = ID;
-
-	UserInfo info;
-	if(storagebackend->getUser(user, info) == false) {
-		LOG4CXX_ERROR(logger, "Didn't find entry for " << user << " in the database!")
-		return;
-	}
+	if(userdb[user].mostRecentDirectMessageID == ID) return;
 
-	storagebackend->updateUserSetting((long)info.id, "twitter_last_dm", ID);
+	userdb[user].mostRecentDirectMessageID = ID;
+	userdb[user].directMessageIDChanged = true;
+	dirtyUsers.insert(user);
 }
 
 std::string TwitterPlugin::getMostRecentDMIDUnsafe(const std::string user) {
 	std::string ID = "";
 	if(onlineUsers.count(user)) {
 		ID = userdb[user].mostRecentDirectMessageID;
-		if (ID.empty()) {
-			int type;
-			UserInfo info;
-			if(storagebackend->getUser(user, info) == false) {
-				LOG4CXX_ERROR(logger, "Didn't find entry for " << user << " in the database!")
-			}
-			else {
-				storagebackend->getUserSetting(info.id, "twitter_last_dm", type, ID);
-			}
-		}
 	}
 	return ID;
 }
@@ -736,6 +811,18 @@ void TwitterPlugin::displayTweets(std::string &user, std::string &userRequested,
 	}
 }
 
+void TwitterPlugin::timelinePollResponse(std::string &user, std::string &userRequested, std::vector<Status> &tweets , Error &errMsg)
+{
+	displayTweets(user, userRequested, tweets, errMsg);
+	pollScheduler->handlePollFinished(user, PollScheduler::Timeline, errMsg.getMessage().empty() && !tweets.empty());
+}
+
+void TwitterPlugin::directMessagePollResponse(std::string &user, std::string &username, std::vector<DirectMessage> &messages, Error &errMsg)
+{
+	directMessageResponse(user, username, messages, errMsg);
+	pollScheduler->handlePollFinished(user, PollScheduler::DirectMessages, errMsg.getMessage().empty() && !messages.empty());
+}
+
 void TwitterPlugin::directMessageResponse(std::string &user, std::string &username, std::vector<DirectMessage> &messages, Error &errMsg)
 {
 	if(errMsg.getCode() == "93") //Permission Denied
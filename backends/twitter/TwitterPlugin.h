@@ -24,6 +24,8 @@
 
 #include "twitcurl.h"
 #include "TwitterResponseParser.h"
+#include "HTTPEngine.h"
+#include "PollScheduler.h"
 
 #include <iostream>
 #include <sstream>
@@ -51,8 +53,7 @@ class TwitterPlugin : public NetworkPlugin {
 		Swift::BoostNetworkFactories *m_factories;
 		Swift::BoostIOServiceThread m_boostIOServiceThread;
 		boost::shared_ptr<Swift::Connection> m_conn;
-		Swift::Timer::ref tweet_timer;
-		Swift::Timer::ref message_timer;
+		Swift::Timer::ref flush_timer;
 		StorageBackend *storagebackend;
 
 		TwitterPlugin(Config *config, Swift::SimpleEventLoop *loop, StorageBackend *storagebackend, const std::string &host, int port);
@@ -82,9 +83,12 @@ class TwitterPlugin : public NetworkPlugin {
 		
 		void handleVCardRequest(const std::string &/*user*/, const std::string &/*legacyName*/, unsigned int /*id*/);
 		
-		void pollForTweets();
+		void pollForTweets(const std::string &user);
 
-		void pollForDirectMessages();
+		void pollForDirectMessages(const std::string &user);
+
+		// Writes changed last tweet/DM IDs to the database
+		void flushLastIDs();
 		
 		bool getUserOAuthKeyAndSecret(const std::string user, std::string &key, std::string &secret);
 		
@@ -132,11 +136,20 @@ class TwitterPlugin : public NetworkPlugin {
 		void RetweetResponse(std::string &user, Error &errMsg);
 		
 		void profileImageResponse(std::string &user, std::string &buddy, std::string &img, unsigned int reqID, Error &errMsg);
+
+		void timelinePollResponse(std::string &user, std::string &userRequested, std::vector<Status> &tweets , Error &errMsg);
+
+		void directMessagePollResponse(std::string &user, std::string &username, std::vector<DirectMessage> &messages, Error &errMsg);
 		/***********************************************************************************/
 
 	private:
 		std::string getMostRecentTweetIDUnsafe(const std::string user);
 		std::string getMostRecentDMIDUnsafe(const std::string user);
+		void loadLastIDsUnsafe(const std::string user);
+		void flushLastIDsUnsafe(const std::string user);
+		void handlePoll(const std::string &user, PollScheduler::Type type);
+		void queueRequest(const std::string &user, Thread *t);
+		void handleFlushTimeout();
 
 		enum status {NEW, WAITING_FOR_PIN, CONNECTED, DISCONNECTED};
 		enum mode {SINGLECONTACT, MULTIPLECONTACT, CHATROOM};
@@ -156,7 +169,10 @@ class TwitterPlugin : public NetworkPlugin {
 		boost::mutex dblock, userlock;
 
 		ThreadPool *tp;
+		HTTPEngine *httpEngine;
+		PollScheduler *pollScheduler;
 		std::set<std::string> onlineUsers;
+		std::set<std::string> dirtyUsers;
 		struct UserData
 		{
 			std::string legacyName;
@@ -167,13 +183,15 @@ class TwitterPlugin : public NetworkPlugin {
 			status connectionState;
 			std::string mostRecentTweetID;
 			std::string mostRecentDirectMessageID;
+			bool tweetIDChanged;
+			bool directMessageIDChanged;
 			std::string nickName;
 			std::set<std::string> buddies;
 			std::map<std::string, User> buddiesInfo;
 			std::map<std::string, std::string> buddiesImgs;
 			mode twitterMode;
 
-			UserData() { sessions = NULL; }
+			UserData() { sessions = NULL; tweetIDChanged = false; directMessageIDChanged = false; }
 		};
 		std::map<std::string, UserData> userdb;
 		bool m_firstPing;
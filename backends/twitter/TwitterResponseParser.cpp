@@ -2,8 +2,10 @@
 #include "transport/logging.h"
 #include "boost/algorithm/string.hpp"
 #include <cctype>
-#include "boost/date_time/local_time/local_time.hpp"
-#include "boost/date_time/time_facet.hpp"
+#include "rapidjson/reader.h"
+#include <cstdio>
+#include <cstring>
+#include <sstream>
 
 DEFINE_LOGGER(logger, "TwitterResponseParser")
 
@@ -20,33 +22,69 @@ template <class T> std::string stringOf(T object) {
 	return (os.str());
 }
 
-static std::string unescape(std::string data, std::vector<UrlEntity> urls) {
-	using boost::algorithm::replace_all;
-	replace_all(data, "&amp;",  "&");
-	replace_all(data, "&quot;", "\"");
-	replace_all(data, "&apos;", "\'");
-	replace_all(data, "&lt;",   "<");
-	replace_all(data, "&gt;",   ">");
-
-	for (std::vector<UrlEntity>::size_type i = 0; i < urls.size(); i++) {
-		replace_all(data, urls[i].getUrl(), urls[i].getExpandedUrl());
+static std::string unescape(const std::string &data, const std::vector<UrlEntity> &urls) {
+	// Entities and shortened URLs are replaced in one pass.
+	std::string out;
+	out.reserve(data.size());
+
+	for (std::string::size_type i = 0; i < data.size(); ) {
+		if (data[i] == '&') {
+			if (data.compare(i, 5, "&amp;") == 0) { out += '&'; i += 5; continue; }
+			if (data.compare(i, 6, "&quot;") == 0) { out += '"'; i += 6; continue; }
+			if (data.compare(i, 6, "&apos;") == 0) { out += '\''; i += 6; continue; }
+			if (data.compare(i, 4, "&lt;") == 0) { out += '<'; i += 4; continue; }
+			if (data.compare(i, 4, "&gt;") == 0) { out += '>'; i += 4; continue; }
+		}
+		else {
+			std::vector<UrlEntity>::size_type u;
+			for (u = 0; u < urls.size(); u++) {
+				const std::string &url = urls[u].getUrl();
+				if (!url.empty() && url[0] == data[i] && data.compare(i, url.size(), url) == 0) {
+					break;
+				}
+			}
+			if (u != urls.size()) {
+				out += urls[u].getExpandedUrl();
+				i += urls[u].getUrl().size();
+				continue;
+			}
+		}
+		out += data[i++];
 	}
 
-	return data;
+	return out;
 }
 
-static std::string toIsoTime(std::string in) {
-	std::locale locale(std::locale::classic(), new boost::local_time::local_time_input_facet("%a %b %d %H:%M:%S +0000 %Y"));
-	boost::local_time::local_time_facet* output_facet = new boost::local_time::local_time_facet();
-	boost::local_time::local_date_time ldt(boost::local_time::not_a_date_time);
-	std::stringstream ss(in);
-	ss.imbue(locale);
-	ss.imbue(std::locale(ss.getloc(), output_facet));
-	output_facet->format("%Y%m%dT%H%M%S"); // boost::local_time::local_time_facet::iso_time_format_specifier ?
-	ss >> ldt;
-	ss.str("");
-	ss << ldt;	
-	return ss.str();
+static bool isDigits(const std::string &in, std::string::size_type pos, std::string::size_type len) {
+	for (std::string::size_type i = pos; i < pos + len; i++) {
+		if (in[i] < '0' || in[i] > '9') return false;
+	}
+	return true;
+}
+
+// Converts Twitter's "Wed Aug 27 13:08:45 +0000 2008" to "20080827T130845".
+static std::string toIsoTime(const std::string &in) {
+	static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	if (in.size() != 30 || in[3] != ' ' || in[7] != ' ' || in[10] != ' ' || in[13] != ':' || in[16] != ':'
+		|| in.compare(19, 7, " +0000 ") != 0 || !isDigits(in, 8, 2) || !isDigits(in, 11, 2)
+		|| !isDigits(in, 14, 2) || !isDigits(in, 17, 2) || !isDigits(in, 26, 4)) {
+		return "not-a-date-time";
+	}
+
+	int month = 0;
+	while (month < 12 && in.compare(4, 3, months + month * 3, 3) != 0) month++;
+	if (month == 12) {
+		return "not-a-date-time";
+	}
+	month++;
+
+	char out[16] = {
+		in[26], in[27], in[28], in[29],
+		(char) ('0' + month / 10), (char) ('0' + month % 10),
+		in[8], in[9], 'T',
+		in[11], in[12], in[14], in[15], in[17], in[18], 0
+	};
+	return std::string(out, 15);
 }
 
 EmbeddedStatus getEmbeddedStatus(const rapidjson::Value &element)
@@ -296,3 +334,491 @@ std::vector<UrlEntity> getUrlEntities(const rapidjson::Value &element)
 	
 	return url_entities;
 }
+
+static std::vector<UrlEntity> toUrlEntities(const std::vector<std::pair<std::string, std::string> > &urls)
+{
+	std::vector<UrlEntity> entities;
+	for (std::vector<std::pair<std::string, std::string> >::size_type i = 0; i < urls.size(); i++) {
+		entities.push_back(UrlEntity(urls[i].first, urls[i].second));
+	}
+	return entities;
+}
+
+// Fields of one timeline/direct message element collected by SAX handler.
+// StatusFields are shared by the element itself and the last status
+// embedded in user objects.
+struct StatusFields
+{
+	std::string created_at;
+	std::string id;
+	std::string text;
+	bool truncated;
+	std::string in_reply_to_status_id;
+	std::string in_reply_to_user_id;
+	std::string in_reply_to_screen_name;
+	unsigned int retweet_count;
+	bool favorited;
+	bool retweeted;
+	std::vector<std::pair<std::string, std::string> > urls;
+
+	StatusFields():truncated(false),retweet_count(0),favorited(false),retweeted(false){}
+
+	EmbeddedStatus toEmbeddedStatus() const {
+		EmbeddedStatus status;
+		status.setCreationTime(toIsoTime(created_at));
+		status.setID(id);
+		status.setTweet(unescape(text, toUrlEntities(urls)));
+		status.setTruncated(truncated);
+		status.setReplyToStatusID(in_reply_to_status_id);
+		status.setReplyToUserID(in_reply_to_user_id);
+		status.setReplyToScreenName(in_reply_to_screen_name);
+		status.setRetweetCount(retweet_count);
+		status.setFavorited(favorited);
+		status.setRetweeted(retweeted);
+		return status;
+	}
+};
+
+struct UserFields
+{
+	std::string id;
+	std::string name;
+	std::string screen_name;
+	std::string profile_image_url;
+	unsigned int statuses_count;
+	bool has_status;
+	StatusFields status;
+
+	UserFields():statuses_count(0),has_status(false){}
+
+	User toUser() const {
+		User user;
+		user.setUserID(id);
+		user.setScreenName(tolowercase(screen_name));
+		user.setUserName(name);
+		user.setProfileImgURL(profile_image_url);
+		user.setNumberOfTweets(statuses_count);
+		if (has_status) {
+			user.setLastStatus(status.toEmbeddedStatus());
+		}
+		return user;
+	}
+};
+
+struct ElementFields : public StatusFields
+{
+	UserFields user;
+
+	bool has_retweet;
+	std::string rt_created_at;
+	std::string rt_id;
+	std::string rt_text;
+	UserFields rt_user;
+
+	std::string sender_id;
+	std::string recipient_id;
+	std::string sender_screen_name;
+	std::string recipient_screen_name;
+	UserFields sender;
+	UserFields recipient;
+
+	ElementFields():has_retweet(false){}
+};
+
+// rapidjson SAX handler filling ElementFields. Only the keys we are
+// interested in are looked up, everything else is skipped.
+class ElementHandler : public rapidjson::BaseReaderHandler<>
+{
+	enum Context {ELEMENT, RETWEET, USER, EMBEDDED, ENTITIES, URLS, URL, IGNORED};
+	enum Field {NONE, CREATED_AT, ID, TEXT, TRUNCATED, IN_REPLY_TO_ID, IN_REPLY_TO_SCREEN_NAME,
+		RETWEET_COUNT, FAVORITED, RETWEETED, SENDER_ID, RECIPIENT_ID, SENDER_SCREEN_NAME, RECIPIENT_SCREEN_NAME,
+		NAME, SCREEN_NAME, PROFILE_IMAGE_URL, STATUSES_COUNT, URL_URL, URL_EXPANDED_URL,
+		USER_OBJECT, SENDER_OBJECT, RECIPIENT_OBJECT, RETWEETED_STATUS_OBJECT, STATUS_OBJECT, ENTITIES_OBJECT, URLS_ARRAY};
+
+	struct Frame {
+		Context context;
+		UserFields *user;
+		StatusFields *status;
+		bool object;
+		bool expectKey;
+	};
+
+	std::vector<Frame> frames;
+	Field field;
+	ElementFields &fields;
+
+	static bool is(const std::string &key, const char *str, rapidjson::SizeType length) {
+		return key.size() == length && memcmp(key.c_str(), str, length) == 0;
+	}
+
+	static Field lookup(Context context, const char *key, rapidjson::SizeType length) {
+		using namespace TwitterReponseTypes;
+		switch (context) {
+			case ELEMENT:
+				if (is(user, key, length)) return USER_OBJECT;
+				if (is(retweeted_status, key, length)) return RETWEETED_STATUS_OBJECT;
+				if (is(sender, key, length)) return SENDER_OBJECT;
+				if (is(recipient, key, length)) return RECIPIENT_OBJECT;
+				if (is(sender_id, key, length)) return SENDER_ID;
+				if (is(recipient_id, key, length)) return RECIPIENT_ID;
+				if (is(sender_screen_name, key, length)) return SENDER_SCREEN_NAME;
+				if (is(recipient_screen_name, key, length)) return RECIPIENT_SCREEN_NAME;
+				// fall through
+			case EMBEDDED:
+				if (is(entities, key, length)) return ENTITIES_OBJECT;
+				if (is(in_reply_to_screen_name, key, length)) return IN_REPLY_TO_SCREEN_NAME;
+				if (is(retweet_count, key, length)) return RETWEET_COUNT;
+				if (is(truncated, key, length)) return TRUNCATED;
+				if (is(favorited, key, length)) return FAVORITED;
+				if (is(retweeted, key, length)) return RETWEETED;
+				// in_reply_to_status_id and in_reply_to_user_id share the key
+				if (is(in_reply_to_user_id, key, length)) return IN_REPLY_TO_ID;
+				// fall through
+			case RETWEET:
+				if (is(id, key, length)) return ID;
+				if (is(text, key, length)) return TEXT;
+				if (is(created_at, key, length)) return CREATED_AT;
+				if (context == RETWEET && is(user, key, length)) return USER_OBJECT;
+				return NONE;
+			case USER:
+				if (is(id, key, length)) return ID;
+				if (is(name, key, length)) return NAME;
+				if (is(screen_name, key, length)) return SCREEN_NAME;
+				if (is(profile_image_url, key, length)) return PROFILE_IMAGE_URL;
+				if (is(statuses_count, key, length)) return STATUSES_COUNT;
+				if (is(status, key, length)) return STATUS_OBJECT;
+				return NONE;
+			case ENTITIES:
+				return length == 4 && memcmp(key, "urls", 4) == 0 ? URLS_ARRAY : NONE;
+			case URL:
+				if (length == 3 && memcmp(key, "url", 3) == 0) return URL_URL;
+				if (length == 12 && memcmp(key, "expanded_url", 12) == 0) return URL_EXPANDED_URL;
+				return NONE;
+			default:
+				return NONE;
+		}
+	}
+
+	// Called for every scalar value. Numbers are formatted only when needed.
+	void value(const char *str, rapidjson::SizeType length, uint64_t number, bool negative, bool boolean) {
+		Field f = field;
+		field = NONE;
+		frames.back().expectKey = frames.back().object;
+		if (f == NONE) {
+			return;
+		}
+
+		char buf[24];
+		if (str == NULL) {
+			length = snprintf(buf, sizeof(buf), negative ? "-%llu" : "%llu", (unsigned long long) number);
+			str = buf;
+		}
+
+		Frame &frame = frames.back();
+		switch (f) {
+			case CREATED_AT: (frame.context == RETWEET ? fields.rt_created_at : frame.status->created_at).assign(str, length); break;
+			case TEXT: (frame.context == RETWEET ? fields.rt_text : frame.status->text).assign(str, length); break;
+			case ID:
+				if (frame.context == USER) frame.user->id.assign(str, length);
+				else (frame.context == RETWEET ? fields.rt_id : frame.status->id).assign(str, length);
+				break;
+			case TRUNCATED: frame.status->truncated = boolean; break;
+			case IN_REPLY_TO_ID:
+				frame.status->in_reply_to_status_id.assign(str, length);
+				frame.status->in_reply_to_user_id.assign(str, length);
+				break;
+			case IN_REPLY_TO_SCREEN_NAME: frame.status->in_reply_to_screen_name.assign(str, length); break;
+			case RETWEET_COUNT: frame.status->retweet_count = (unsigned int) number; break;
+			case FAVORITED: frame.status->favorited = boolean; break;
+			case RETWEETED: frame.status->retweeted = boolean; break;
+			case SENDER_ID: fields.sender_id.assign(str, length); break;
+			case RECIPIENT_ID: fields.recipient_id.assign(str, length); break;
+			case SENDER_SCREEN_NAME: fields.sender_screen_name.assign(str, length); break;
+			case RECIPIENT_SCREEN_NAME: fields.recipient_screen_name.assign(str, length); break;
+			case NAME: frame.user->name.assign(str, length); break;
+			case SCREEN_NAME: frame.user->screen_name.assign(str, length); break;
+			case PROFILE_IMAGE_URL: frame.user->profile_image_url.assign(str, length); break;
+			case STATUSES_COUNT: frame.user->statuses_count = (unsigned int) number; break;
+			case URL_URL: frame.status->urls.back().first.assign(str, length); break;
+			case URL_EXPANDED_URL: frame.status->urls.back().second.assign(str, length); break;
+			default: break;
+		}
+	}
+
+	void start(bool object) {
+		Frame frame;
+		frame.context = IGNORED;
+		frame.user = NULL;
+		frame.status = NULL;
+		frame.object = object;
+		frame.expectKey = object;
+
+		if (frames.empty()) {
+			frame.context = ELEMENT;
+			frame.status = &fields;
+		}
+		else {
+			Frame &parent = frames.back();
+			parent.expectKey = parent.object;
+			switch (parent.context == URLS ? URLS_ARRAY : field) {
+				case USER_OBJECT:
+					frame.context = USER;
+					frame.user = parent.context == RETWEET ? &fields.rt_user : &fields.user;
+					break;
+				case SENDER_OBJECT: frame.context = USER; frame.user = &fields.sender; break;
+				case RECIPIENT_OBJECT: frame.context = USER; frame.user = &fields.recipient; break;
+				case RETWEETED_STATUS_OBJECT: frame.context = RETWEET; fields.has_retweet = true; break;
+				case STATUS_OBJECT:
+					if (object) {
+						frame.context = EMBEDDED;
+						frame.status = &parent.user->status;
+						parent.user->has_status = true;
+					}
+					break;
+				case ENTITIES_OBJECT: frame.context = ENTITIES; frame.status = parent.status; break;
+				case URLS_ARRAY:
+					frame.status = parent.status;
+					if (parent.context == URLS) {
+						frame.context = URL;
+						if (object) {
+							frame.status->urls.push_back(std::make_pair(std::string(), std::string()));
+						}
+					}
+					else {
+						frame.context = URLS;
+					}
+					break;
+				default: break;
+			}
+			if ((frame.context == USER || frame.context == RETWEET || frame.context == EMBEDDED || frame.context == ENTITIES || frame.context == URL) != object) {
+				frame.context = IGNORED;
+			}
+		}
+
+		field = NONE;
+		frames.push_back(frame);
+	}
+
+	void end() {
+		frames.pop_back();
+		field = NONE;
+	}
+
+	public:
+	ElementHandler(ElementFields &_fields) : field(NONE), fields(_fields) {
+		frames.reserve(8);
+	}
+
+	void Null() { value("", 0, 0, false, false); }
+	void Bool(bool b) { value(b ? "true" : "false", b ? 4 : 5, 0, false, b); }
+	void Int(int i) { value(NULL, 0, i < 0 ? -(int64_t) i : i, i < 0, false); }
+	void Uint(unsigned i) { value(NULL, 0, i, false, false); }
+	void Int64(int64_t i) { value(NULL, 0, i < 0 ? -i : i, i < 0, false); }
+	void Uint64(uint64_t i) { value(NULL, 0, i, false, false); }
+	void Double(double) { value("", 0, 0, false, false); }
+
+	void String(const char *str, rapidjson::SizeType length, bool) {
+		Frame &frame = frames.back();
+		if (frame.expectKey) {
+			frame.expectKey = false;
+			field = frame.context == IGNORED ? NONE : lookup(frame.context, str, length);
+			return;
+		}
+		value(str, length, 0, false, false);
+	}
+
+	void StartObject() { start(true); }
+	void EndObject(rapidjson::SizeType) { end(); }
+	void StartArray() { start(false); }
+	void EndArray(rapidjson::SizeType) { end(); }
+};
+
+// Characters which have to be checked when looking for the end of element.
+enum {STRING_SPECIAL = 1, STRUCTURAL = 2};
+static unsigned char charClass[256];
+
+static bool initCharClass() {
+	charClass[(unsigned char) '"'] = STRING_SPECIAL | STRUCTURAL;
+	charClass[(unsigned char) '\\'] = STRING_SPECIAL;
+	charClass[(unsigned char) '{'] = STRUCTURAL;
+	charClass[(unsigned char) '}'] = STRUCTURAL;
+	charClass[(unsigned char) '['] = STRUCTURAL;
+	charClass[(unsigned char) ']'] = STRUCTURAL;
+	return true;
+}
+
+static bool charClassInitialized = initCharClass();
+
+TwitterStreamParser::TwitterStreamParser(Type _type)
+{
+	type = _type;
+	scanned = 0;
+	elementBegin = std::string::npos;
+	depth = 0;
+	inString = false;
+	escaped = false;
+	isArray = false;
+	done = false;
+	failed = false;
+}
+
+size_t TwitterStreamParser::feedCallback(const char *data, size_t size, void *parser)
+{
+	static_cast<TwitterStreamParser *>(parser)->feed(data, size);
+	return size;
+}
+
+void TwitterStreamParser::feed(const char *data, size_t size)
+{
+	if (done || failed) {
+		return;
+	}
+
+	if (depth == 0 && !isArray) {
+		// Skip the whitespace before the root element.
+		while (size && response.empty() && isspace(*data)) {
+			data++;
+			size--;
+		}
+		if (size == 0) {
+			return;
+		}
+		if (response.empty() && *data == '[') {
+			isArray = true;
+		}
+		else {
+			// Not a timeline, keep it for getErrorMessage().
+			response.append(data, size);
+			return;
+		}
+	}
+
+	buffer.append(data, size);
+
+	const char *p = buffer.data() + scanned;
+	const char *end = buffer.data() + buffer.size();
+	while (p < end) {
+		if (escaped) {
+			escaped = false;
+			p++;
+			continue;
+		}
+
+		if (inString) {
+			// Strings are the biggest part of the response, skip them quickly.
+			while (p < end && !(charClass[(unsigned char) *p] & STRING_SPECIAL)) p++;
+			if (p == end) break;
+			if (*p == '\\') escaped = true;
+			else inString = false;
+			p++;
+			continue;
+		}
+
+		while (p < end && !(charClass[(unsigned char) *p] & STRUCTURAL)) p++;
+		if (p == end) break;
+
+		switch (*p) {
+			case '"':
+				inString = true;
+				break;
+			case '{':
+			case '[':
+				if (depth == 1) elementBegin = p - buffer.data();
+				depth++;
+				break;
+			case '}':
+			case ']':
+				depth--;
+				if (depth == 1 && elementBegin != std::string::npos) {
+					parseElement(elementBegin, p - buffer.data() + 1);
+					elementBegin = std::string::npos;
+				}
+				else if (depth == 0) {
+					done = true;
+				}
+				break;
+			default:
+				break;
+		}
+		p++;
+		if (done) break;
+	}
+	scanned = p - buffer.data();
+
+	// Drop everything what has been parsed already.
+	std::string::size_type keep = elementBegin == std::string::npos ? scanned : elementBegin;
+	buffer.erase(0, keep);
+	scanned -= keep;
+	if (elementBegin != std::string::npos) elementBegin = 0;
+}
+
+void TwitterStreamParser::parseElement(size_t begin, size_t end)
+{
+	if (buffer[begin] != '{') {
+		return;
+	}
+
+	// In-situ parsing needs zero terminated string, element is parsed
+	// only once, so it doesn't matter that it's modified.
+	char saved = end < buffer.size() ? buffer[end] : 0;
+	if (end < buffer.size()) buffer[end] = 0;
+
+	ElementFields fields;
+	ElementHandler handler(fields);
+	rapidjson::InsituStringStream stream(&buffer[begin]);
+	bool ok = reader.Parse<rapidjson::kParseInsituFlag>(stream, handler);
+
+	if (end < buffer.size()) buffer[end] = saved;
+
+	if (!ok) {
+		LOG4CXX_ERROR(logger, "Error while parsing JSON: " << reader.GetParseError())
+		failed = true;
+		return;
+	}
+
+	std::vector<UrlEntity> urls = toUrlEntities(fields.urls);
+
+	if (type == DIRECT_MESSAGES) {
+		directMessages.push_back(DirectMessage());
+		DirectMessage &DM = directMessages.back();
+		DM.setCreationTime(toIsoTime(fields.created_at));
+		DM.setID(fields.id);
+		DM.setMessage(unescape(fields.text, urls));
+		DM.setSenderID(fields.sender_id);
+		DM.setRecipientID(fields.recipient_id);
+		DM.setSenderScreenName(fields.sender_screen_name);
+		DM.setRecipientScreenName(fields.recipient_screen_name);
+		DM.setSenderData(fields.sender.toUser());
+		DM.setRecipientData(fields.recipient.toUser());
+		return;
+	}
+
+	statuses.push_back(Status());
+	Status &status = statuses.back();
+	status.setCreationTime(toIsoTime(fields.created_at));
+	status.setID(fields.id);
+	status.setTweet(unescape(fields.text, urls));
+	status.setTruncated(fields.truncated);
+	status.setReplyToStatusID(fields.in_reply_to_status_id);
+	status.setReplyToUserID(fields.in_reply_to_user_id);
+	status.setReplyToScreenName(fields.in_reply_to_screen_name);
+	status.setUserData(fields.user.toUser());
+	status.setRetweetCount(fields.retweet_count);
+	status.setFavorited(fields.favorited);
+	status.setRetweeted(fields.retweeted);
+	if (fields.has_retweet) {
+		status.setTweet(unescape(fields.rt_text + " (RT by @" + tolowercase(fields.user.screen_name) + ")", urls));
+		status.setRetweetID(fields.rt_id);
+		status.setCreationTime(toIsoTime(fields.rt_created_at));
+		status.setUserData(fields.rt_user.toUser());
+	}
+}
+
+bool TwitterStreamParser::finish()
+{
+	if (isArray && !done && !failed) {
+		LOG4CXX_ERROR(logger, "Incomplete JSON response")
+	}
+	buffer.clear();
+	return isArray && done && !failed;
+}
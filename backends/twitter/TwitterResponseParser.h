@@ -38,6 +38,7 @@ namespace TwitterReponseTypes
 	const std::string sender = "sender";
    	const std::string recipient = "recipient";
 	const std::string profile_image_url = "profile_image_url";
+	const std::string entities = "entities";
 };
 
 //Class representing an embedded status object within other objects such as the User object.
@@ -222,11 +223,52 @@ public:
 		url = _url;
 		expanded_url = _expanded;
 	}
-	std::string getUrl() {return url;}
-	std::string getExpandedUrl() {return expanded_url;}
+	const std::string &getUrl() const {return url;}
+	const std::string &getExpandedUrl() const {return expanded_url;}
 	
 };
 
+//Parses timeline or direct messages while they are being received.
+//Every element of the top-level array is parsed by SAX parser as soon as
+//it's complete, so neither the whole response nor the DOM is kept in memory.
+class TwitterStreamParser
+{
+	public:
+	enum Type {STATUSES, DIRECT_MESSAGES};
+
+	TwitterStreamParser(Type _type);
+
+	void feed(const char *data, size_t size);
+	static size_t feedCallback(const char *data, size_t size, void *parser);
+
+	//Returns false if the response isn't complete array
+	bool finish();
+
+	std::vector<Status> &getStatuses() {return statuses;}
+	std::vector<DirectMessage> &getDirectMessages() {return directMessages;}
+
+	//Response which is not an array (usually error object)
+	std::string &getResponse() {return response;}
+
+	private:
+	void parseElement(size_t begin, size_t end);
+
+	Type type;
+	std::string buffer;
+	std::string response;
+	size_t scanned;
+	size_t elementBegin;
+	int depth;
+	bool inString;
+	bool escaped;
+	bool isArray;
+	bool done;
+	bool failed;
+	std::vector<Status> statuses;
+	std::vector<DirectMessage> directMessages;
+	rapidjson::Reader reader;
+};
+
 std::vector<Status> getTimeline(std::string &xml);
 std::vector<DirectMessage> getDirectMessages(std::string &xml);
 std::vector<std::string> getIDs(std::string &xml);
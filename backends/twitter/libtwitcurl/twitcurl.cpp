@@ -1,5 +1,7 @@
 #define NOMINMAX
 #include <memory.h>
+#include <cstdlib>
+#include <cctype>
 #include "twitcurlurls.h"
 #include "twitcurl.h"
 #include "urlencode.h"
@@ -16,9 +18,14 @@
 *--*/
 twitCurl::twitCurl():
 m_curlHandle( NULL ),
+m_dataCallback( NULL ),
+m_dataCallbackUserData( NULL ),
+m_transport( NULL ),
 m_curlProxyParamsSet( false ),
 m_curlLoginParamsSet( false ),
 m_curlCallbackParamsSet( false ),
+m_rateLimitRemaining( -1 ),
+m_rateLimitReset( -1 ),
 m_eApiFormatType( twitCurlTypes::eTwitCurlApiFormatJson ),
 m_eProtocolType( twitCurlTypes::eTwitCurlProtocolHttps )
 {
@@ -90,6 +97,9 @@ twitCurl* twitCurl::clone()
     /* OAuth data */
     cloneObj->m_oAuth = m_oAuth.clone();
 
+    /* Transport */
+    cloneObj->setTransport(m_transport);
+
     return cloneObj;
 }
 
@@ -1513,6 +1523,86 @@ void twitCurl::getLastCurlError( std::string& outErrResp )
     outErrResp.assign( m_errorBuffer );
 }
 
+/*++
+* @method: twitCurl::getLastRateLimit
+*
+* @description: method to get rate limit status sent by twitter in
+*               x-rate-limit-* headers of the most recent http request.
+*
+* @input: remaining - number of requests left in the current window,
+*         reset - unix time when the window is reset
+*
+* @output: true if the headers were present in the response
+*
+*--*/
+bool twitCurl::getLastRateLimit( int& remaining, long& reset )
+{
+    remaining = m_rateLimitRemaining;
+    reset = m_rateLimitReset;
+    return ( m_rateLimitRemaining >= 0 && m_rateLimitReset >= 0 );
+}
+
+/*++
+* @method: twitCurl::setDataCallback
+*
+* @description: method to process http responses while they are being
+*               received. when the callback is set, responses are passed
+*               to it and getLastWebResponse returns empty string.
+*
+* @input: callback - function called with every piece of the response,
+*                    NULL to store responses again,
+*         userdata - passed to callback
+*
+* @output: none
+*
+*--*/
+void twitCurl::setDataCallback( twitCurlDataCallback callback, void* userdata )
+{
+    m_dataCallback = callback;
+    m_dataCallbackUserData = userdata;
+}
+
+/*++
+* @method: twitCurl::setTransport
+*
+* @description: method to perform http requests using the given transport
+*               instead of curl_easy_perform. transport must be valid as
+*               long as this object and its clones are used.
+*
+* @input: transport - transport to use, NULL to use curl_easy_perform
+*
+* @output: none
+*
+*--*/
+void twitCurl::setTransport( twitCurlTransport* transport )
+{
+    m_transport = transport;
+    if( m_transport && m_curlHandle )
+    {
+        m_transport->setup( m_curlHandle );
+    }
+}
+
+/*++
+* @method: twitCurl::performRequest
+*
+* @description: method to send prepared http request using the transport
+*               if it's set, otherwise using curl_easy_perform
+*
+* @input: none
+*
+* @output: cURL result code
+*
+*--*/
+CURLcode twitCurl::performRequest()
+{
+    if( m_transport )
+    {
+        return m_transport->perform( m_curlHandle );
+    }
+    return curl_easy_perform( m_curlHandle );
+}
+
 /*++
 * @method: twitCurl::curlCallback
 *
@@ -1537,6 +1627,69 @@ int twitCurl::curlCallback( char* data, size_t size, size_t nmemb, twitCurl* pTw
     return 0;
 }
 
+/*++
+* @method: twitCurl::curlHeaderCallback
+*
+* @description: static method to get http response headers back from cURL.
+*               this is an internal method, users of twitcurl need not
+*               use this.
+*
+* @input: as per cURL convention.
+*
+* @output: size of the header
+*
+* @remarks: internal method
+*
+*--*/
+size_t twitCurl::curlHeaderCallback( char* data, size_t size, size_t nmemb, twitCurl* pTwitCurlObj )
+{
+    if( pTwitCurlObj && data )
+    {
+        pTwitCurlObj->saveLastHeader( data, size*nmemb );
+    }
+    return size*nmemb;
+}
+
+/*++
+* @method: twitCurl::saveLastHeader
+*
+* @description: method to remember rate limit headers. this is an internal
+*               method and twitcurl users need not use this.
+*
+* @input: data - header line from cURL,
+*         size - size of the header line
+*
+* @output: none
+*
+* @remarks: internal method
+*
+*--*/
+void twitCurl::saveLastHeader( const char* data, size_t size )
+{
+    std::string header( data, size );
+    std::string::size_type colon = header.find( ':' );
+    if( std::string::npos == colon )
+    {
+        return;
+    }
+
+    /* Header names are case insensitive */
+    std::string name = header.substr( 0, colon );
+    for( std::string::size_type i = 0; i < name.size(); i++ )
+    {
+        name[i] = tolower( name[i] );
+    }
+
+    if( name == "x-rate-limit-remaining" )
+    {
+        m_rateLimitRemaining = atoi( header.c_str() + colon + 1 );
+    }
+    else if( name == "x-rate-limit-reset" )
+    {
+        m_rateLimitReset = atol( header.c_str() + colon + 1 );
+    }
+}
+
 /*++
 * @method: twitCurl::saveLastWebResponse
 *
@@ -1553,6 +1706,10 @@ int twitCurl::curlCallback( char* data, size_t size, size_t nmemb, twitCurl* pTw
 *--*/
 int twitCurl::saveLastWebResponse(  char*& data, size_t size )
 {
+    if( data && size && m_dataCallback )
+    {
+        return (int)m_dataCallback( data, size, m_dataCallbackUserData );
+    }
     if( data && size )
     {
         /* Append data in our internal buffer */
@@ -1578,6 +1735,8 @@ int twitCurl::saveLastWebResponse(  char*& data, size_t size )
 void twitCurl::clearCurlCallbackBuffers()
 {
     m_callbackData = "";
+    m_rateLimitRemaining = -1;
+    m_rateLimitReset = -1;
     memset( m_errorBuffer, 0, twitCurlDefaults::TWITCURL_DEFAULT_BUFFSIZE );
 }
 
@@ -1654,6 +1813,10 @@ void twitCurl::prepareCurlCallback()
     curl_easy_setopt( m_curlHandle, CURLOPT_WRITEFUNCTION, curlCallback );
     curl_easy_setopt( m_curlHandle, CURLOPT_WRITEDATA, this );
 
+    /* Set callback function to get rate limit headers */
+    curl_easy_setopt( m_curlHandle, CURLOPT_HEADERFUNCTION, curlHeaderCallback );
+    curl_easy_setopt( m_curlHandle, CURLOPT_HEADERDATA, this );
+
     /* Set the flag to true indicating that callback info is set in cURL */
     m_curlCallbackParamsSet = true;
 }
@@ -1774,7 +1937,7 @@ bool twitCurl::performGet( const std::string& getUrl )
     curl_easy_setopt( m_curlHandle, CURLOPT_URL, getUrl.c_str() );
 
     /* Send http request */
-    if( CURLE_OK == curl_easy_perform( m_curlHandle ) )
+    if( CURLE_OK == performRequest() )
     {
         if( pOAuthHeaderList )
         {
@@ -1831,7 +1994,7 @@ bool twitCurl::performGetInternal( const std::string& getUrl,
     }
 
     /* Send http request */
-    if( CURLE_OK == curl_easy_perform( m_curlHandle ) )
+    if( CURLE_OK == performRequest() )
     {
         if( pOAuthHeaderList )
         {
@@ -1891,7 +2054,7 @@ bool twitCurl::performDelete( const std::string& deleteUrl )
     curl_easy_setopt( m_curlHandle, CURLOPT_COPYPOSTFIELDS, dataStrDummy.c_str() );
 
     /* Send http request */
-    if( CURLE_OK == curl_easy_perform( m_curlHandle ) )
+    if( CURLE_OK == performRequest() )
     {
         if( pOAuthHeaderList )
         {
@@ -1956,7 +2119,7 @@ bool twitCurl::performPost( const std::string& postUrl, std::string dataStr )
     }
 
     /* Send http request */
-    if( CURLE_OK == curl_easy_perform( m_curlHandle ) )
+    if( CURLE_OK == performRequest() )
     {
         if( pOAuthHeaderList )
         {
@@ -2184,7 +2347,7 @@ bool twitCurl::oAuthHandlePIN( const std::string& authorizeUrl /* in */ )
     curl_easy_setopt( m_curlHandle, CURLOPT_URL, authorizeUrl.c_str() );
 
     /* Send http request */
-    if( CURLE_OK == curl_easy_perform( m_curlHandle ) )
+    if( CURLE_OK == performRequest() )
     {
         if( pOAuthHeaderList )
         {
@@ -2258,7 +2421,7 @@ bool twitCurl::oAuthHandlePIN( const std::string& authorizeUrl /* in */ )
     curl_easy_setopt( m_curlHandle, CURLOPT_COPYPOSTFIELDS, dataStr.c_str() );
 
     /* Send http request */
-    if( CURLE_OK == curl_easy_perform( m_curlHandle ) )
+    if( CURLE_OK == performRequest() )
     {
         if( pOAuthHeaderList )
         {
@@ -26,6 +26,22 @@ namespace twitCurlTypes
     } eTwitCurlProtocolType;
 };
 
+/* Callback receiving the http response while it's being downloaded */
+typedef size_t (*twitCurlDataCallback)( const char* data, size_t size, void* userdata );
+
+/* Performs http requests of twitCurl instead of curl_easy_perform */
+class twitCurlTransport
+{
+public:
+    virtual ~twitCurlTransport() {}
+
+    /* Called once for every cURL handle before it's used */
+    virtual void setup( CURL* handle ) = 0;
+
+    /* Performs the request and waits for the result */
+    virtual CURLcode perform( CURL* handle ) = 0;
+};
+
 /* twitCurl class */
 class twitCurl
 {
@@ -121,9 +137,13 @@ public:
     bool isCurlInit();
     void getLastWebResponse( std::string& outWebResp /* out */ );
     void getLastCurlError( std::string& outErrResp /* out */);
+    bool getLastRateLimit( int& remaining /* out */, long& reset /* out */ );
+    void setDataCallback( twitCurlDataCallback callback /* in */, void* userdata /* in */ );
+    void setTransport( twitCurlTransport* transport /* in */ );
 
     /* Internal cURL related methods */
     int saveLastWebResponse( char*& data, size_t size );
+    void saveLastHeader( const char* data, size_t size );
 
     /* cURL proxy APIs */
     std::string& getProxyServerIp();
@@ -143,6 +163,13 @@ private:
     CURL* m_curlHandle;
     char* m_errorBuffer;
     std::string m_callbackData;
+    twitCurlDataCallback m_dataCallback;
+    void* m_dataCallbackUserData;
+    twitCurlTransport* m_transport;
+
+    /* Rate limit of the most recent request, -1 if unknown */
+    int m_rateLimitRemaining;
+    long m_rateLimitReset;
 
     /* cURL flags */
     bool m_curlProxyParamsSet;
@@ -172,6 +199,7 @@ private:
     void prepareCurlCallback();
     void prepareCurlUserPass();
     void prepareStandardParams();
+    CURLcode performRequest();
     bool performGet( const std::string& getUrl );
     bool performGetInternal( const std::string& getUrl,
                              const std::string& oAuthHttpHeader );
@@ -180,6 +208,7 @@ private:
 
     /* Internal cURL related methods */
     static int curlCallback( char* data, size_t size, size_t nmemb, twitCurl* pTwitCurlObj );
+    static size_t curlHeaderCallback( char* data, size_t size, size_t nmemb, twitCurl* pTwitCurlObj );
 };
 
 
@@ -0,0 +1,222 @@
+#include "HTTPEngine.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// HTTP server listening on localhost. Every connection gets the same
+// response after the configured delay and is closed.
+class StubServer {
+	public:
+		StubServer(int delay = 0) : m_delay(delay), m_stopped(false), m_connections(0) {
+			m_socket = socket(AF_INET, SOCK_STREAM, 0);
+			int yes = 1;
+			setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+			struct sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			addr.sin_port = 0;
+			bind(m_socket, (struct sockaddr *) &addr, sizeof(addr));
+			listen(m_socket, 64);
+
+			socklen_t len = sizeof(addr);
+			getsockname(m_socket, (struct sockaddr *) &addr, &len);
+			m_port = ntohs(addr.sin_port);
+
+			m_thread = new boost::thread(boost::bind(&StubServer::run, this));
+		}
+
+		~StubServer() {
+			m_stopped = true;
+			// Wake up accept().
+			shutdown(m_socket, SHUT_RDWR);
+			close(m_socket);
+			m_thread->join();
+			delete m_thread;
+		}
+
+		std::string getURL() {
+			return "http://127.0.0.1:" + boost::lexical_cast<std::string>(m_port) + "/";
+		}
+
+		int getConnectionCount() {
+			return m_connections;
+		}
+
+	private:
+		void run() {
+			while (!m_stopped) {
+				int client = accept(m_socket, NULL, NULL);
+				if (client < 0) {
+					return;
+				}
+				m_connections++;
+				boost::thread(boost::bind(&StubServer::handleClient, client, m_delay)).detach();
+			}
+		}
+
+		static void handleClient(int client, int delay) {
+			std::string request;
+			char buffer[1024];
+			while (request.find("\r\n\r\n") == std::string::npos) {
+				ssize_t size = recv(client, buffer, sizeof(buffer), 0);
+				if (size <= 0) {
+					close(client);
+					return;
+				}
+				request.append(buffer, size);
+			}
+
+			if (delay) {
+				boost::this_thread::sleep(boost::posix_time::milliseconds(delay));
+			}
+
+			std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nConnection: close\r\n\r\nhello";
+			send(client, response.c_str(), response.size(), 0);
+			close(client);
+		}
+
+		int m_socket;
+		int m_port;
+		int m_delay;
+		volatile bool m_stopped;
+		volatile int m_connections;
+		boost::thread *m_thread;
+};
+
+static size_t writeData(char *data, size_t size, size_t nmemb, void *userp)
+{
+	static_cast<std::string *>(userp)->append(data, size * nmemb);
+	return size * nmemb;
+}
+
+class HTTPEngineTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(HTTPEngineTest);
+	CPPUNIT_TEST(performBlocking);
+	CPPUNIT_TEST(performAsync);
+	CPPUNIT_TEST(performSameHandleTwice);
+	CPPUNIT_TEST(connectionRefused);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		boost::mutex lock;
+		std::vector<CURLcode> results;
+
+		void setUp (void) {
+			results.clear();
+		}
+
+		void tearDown (void) {
+		}
+
+	CURL *createHandle(HTTPEngine &engine, const std::string &url, std::string *data) {
+		CURL *handle = curl_easy_init();
+		engine.setup(handle);
+		curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeData);
+		curl_easy_setopt(handle, CURLOPT_WRITEDATA, data);
+		curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1);
+		return handle;
+	}
+
+	void handleFinished(CURLcode code) {
+		boost::mutex::scoped_lock l(lock);
+		results.push_back(code);
+	}
+
+	void waitForResults(size_t count) {
+		for (int i = 0; i < 5000; i++) {
+			{
+				boost::mutex::scoped_lock l(lock);
+				if (results.size() >= count) {
+					return;
+				}
+			}
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+		}
+	}
+
+	void performBlocking() {
+		StubServer server;
+		HTTPEngine engine;
+		std::string data;
+
+		CURL *handle = createHandle(engine, server.getURL(), &data);
+		CPPUNIT_ASSERT_EQUAL(CURLE_OK, engine.perform(handle));
+		CPPUNIT_ASSERT_EQUAL(std::string("hello"), data);
+		CPPUNIT_ASSERT_EQUAL(0, engine.getRequestCount());
+		curl_easy_cleanup(handle);
+	}
+
+	void performAsync() {
+		StubServer server;
+		HTTPEngine engine;
+		std::vector<std::string> data(20);
+		std::vector<CURL *> handles;
+
+		for (int i = 0; i < 20; i++) {
+			handles.push_back(createHandle(engine, server.getURL(), &data[i]));
+			engine.perform(handles[i], boost::bind(&HTTPEngineTest::handleFinished, this, _1));
+		}
+
+		waitForResults(20);
+		CPPUNIT_ASSERT_EQUAL(20, (int) results.size());
+		for (int i = 0; i < 20; i++) {
+			CPPUNIT_ASSERT_EQUAL(CURLE_OK, results[i]);
+			CPPUNIT_ASSERT_EQUAL(std::string("hello"), data[i]);
+			curl_easy_cleanup(handles[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL(0, engine.getRequestCount());
+		CPPUNIT_ASSERT_EQUAL(20, server.getConnectionCount());
+	}
+
+	void performSameHandleTwice() {
+		// The response is delayed, so the first request is still running
+		// when the handle is passed again.
+		StubServer server(200);
+		HTTPEngine engine;
+		std::string data;
+
+		CURL *handle = createHandle(engine, server.getURL(), &data);
+		engine.perform(handle, boost::bind(&HTTPEngineTest::handleFinished, this, _1));
+		engine.perform(handle, boost::bind(&HTTPEngineTest::handleFinished, this, _1));
+
+		waitForResults(2);
+		CPPUNIT_ASSERT_EQUAL(2, (int) results.size());
+		CPPUNIT_ASSERT_EQUAL(CURLE_FAILED_INIT, results[0]);
+		CPPUNIT_ASSERT_EQUAL(CURLE_OK, results[1]);
+		CPPUNIT_ASSERT_EQUAL(std::string("hello"), data);
+		CPPUNIT_ASSERT_EQUAL(1, server.getConnectionCount());
+		CPPUNIT_ASSERT_EQUAL(0, engine.getRequestCount());
+		curl_easy_cleanup(handle);
+	}
+
+	void connectionRefused() {
+		std::string url;
+		{
+			StubServer server;
+			url = server.getURL();
+		}
+
+		HTTPEngine engine;
+		std::string data;
+		CURL *handle = createHandle(engine, url, &data);
+		CPPUNIT_ASSERT_EQUAL(CURLE_COULDNT_CONNECT, engine.perform(handle));
+		CPPUNIT_ASSERT(data.empty());
+		curl_easy_cleanup(handle);
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (HTTPEngineTest);
@@ -0,0 +1,185 @@
+#include "TwitterResponseParser.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class ResponseParserTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(ResponseParserTest);
+	CPPUNIT_TEST(streamTimeline);
+	CPPUNIT_TEST(streamTimelineChunks);
+	CPPUNIT_TEST(streamDirectMessages);
+	CPPUNIT_TEST(creationTime);
+	CPPUNIT_TEST(unescape);
+	CPPUNIT_TEST(errorResponse);
+	CPPUNIT_TEST(incompleteResponse);
+	CPPUNIT_TEST(userLastStatus);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		std::string timeline;
+
+		void setUp (void) {
+			std::ifstream f(TWITTER_TEST_DATA "/timeline.json");
+			std::stringstream ss;
+			ss << f.rdbuf();
+			timeline = ss.str();
+		}
+
+		void tearDown (void) {
+		}
+
+		std::vector<Status> parse(const std::string &json, size_t chunk) {
+			TwitterStreamParser parser(TwitterStreamParser::STATUSES);
+			for (size_t i = 0; i < json.size(); i += chunk) {
+				parser.feed(json.c_str() + i, std::min(chunk, json.size() - i));
+			}
+			CPPUNIT_ASSERT(parser.finish());
+			return parser.getStatuses();
+		}
+
+		void compare(std::vector<Status> &expected, std::vector<Status> &statuses) {
+			CPPUNIT_ASSERT_EQUAL(expected.size(), statuses.size());
+			for (size_t i = 0; i < expected.size(); i++) {
+				CPPUNIT_ASSERT_EQUAL(expected[i].getID(), statuses[i].getID());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getRetweetID(), statuses[i].getRetweetID());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getTweet(), statuses[i].getTweet());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getCreationTime(), statuses[i].getCreationTime());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getReplyToUserID(), statuses[i].getReplyToUserID());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getReplyToScreenName(), statuses[i].getReplyToScreenName());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getRetweetCount(), statuses[i].getRetweetCount());
+				CPPUNIT_ASSERT_EQUAL(expected[i].isRetweeted(), statuses[i].isRetweeted());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getUserData().getUserID(), statuses[i].getUserData().getUserID());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getUserData().getScreenName(), statuses[i].getUserData().getScreenName());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getUserData().getUserName(), statuses[i].getUserData().getUserName());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getUserData().getProfileImgURL(), statuses[i].getUserData().getProfileImgURL());
+				CPPUNIT_ASSERT_EQUAL(expected[i].getUserData().getNumberOfTweets(), statuses[i].getUserData().getNumberOfTweets());
+			}
+		}
+
+		void streamTimeline() {
+			CPPUNIT_ASSERT(!timeline.empty());
+			std::vector<Status> expected = getTimeline(timeline);
+			CPPUNIT_ASSERT_EQUAL(20, (int) expected.size());
+
+			std::vector<Status> statuses = parse(timeline, timeline.size());
+			compare(expected, statuses);
+		}
+
+		void streamTimelineChunks() {
+			std::vector<Status> expected = getTimeline(timeline);
+
+			std::vector<Status> statuses = parse(timeline, 1);
+			compare(expected, statuses);
+
+			statuses = parse(timeline, 1000);
+			compare(expected, statuses);
+		}
+
+		void streamDirectMessages() {
+			std::string json = "[{\"id\":240136858829479936,\"created_at\":\"Mon Aug 27 17:21:03 +0000 2012\","
+				"\"sender\":{\"id\":14,\"name\":\"Sender\",\"screen_name\":\"SenderName\",\"profile_image_url\":\"http://a0.twimg.com/s.png\",\"statuses_count\":7,\"entities\":{\"url\":{\"urls\":[]}}},"
+				"\"sender_id\":14,\"sender_screen_name\":\"SenderName\","
+				"\"recipient\":{\"id\":15,\"name\":\"Recipient\",\"screen_name\":\"recipient\",\"profile_image_url\":\"http://a0.twimg.com/r.png\",\"statuses_count\":9},"
+				"\"recipient_id\":15,\"recipient_screen_name\":\"recipient\","
+				"\"text\":\"see http://t.co/x &amp; reply\",\"entities\":{\"hashtags\":[],\"urls\":[{\"url\":\"http://t.co/x\",\"expanded_url\":\"http://spectrum.im\",\"indices\":[4,16]}]}}]";
+
+			std::vector<DirectMessage> expected = getDirectMessages(json);
+			TwitterStreamParser parser(TwitterStreamParser::DIRECT_MESSAGES);
+			parser.feed(json.c_str(), json.size());
+			CPPUNIT_ASSERT(parser.finish());
+			std::vector<DirectMessage> &messages = parser.getDirectMessages();
+
+			CPPUNIT_ASSERT_EQUAL(1, (int) messages.size());
+			CPPUNIT_ASSERT_EQUAL(expected[0].getID(), messages[0].getID());
+			CPPUNIT_ASSERT_EQUAL(std::string("240136858829479936"), messages[0].getID());
+			CPPUNIT_ASSERT_EQUAL(std::string("see http://spectrum.im & reply"), messages[0].getMessage());
+			CPPUNIT_ASSERT_EQUAL(expected[0].getMessage(), messages[0].getMessage());
+			CPPUNIT_ASSERT_EQUAL(std::string("20120827T172103"), messages[0].getCreationTime());
+			CPPUNIT_ASSERT_EQUAL(std::string("14"), messages[0].getSenderID());
+			CPPUNIT_ASSERT_EQUAL(std::string("SenderName"), messages[0].getSenderScreenName());
+			CPPUNIT_ASSERT_EQUAL(std::string("sendername"), messages[0].getSenderData().getScreenName());
+			CPPUNIT_ASSERT_EQUAL(expected[0].getSenderData().getScreenName(), messages[0].getSenderData().getScreenName());
+			CPPUNIT_ASSERT_EQUAL(std::string("recipient"), messages[0].getRecipientData().getScreenName());
+		}
+
+		void creationTime() {
+			std::string json = "[{\"created_at\":\"Wed Aug 07 03:08:45 +0000 2013\",\"id\":1,\"text\":\"\",\"user\":{\"id\":2,\"screen_name\":\"a\"}},"
+				"{\"created_at\":\"Thu Dec 31 23:59:59 +0000 2009\",\"id\":3,\"text\":\"\"},"
+				"{\"created_at\":\"invalid\",\"id\":4,\"text\":\"\"}]";
+			std::vector<Status> statuses = parse(json, json.size());
+			CPPUNIT_ASSERT_EQUAL(3, (int) statuses.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("20130807T030845"), statuses[0].getCreationTime());
+			CPPUNIT_ASSERT_EQUAL(std::string("20091231T235959"), statuses[1].getCreationTime());
+			CPPUNIT_ASSERT_EQUAL(std::string("not-a-date-time"), statuses[2].getCreationTime());
+		}
+
+		void unescape() {
+			std::string json = "[{\"created_at\":\"\",\"id\":1,\"text\":\"&lt;b&gt; &quot;q&quot; &apos;a&apos; &amp; &unknown; http://t.co/1 http://t.co/12\","
+				"\"entities\":{\"urls\":[{\"url\":\"http://t.co/12\",\"expanded_url\":\"http://example.com/12\"},{\"url\":\"http://t.co/1\",\"expanded_url\":\"http://example.com/1\"}]}}]";
+			std::vector<Status> statuses = parse(json, json.size());
+			CPPUNIT_ASSERT_EQUAL(1, (int) statuses.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("<b> \"q\" 'a' & &unknown; http://example.com/1 http://example.com/12"), statuses[0].getTweet());
+		}
+
+		void errorResponse() {
+			std::string json = "{\"errors\":[{\"message\":\"Rate limit exceeded\",\"code\":88}]}";
+			TwitterStreamParser parser(TwitterStreamParser::STATUSES);
+			parser.feed(json.c_str(), 10);
+			parser.feed(json.c_str() + 10, json.size() - 10);
+			CPPUNIT_ASSERT(!parser.finish());
+			CPPUNIT_ASSERT(parser.getStatuses().empty());
+			CPPUNIT_ASSERT_EQUAL(json, parser.getResponse());
+
+			Error error = getErrorMessage(parser.getResponse());
+			CPPUNIT_ASSERT_EQUAL(std::string("88"), error.getCode());
+			CPPUNIT_ASSERT_EQUAL(std::string("Rate limit exceeded"), error.getMessage());
+		}
+
+		void incompleteResponse() {
+			TwitterStreamParser parser(TwitterStreamParser::STATUSES);
+			parser.feed(timeline.c_str(), timeline.size() / 2);
+			CPPUNIT_ASSERT(!parser.finish());
+			CPPUNIT_ASSERT(parser.getStatuses().size() < 20);
+		}
+
+		void userLastStatus() {
+			std::string json = "[{\"id\":240136858829479936,\"created_at\":\"Mon Aug 27 17:21:03 +0000 2012\",\"text\":\"hi\","
+				"\"sender_id\":14,\"recipient_id\":15,\"sender_screen_name\":\"SenderName\",\"recipient_screen_name\":\"recipient\","
+				"\"sender\":{\"id\":14,\"screen_name\":\"SenderName\",\"name\":\"Sender\",\"profile_image_url\":\"http://a0.twimg.com/s.png\","
+				"\"statuses_count\":7,\"status\":{\"created_at\":\"Wed Aug 07 03:08:45 +0000 2013\",\"id\":5,"
+				"\"text\":\"last &amp; http://t.co/x\",\"truncated\":false,\"in_reply_to_status_id\":null,\"in_reply_to_user_id\":null,"
+				"\"in_reply_to_screen_name\":null,\"retweet_count\":3,\"favorited\":true,\"retweeted\":false,"
+				"\"entities\":{\"urls\":[{\"url\":\"http://t.co/x\",\"expanded_url\":\"http://spectrum.im\"}]}}},"
+				"\"recipient\":{\"id\":15,\"screen_name\":\"recipient\",\"name\":\"Recipient\",\"profile_image_url\":\"http://a0.twimg.com/r.png\","
+				"\"statuses_count\":0}}]";
+
+			std::vector<DirectMessage> expected = getDirectMessages(json);
+			TwitterStreamParser parser(TwitterStreamParser::DIRECT_MESSAGES);
+			parser.feed(json.c_str(), json.size());
+			CPPUNIT_ASSERT(parser.finish());
+			std::vector<DirectMessage> &messages = parser.getDirectMessages();
+			CPPUNIT_ASSERT_EQUAL(1, (int) messages.size());
+
+			EmbeddedStatus status = messages[0].getSenderData().getLastStatus();
+			EmbeddedStatus expectedStatus = expected[0].getSenderData().getLastStatus();
+			CPPUNIT_ASSERT_EQUAL(std::string("5"), status.getID());
+			CPPUNIT_ASSERT_EQUAL(std::string("last & http://spectrum.im"), status.getTweet());
+			CPPUNIT_ASSERT_EQUAL(std::string("20130807T030845"), status.getCreationTime());
+			CPPUNIT_ASSERT_EQUAL(3, (int) status.getRetweetCount());
+			CPPUNIT_ASSERT(status.isFavorited());
+			CPPUNIT_ASSERT_EQUAL(expectedStatus.getID(), status.getID());
+			CPPUNIT_ASSERT_EQUAL(expectedStatus.getTweet(), status.getTweet());
+			CPPUNIT_ASSERT_EQUAL(expectedStatus.getCreationTime(), status.getCreationTime());
+
+			// Message's own entities are not mixed with the embedded ones.
+			CPPUNIT_ASSERT_EQUAL(std::string("hi"), messages[0].getMessage());
+			CPPUNIT_ASSERT_EQUAL(std::string(""), messages[0].getRecipientData().getLastStatus().getID());
+		}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (ResponseParserTest);
@@ -26,7 +26,7 @@
 
 #include "Swiften/Queries/Responder.h"
 #include "Swiften/Elements/Command.h"
-#include "Swiften/Network/Timer.h"
+#include "transport/timerwheel.h"
 
 namespace Transport {
 
@@ -62,21 +62,21 @@ class AdHocManager : public Swift::Responder<Swift::Command> {
 		/// Adds factory to create new AdHoc commands sessions of particular type.
 		void addAdHocCommand(AdHocCommandFactory *factory);
 
-		/// Remove sessions older than N seconds.
-		void removeOldSessions();
-
 
 	private:
 		virtual bool handleGetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::Command> payload);
 		virtual bool handleSetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::Command> payload);
 		
 		void handleUserCreated(User *user);
+		void scheduleSessionTimeout(const Swift::JID &from, AdHocCommand *command, int timeout);
+		void handleSessionTimeout(const Swift::JID &from, const std::string &sessionID);
+		void removeSession(const Swift::JID &from, AdHocCommand *command);
 
 		Component *m_component;
 		DiscoItemsResponder *m_discoItemsResponder;
 		std::map<std::string, AdHocCommandFactory *> m_factories;
 		SessionsMap m_sessions;
-		Swift::Timer::ref m_collectTimer;
+		std::map<AdHocCommand *, TimerWheel::ID> m_sessionTimeouts;
 		UserManager *m_userManager;
 		StorageBackend *m_storageBackend;
 };
@@ -0,0 +1,90 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+
+namespace Transport {
+
+/// Capture of the traffic between Spectrum 2 and its backends.
+
+/// Every WrapperMessage frame sent to or received from backend is appended
+/// to the capture file together with the time, direction and the number
+/// of the backend. The capture can be replayed later without any legacy
+/// network using "libtransport_benchmark --replay".
+///
+/// Capture file starts with BACKEND_CAPTURE_MAGIC. Every record then has
+/// 17 bytes long header (seconds, microseconds, direction, backend number
+/// and frame size, all in network byte order) followed by the serialized
+/// WrapperMessage without its length prefix.
+class BackendCapture {
+	public:
+		enum Direction {
+			FromBackend = 0,
+			ToBackend = 1
+		};
+
+		struct Record {
+			double time;
+			Direction direction;
+			unsigned long backend;
+			std::string frame;
+		};
+
+		/// Creates new BackendCapture.
+		/// \param path Path to capture file. It's truncated if it exists and
+		/// only its owner can read it.
+		BackendCapture(const std::string &path);
+
+		/// Destructor.
+		~BackendCapture();
+
+		/// Returns true if the capture file has been opened.
+		bool isOpen() const {
+			return m_file.is_open();
+		}
+
+		/// Appends frame to the capture.
+		/// \param backend Pointer identifying the backend. Backends are numbered in the order they appear in the capture.
+		/// \param direction Direction of the frame.
+		/// \param frame Serialized WrapperMessage without length prefix.
+		/// \param time Time in seconds.
+		void record(const void *backend, Direction direction, const std::string &frame, double time);
+
+		/// Forgets the backend, so new backend allocated at the same address gets new number.
+		void removeBackend(const void *backend);
+
+		/// Loads all records from capture file.
+		/// \param path Path to capture file.
+		/// \param records Loaded records.
+		/// \return False if the file can't be opened or it's not a capture file. Truncated last record is ignored.
+		static bool load(const std::string &path, std::vector<Record> &records);
+
+	private:
+		std::ofstream m_file;
+		std::map<const void *, unsigned long> m_backends;
+		unsigned long m_nextBackend;
+};
+
+}
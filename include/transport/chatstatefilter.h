@@ -0,0 +1,107 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+
+namespace Transport {
+
+/// Suppresses redundant chat state changes per user and buddy.
+
+/// Chat state which is the same as the last forwarded one is suppressed.
+/// When the coalescing window is set, state changes which come sooner than
+/// window seconds after the last forwarded one are delayed and only the
+/// last of them is forwarded once the window expires.
+class ChatStateFilter {
+	public:
+		/// Result of ChatStateFilter::filter.
+		typedef enum {
+			Forward,	///< forward the state now
+			Suppress,	///< state is redundant, don't forward it
+			Delay		///< state is delayed and will be returned by flush() later
+		} Result;
+
+		/// Pending state returned by flush().
+		struct State {
+			std::string user;
+			std::string buddy;
+			int state;
+		};
+
+		/// Creates new ChatStateFilter.
+		/// \param window Coalescing window in seconds. 0 disables coalescing.
+		ChatStateFilter(double window = 0);
+
+		/// Decides what to do with the new chat state.
+		/// \param user Bare JID of user.
+		/// \param buddy Legacy name of buddy.
+		/// \param state New chat state.
+		/// \param now Current time in seconds.
+		/// \param coalesce False if the state should not be delayed (for example when it's part of message).
+		/// \return Forward, Suppress or Delay.
+		Result filter(const std::string &user, const std::string &buddy, int state, double now, bool coalesce = true);
+
+		/// Returns delayed states for which the coalescing window expired.
+		/// \param now Current time in seconds.
+		/// \param states Delayed states which should be forwarded now.
+		void flush(double now, std::vector<State> &states);
+
+		/// Forgets the last state of buddy. Next state will be forwarded.
+		/// It should be called when message is exchanged, because that resets
+		/// the chat state on most networks.
+		/// \param user Bare JID of user.
+		/// \param buddy Legacy name of buddy.
+		void reset(const std::string &user, const std::string &buddy);
+
+		/// Forgets all states of the user.
+		/// \param user Bare JID of user.
+		void removeUser(const std::string &user);
+
+		/// Returns number of states which have not been forwarded.
+		/// \return Number of saved states.
+		unsigned long getSavedCount() const { return m_saved; }
+
+		/// Returns number of delayed states which will be forwarded by flush().
+		/// Delayed states which were replaced by the already forwarded state,
+		/// reset or removed are not counted.
+		/// \return Number of delayed states.
+		unsigned long getPendingCount() const { return m_pendingCount; }
+
+	private:
+		struct Entry {
+			int sent;
+			int pending;
+			double lastSent;
+		};
+
+		typedef std::map<std::string, Entry> BuddyEntries;
+
+		std::map<std::string, BuddyEntries> m_entries;
+		std::list<std::pair<std::string, std::string> > m_pending;
+		double m_window;
+		unsigned long m_saved;
+		unsigned long m_pendingCount;
+};
+
+}
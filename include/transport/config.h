@@ -27,6 +27,7 @@
 #include <boost/assign.hpp>
 #include <boost/bind.hpp>
 #include <boost/signal.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace Transport {
 
@@ -59,6 +60,34 @@ namespace Transport {
 /// Represents variable:value pairs.
 typedef boost::program_options::variables_map Variables;
 
+/// Typed copy of the config variables used in frequently called code.
+
+/// CONFIG_* macros look the variable up by its name and cast boost::any on
+/// every call. ConfigSnapshot is built once when the config is (re)loaded
+/// and replaced as a whole, so code which keeps the ConfigSnapshot::ref
+/// always sees consistent values.
+struct ConfigSnapshot {
+	typedef boost::shared_ptr<const ConfigSnapshot> ref;
+
+	ConfigSnapshot() : serverMode(false), usersPerBackend(100), reuseOldBackends(true),
+		moreResources(false), enableXHTML(true), jidEscaping(true), ftSpoolThreshold(1000000), ftSpoolLimit(100000000),
+		rawXML(false), noVCardFetch(false) {}
+
+	std::string jid;					///< service.jid
+	std::string protocol;				///< service.protocol
+	bool serverMode;					///< service.server_mode
+	int usersPerBackend;				///< service.users_per_backend
+	bool reuseOldBackends;				///< service.reuse_old_backends
+	bool moreResources;					///< service.more_resources
+	bool enableXHTML;					///< service.enable_xhtml
+	bool jidEscaping;					///< service.jid_escaping
+	std::vector<std::string> adminJIDs;	///< service.admin_jid
+	int ftSpoolThreshold;				///< service.ft_spool_threshold
+	int ftSpoolLimit;					///< service.ft_spool_limit
+	bool rawXML;						///< features.rawxml from backend config
+	bool noVCardFetch;					///< backend.no_vcard_fetch
+};
+
 /// Represents config file.
 
 /// It's used to load config file and allows others parts of libtransport to be configured
@@ -71,7 +100,7 @@ class Config {
 		typedef std::map<std::string, boost::program_options::variable_value> UnregisteredCont;
 
 		/// Constructor.
-		Config(int argc = 0, char **argv = NULL) : m_argc(argc), m_argv(argv) {}
+		Config(int argc = 0, char **argv = NULL) : m_argc(argc), m_argv(argv), m_snapshot(new ConfigSnapshot()) {}
 
 		/// Destructor
 		virtual ~Config() {}
@@ -123,6 +152,10 @@ class Config {
 		/// Returns path to config file from which data were loaded.
 		const std::string &getConfigFile() { return m_file; }
 
+		/// Returns typed snapshot of the current config.
+		/// The snapshot is replaced before onConfigReloaded and onBackendConfigUpdated are emitted.
+		ConfigSnapshot::ref getSnapshot() { return m_snapshot; }
+
 		/// This signal is emitted when config is loaded/reloaded.
 		boost::signal<void ()> onConfigReloaded;
 
@@ -132,8 +165,11 @@ class Config {
 		static Config *createFromArgs(int argc, char **argv, std::string &error, std::string &host, int &port);
 	
 	private:
+		void updateSnapshot();
+
 		int m_argc;
 		char **m_argv;
+		ConfigSnapshot::ref m_snapshot;
 		Variables m_variables;
 		Variables m_backendConfig;
 		std::map<std::string, boost::program_options::variable_value> m_unregistered;
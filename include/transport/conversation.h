@@ -45,6 +45,7 @@ class Conversation {
 		} ParticipantFlag;
 
 		typedef struct _Participant {
+			std::string nickname;
 			ParticipantFlag flag;
 			int status;
 			std::string statusMessage;
@@ -65,6 +66,11 @@ class Conversation {
 		/// \return legacy network name of this conversation.
 		const std::string &getLegacyName() { return m_legacyName; }
 
+		/// Returns key of this conversation in MessageCache.
+
+		/// \return key of this conversation in MessageCache.
+		const std::string &getCacheKey() { return m_cacheKey; }
+
 		/// Handles new message from Legacy network and forwards it to XMPP.
 
 		/// \param message Message received from legacy network.
@@ -83,6 +89,14 @@ class Conversation {
 		/// \param newname If participant was renamed, this variable contains his new name.
 		void handleParticipantChanged(const std::string &nickname, ParticipantFlag flag, int status = Swift::StatusShow::None, const std::string &statusMessage = "", const std::string &newname = "");
 
+		/// Handles list of MUC participants, typically received right after joining the room.
+
+		/// This is the same as calling handleParticipantChanged for every participant,
+		/// but presences of ordinary participants share the same MUC payload and
+		/// the XMPP user's own presence is sent as the last one.
+		/// \param participants Participants of the room.
+		void handleParticipantList(const std::list<Participant> &participants);
+
 		/// Sets XMPP user nickname in MUC rooms.
 
 		/// \param nickname XMPP user nickname in MUC rooms.
@@ -151,6 +165,8 @@ class Conversation {
 		void sendCachedMessages(const Swift::JID &to = Swift::JID());
 
 	private:
+		// Node of participants' JIDs; '@' in MUC legacy name is escaped as '%'.
+		std::string getParticipantNode();
 		Swift::Presence::ref generatePresence(const std::string &nick, int flag, int status, const std::string &statusMessage, const std::string &newname = "");
 		void cacheMessage(boost::shared_ptr<Swift::Message> &message);
 
@@ -171,7 +187,7 @@ class Conversation {
 		// It would be also great to store last 100 messages per room
 		// every time, so we can get history messages for IRC for example.
 		boost::shared_ptr<Swift::Message> m_subject;
-		std::list<boost::shared_ptr<Swift::Message> > m_cachedMessages;
+		std::string m_cacheKey;
 		std::map<std::string, Swift::Presence::ref> m_participants;
 };
 
@@ -62,6 +62,12 @@ class ConversationManager {
 
 		void sendCachedChatMessages();
 
+		/// Sends messages cached for conversations which don't exist anymore,
+		/// for example the ones spooled before restart or before the user
+		/// logged out. Groupchat messages are removed, because the user is
+		/// not in the room anymore.
+		void sendSpooledMessages();
+
 		/// Adds new Conversation to the manager.
 
 		/// \param conv Conversation.
@@ -22,28 +22,75 @@
 
 #include <string>
 #include <map>
+#include <deque>
+#include <cstdio>
+#include <boost/shared_ptr.hpp>
 
 #include "Swiften/FileTransfer/ReadBytestream.h"
 
 namespace Transport {
 
+/// ReadBytestream with the data received from backend.
+
+/// Received data are kept as a chain of chunks which are shared with the
+/// caller when possible and they are never moved in memory. When more than
+/// spoolThreshold bytes are buffered in memory, new chunks are stored in
+/// temporary file and read from there once all previous data are sent.
+/// The sender should pause while isFull() returns true.
 class MemoryReadBytestream : public Swift::ReadBytestream {
 	public:
-		MemoryReadBytestream(unsigned long size);
+		/// Creates new MemoryReadBytestream.
+		/// \param size Size of the transferred file.
+		/// \param spoolThreshold Maximum number of bytes buffered in memory
+		/// before the data are stored in temporary file. 0 disables it.
+		/// \param spoolLimit Size of temporary file at which the stream is full.
+		/// 0 means unlimited.
+		MemoryReadBytestream(unsigned long size, unsigned long spoolThreshold = 0, unsigned long spoolLimit = 0);
 		virtual ~MemoryReadBytestream();
 
+		/// Appends data to the stream.
+		/// \return Number of bytes buffered in memory.
 		unsigned long appendData(const std::string &data);
 
+		/// Appends data to the stream without copying them if they are kept in memory.
+		/// \return Number of bytes buffered in memory.
+		unsigned long appendData(const boost::shared_ptr<std::string> &data);
+
 		virtual boost::shared_ptr<std::vector<unsigned char> > read(size_t size);
 
 		void setFinished() { m_finished = true; }
 		bool isFinished() const;
 
+		/// Returns number of bytes buffered in temporary file.
+		unsigned long getSpooledSize() const { return m_spoolSize; }
+
+		/// Returns true if too much data is buffered and the sender should wait
+		/// for onDataNeeded before sending more.
+		bool isFull() const;
+
 		boost::signal<void ()> onDataNeeded;
 
 	private:
+		struct Chunk {
+			// NULL when the chunk is stored in temporary file.
+			boost::shared_ptr<std::string> data;
+			long offset;
+			size_t size;
+		};
+
+		bool spool(const std::string &data, long &offset);
+		void popChunk();
+
 		bool m_finished;
-		std::string m_data;
+		std::deque<Chunk> m_chunks;
+		// Number of bytes already read from the first chunk.
+		size_t m_offset;
+		unsigned long m_memorySize;
+		unsigned long m_spoolSize;
+		unsigned long m_spoolThreshold;
+		unsigned long m_spoolLimit;
+		FILE *m_spool;
+		long m_spoolEnd;
 		bool neededData;
 		unsigned long m_sent;
 		unsigned long m_size;
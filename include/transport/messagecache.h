@@ -0,0 +1,170 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <list>
+#include <deque>
+#include <vector>
+#include <fstream>
+#include "Swiften/Elements/Message.h"
+
+namespace Transport {
+
+/// Cache of messages which can't be delivered to XMPP user yet.
+
+/// Messages are cached per conversation. All conversations share the global
+/// memory limit. When it's exceeded, the oldest messages are moved to the
+/// append-only spool file in compact form (or dropped when there's no spool
+/// file). Messages stored in spool file are read again one by one when
+/// they're popped, so the whole cache never has to be loaded into memory.
+///
+/// Spool file contains two kinds of records: the message itself and the
+/// record saying that first N spooled messages of conversation were removed.
+/// Thanks to that, the spool survives the restart and messages which have
+/// not been delivered yet are loaded again when MessageCache is created.
+/// Removal record is written before the popped message is returned, so
+/// the message is never delivered twice.
+class MessageCache {
+	public:
+		/// Creates new MessageCache.
+		/// \param memoryLimit Maximum size of messages kept in memory in bytes. 0 means unlimited.
+		/// \param conversationLimit Maximum number of messages cached per conversation.
+		/// \param spool Path to spool file. Empty string disables spooling.
+		MessageCache(unsigned long memoryLimit = 0, unsigned long conversationLimit = 100, const std::string &spool = "");
+
+		/// Destructor.
+		~MessageCache();
+
+		/// Adds message to the end of conversation's queue. If there are
+		/// already conversationLimit messages, the oldest one is removed.
+		/// \param key Key identifying the conversation.
+		/// \param message Message.
+		void add(const std::string &key, boost::shared_ptr<Swift::Message> message);
+
+		/// Removes the oldest message from conversation's queue.
+		/// \param key Key identifying the conversation.
+		/// \param message The oldest message.
+		/// \return False if there are no messages cached for this conversation.
+		bool pop(const std::string &key, boost::shared_ptr<Swift::Message> &message);
+
+		/// Returns true if there are messages cached for this conversation.
+		/// \param key Key identifying the conversation.
+		/// \return True if there are cached messages.
+		bool contains(const std::string &key) const {
+			return m_queues.find(key) != m_queues.end();
+		}
+
+		/// Removes all messages cached for this conversation.
+		/// \param key Key identifying the conversation.
+		void remove(const std::string &key);
+
+		/// Returns keys of all user's conversations with cached messages.
+		/// \param user Bare JID of user.
+		/// \param keys Keys of conversations.
+		void getKeys(const std::string &user, std::vector<std::string> &keys) const;
+
+		/// Called when the conversation is destroyed. Messages cached in
+		/// memory are moved to spool file, so they can be delivered once
+		/// the conversation is created again. Without spool file they are
+		/// removed.
+		/// \param key Key identifying the conversation.
+		void release(const std::string &key);
+
+		/// Returns size of messages kept in memory.
+		/// \return Size in bytes.
+		unsigned long getMemoryUsage() const { return m_memoryUsage; }
+
+		/// Returns number of messages kept in memory.
+		/// \return Number of messages.
+		unsigned long getMemoryCount() const { return m_memory.size(); }
+
+		/// Returns number of messages stored in spool file.
+		/// \return Number of messages.
+		unsigned long getSpoolCount() const { return m_spoolCount; }
+
+		/// Returns number of messages dropped because of the limits.
+		/// \return Number of messages.
+		unsigned long getDroppedCount() const { return m_dropped; }
+
+		/// Returns the key used for conversation.
+		/// \param user Bare JID of user.
+		/// \param legacyName Legacy name of conversation.
+		/// \return Key.
+		static std::string getKey(const std::string &user, const std::string &legacyName) {
+			return user + "/" + legacyName;
+		}
+
+	private:
+		struct Queue;
+
+		struct Item {
+			Queue *queue;
+			boost::shared_ptr<Swift::Message> message;
+			unsigned long size;
+		};
+
+		struct Record {
+			unsigned long offset;
+			unsigned long size;
+		};
+
+		struct Queue {
+			std::string key;
+			std::deque<std::list<Item>::iterator> memory;
+			std::deque<Record> spool;
+			unsigned long popped;
+		};
+
+		Queue *getQueue(const std::string &key);
+		void removeQueueIfEmpty(Queue *queue);
+		void removeOldest(Queue *queue);
+		void removeMemoryItem(Queue *queue);
+		void spillOldest();
+		void spillQueue(Queue *queue);
+
+		void openSpool(bool truncate);
+		void loadSpool();
+		bool writeMessage(Queue *queue, boost::shared_ptr<Swift::Message> message);
+		bool readMessage(const Record &record, boost::shared_ptr<Swift::Message> &message);
+		void writeRemoved(Queue *queue, unsigned long count);
+		bool appendRecord(const std::string &data);
+		void compactSpool();
+
+		static unsigned long getSize(boost::shared_ptr<Swift::Message> message);
+
+		unsigned long m_memoryLimit;
+		unsigned long m_conversationLimit;
+		std::string m_spoolPath;
+		std::fstream m_spool;
+		bool m_spoolEnabled;
+		unsigned long m_spoolSize;
+		unsigned long m_spoolLiveSize;
+		unsigned long m_spoolCount;
+
+		std::map<std::string, Queue *> m_queues;
+		std::list<Item> m_memory;
+		unsigned long m_memoryUsage;
+		unsigned long m_dropped;
+};
+
+}
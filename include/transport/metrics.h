@@ -0,0 +1,136 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+
+namespace Transport {
+
+/// Counter or gauge stored in Metrics registry.
+class Counter {
+	public:
+		Counter() : m_value(0) {}
+
+		void increment(long value = 1) { m_value += value; }
+		void decrement(long value = 1) { m_value -= value; }
+		void setValue(long value) { m_value = value; }
+		long getValue() const { return m_value; }
+
+	private:
+		long m_value;
+};
+
+/// Histogram with fixed buckets stored in Metrics registry.
+class Histogram {
+	public:
+		/// Creates new Histogram.
+		/// \param bounds Upper bounds of the buckets in ascending order. +Inf bucket is added automatically.
+		Histogram(const std::vector<double> &bounds);
+
+		/// Adds new observation to the histogram.
+		/// \param value Observed value, usually in seconds.
+		void observe(double value);
+
+		const std::vector<double> &getBounds() const { return m_bounds; }
+
+		/// Returns number of observations in each bucket (not cumulative). The last one is +Inf bucket.
+		const std::vector<unsigned long> &getCounts() const { return m_counts; }
+
+		unsigned long getCount() const { return m_count; }
+		double getSum() const { return m_sum; }
+
+	private:
+		std::vector<double> m_bounds;
+		std::vector<unsigned long> m_counts;
+		unsigned long m_count;
+		double m_sum;
+};
+
+/// Registry of the counters, gauges and histograms describing the state of Spectrum 2.
+
+/// Metrics are updated incrementally by the classes which change the state
+/// (UserManager, RosterManager, NetworkPluginServer, ...), so reading them
+/// is cheap even with many users online. They are exported by StatsResponder,
+/// AdminInterface and MetricsServer.
+///
+/// Returned pointers are valid until Metrics is destroyed.
+class Metrics {
+	public:
+		/// Creates new Metrics registry.
+		Metrics();
+
+		/// Destructor.
+		~Metrics();
+
+		/// Returns counter with the given name, creating it if needed. Counter can only grow.
+		/// \param name Metric name, for example "spectrum2_messages_to_xmpp_total".
+		/// \param help Description of the metric.
+		Counter *getCounter(const std::string &name, const std::string &help = "");
+
+		/// Returns gauge with the given name, creating it if needed. Gauge can go up and down.
+		/// \param name Metric name, for example "spectrum2_users_online".
+		/// \param help Description of the metric.
+		Counter *getGauge(const std::string &name, const std::string &help = "");
+
+		/// Returns latency histogram with the given name, creating it if needed.
+		/// \param name Metric name, for example "spectrum2_login_seconds".
+		/// \param help Description of the metric.
+		Histogram *getHistogram(const std::string &name, const std::string &help = "");
+
+		/// Returns all metrics in Prometheus text exposition format.
+		std::string toPrometheus();
+
+		/// Returns current time in seconds.
+		static double getTime();
+
+	private:
+		struct Entry {
+			std::string help;
+			bool gauge;
+			Counter *counter;
+			Histogram *histogram;
+		};
+
+		Entry &getEntry(const std::string &name, const std::string &help);
+
+		std::map<std::string, Entry> m_entries;
+		std::vector<double> m_latencyBounds;
+};
+
+/// Observes the time between its creation and destruction in the histogram.
+class HistogramTimer {
+	public:
+		HistogramTimer(Histogram *histogram) : m_histogram(histogram), m_start(Metrics::getTime()) {}
+
+		~HistogramTimer() {
+			if (m_histogram) {
+				m_histogram->observe(Metrics::getTime() - m_start);
+			}
+		}
+
+	private:
+		Histogram *m_histogram;
+		double m_start;
+};
+
+}
@@ -0,0 +1,65 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include "Swiften/Network/ConnectionServer.h"
+#include "Swiften/Network/Connection.h"
+
+namespace Transport {
+
+class Component;
+
+/// Minimal HTTP server exporting Metrics in Prometheus text format.
+
+/// Every HTTP GET request is answered with the current metrics and the
+/// connection is closed. The server listens on service.metrics_host and
+/// service.metrics_port and it's disabled when service.metrics_port is 0.
+class MetricsServer {
+	public:
+		/// Creates new MetricsServer.
+		/// \param component Transport instance whose metrics are exported.
+		MetricsServer(Component *component);
+
+		/// Destructor.
+		~MetricsServer();
+
+		/// Starts listening if service.metrics_port is set.
+		void start();
+
+	private:
+		struct Client {
+			boost::shared_ptr<Swift::Connection> connection;
+			std::string request;
+		};
+
+		void handleNewConnection(boost::shared_ptr<Swift::Connection> connection);
+		void handleDataRead(Client *client, boost::shared_ptr<Swift::SafeByteArray> data);
+		void handleDataWritten(Client *client);
+		void removeClient(Client *client);
+
+		Component *m_component;
+		boost::shared_ptr<Swift::ConnectionServer> m_server;
+		std::list<Client *> m_clients;
+};
+
+}
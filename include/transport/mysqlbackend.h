@@ -94,6 +94,7 @@ class MySQLBackend : public StorageBackend
 
 		void getUserSetting(long userId, const std::string &variable, int &type, std::string &value);
 		void updateUserSetting(long userId, const std::string &variable, const std::string &value);
+		bool getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values);
 
 		void beginTransaction();
 		void commitTransaction();
@@ -143,6 +144,7 @@ class MySQLBackend : public StorageBackend
 		Statement *m_getUserSetting;
 		Statement *m_setUserSetting;
 		Statement *m_updateUserSetting;
+		Statement *m_getUsersSetting;
 		Statement *m_removeUser;
 		Statement *m_removeUserBuddies;
 		Statement *m_removeUserSettings;
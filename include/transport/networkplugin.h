@@ -25,6 +25,7 @@
 // #include "conversation.h"
 #include <iostream>
 #include <list>
+#include <map>
 
 namespace Transport {
 
@@ -61,6 +62,17 @@ class NetworkPlugin {
 				friend class NetworkPlugin;
 		};
 
+		/// Room participant used by NetworkPlugin::handleParticipantList().
+		struct Participant {
+			Participant(const std::string &nickname, int flags = 0, pbnetwork::StatusType status = pbnetwork::STATUS_ONLINE,
+				const std::string &statusMessage = "") : nickname(nickname), flags(flags), status(status), statusMessage(statusMessage) {}
+
+			std::string nickname;
+			int flags;
+			pbnetwork::StatusType status;
+			std::string statusMessage;
+		};
+
 		/// Creates new NetworkPlugin and connects the Spectrum2 NetworkPluginServer.
 		/// \param loop Event loop.
 		/// \param host Host where Spectrum2 NetworkPluginServer runs.
@@ -104,6 +116,14 @@ class NetworkPlugin {
 		void handleParticipantChanged(const std::string &user, const std::string &nickname, const std::string &room, int flags,
 			pbnetwork::StatusType = pbnetwork::STATUS_NONE, const std::string &statusMessage = "", const std::string &newname = "");
 
+		/// Call this function when the list of room participants is known, typically right after joining the room.
+		/// All participants are sent in single message, so use this instead of calling handleParticipantChanged for
+		/// every participant of large rooms.
+		/// \param user XMPP JID of user for which this event occurs. You can get it from NetworkPlugin::handleLoginRequest(). (eg. "user%gmail.com@xmpp.domain.tld")
+		/// \param room Room in which participants are. (eg. #spectrum)
+		/// \param participants Participants of the room.
+		void handleParticipantList(const std::string &user, const std::string &room, const std::list<Participant> &participants);
+
 		/// Call this function when user disconnected the legacy network because of some legacy network error.
 		/// \param user XMPP JID of user for which this event occurs. You can get it from NetworkPlugin::handleLoginRequest(). (eg. "user%gmail.com@xmpp.domain.tld")
 		/// \param error Reserved for future use, currently keep it on 0.
@@ -284,7 +304,23 @@ class NetworkPlugin {
 		void sendPong();
 		void sendMemoryUsage();
 
+		// Session handle assigned to user by Spectrum 2 in Login message
+		// together with buddy IDs we have assigned to buddies in this session.
+		struct Session {
+			unsigned int id;
+			unsigned int lastBuddyID;
+			std::map<std::string, unsigned int> buddies;
+		};
+
+		Session *getSession(const std::string &user);
+		unsigned int getBuddyID(Session *session, const std::string &buddyName, bool &isNew);
+
 		std::string m_data;
+		// Reused for every received message, so its payload buffer is not
+		// allocated again for every message.
+		pbnetwork::WrapperMessage m_wrapper;
+		bool m_parsing;
+		std::map<std::string, Session> m_sessions;
 		bool m_pingReceived;
 		double m_init_res;
 
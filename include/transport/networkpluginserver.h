@@ -35,6 +35,8 @@
 #include "Swiften/Serializer/XMPPSerializer.h"
 #include "storagebackend.h"
 #include "transport/filetransfermanager.h"
+#include "transport/metrics.h"
+#include "transport/protocol.pb.h"
 
 namespace Transport {
 
@@ -51,6 +53,9 @@ class BlockResponder;
 class DummyReadBytestream;
 class AdminInterface;
 class DiscoItemsResponder;
+class RateLimiter;
+class ChatStateFilter;
+class BackendCapture;
 
 class NetworkPluginServer : Swift::XMPPParserClient {
 	public:
@@ -66,6 +71,8 @@ class NetworkPluginServer : Swift::XMPPParserClient {
 			bool longRun;
 			bool willDie;
 			std::string id;
+			RateLimiter *limiter;
+			double pingSent;
 		};
 
 		NetworkPluginServer(Component *component, Config *config, UserManager *userManager, FileTransferManager *ftManager, DiscoItemsResponder *discoItemsResponder);
@@ -90,6 +97,22 @@ class NetworkPluginServer : Swift::XMPPParserClient {
 			return m_crashedBackends;
 		}
 
+		/// Returns number of messages from XMPP users which have been delayed by rate limiting.
+		/// \return Number of throttled messages.
+		unsigned long getThrottledMessages() {
+			return m_throttledMessages->getValue();
+		}
+
+		/// Returns number of messages from XMPP users which have been dropped by rate limiting.
+		/// \return Number of dropped messages.
+		unsigned long getDroppedMessages() {
+			return m_droppedMessages->getValue();
+		}
+
+		/// Returns number of redundant chat states and presences which have not been forwarded.
+		/// \return Number of saved stanzas.
+		unsigned long getSavedStanzas();
+
 		void collectBackend();
 
 		bool moveToLongRunBackend(User *user);
@@ -109,6 +132,7 @@ class NetworkPluginServer : Swift::XMPPParserClient {
 		void handleConvMessagePayload(const std::string &payload, bool subject = false);
 		void handleConvMessageAckPayload(const std::string &payload);
 		void handleParticipantChangedPayload(const std::string &payload);
+		void handleParticipantListPayload(const std::string &payload);
 		void handleRoomChangedPayload(const std::string &payload);
 		void handleVCardPayload(const std::string &payload);
 		void handleChatStatePayload(const std::string &payload, Swift::ChatState::ChatStateType type);
@@ -149,6 +173,17 @@ class NetworkPluginServer : Swift::XMPPParserClient {
 		void handlePIDTerminated(unsigned long pid);
 	private:
 		void send(boost::shared_ptr<Swift::Connection> &, const std::string &data);
+		// Returns false if the data have been dropped because of rate limiting.
+		bool sendFromUser(User *user, const std::string &data, bool droppable = false);
+		void flushRateLimitedQueues();
+		void sendChatState(User *user, const std::string &buddyName, Swift::ChatState::ChatStateType state);
+		void forwardChatState(User *user, const std::string &buddyName, Swift::ChatState::ChatStateType state);
+		void flushChatStates();
+
+		unsigned int createSession(User *user);
+		void removeSession(User *user);
+		User *getSessionUser(unsigned int session, const std::string &userName);
+		void resolveBuddyName(unsigned int session, unsigned int buddyId, std::string *buddyName);
 
 		void pingTimeout();
 		void sendPing(Backend *c);
@@ -175,6 +210,38 @@ class NetworkPluginServer : Swift::XMPPParserClient {
 		Swift::Timer::ref m_pingTimer;
 		Swift::Timer::ref m_collectTimer;
 		Swift::Timer::ref m_loginTimer;
+		Swift::Timer::ref m_rateLimitTimer;
+		Counter *m_throttledMessages;
+		Counter *m_droppedMessages;
+		Counter *m_runningBackends;
+		Counter *m_crashedBackendsCount;
+		Histogram *m_pingLatency;
+		Histogram *m_deliveryLatency;
+		Swift::Timer::ref m_chatStateTimer;
+		ChatStateFilter *m_outgoingChatStates;
+		ChatStateFilter *m_incomingChatStates;
+		unsigned long m_savedPresences;
+		BackendCapture *m_capture;
+
+		// Messages reused for every received frame. Parsing into already used
+		// message reuses memory allocated for its strings, so hot messages
+		// don't allocate once the buffers are big enough.
+		pbnetwork::WrapperMessage m_wrapper;
+		pbnetwork::Buddy m_buddyPayload;
+		pbnetwork::ConversationMessage m_convMessagePayload;
+		pbnetwork::Participant m_participantPayload;
+
+		// Session handles assigned in Login message. Handle consists of index to
+		// m_sessions and generation of that slot, so late messages for already
+		// removed session can't be delivered to another user.
+		struct Session {
+			User *user;
+			unsigned int generation;
+			std::map<unsigned int, std::string> buddies;
+		};
+		std::vector<Session> m_sessions;
+		std::list<unsigned int> m_freeSessions;
+		std::map<User *, unsigned int> m_userSessions;
 		Component *m_component;
 		std::list<User *> m_waitingUsers;
 		bool m_isNextLongRun;
@@ -94,6 +94,7 @@ class PQXXBackend : public StorageBackend
 
 		void getUserSetting(long userId, const std::string &variable, int &type, std::string &value);
 		void updateUserSetting(long userId, const std::string &variable, const std::string &value);
+		bool getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values);
 
 		void beginTransaction();
 		void commitTransaction();
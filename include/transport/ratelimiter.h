@@ -0,0 +1,131 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <string>
+#include <list>
+#include <map>
+
+namespace Transport {
+
+/// Token bucket used to limit rate of events.
+class TokenBucket {
+	public:
+		/// Creates new TokenBucket.
+		/// \param rate Number of tokens added per second. 0 means unlimited.
+		/// \param burst Maximum number of tokens the bucket can hold.
+		TokenBucket(double rate = 0, double burst = 0);
+
+		/// Changes the limits of this bucket. Bucket is refilled to its new burst.
+		/// \param rate Number of tokens added per second. 0 means unlimited.
+		/// \param burst Maximum number of tokens the bucket can hold.
+		void setLimit(double rate, double burst);
+
+		/// Takes tokens from the bucket if there are enough of them.
+		/// \param now Current time in seconds.
+		/// \param tokens Number of tokens to take.
+		/// \return True if the tokens have been taken.
+		bool consume(double now, double tokens = 1);
+
+		/// Returns true if there are enough tokens in the bucket, but does not take them.
+		/// \param now Current time in seconds.
+		/// \param tokens Number of tokens.
+		/// \return True if the tokens are available.
+		bool available(double now, double tokens = 1);
+
+		bool isUnlimited() const { return m_rate <= 0; }
+
+	private:
+		void refill(double now);
+
+		double m_rate;
+		double m_burst;
+		double m_tokens;
+		double m_last;
+};
+
+/// Limits rate of frames sent from users to one backend.
+
+/// Every user (flow) has its own TokenBucket and the backend has one shared TokenBucket.
+/// Frames which can't be sent immediately are queued per flow and dequeued
+/// using deficit round robin, so one noisy user can't starve the others.
+class RateLimiter {
+	public:
+		/// Result of RateLimiter::push.
+		typedef enum {
+			Send,		///< frame can be sent right now
+			Queued,		///< frame has been queued and will be returned by pop() later
+			Dropped		///< frame has been dropped
+		} Result;
+
+		/// Creates new RateLimiter.
+		/// \param userRate Frames per second allowed for one user. 0 means unlimited.
+		/// \param userBurst Number of frames one user can send at once.
+		/// \param backendRate Frames per second allowed for whole backend. 0 means unlimited.
+		/// \param backendBurst Number of frames the backend can receive at once.
+		/// \param quantum Number of bytes added to flow's deficit in every round.
+		/// \param maxQueued Maximum number of queued frames per flow.
+		RateLimiter(double userRate, double userBurst, double backendRate, double backendBurst, unsigned long quantum = 1024, unsigned long maxQueued = 100);
+
+		/// Decides what to do with the frame sent by particular flow.
+		/// \param flow Flow identifier (bare JID of user).
+		/// \param data Frame.
+		/// \param droppable True if the frame can be dropped instead of queued (chat states).
+		/// \param now Current time in seconds.
+		/// \return Send if frame should be sent now, Queued or Dropped otherwise.
+		Result push(const std::string &flow, const std::string &data, bool droppable, double now);
+
+		/// Returns next queued frame which is allowed to be sent.
+		/// \param data Frame.
+		/// \param now Current time in seconds.
+		/// \return False if there is no frame which can be sent now.
+		bool pop(std::string &data, double now);
+
+		/// Removes the flow and all its queued frames.
+		/// \param flow Flow identifier.
+		/// \return Number of removed queued frames.
+		unsigned long removeFlow(const std::string &flow);
+
+		/// Returns number of queued frames.
+		/// \return Number of queued frames.
+		unsigned long getQueuedCount() const { return m_queued; }
+
+	private:
+		struct Flow {
+			TokenBucket bucket;
+			std::list<std::string> frames;
+			unsigned long deficit;
+			bool active;
+		};
+
+		Flow &getFlow(const std::string &flow);
+
+		std::map<std::string, Flow> m_flows;
+		std::list<std::string> m_active;
+		TokenBucket m_backend;
+		double m_userRate;
+		double m_userBurst;
+		unsigned long m_quantum;
+		unsigned long m_maxQueued;
+		unsigned long m_queued;
+};
+
+}
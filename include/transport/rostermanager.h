@@ -23,6 +23,7 @@
 #include <string>
 #include <algorithm>
 #include <map>
+#include <list>
 #include <boost/pool/pool_alloc.hpp>
 #include <boost/pool/object_pool.hpp>
 // #include "rosterstorage.h"
@@ -38,7 +39,10 @@ class Buddy;
 class User;
 class Component;
 class StorageBackend;
+struct BuddyInfo;
 class RosterStorage;
+class Counter;
+class Histogram;
 
 // TODO: Once Swiften GetRosterRequest will support setting to="", this can be removed
 class AddressedRosterRequest : public Swift::GenericRequest<Swift::RosterPayload> {
@@ -81,8 +85,16 @@ class RosterManager {
 
 		void setStorageBackend(StorageBackend *storageBackend);
 
+		/// Sets StorageBackend, but uses the given roster instead of fetching
+		/// it from the storage backend.
+		void setStorageBackend(StorageBackend *storageBackend, const std::list<BuddyInfo> &roster);
+
 		void storeBuddy(Buddy *buddy);
 
+		/// Stores buddies waiting in the storage queue right now, so all
+		/// buddies have their database IDs.
+		void storeBuddies();
+
 		Swift::RosterPayload::ref generateRosterPayload();
 
 		/// Returns user associated with this roster.
@@ -111,6 +123,10 @@ class RosterManager {
 
 		void handleBuddyChanged(Buddy *buddy);
 
+		/// Called by Buddy when it goes online or offline to keep the online contacts metric up to date.
+		/// \param buddy Buddy which changed its availability.
+		void handleBuddyAvailabilityChanged(Buddy *buddy);
+
 		void handleSubscription(Swift::Presence::ref presence);
 
 		void sendBuddyRosterPush(Buddy *buddy);
@@ -143,6 +159,9 @@ class RosterManager {
 		std::list <Swift::SetRosterRequest::ref> m_requests;
 		bool m_supportRemoteRoster;
 		AddressedRosterRequest::ref m_remoteRosterRequest;
+		Counter *m_contactsTotal;
+		Counter *m_contactsOnline;
+		Histogram *m_storageLatency;
 };
 
 }
@@ -24,7 +24,7 @@
 #include <algorithm>
 #include <map>
 
-#include "Swiften/Network/Timer.h"
+#include "transport/timerwheel.h"
 
 namespace Transport {
 
@@ -55,7 +55,7 @@ class RosterStorage {
 		User *m_user;
 		StorageBackend *m_storageBackend;
 		std::map<std::string, Buddy *> m_buddies;
-		Swift::Timer::ref m_storageTimer;
+		TimerWheel::ID m_storageTimer;
 };
 
 }
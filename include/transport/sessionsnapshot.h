@@ -0,0 +1,109 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include "Swiften/Elements/Presence.h"
+#include "transport/storagebackend.h"
+
+namespace Transport {
+
+class Component;
+class UserManager;
+class User;
+
+/// State of online users persisted over Spectrum 2 restart.
+
+/// When Spectrum 2 is stopped, presences of all online users, rooms they
+/// have joined and their rosters together with the last known presences
+/// of the buddies are stored in snapshot file. When it starts again,
+/// UsersReconnecter replays the stored presences instead of waiting for
+/// presence probes and UserManager restores the roster from the snapshot
+/// instead of fetching it from the storage backend.
+///
+/// Only the state kept by Spectrum 2 itself is restored. Backends are
+/// stopped together with Spectrum 2, so legacy network sessions are
+/// logged in again.
+///
+/// Snapshot file is removed once it's loaded, so the snapshot is never used
+/// after crash or for users who changed their state in the meantime.
+class SessionSnapshot {
+	public:
+		struct BuddyState {
+			BuddyInfo info;
+			int show;
+			std::string statusMessage;
+		};
+
+		struct UserState {
+			// Presences of all resources followed by presences used to join the rooms.
+			std::vector<Swift::Presence::ref> presences;
+			std::list<BuddyState> buddies;
+		};
+
+		/// Creates new SessionSnapshot.
+		/// \param component Transport instance.
+		/// \param userManager UserManager with online users.
+		/// \param path Path to snapshot file.
+		SessionSnapshot(Component *component, UserManager *userManager, const std::string &path);
+
+		/// Destructor.
+		~SessionSnapshot();
+
+		/// Stores the state of all online users to snapshot file.
+		/// \return False if the file can't be written.
+		bool save();
+
+		/// Loads the snapshot file and removes it.
+		/// \return False if there's no snapshot or it can't be parsed.
+		bool load();
+
+		/// Returns JIDs of users stored in loaded snapshot.
+		void getUsers(std::vector<std::string> &users);
+
+		/// Returns state of the user stored in loaded snapshot or NULL.
+		const UserState *getUserState(const std::string &jid);
+
+		/// Replays stored presences of the user, so the user is logged in
+		/// and joins the rooms again, and sends presence probe to the user
+		/// to get presences changed while Spectrum 2 was not running.
+		/// \return False if there's no such user in the snapshot.
+		bool restorePresences(const std::string &jid);
+
+		/// Sets the roster of newly created user from the snapshot. The snapshot
+		/// of this user is forgotten then.
+		/// \param user Newly created user.
+		/// \param storageBackend StorageBackend used to store further roster changes.
+		/// \return False if there's no such user in the snapshot.
+		bool restoreRoster(User *user, StorageBackend *storageBackend);
+
+	private:
+		Component *m_component;
+		UserManager *m_userManager;
+		std::string m_path;
+		std::map<std::string, UserState> m_users;
+};
+
+}
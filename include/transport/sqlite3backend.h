@@ -93,6 +93,7 @@ class SQLite3Backend : public StorageBackend
 
 		void getUserSetting(long userId, const std::string &variable, int &type, std::string &value);
 		void updateUserSetting(long userId, const std::string &variable, const std::string &value);
+		bool getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values);
 
 		void beginTransaction();
 		void commitTransaction();
@@ -110,6 +111,7 @@ class SQLite3Backend : public StorageBackend
 		sqlite3_stmt *m_getUserSetting;
 		sqlite3_stmt *m_setUserSetting;
 		sqlite3_stmt *m_updateUserSetting;
+		sqlite3_stmt *m_getUsersSetting;
 		sqlite3_stmt *m_removeUser;
 		sqlite3_stmt *m_removeUserBuddies;
 		sqlite3_stmt *m_removeUserSettings;
@@ -135,6 +135,13 @@ class StorageBackend
 		virtual void getUserSetting(long userId, const std::string &variable, int &type, std::string &value) = 0;
 		virtual void updateUserSetting(long userId, const std::string &variable, const std::string &value) = 0;
 
+		/// Fetches the setting of all users in one query.
+		/// \param variable name of the setting
+		/// \param values map where values are stored, indexed by user's bare JID.
+		/// Users without this setting stored are not added.
+		/// \return false if the query failed
+		virtual bool getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values) = 0;
+
 		virtual void beginTransaction() = 0;
 		virtual void commitTransaction() = 0;
 
@@ -3,8 +3,10 @@
 
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
-#include <boost/signals2/signal.hpp>
-#include <queue>
+#include <boost/thread/condition_variable.hpp>
+#include <deque>
+#include <vector>
+#include <set>
 #include <iostream>
 #include "transport/logging.h"
 #include "Swiften/EventLoop/EventLoop.h"
@@ -17,6 +19,8 @@
  * waiting for the response and storing the response. When the thread finishes
  * execution, the ThreadPool invokes finalize where one could have the code necessary
  * to collect all the responses and release any resources. 
+ * Jobs which are never finalized (they have been dropped, or ThreadPool is
+ * destroyed before they are finished) get cancel called instead.
  *
  * NOTE: The object of the Thread class must be valid (in scope) throughout the 
  * execution of the thread.
@@ -32,43 +36,83 @@ class Thread
 	virtual ~Thread() {}
 	virtual void run() = 0;
 	virtual void finalize() {}
+	virtual void cancel() {}
 	int getThreadID() {return threadID;}
 	void setThreadID(int tid) {threadID = tid;}
 };
 
 /*
- * ThreadPool provides the interface to manage a pool of threads. It schedules jobs
- * on free threads and when the thread completes it automatically deletes the object
- * corresponding to a Thread. If free threads are not available, the requests are 
- * added to a queue and scheduled later when threads become available.
+ * ThreadPool provides the interface to manage a pool of threads. Worker threads
+ * are created once in the constructor and they take jobs from the shared queue.
+ * Interactive jobs (like sending a message) are always taken before background
+ * jobs (like periodic polls). When the job is done, ThreadPool calls finalize
+ * in the event loop thread and deletes the object corresponding to a Thread.
+ *
+ * Number of queued jobs of each priority is limited. When the limit is reached,
+ * new jobs of that priority are dropped (cancelled without running them). There's
+ * no reason to queue more periodic polls when we can't handle the current ones
+ * and interactive jobs queued for minutes are useless for the user anyway.
  */
 
 class ThreadPool
 {
+	public:
+	typedef enum {
+		Interactive = 0,
+		Background = 1
+	} Priority;
+
+	ThreadPool(Swift::EventLoop *loop, int maxthreads, int maxqueued = 1000);
+	~ThreadPool();
+
+	/*
+	 * Queues the job. Returns false if the job has been dropped, because there
+	 * are too many jobs with the same priority in the queue.
+	 */
+	bool runAsThread(Thread *t, Priority priority = Interactive);
+
+	// Number of workers which are running some job just now.
+	int getActiveThreadCount();
+	// Number of queued jobs which have not been started yet.
+	int getQueuedCount();
+
+	unsigned long getCompletedCount() { return completed; }
+	unsigned long getDroppedCount() { return dropped; }
+	// Average and maximum time in seconds jobs spent waiting in the queue.
+	double getAverageWaitTime() { return completed ? totalWaitTime / completed : 0; }
+	double getMaxWaitTime() { return maxWaitTime; }
+	// Average time in seconds jobs spent running.
+	double getAverageRunTime() { return completed ? totalRunTime / completed : 0; }
+
+	private:
+	struct Job {
+		Thread *thread;
+		double queued;
+	};
+
+	void workerLoop(int wid);
+	void handleWorkCompleted(Thread *t, double waitTime, double runTime);
+	static double getTime();
+
 	const int MAX_THREADS;
+	const int MAX_QUEUED;
+	std::vector<boost::thread *> workers;
+	std::deque<Job> requestQueue[2];
+	// Jobs which have been run, but have not been finalized yet.
+	std::set<Thread *> finished;
 	int activeThreads;
-	std::queue<int> freeThreads;
-	
-	std::queue<Thread*> requestQueue;
-	boost::thread **worker;
+	bool stopped;
 
-	boost::mutex count_lock;
-	boost::mutex pool_lock;
-	boost::mutex criticalregion;
+	boost::mutex lock;
+	boost::condition_variable workAvailable;
 	Swift::EventLoop *loop;
+	boost::shared_ptr<Swift::EventOwner> owner;
 
-	boost::signals2::signal  < void () > onWorkerAvailable;
-
-	public:
-	ThreadPool(Swift::EventLoop *loop, int maxthreads);
-	~ThreadPool();
-	void runAsThread(Thread *t);
-	int getActiveThreadCount(); 
-	void updateActiveThreadCount(int k);
-	void cleandUp(Thread *, int);
-	void scheduleFromQueue();
-	int getFreeThread();
-	void releaseThread(int i);
+	unsigned long completed;
+	unsigned long dropped;
+	double totalWaitTime;
+	double totalRunTime;
+	double maxWaitTime;
 };
 
 #endif
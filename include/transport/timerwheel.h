@@ -0,0 +1,105 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <vector>
+#include <list>
+#include <map>
+#include <boost/function.hpp>
+#include "Swiften/Network/Timer.h"
+#include "Swiften/Network/TimerFactory.h"
+
+namespace Transport {
+
+/// Hashed timer wheel used for housekeeping timeouts.
+
+/// All deadlines share single Swift::Timer which ticks with the wheel
+/// resolution only while there is at least one deadline scheduled.
+/// Deadline is put into the slot in which it expires and it remembers how
+/// many full turns of the wheel it has to wait, so every tick touches only
+/// one slot. Deadlines are found by ID in std::map, so scheduling,
+/// cancelling and expiring are O(log n) in the number of deadlines.
+///
+/// Callbacks are never called earlier than the requested timeout, but they
+/// can be called up to one resolution later.
+class TimerWheel {
+	public:
+		typedef boost::function<void ()> Callback;
+
+		/// Identifies scheduled deadline. 0 is never used for valid deadline.
+		typedef unsigned long ID;
+
+		/// Creates new TimerWheel.
+		/// \param timerFactory TimerFactory used to create the ticking timer.
+		/// \param resolution Length of one tick in milliseconds.
+		/// \param slots Number of slots in the wheel.
+		TimerWheel(Swift::TimerFactory *timerFactory, int resolution = 1000, int slots = 512);
+
+		/// Destructor. Pending callbacks are not called.
+		~TimerWheel();
+
+		/// Schedules the callback to be called after timeout.
+		/// \param timeout Timeout in milliseconds.
+		/// \param callback Callback to be called.
+		/// \return ID which can be used to cancel the deadline.
+		ID schedule(int timeout, const Callback &callback);
+
+		/// Cancels scheduled deadline. It's safe to cancel already expired
+		/// deadline or 0.
+		/// \param id ID returned by schedule().
+		void cancel(ID id);
+
+		/// Returns true if the deadline is scheduled and its callback has not
+		/// been called yet.
+		bool isScheduled(ID id) { return m_entries.find(id) != m_entries.end(); }
+
+		/// Returns number of scheduled deadlines.
+		size_t getScheduledCount() { return m_entries.size(); }
+
+		/// Returns length of one tick in milliseconds.
+		int getResolution() { return m_resolution; }
+
+	private:
+		struct Entry {
+			ID id;
+			unsigned long rounds;
+			Callback callback;
+		};
+
+		struct Location {
+			size_t slot;
+			std::list<Entry>::iterator entry;
+		};
+
+		void handleTick();
+
+		Swift::Timer::ref m_timer;
+		bool m_running;
+		int m_resolution;
+		size_t m_cursor;
+		ID m_lastID;
+		std::vector<std::list<Entry> > m_slots;
+		// Entries which expired in the current tick and wait for their callback.
+		std::list<Entry> m_expired;
+		std::map<ID, Location> m_entries;
+};
+
+}
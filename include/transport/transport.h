@@ -46,6 +46,9 @@ namespace Transport {
 	class StorageBackend;
 	class Factory;
 	class UserRegistry;
+	class MessageCache;
+	class Metrics;
+	class TimerWheel;
 
 	/// Represents one transport instance.
 
@@ -119,6 +122,21 @@ namespace Transport {
 			/// \return Transport Factory used to create basic Transport components.
 			Factory *getFactory() { return m_factory; }
 
+			/// Returns MessageCache used to cache messages which can't be delivered to users yet.
+
+			/// \return MessageCache shared by all conversations.
+			MessageCache *getMessageCache() { return m_messageCache; }
+
+			/// Returns Metrics registry with the counters and histograms describing this transport.
+
+			/// \return Metrics shared by all users and backends.
+			Metrics *getMetrics() { return m_metrics; }
+
+			/// Returns TimerWheel used for housekeeping timeouts.
+
+			/// \return TimerWheel shared by all users and backends.
+			TimerWheel *getTimerWheel() { return m_timerWheel; }
+
 			/// This signal is emitted when server disconnects the transport because of some error.
 
 			/// \param error disconnection error
@@ -181,6 +199,9 @@ namespace Transport {
 			Swift::CapsManager *m_capsManager;
 			Swift::CapsMemoryStorage *m_capsMemoryStorage;
 			PresenceOracle *m_presenceOracle;
+			MessageCache *m_messageCache;
+			Metrics *m_metrics;
+			TimerWheel *m_timerWheel;
 			Swift::StanzaChannel *m_stanzaChannel;
 			Swift::IQRouter *m_iqRouter;
 			
@@ -26,7 +26,7 @@
 #include "storagebackend.h"
 #include <Swiften/FileTransfer/OutgoingFileTransfer.h>
 #include "Swiften/Elements/SpectrumErrorPayload.h"
-#include "Swiften/Network/Timer.h"
+#include "transport/timerwheel.h"
 #include "Swiften/Network/Connection.h"
 
 namespace Transport {
@@ -117,6 +117,11 @@ class User : public Swift::EntityCapsProvider {
 			return m_resources;
 		}
 
+		/// Returns presences used to join the rooms the user is in.
+		const std::list<Swift::Presence::ref> &getJoinedRooms() {
+			return m_joinedRooms;
+		}
+
 		void addUserSetting(const std::string &key, const std::string &value) {
 			m_settings[key] = value;
 		}
@@ -140,6 +145,7 @@ class User : public Swift::EntityCapsProvider {
 
 	private:
 		void onConnectingTimeout();
+		void startReconnectTimer();
 
 		Swift::JID m_jid;
 		Component *m_component;
@@ -153,7 +159,7 @@ class User : public Swift::EntityCapsProvider {
 		bool m_connected;
 		bool m_readyForConnect;
 		bool m_ignoreDisconnect;
-		Swift::Timer::ref m_reconnectTimer;
+		TimerWheel::ID m_reconnectTimer;
 		boost::shared_ptr<Swift::Connection> connection;
 		time_t m_lastActivity;
 		std::map<Swift::JID, Swift::DiscoInfo::ref> m_legacyCaps;
@@ -163,6 +169,7 @@ class User : public Swift::EntityCapsProvider {
 		std::list<Swift::Presence::ref> m_joinedRooms;
 		std::map<std::string, std::string> m_settings;
 		bool m_cacheMessages;
+		double m_loginStart;
 };
 
 }
@@ -0,0 +1,91 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Swiften/JID/JID.h"
+
+namespace Transport {
+
+class User;
+
+/// Hash index of online users keyed by bare JID.
+
+/// Every bare JID added to the index is interned and gets small integer ID
+/// which is used as index to the vectors with keys and users. Lookup uses
+/// open addressing hash table with linear probing which stores just the hash
+/// and the ID, so it does not allocate anything.
+class UserIndex {
+	public:
+		/// Creates new empty UserIndex.
+		UserIndex();
+
+		/// Adds the user to index. If there's already user with the same
+		/// bare JID, it's replaced.
+		/// \param barejid Bare JID of user.
+		/// \param user User.
+		void add(const std::string &barejid, User *user);
+
+		/// Removes the user from index.
+		/// \param barejid Bare JID of user.
+		/// \return True if the user has been removed.
+		bool remove(const std::string &barejid);
+
+		/// Returns user with this bare JID.
+		/// \param barejid Bare JID of user.
+		/// \return User or NULL.
+		User *find(const std::string &barejid) const;
+
+		/// Returns user with bare JID of this JID. Resource is ignored and no
+		/// temporary string is created.
+		/// \param jid JID of user.
+		/// \return User or NULL.
+		User *find(const Swift::JID &jid) const;
+
+		/// Returns number of users in index.
+		/// \return Number of users.
+		unsigned long size() const { return m_count; }
+
+	private:
+		struct Slot {
+			unsigned int hash;
+			int id;
+		};
+
+		static unsigned int hash(const std::string &barejid);
+		static unsigned int hash(const Swift::JID &jid);
+		static bool equals(const std::string &barejid, const Swift::JID &jid);
+
+		int findSlot(const std::string &barejid, unsigned int h) const;
+		int findSlot(const Swift::JID &jid, unsigned int h) const;
+		void insertSlot(unsigned int h, int id);
+		void rehash(unsigned long capacity);
+
+		std::vector<Slot> m_slots;
+		std::vector<std::string> m_keys;
+		std::vector<User *> m_users;
+		std::vector<int> m_freeIDs;
+		unsigned long m_count;
+		unsigned long m_used;
+};
+
+}
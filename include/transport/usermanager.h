@@ -23,6 +23,8 @@
 #include <string>
 #include <map>
 #include "transport/userregistry.h"
+#include "transport/userindex.h"
+#include "transport/metrics.h"
 #include "Swiften/Elements/Message.h"
 #include "Swiften/Elements/Presence.h"
 #include "Swiften/Disco/EntityCapsProvider.h"
@@ -37,6 +39,7 @@ class StorageBackend;
 class StorageResponder;
 class RosterResponder;
 class DiscoItemsResponder;
+class SessionSnapshot;
 
 /// Manages online XMPP Users.
 
@@ -70,6 +73,20 @@ class UserManager : public Swift::EntityCapsProvider {
 		/// \return User class associated with this user
 		User *getUser(const std::string &barejid);
 
+		/// Returns user according to his JID. Resource is ignored. This
+		/// is faster than getUser(jid.toBare().toString()), because no
+		/// temporary string is created.
+		/// \param jid JID of user
+		/// \return User class associated with this user
+		User *getUser(const Swift::JID &jid);
+
+		/// Returns user according to his bare JID.
+		/// \param barejid bare JID of user
+		/// \return User class associated with this user
+		User *getUser(const char *barejid) {
+			return getUser(std::string(barejid));
+		}
+
 		/// Returns map with all connected users.
 		/// \return All connected users.
 		const std::map<std::string, User *> &getUsers() {
@@ -102,7 +119,7 @@ class UserManager : public Swift::EntityCapsProvider {
 		/// Returns true if user is connected.
 		/// \return True if user is connected.
 		bool isUserConnected(const std::string &barejid) const {
-			return m_users.find(barejid) != m_users.end();
+			return m_index.find(barejid) != NULL;
 		}
 
 		/// Returns pointer to UserRegistry.
@@ -123,12 +140,17 @@ class UserManager : public Swift::EntityCapsProvider {
 		/// \param user JID of user.
 		void disconnectUser(const Swift::JID &user);
 
-		void messageToXMPPSent() { m_sentToXMPP++; }
-		void messageToBackendSent() { m_sentToBackend++; }
+		void messageToXMPPSent() { m_sentToXMPP->increment(); }
+		void messageToBackendSent() { m_sentToBackend->increment(); }
+
+		unsigned long getMessagesToXMPP() { return m_sentToXMPP->getValue(); }
+		unsigned long getMessagesToBackend() { return m_sentToBackend->getValue(); }
+
+		/// Sets SessionSnapshot from which the rosters of users are restored
+		/// instead of fetching them from the storage backend.
+		/// \param sessionSnapshot Loaded SessionSnapshot or NULL.
+		void setSessionSnapshot(SessionSnapshot *sessionSnapshot) { m_sessionSnapshot = sessionSnapshot; }
 
-		unsigned long getMessagesToXMPP() { return m_sentToXMPP; }
-		unsigned long getMessagesToBackend() { return m_sentToBackend; }
-		
 
 	private:
 		void handlePresence(Swift::Presence::ref presence);
@@ -143,16 +165,19 @@ class UserManager : public Swift::EntityCapsProvider {
 		void addUser(User *user);
 
 		long m_onlineBuddies;
-		User *m_cachedUser;
 		std::map<std::string, User *> m_users;
+		UserIndex m_index;
 		Component *m_component;
 		StorageBackend *m_storageBackend;
 		StorageResponder *m_storageResponder;
 		UserRegistry *m_userRegistry;
 		Swift::Timer::ref m_removeTimer;
-		unsigned long m_sentToXMPP;
-		unsigned long m_sentToBackend;
+		Counter *m_sentToXMPP;
+		Counter *m_sentToBackend;
+		Counter *m_usersOnline;
+		Histogram *m_storageLatency;
 		DiscoItemsResponder *m_discoItemsResponder;
+		SessionSnapshot *m_sessionSnapshot;
 		friend class RosterResponder;
 };
 
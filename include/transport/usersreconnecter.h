@@ -23,6 +23,7 @@
 #include <string>
 #include <algorithm>
 #include <vector>
+#include <map>
 
 #include "transport/config.h"
 #include "Swiften/Network/Timer.h"
@@ -31,29 +32,61 @@ namespace Transport {
 
 class StorageBackend;
 class Component;
+class UserManager;
+class SessionSnapshot;
 
 /// Tries to reconnect users who have been online before crash/restart.
+
+/// Users are reconnected in waves. The number of users logging in at the
+/// same time starts at service.users_per_backend, grows with every
+/// successful login up to service.reconnect_concurrency and it's halved
+/// when the login fails or doesn't finish in time.
+///
+/// Users stored in SessionSnapshot are reconnected first by replaying their
+/// stored presences.
 class UsersReconnecter {
 	public:
 		/// Creates new UsersReconnecter.
 		/// \param component Transport instance associated with this roster.
+		/// \param userManager UserManager used to check the state of reconnected users.
 		/// \param storageBackend StorageBackend from which the users will be fetched.
-		UsersReconnecter(Component *component, StorageBackend *storageBackend);
+		/// \param sessionSnapshot Loaded SessionSnapshot or NULL.
+		UsersReconnecter(Component *component, UserManager *userManager, StorageBackend *storageBackend, SessionSnapshot *sessionSnapshot = NULL);
 
 		/// Destructor.
 		virtual ~UsersReconnecter();
 
-		void reconnectNextUser();
+		/// Checks the users being reconnected and starts reconnecting the next
+		/// users if there's free place in the current wave.
+		void reconnectNextUsers();
+
+		/// Returns number of users which can log in at the same time.
+		int getWindow() { return m_window; }
+
+		/// Returns number of users which are logging in right now.
+		int getPendingCount() { return m_pending.size(); }
 
 	private:
+		struct PendingLogin {
+			time_t started;
+			bool seen;
+		};
+
 		void handleConnected();
+		void reconnectUser(const std::string &jid);
+		void checkPendingLogins();
 
 		Component *m_component;
+		UserManager *m_userManager;
 		StorageBackend *m_storageBackend;
+		SessionSnapshot *m_sessionSnapshot;
 		bool m_started;
 		std::vector<std::string> m_users;
+		std::map<std::string, PendingLogin> m_pending;
+		int m_window;
+		int m_maxWindow;
 		Swift::Timer::ref m_nextUserTimer;
-                Config *m_config;
+		Config *m_config;
 };
 
 }
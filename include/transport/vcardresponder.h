@@ -24,7 +24,7 @@
 #include "Swiften/Queries/Responder.h"
 #include "Swiften/Elements/VCard.h"
 #include "Swiften/Network/NetworkFactories.h"
-#include "Swiften/Network/Timer.h"
+#include "transport/timerwheel.h"
 #include <boost/signal.hpp>
 
 namespace Transport {
@@ -43,22 +43,22 @@ class VCardResponder : public Swift::Responder<Swift::VCard> {
 		boost::signal<void (User *, const std::string &name, unsigned int id)> onVCardRequired;
 		boost::signal<void (User *, boost::shared_ptr<Swift::VCard> vcard)> onVCardUpdated;
 
-		void collectTimeouted();
-
 	private:
 		struct VCardData {
 			Swift::JID from;
 			Swift::JID to;
 			std::string id;
-			time_t received;
+			TimerWheel::ID timeout;
 		};
 
+		void handleQueryTimeout(unsigned int id);
+
 		virtual bool handleGetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::VCard> payload);
 		virtual bool handleSetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::VCard> payload);
 		UserManager *m_userManager;
 		std::map<unsigned int, VCardData> m_queries;
 		unsigned int m_id;
-		Swift::Timer::ref m_collectTimer;
+		TimerWheel *m_timerWheel;
 };
 
 }
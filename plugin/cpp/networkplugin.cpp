@@ -44,6 +44,42 @@ namespace Transport {
 	wrap.set_payload(MESSAGE); \
 	wrap.SerializeToString(&MESSAGE);
 
+// Uses session handle instead of userName when Spectrum 2 assigned one to the user.
+#define SET_USER(MESSAGE, USER) { \
+	Session *session_ = getSession(USER); \
+	if (session_) { \
+		MESSAGE.set_session(session_->id); \
+	} \
+	else { \
+		MESSAGE.set_username(USER); \
+	} \
+}
+
+// The same as SET_USER, but also replaces buddyName by buddyId. buddyName is
+// sent only when the buddyId is used for the first time in this session.
+#define SET_USER_AND_BUDDY(MESSAGE, USER, BUDDY) { \
+	Session *session_ = getSession(USER); \
+	if (session_) { \
+		bool new_ = true; \
+		unsigned int id_ = getBuddyID(session_, BUDDY, new_); \
+		MESSAGE.set_session(session_->id); \
+		if (id_) { \
+			MESSAGE.set_buddyid(id_); \
+		} \
+		if (new_) { \
+			MESSAGE.set_buddyname(BUDDY); \
+		} \
+	} \
+	else { \
+		MESSAGE.set_username(USER); \
+		MESSAGE.set_buddyname(BUDDY); \
+	} \
+}
+
+// Maximum number of buddy IDs per session. Buddies over this limit are
+// sent with buddyName.
+#define MAX_BUDDY_ID 1000000
+
 template <class T> std::string stringOf(T object) {
 	std::ostringstream os;
 	os << object;
@@ -52,6 +88,7 @@ template <class T> std::string stringOf(T object) {
 
 NetworkPlugin::NetworkPlugin() {
 	m_pingReceived = false;
+	m_parsing = false;
 
 	double shared;
 #ifndef WIN32
@@ -96,8 +133,7 @@ void NetworkPlugin::sendRawXML(std::string &xml) {
 
 void NetworkPlugin::handleMessage(const std::string &user, const std::string &legacyName, const std::string &msg, const std::string &nickname, const std::string &xhtml, const std::string &timestamp, bool headline, bool pm) {
 	pbnetwork::ConversationMessage m;
-	m.set_username(user);
-	m.set_buddyname(legacyName);
+	SET_USER_AND_BUDDY(m, user, legacyName);
 	m.set_message(msg);
 	m.set_nickname(nickname);
 	m.set_xhtml(xhtml);
@@ -115,8 +151,7 @@ void NetworkPlugin::handleMessage(const std::string &user, const std::string &le
 
 void NetworkPlugin::handleMessageAck(const std::string &user, const std::string &legacyName, const std::string &id) {
 	pbnetwork::ConversationMessage m;
-	m.set_username(user);
-	m.set_buddyname(legacyName);
+	SET_USER_AND_BUDDY(m, user, legacyName);
 	m.set_message("");
 	m.set_id(id);
 
@@ -130,8 +165,7 @@ void NetworkPlugin::handleMessageAck(const std::string &user, const std::string
 
 void NetworkPlugin::handleAttention(const std::string &user, const std::string &buddyName, const std::string &msg) {
 	pbnetwork::ConversationMessage m;
-	m.set_username(user);
-	m.set_buddyname(buddyName);
+	SET_USER_AND_BUDDY(m, user, buddyName);
 	m.set_message(msg);
 
 	std::string message;
@@ -144,7 +178,7 @@ void NetworkPlugin::handleAttention(const std::string &user, const std::string &
 
 void NetworkPlugin::handleVCard(const std::string &user, unsigned int id, const std::string &legacyName, const std::string &fullName, const std::string &nickname, const std::string &photo) {
 	pbnetwork::VCard vcard;
-	vcard.set_username(user);
+	SET_USER(vcard, user);
 	vcard.set_buddyname(legacyName);
 	vcard.set_id(id);
 	vcard.set_fullname(fullName);
@@ -160,8 +194,7 @@ void NetworkPlugin::handleVCard(const std::string &user, unsigned int id, const
 
 void NetworkPlugin::handleSubject(const std::string &user, const std::string &legacyName, const std::string &msg, const std::string &nickname) {
 	pbnetwork::ConversationMessage m;
-	m.set_username(user);
-	m.set_buddyname(legacyName);
+	SET_USER_AND_BUDDY(m, user, legacyName);
 	m.set_message(msg);
 	m.set_nickname(nickname);
 
@@ -177,8 +210,7 @@ void NetworkPlugin::handleSubject(const std::string &user, const std::string &le
 void NetworkPlugin::handleBuddyChanged(const std::string &user, const std::string &buddyName, const std::string &alias,
 			const std::vector<std::string> &groups, pbnetwork::StatusType status, const std::string &statusMessage, const std::string &iconHash, bool blocked) {
 	pbnetwork::Buddy buddy;
-	buddy.set_username(user);
-	buddy.set_buddyname(buddyName);
+	SET_USER_AND_BUDDY(buddy, user, buddyName);
 	buddy.set_alias(alias);
 	for (std::vector<std::string>::const_iterator it = groups.begin(); it != groups.end(); it++) {
 		buddy.add_group(*it);
@@ -198,8 +230,7 @@ void NetworkPlugin::handleBuddyChanged(const std::string &user, const std::strin
 
 void NetworkPlugin::handleBuddyRemoved(const std::string &user, const std::string &buddyName) {
 	pbnetwork::Buddy buddy;
-	buddy.set_username(user);
-	buddy.set_buddyname(buddyName);
+	SET_USER_AND_BUDDY(buddy, user, buddyName);
 
 	std::string message;
 	buddy.SerializeToString(&message);
@@ -211,8 +242,7 @@ void NetworkPlugin::handleBuddyRemoved(const std::string &user, const std::strin
 
 void NetworkPlugin::handleBuddyTyping(const std::string &user, const std::string &buddyName) {
 	pbnetwork::Buddy buddy;
-	buddy.set_username(user);
-	buddy.set_buddyname(buddyName);
+	SET_USER_AND_BUDDY(buddy, user, buddyName);
 
 	std::string message;
 	buddy.SerializeToString(&message);
@@ -224,8 +254,7 @@ void NetworkPlugin::handleBuddyTyping(const std::string &user, const std::string
 
 void NetworkPlugin::handleBuddyTyped(const std::string &user, const std::string &buddyName) {
 	pbnetwork::Buddy buddy;
-	buddy.set_username(user);
-	buddy.set_buddyname(buddyName);
+	SET_USER_AND_BUDDY(buddy, user, buddyName);
 
 	std::string message;
 	buddy.SerializeToString(&message);
@@ -237,8 +266,7 @@ void NetworkPlugin::handleBuddyTyped(const std::string &user, const std::string
 
 void NetworkPlugin::handleBuddyStoppedTyping(const std::string &user, const std::string &buddyName) {
 	pbnetwork::Buddy buddy;
-	buddy.set_username(user);
-	buddy.set_buddyname(buddyName);
+	SET_USER_AND_BUDDY(buddy, user, buddyName);
 
 	std::string message;
 	buddy.SerializeToString(&message);
@@ -250,8 +278,7 @@ void NetworkPlugin::handleBuddyStoppedTyping(const std::string &user, const std:
 
 void NetworkPlugin::handleAuthorization(const std::string &user, const std::string &buddyName) {
 	pbnetwork::Buddy buddy;
-	buddy.set_username(user);
-	buddy.set_buddyname(buddyName);
+	SET_USER_AND_BUDDY(buddy, user, buddyName);
 
 	std::string message;
 	buddy.SerializeToString(&message);
@@ -289,7 +316,7 @@ void NetworkPlugin::handleDisconnected(const std::string &user, int error, const
 
 void NetworkPlugin::handleParticipantChanged(const std::string &user, const std::string &nickname, const std::string &room, int flags, pbnetwork::StatusType status, const std::string &statusMessage, const std::string &newname) {
 	pbnetwork::Participant d;
-	d.set_username(user);
+	SET_USER(d, user);
 	d.set_nickname(nickname);
 	d.set_room(room);
 	d.set_flag(flags);
@@ -305,9 +332,35 @@ void NetworkPlugin::handleParticipantChanged(const std::string &user, const std:
 	send(message);
 }
 
+void NetworkPlugin::handleParticipantList(const std::string &user, const std::string &room, const std::list<Participant> &participants) {
+	pbnetwork::ParticipantList d;
+	SET_USER(d, user);
+	d.set_room(room);
+	for (std::list<Participant>::const_iterator it = participants.begin(); it != participants.end(); it++) {
+		pbnetwork::ParticipantListItem *item = d.add_participant();
+		item->set_nickname(it->nickname);
+		if (it->flags != 0) {
+			item->set_flag(it->flags);
+		}
+		if (it->status != pbnetwork::STATUS_ONLINE) {
+			item->set_status(it->status);
+		}
+		if (!it->statusMessage.empty()) {
+			item->set_statusmessage(it->statusMessage);
+		}
+	}
+
+	std::string message;
+	d.SerializeToString(&message);
+
+	WRAP(message, pbnetwork::WrapperMessage_Type_TYPE_PARTICIPANT_LIST);
+
+	send(message);
+}
+
 void NetworkPlugin::handleRoomNicknameChanged(const std::string &user, const std::string &r, const std::string &nickname) {
 	pbnetwork::Room room;
-	room.set_username(user);
+	SET_USER(room, user);
 	room.set_nickname(nickname);
 	room.set_room(r);
 	room.set_password("");
@@ -322,7 +375,7 @@ void NetworkPlugin::handleRoomNicknameChanged(const std::string &user, const std
 
 void NetworkPlugin::handleFTStart(const std::string &user, const std::string &buddyName, const std::string fileName, unsigned long size) {
 	pbnetwork::File room;
-	room.set_username(user);
+	SET_USER(room, user);
 	room.set_buddyname(buddyName);
 	room.set_filename(fileName);
 	room.set_size(size);
@@ -337,7 +390,7 @@ void NetworkPlugin::handleFTStart(const std::string &user, const std::string &bu
 
 void NetworkPlugin::handleFTFinish(const std::string &user, const std::string &buddyName, const std::string fileName, unsigned long size, unsigned long ftid) {
 	pbnetwork::File room;
-	room.set_username(user);
+	SET_USER(room, user);
 	room.set_buddyname(buddyName);
 	room.set_filename(fileName);
 	room.set_size(size);
@@ -390,6 +443,19 @@ void NetworkPlugin::handleLoginPayload(const std::string &data) {
 		// TODO: ERROR
 		return;
 	}
+
+	// Spectrum 2 assigned session handle to this user, so we can use it
+	// instead of user's JID in messages we send.
+	if (payload.session() != 0) {
+		Session &session = m_sessions[payload.user()];
+		session.id = payload.session();
+		session.lastBuddyID = 0;
+		session.buddies.clear();
+	}
+	else {
+		m_sessions.erase(payload.user());
+	}
+
 	handleLoginRequest(payload.user(), payload.legacyname(), payload.password());
 }
 
@@ -399,9 +465,41 @@ void NetworkPlugin::handleLogoutPayload(const std::string &data) {
 		// TODO: ERROR
 		return;
 	}
+	// Session is not valid anymore once the user logs out.
+	m_sessions.erase(payload.user());
+
 	handleLogoutRequest(payload.user(), payload.legacyname());
 }
 
+NetworkPlugin::Session *NetworkPlugin::getSession(const std::string &user) {
+	if (m_sessions.empty()) {
+		return NULL;
+	}
+
+	std::map<std::string, Session>::iterator it = m_sessions.find(user);
+	if (it == m_sessions.end()) {
+		return NULL;
+	}
+
+	return &it->second;
+}
+
+unsigned int NetworkPlugin::getBuddyID(Session *session, const std::string &buddyName, bool &isNew) {
+	std::map<std::string, unsigned int>::iterator it = session->buddies.find(buddyName);
+	if (it != session->buddies.end()) {
+		isNew = false;
+		return it->second;
+	}
+
+	isNew = true;
+	if (session->lastBuddyID >= MAX_BUDDY_ID) {
+		return 0;
+	}
+
+	session->buddies[buddyName] = ++session->lastBuddyID;
+	return session->lastBuddyID;
+}
+
 void NetworkPlugin::handleStatusChangedPayload(const std::string &data) {
 	pbnetwork::Status payload;
 	if (payload.ParseFromString(data) == false) {
@@ -575,25 +673,35 @@ void NetworkPlugin::handleChatStatePayload(const std::string &data, int type) {
 void NetworkPlugin::handleDataRead(std::string &data) {
 	m_data.insert(m_data.end(), data.begin(), data.end());
 
-	while (m_data.size() != 0) {
+	// Some backends run nested event loop in the handlers. New data are
+	// handled by the outer call then, so m_wrapper and offset stay valid.
+	if (m_parsing) {
+		return;
+	}
+	m_parsing = true;
+
+	// Parsed messages are erased from m_data at once at the end, so the rest
+	// of the buffer is not moved after every message.
+	size_t offset = 0;
+	while (m_data.size() - offset != 0) {
 		unsigned int expected_size;
 
-		if (m_data.size() >= 4) {
-			expected_size = *((unsigned int*) &m_data[0]);
+		if (m_data.size() - offset >= 4) {
+			expected_size = *((unsigned int*) &m_data[offset]);
 			expected_size = ntohl(expected_size);
-			if (m_data.size() - 4 < expected_size)
-				return;
+			if (m_data.size() - offset - 4 < expected_size)
+				break;
 		}
 		else {
-			return;
+			break;
 		}
 
-		pbnetwork::WrapperMessage wrapper;
-		if (wrapper.ParseFromArray(&m_data[4], expected_size) == false) {
-			m_data.erase(m_data.begin(), m_data.begin() + 4 + expected_size);
-			return;
+		pbnetwork::WrapperMessage &wrapper = m_wrapper;
+		bool parsed = wrapper.ParseFromArray(&m_data[offset + 4], expected_size);
+		offset += 4 + expected_size;
+		if (parsed == false) {
+			break;
 		}
-		m_data.erase(m_data.begin(), m_data.begin() + 4 + expected_size);
 
 		switch(wrapper.type()) {
 			case pbnetwork::WrapperMessage_Type_TYPE_LOGIN:
@@ -660,9 +768,12 @@ void NetworkPlugin::handleDataRead(std::string &data) {
 				handleRawXML(wrapper.payload());
 				break;
 			default:
-				return;
+				break;
 		}
 	}
+
+	m_data.erase(0, offset);
+	m_parsing = false;
 }
 
 void NetworkPlugin::send(const std::string &data) {
@@ -144,6 +144,22 @@ class NetworkPlugin:
 		self.send(message);
 
 
+	def handleParticipantList(self, user, room, participants):
+		"""participants is list of (nickname, flags, status, statusMessage) tuples."""
+		d = protocol_pb2.ParticipantList()
+		d.userName = user
+		d.room = room
+		for (nickname, flags, status, statusMessage) in participants:
+			item = d.participant.add()
+			item.nickname = nickname
+			item.flag = flags
+			item.status = status
+			item.statusMessage = statusMessage
+
+		message = WRAP(d.SerializeToString(), protocol_pb2.WrapperMessage.TYPE_PARTICIPANT_LIST)
+		self.send(message);
+
+
 	def handleRoomNicknameChanged(self, user, r, nickname):
 		room = protocol_pb2.Room()
 		room.userName = user
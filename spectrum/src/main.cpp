@@ -9,7 +9,9 @@
 #include "transport/networkpluginserver.h"
 #include "transport/admininterface.h"
 #include "transport/statsresponder.h"
+#include "transport/metricsserver.h"
 #include "transport/usersreconnecter.h"
+#include "transport/sessionsnapshot.h"
 #include "transport/util.h"
 #include "transport/gatewayresponder.h"
 #include "transport/logging.h"
@@ -48,8 +50,12 @@ Swift::SimpleEventLoop *eventLoop_ = NULL;
 Component *component_ = NULL;
 UserManager *userManager_ = NULL;
 Config *config_ = NULL;
+SessionSnapshot *sessionSnapshot_ = NULL;
 
 static void stop_spectrum() {
+	if (sessionSnapshot_) {
+		sessionSnapshot_->save();
+	}
 	userManager_->removeAllUsers(false);
 	component_->stop();
 	eventLoop_->stop();
@@ -237,13 +243,21 @@ int mainloop() {
 	UserManager userManager(&transport, &userRegistry, &discoItemsResponder, storageBackend);
 	userManager_ = &userManager;
 
+	SessionSnapshot *sessionSnapshot = NULL;
+	if (storageBackend && !CONFIG_STRING(config_, "service.session_snapshot").empty()) {
+		sessionSnapshot = new SessionSnapshot(&transport, &userManager, CONFIG_STRING(config_, "service.session_snapshot"));
+		sessionSnapshot->load();
+		userManager.setSessionSnapshot(sessionSnapshot);
+		sessionSnapshot_ = sessionSnapshot;
+	}
+
 	UserRegistration *userRegistration = NULL;
 	UsersReconnecter *usersReconnecter = NULL;
 	if (storageBackend) {
 		userRegistration = new UserRegistration(&transport, &userManager, storageBackend);
 		userRegistration->start();
 
-		usersReconnecter = new UsersReconnecter(&transport, storageBackend);
+		usersReconnecter = new UsersReconnecter(&transport, &userManager, storageBackend, sessionSnapshot);
 	}
 	else if (!CONFIG_BOOL(config_, "service.server_mode")) {
 		LOG4CXX_WARN(logger, "Registrations won't work, you have specified [database] type=none in config file.");
@@ -260,6 +274,9 @@ int mainloop() {
 	StatsResponder statsResponder(&transport, &userManager, &plugin, storageBackend);
 	statsResponder.start();
 
+	MetricsServer metricsServer(&transport);
+	metricsServer.start();
+
 	GatewayResponder gatewayResponder(transport.getIQRouter(), &userManager);
 	gatewayResponder.start();
 
@@ -286,6 +303,12 @@ int mainloop() {
 		delete usersReconnecter;
 	}
 
+	if (sessionSnapshot) {
+		userManager.setSessionSnapshot(NULL);
+		sessionSnapshot_ = NULL;
+		delete sessionSnapshot;
+	}
+
 	delete storageBackend;
 	delete factories;
 	return 0;
@@ -28,6 +28,7 @@
 #include "transport/user.h"
 #include "transport/logging.h"
 #include "transport/storagebackend.h"
+#include "transport/transport.h"
 
 namespace Transport {
 
@@ -39,15 +40,10 @@ AdHocManager::AdHocManager(Component *component, DiscoItemsResponder *discoItems
 	m_userManager = userManager;
 	m_storageBackend = storageBackend;
 
-	m_collectTimer = m_component->getNetworkFactories()->getTimerFactory()->createTimer(20);
-	m_collectTimer->onTick.connect(boost::bind(&AdHocManager::removeOldSessions, this));
-	m_collectTimer->start();
-
 	m_userManager->onUserCreated.connect(boost::bind(&AdHocManager::handleUserCreated, this, _1));
 }
 
 AdHocManager::~AdHocManager() {
-	m_collectTimer->stop();
 	stop();
 }
 
@@ -66,6 +62,11 @@ void AdHocManager::stop() {
 	}
 
 	m_sessions.clear();
+
+	for (std::map<AdHocCommand *, TimerWheel::ID>::iterator it = m_sessionTimeouts.begin(); it != m_sessionTimeouts.end(); it++) {
+		m_component->getTimerWheel()->cancel(it->second);
+	}
+	m_sessionTimeouts.clear();
 }
 
 void AdHocManager::handleUserCreated(User *user) {
@@ -91,37 +92,39 @@ void AdHocManager::addAdHocCommand(AdHocCommandFactory *factory) {
 	m_discoItemsResponder->addAdHocCommand(factory->getNode(), factory->getName());
 }
 
-void AdHocManager::removeOldSessions() {
-	unsigned long removedCommands = 0;
-	time_t now = time(NULL);
-
-	std::vector<std::string> toRemove;
-	for (SessionsMap::iterator it = m_sessions.begin(); it != m_sessions.end(); it++) {
-		std::vector<std::string> candidates;
-		for (CommandsMap::iterator ct = it->second.begin(); ct != it->second.end(); ct++) {
-			if (now - ct->second->getLastActivity() > 15*60) {
-				candidates.push_back(it->first);
-				delete ct->second;
-				removedCommands++;
-			}
-		}
+void AdHocManager::scheduleSessionTimeout(const Swift::JID &from, AdHocCommand *command, int timeout) {
+	m_sessionTimeouts[command] = m_component->getTimerWheel()->schedule(timeout * 1000,
+		boost::bind(&AdHocManager::handleSessionTimeout, this, from, command->getId()));
+}
 
-		BOOST_FOREACH(std::string &key, candidates) {
-			it->second.erase(key);
-		}
+void AdHocManager::handleSessionTimeout(const Swift::JID &from, const std::string &sessionID) {
+	AdHocCommand *command = m_sessions[from][sessionID];
+	m_sessionTimeouts.erase(command);
 
-		if (it->second.empty()) {
-			toRemove.push_back(it->first);
-		}
+	// Session has been used since the deadline was scheduled, so wait
+	// for the rest of its inactivity period.
+	time_t inactive = time(NULL) - command->getLastActivity();
+	if (inactive <= 15*60) {
+		scheduleSessionTimeout(from, command, 15*60 - inactive + 1);
+		return;
 	}
 
-	BOOST_FOREACH(std::string &key, toRemove) {
-		m_sessions.erase(key);
+	LOG4CXX_INFO(logger, from.toString() << ": Removing old command session " << sessionID);
+	removeSession(from, command);
+}
+
+void AdHocManager::removeSession(const Swift::JID &from, AdHocCommand *command) {
+	std::map<AdHocCommand *, TimerWheel::ID>::iterator it = m_sessionTimeouts.find(command);
+	if (it != m_sessionTimeouts.end()) {
+		m_component->getTimerWheel()->cancel(it->second);
+		m_sessionTimeouts.erase(it);
 	}
 
-	if (removedCommands > 0) {
-		LOG4CXX_INFO(logger, "Removed " << removedCommands << " old commands sessions.");
+	m_sessions[from].erase(command->getId());
+	if (m_sessions[from].empty()) {
+		m_sessions.erase(from);
 	}
+	delete command;
 }
 
 bool AdHocManager::handleGetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::Command> payload) {
@@ -145,6 +148,7 @@ bool AdHocManager::handleSetRequest(const Swift::JID& from, const Swift::JID& to
 	else if (m_factories.find(payload->getNode()) != m_factories.end()) {
 		command = m_factories[payload->getNode()]->createAdHocCommand(m_component, m_userManager, m_storageBackend, from, to);
 		m_sessions[from][command->getId()] = command;
+		scheduleSessionTimeout(from, command, 15*60);
 		LOG4CXX_INFO(logger, from.toString() << ": Started new AdHoc command session with node " << payload->getNode());
 	}
 	else {
@@ -175,16 +179,12 @@ bool AdHocManager::handleSetRequest(const Swift::JID& from, const Swift::JID& to
 	// Command completed, so we can remove it now
 	if (response->getStatus() == Swift::Command::Completed || response->getStatus() == Swift::Command::Canceled) {
 		// update userSettings map if user is already connected
-		User *user = m_userManager->getUser(from.toBare().toString());
+		User *user = m_userManager->getUser(from);
 		if (user) {
 			handleUserCreated(user);
 		}
 
-		m_sessions[from].erase(command->getId());
-		if (m_sessions[from].empty()) {
-			m_sessions.erase(from);
-		}
-		delete command;
+		removeSession(from, command);
 	}
 	
 
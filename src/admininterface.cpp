@@ -30,6 +30,7 @@
 #include "transport/userregistration.h"
 #include "storageresponder.h"
 #include "transport/memoryusage.h"
+#include "transport/metrics.h"
 #include <boost/foreach.hpp>
 
 namespace Transport {
@@ -255,6 +256,9 @@ void AdminInterface::handleQuery(Swift::Message::ref message) {
 		int msgCount = m_userManager->getMessagesToXMPP();
 		message->setBody(boost::lexical_cast<std::string>(msgCount));
 	}
+	else if (message->getBody() == "metrics") {
+		message->setBody(m_component->getMetrics()->toPrometheus());
+	}
 	else if (message->getBody().find("register ") == 0 && m_userRegistration) {
 		std::string body = message->getBody();
 		std::vector<std::string> args;
@@ -317,6 +321,8 @@ void AdminInterface::handleQuery(Swift::Message::ref message) {
 		help += "    backends_count - number of active backends\n";
 		help += "    crashed_backends - returns IDs of crashed backends\n";
 		help += "    crashed_backends_count - returns number of crashed backends\n";
+		help += "Metrics:\n";
+		help += "    metrics - returns all counters and latency histograms in Prometheus text format\n";
 		help += "Memory:\n";
 		help += "    res_memory - Total RESident memory spectrum2 and its backends use in KB\n";
 		help += "    shr_memory - Total SHaRed memory spectrum2 backends share together in KB\n";
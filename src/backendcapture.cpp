@@ -0,0 +1,143 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/backendcapture.h"
+#include "transport/logging.h"
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
+namespace Transport {
+
+DEFINE_LOGGER(logger, "BackendCapture");
+
+#define BACKEND_CAPTURE_MAGIC "SPECTRUM2CAP1"
+#define RECORD_HEADER_SIZE 17
+
+static void putInt(std::string &data, unsigned long value) {
+	data += (char) ((value >> 24) & 0xff);
+	data += (char) ((value >> 16) & 0xff);
+	data += (char) ((value >> 8) & 0xff);
+	data += (char) (value & 0xff);
+}
+
+static unsigned long getInt(const std::string &data, size_t pos) {
+	return ((unsigned long) (unsigned char) data[pos] << 24) | ((unsigned long) (unsigned char) data[pos + 1] << 16)
+		| ((unsigned long) (unsigned char) data[pos + 2] << 8) | (unsigned long) (unsigned char) data[pos + 3];
+}
+
+BackendCapture::BackendCapture(const std::string &path) {
+	m_nextBackend = 0;
+
+#ifndef WIN32
+	// Capture contains credentials and messages, so only we can read it.
+	mode_t old_cmask = umask(0077);
+#endif
+	m_file.open(path.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+#ifndef WIN32
+	umask(old_cmask);
+#endif
+	if (!m_file.is_open()) {
+		LOG4CXX_ERROR(logger, "Can't open backend capture file " << path);
+		return;
+	}
+
+#ifndef WIN32
+	// umask doesn't change the mode of already existing file.
+	chmod(path.c_str(), S_IRUSR | S_IWUSR);
+#endif
+
+	LOG4CXX_INFO(logger, "Recording traffic between Spectrum 2 and backends to " << path);
+	m_file.write(BACKEND_CAPTURE_MAGIC, sizeof(BACKEND_CAPTURE_MAGIC) - 1);
+}
+
+BackendCapture::~BackendCapture() {
+	if (m_file.is_open()) {
+		m_file.close();
+	}
+}
+
+void BackendCapture::record(const void *backend, Direction direction, const std::string &frame, double time) {
+	if (!m_file.is_open()) {
+		return;
+	}
+
+	std::map<const void *, unsigned long>::iterator it = m_backends.find(backend);
+	if (it == m_backends.end()) {
+		it = m_backends.insert(std::make_pair(backend, m_nextBackend++)).first;
+	}
+
+	unsigned long seconds = (unsigned long) time;
+	std::string header;
+	header.reserve(RECORD_HEADER_SIZE);
+	putInt(header, seconds);
+	putInt(header, (unsigned long) ((time - seconds) * 1000000));
+	header += (char) direction;
+	putInt(header, it->second);
+	putInt(header, frame.size());
+
+	m_file.write(header.c_str(), header.size());
+	m_file.write(frame.c_str(), frame.size());
+}
+
+void BackendCapture::removeBackend(const void *backend) {
+	m_backends.erase(backend);
+}
+
+bool BackendCapture::load(const std::string &path, std::vector<Record> &records) {
+	std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::string magic(sizeof(BACKEND_CAPTURE_MAGIC) - 1, 0);
+	if (!file.read(&magic[0], magic.size()) || magic != BACKEND_CAPTURE_MAGIC) {
+		return false;
+	}
+
+	file.seekg(0, std::ios::end);
+	unsigned long fileSize = file.tellg();
+	file.seekg(magic.size());
+
+	std::string header(RECORD_HEADER_SIZE, 0);
+	while (file.read(&header[0], RECORD_HEADER_SIZE)) {
+		Record record;
+		record.time = getInt(header, 0) + getInt(header, 4) / 1000000.0;
+		record.direction = header[8] == ToBackend ? ToBackend : FromBackend;
+		record.backend = getInt(header, 9);
+
+		// Corrupted frame size must not make us allocate more memory
+		// than the rest of the file.
+		unsigned long size = getInt(header, 13);
+		if (size > fileSize - (unsigned long) file.tellg()) {
+			break;
+		}
+
+		record.frame.resize(size);
+		if (!record.frame.empty() && !file.read(&record.frame[0], record.frame.size())) {
+			break;
+		}
+		records.push_back(record);
+	}
+
+	return true;
+}
+
+}
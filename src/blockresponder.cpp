@@ -46,7 +46,7 @@ BlockResponder::~BlockResponder() {
 }
 
 bool BlockResponder::handleSetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Transport::BlockPayload> info) {
-	User *user = m_userManager->getUser(from.toBare().toString());
+	User *user = m_userManager->getUser(from);
 	if (!user) {
 		LOG4CXX_WARN(logger, from.toBare().toString() << ": User is not logged in");
 		return true;
@@ -0,0 +1,158 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/chatstatefilter.h"
+
+namespace Transport {
+
+// Returns true if the delayed state of entry will be forwarded by flush().
+static inline bool willForward(int sent, int pending) {
+	return pending != -1 && pending != sent;
+}
+
+ChatStateFilter::ChatStateFilter(double window) {
+	m_window = window;
+	m_saved = 0;
+	m_pendingCount = 0;
+}
+
+ChatStateFilter::Result ChatStateFilter::filter(const std::string &user, const std::string &buddy, int state, double now, bool coalesce) {
+	BuddyEntries &entries = m_entries[user];
+	BuddyEntries::iterator it = entries.find(buddy);
+	if (it == entries.end()) {
+		Entry &entry = entries[buddy];
+		entry.sent = state;
+		entry.pending = -1;
+		entry.lastSent = now;
+		return Forward;
+	}
+
+	Entry &entry = it->second;
+
+	// There's already delayed state, so just replace it. It will be
+	// forwarded once the window expires.
+	if (entry.pending != -1 && coalesce) {
+		if (willForward(entry.sent, entry.pending)) {
+			m_pendingCount--;
+		}
+		entry.pending = state;
+		if (willForward(entry.sent, entry.pending)) {
+			m_pendingCount++;
+		}
+		m_saved++;
+		return Delay;
+	}
+
+	if (willForward(entry.sent, entry.pending)) {
+		m_pendingCount--;
+	}
+	entry.pending = -1;
+	if (entry.sent == state) {
+		m_saved++;
+		return Suppress;
+	}
+
+	if (coalesce && m_window > 0 && now - entry.lastSent < m_window) {
+		entry.pending = state;
+		m_pending.push_back(std::make_pair(user, buddy));
+		m_pendingCount++;
+		m_saved++;
+		return Delay;
+	}
+
+	entry.sent = state;
+	entry.lastSent = now;
+	return Forward;
+}
+
+void ChatStateFilter::flush(double now, std::vector<State> &states) {
+	std::list<std::pair<std::string, std::string> >::iterator it = m_pending.begin();
+	while (it != m_pending.end()) {
+		std::map<std::string, BuddyEntries>::iterator u = m_entries.find(it->first);
+		if (u == m_entries.end()) {
+			it = m_pending.erase(it);
+			continue;
+		}
+
+		BuddyEntries::iterator b = u->second.find(it->second);
+		if (b == u->second.end() || b->second.pending == -1) {
+			it = m_pending.erase(it);
+			continue;
+		}
+
+		Entry &entry = b->second;
+		if (now - entry.lastSent < m_window) {
+			it++;
+			continue;
+		}
+
+		// The delayed state has been counted as saved, but now we forward it.
+		if (entry.pending != entry.sent) {
+			State state;
+			state.user = it->first;
+			state.buddy = it->second;
+			state.state = entry.pending;
+			states.push_back(state);
+
+			entry.sent = entry.pending;
+			entry.lastSent = now;
+			m_saved--;
+			m_pendingCount--;
+		}
+		entry.pending = -1;
+		it = m_pending.erase(it);
+	}
+}
+
+void ChatStateFilter::reset(const std::string &user, const std::string &buddy) {
+	std::map<std::string, BuddyEntries>::iterator u = m_entries.find(user);
+	if (u == m_entries.end()) {
+		return;
+	}
+
+	BuddyEntries::iterator b = u->second.find(buddy);
+	if (b == u->second.end()) {
+		return;
+	}
+
+	if (willForward(b->second.sent, b->second.pending)) {
+		m_pendingCount--;
+	}
+	u->second.erase(b);
+	if (u->second.empty()) {
+		m_entries.erase(u);
+	}
+}
+
+void ChatStateFilter::removeUser(const std::string &user) {
+	std::map<std::string, BuddyEntries>::iterator u = m_entries.find(user);
+	if (u == m_entries.end()) {
+		return;
+	}
+
+	for (BuddyEntries::iterator b = u->second.begin(); b != u->second.end(); b++) {
+		if (willForward(b->second.sent, b->second.pending)) {
+			m_pendingCount--;
+		}
+	}
+	m_entries.erase(u);
+}
+
+}
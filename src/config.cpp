@@ -103,6 +103,23 @@ bool Config::load(std::istream &ifs, boost::program_options::options_description
 		("service.vip_only", value<bool>()->default_value(false), "")
 		("service.vip_message", value<std::string>()->default_value(""), "")
 		("service.reconnect_on_start", value<bool>()->default_value(false), "Connect all users with 'stay_connected' == 1 on start.")
+		("service.ft_spool_threshold", value<int>()->default_value(1000000), "Number of bytes of file transfer data buffered in memory before the rest is stored in temporary file. 0 disables it.")
+		("service.ft_spool_limit", value<int>()->default_value(100000000), "Maximum size of temporary file of one file transfer. The backend is paused when it's reached. 0 means unlimited.")
+		("service.reconnect_concurrency", value<int>()->default_value(200), "Maximum number of users reconnected after restart which can log in at the same time.")
+		("service.user_rate_limit", value<int>()->default_value(0), "Number of messages per second one user can send to backend. 0 means unlimited.")
+		("service.user_rate_burst", value<int>()->default_value(10), "Number of messages one user can send to backend at once.")
+		("service.backend_rate_limit", value<int>()->default_value(0), "Number of messages per second all users can send to one backend. 0 means unlimited.")
+		("service.backend_rate_burst", value<int>()->default_value(100), "Number of messages all users can send to one backend at once.")
+		("service.rate_limit_queue_size", value<int>()->default_value(100), "Maximum number of rate-limited messages queued per user.")
+		("service.chatstate_coalesce_time", value<int>()->default_value(0), "Time in milliseconds in which chat state changes are coalesced. 0 disables coalescing.")
+		("service.message_cache_memory", value<int>()->default_value(0), "Maximum size in KB of messages cached in memory for all users. 0 means unlimited.")
+		("service.message_cache_max", value<int>()->default_value(100), "Maximum number of messages cached per conversation.")
+		("service.message_cache_spool", value<std::string>()->default_value(""), "File where cached messages are stored when message_cache_memory is exceeded.")
+		("service.session_snapshot", value<std::string>()->default_value(""), "File where the state of online users is stored when Spectrum 2 stops and restored from when it starts. Empty value disables it.")
+		("service.backend_capture", value<std::string>()->default_value(""), "File where all frames exchanged with backends are recorded. Empty value disables recording.")
+		("service.metrics_host", value<std::string>()->default_value("127.0.0.1"), "Host to bind HTTP server exporting metrics to")
+		("service.metrics_port", value<int>()->default_value(0), "Port of HTTP server exporting metrics in Prometheus format. 0 disables it.")
+		("service.irc_shared_channels", value<bool>()->default_value(false), "Track participants of IRC channels once for all users connected to the same IRC server.")
 		("vhosts.vhost", value<std::vector<std::string> >()->multitoken(), "")
 		("identity.name", value<std::string>()->default_value("Spectrum 2 Transport"), "Name showed in service discovery.")
 		("identity.category", value<std::string>()->default_value("gateway"), "Disco#info identity category. 'gateway' by default.")
@@ -133,6 +150,10 @@ bool Config::load(std::istream &ifs, boost::program_options::options_description
 		("database.vip_statement", value<std::string>()->default_value(""), "Encryption key.")
 		("logging.config", value<std::string>()->default_value(""), "Path to log4cxx config file which is used for Spectrum 2 instance")
 		("logging.backend_config", value<std::string>()->default_value(""), "Path to log4cxx config file which is used for backends")
+		("logging.async", value<bool>()->default_value(false), "Write log records from separate thread")
+		("logging.async_queue_size", value<int>()->default_value(10000), "Maximum number of log records waiting for the writer thread")
+		("logging.async_overflow", value<std::string>()->default_value("drop"), "What to do when the queue is full: 'drop' drops INFO and DEBUG records first, 'block' waits")
+		("logging.rate_limit", value<int>()->default_value(0), "Maximum number of INFO and DEBUG records per second per logger. 0 means unlimited.")
 		("backend.default_avatar", value<std::string>()->default_value(""), "Full path to default avatar")
 		("backend.avatars_directory", value<std::string>()->default_value(""), "Path to directory with avatars")
 		("backend.no_vcard_fetch", value<bool>()->default_value(false), "True if VCards for buddies should not be fetched. Only avatars will be forwarded.")
@@ -140,6 +161,10 @@ bool Config::load(std::istream &ifs, boost::program_options::options_description
 		("proxy.user", value<std::string>()->default_value(""), "Proxy user.")
 		("proxy.password", value<std::string>()->default_value(""), "Proxy Password.")
 		("proxy.port", value<int>()->default_value(0), "Proxy port.")
+		("twitter.poll_interval", value<int>()->default_value(90), "Initial interval in seconds between two polls of user's timeline or direct messages.")
+		("twitter.poll_interval_min", value<int>()->default_value(30), "Minimal poll interval in seconds used for active users.")
+		("twitter.poll_interval_max", value<int>()->default_value(300), "Maximal poll interval in seconds used for inactive users.")
+		("twitter.last_id_flush_interval", value<int>()->default_value(60), "Interval in seconds in which last tweet and direct message IDs are stored in database.")
 
 	;
 
@@ -248,6 +273,7 @@ bool Config::load(std::istream &ifs, boost::program_options::options_description
 	store(parsed, m_variables);
 	notify(m_variables);
 
+	updateSnapshot();
 	onConfigReloaded();
 
 	return true;
@@ -326,13 +352,33 @@ void Config::updateBackendConfig(const std::string &backendConfig) {
 	store(parsed, m_backendConfig);
 	notify(m_backendConfig);
 
-	onBackendConfigUpdated();
-
 	if (CONFIG_BOOL_DEFAULTED(this, "features.disable_jid_escaping", false)) {
 		Variables::iterator it(m_variables.find("service.jid_escaping"));
 		boost::program_options::variable_value& vx(it->second);
 		vx.value() = false;
 	}
+
+	updateSnapshot();
+	onBackendConfigUpdated();
+}
+
+void Config::updateSnapshot() {
+	// Build the new snapshot completely before replacing the current one.
+	boost::shared_ptr<ConfigSnapshot> snapshot(new ConfigSnapshot());
+	snapshot->jid = CONFIG_STRING_DEFAULTED(this, "service.jid", "");
+	snapshot->protocol = CONFIG_STRING_DEFAULTED(this, "service.protocol", "");
+	snapshot->serverMode = CONFIG_BOOL_DEFAULTED(this, "service.server_mode", false);
+	snapshot->usersPerBackend = CONFIG_INT_DEFAULTED(this, "service.users_per_backend", 100);
+	snapshot->reuseOldBackends = CONFIG_BOOL_DEFAULTED(this, "service.reuse_old_backends", true);
+	snapshot->moreResources = CONFIG_BOOL_DEFAULTED(this, "service.more_resources", false);
+	snapshot->enableXHTML = CONFIG_BOOL_DEFAULTED(this, "service.enable_xhtml", true);
+	snapshot->jidEscaping = CONFIG_BOOL_DEFAULTED(this, "service.jid_escaping", true);
+	snapshot->adminJIDs = CONFIG_VECTOR(this, "service.admin_jid");
+	snapshot->ftSpoolThreshold = CONFIG_INT_DEFAULTED(this, "service.ft_spool_threshold", 1000000);
+	snapshot->ftSpoolLimit = CONFIG_INT_DEFAULTED(this, "service.ft_spool_limit", 100000000);
+	snapshot->rawXML = CONFIG_BOOL_DEFAULTED(this, "features.rawxml", false);
+	snapshot->noVCardFetch = CONFIG_BOOL_DEFAULTED(this, "backend.no_vcard_fetch", false);
+	m_snapshot = snapshot;
 }
 
 Config *Config::createFromArgs(int argc, char **argv, std::string &error, std::string &host, int &port) {
@@ -19,12 +19,14 @@
  */
 
 #include <iostream>
+#include <vector>
 #include "transport/conversation.h"
 #include "transport/conversationmanager.h"
 #include "transport/user.h"
 #include "transport/transport.h"
 #include "transport/buddy.h"
 #include "transport/rostermanager.h"
+#include "transport/messagecache.h"
 
 #include "Swiften/Elements/MUCItem.h"
 #include "Swiften/Elements/MUCOccupant.h"
@@ -38,25 +40,25 @@ Conversation::Conversation(ConversationManager *conversationManager, const std::
 	m_legacyName = legacyName;
 	m_muc = isMUC;
 	m_jid = m_conversationManager->getUser()->getJID().toBare();
+	m_cacheKey = MessageCache::getKey(m_jid.toString(), m_legacyName);
 	m_sentInitialPresence = false;
 	m_nicknameChanged = false;
 
-	if (CONFIG_BOOL_DEFAULTED(conversationManager->getComponent()->getConfig(), "features.rawxml", false)) {
+	if (conversationManager->getComponent()->getConfig()->getSnapshot()->rawXML) {
 		m_sentInitialPresence = true;
 	}
 }
 
 Conversation::~Conversation() {
+	// Keep the undelivered messages in spool, so they can be sent once the
+	// conversation is created again.
+	m_conversationManager->getComponent()->getMessageCache()->release(m_cacheKey);
 }
 
 void Conversation::destroyRoom() {
 	if (m_muc) {
 		Swift::Presence::ref presence = Swift::Presence::create();
-		std::string legacyName = m_legacyName;
-		if (legacyName.find_last_of("@") != std::string::npos) {
-			legacyName.replace(legacyName.find_last_of("@"), 1, "%"); // OK
-		}
-		presence->setFrom(Swift::JID(legacyName, m_conversationManager->getComponent()->getJID().toBare(), m_nickname));
+		presence->setFrom(Swift::JID(getParticipantNode(), m_conversationManager->getComponent()->getJID().toBare(), m_nickname));
 		presence->setType(Swift::Presence::Unavailable);
 
 		Swift::MUCItem item;
@@ -85,6 +87,7 @@ void Conversation::destroyRoom() {
 void Conversation::setRoom(const std::string &room) {
 	m_room = room;
 	m_legacyName = m_room + "/" + m_legacyName;
+	m_cacheKey = MessageCache::getKey(m_jid.toString(), m_legacyName);
 }
 
 void Conversation::cacheMessage(boost::shared_ptr<Swift::Message> &message) {
@@ -92,10 +95,7 @@ void Conversation::cacheMessage(boost::shared_ptr<Swift::Message> &message) {
 	boost::shared_ptr<Swift::Delay> delay(boost::make_shared<Swift::Delay>());
 	delay->setStamp(timestamp);
 	message->addPayload(delay);
-	m_cachedMessages.push_back(message);
-	if (m_cachedMessages.size() > 100) {
-		m_cachedMessages.pop_front();
-	}
+	m_conversationManager->getComponent()->getMessageCache()->add(m_cacheKey, message);
 }
 
 void Conversation::handleRawMessage(boost::shared_ptr<Swift::Message> &message) {
@@ -104,6 +104,11 @@ void Conversation::handleRawMessage(boost::shared_ptr<Swift::Message> &message)
 			cacheMessage(message);
 		}
 		else {
+			// There can be messages spooled from the previous session, they
+			// have to be delivered first.
+			if (m_conversationManager->getComponent()->getMessageCache()->contains(m_cacheKey)) {
+				sendCachedMessages();
+			}
 			m_conversationManager->getComponent()->getStanzaChannel()->sendMessage(message);
 		}
 	}
@@ -155,7 +160,7 @@ void Conversation::handleMessage(boost::shared_ptr<Swift::Message> &message, con
 			}
 			else {
 				std::string name = m_legacyName;
-				if (CONFIG_BOOL_DEFAULTED(m_conversationManager->getComponent()->getConfig(), "service.jid_escaping", true)) {
+				if (m_conversationManager->getComponent()->getConfig()->getSnapshot()->jidEscaping) {
 					name = Swift::JID::getEscapedNode(m_legacyName);
 				}
 				else {
@@ -206,14 +211,18 @@ void Conversation::sendParticipants(const Swift::JID &to) {
 }
 
 void Conversation::sendCachedMessages(const Swift::JID &to) {
-	for (std::list<boost::shared_ptr<Swift::Message> >::const_iterator it = m_cachedMessages.begin(); it != m_cachedMessages.end(); it++) {
+	// Messages are popped one by one, so the spooled ones are not loaded
+	// into memory all at once.
+	MessageCache *cache = m_conversationManager->getComponent()->getMessageCache();
+	boost::shared_ptr<Swift::Message> message;
+	while (cache->pop(m_cacheKey, message)) {
 		if (to.isValid()) {
-			(*it)->setTo(to);
+			message->setTo(to);
 		}
 		else {
-			(*it)->setTo(m_jid.toBare());
+			message->setTo(m_jid.toBare());
 		}
-		m_conversationManager->getComponent()->getStanzaChannel()->sendMessage(*it);
+		m_conversationManager->getComponent()->getStanzaChannel()->sendMessage(message);
 	}
 
 	if (m_subject) {
@@ -225,20 +234,22 @@ void Conversation::sendCachedMessages(const Swift::JID &to) {
 		}
 		m_conversationManager->getComponent()->getStanzaChannel()->sendMessage(m_subject);
 	}
-
-	m_cachedMessages.clear();
 }
 
-Swift::Presence::ref Conversation::generatePresence(const std::string &nick, int flag, int status, const std::string &statusMessage, const std::string &newname) {
-	std::string nickname = nick;
-	Swift::Presence::ref presence = Swift::Presence::create();
+std::string Conversation::getParticipantNode() {
 	std::string legacyName = m_legacyName;
 	if (m_muc) {
 		if (legacyName.find_last_of("@") != std::string::npos) {
 			legacyName.replace(legacyName.find_last_of("@"), 1, "%"); // OK
 		}
 	}
-	presence->setFrom(Swift::JID(legacyName, m_conversationManager->getComponent()->getJID().toBare(), nickname));
+	return legacyName;
+}
+
+Swift::Presence::ref Conversation::generatePresence(const std::string &nick, int flag, int status, const std::string &statusMessage, const std::string &newname) {
+	std::string nickname = nick;
+	Swift::Presence::ref presence = Swift::Presence::create();
+	presence->setFrom(Swift::JID(getParticipantNode(), m_conversationManager->getComponent()->getJID().toBare(), nickname));
 	presence->setType(Swift::Presence::Available);
 
 	if (!statusMessage.empty())
@@ -351,4 +362,74 @@ void Conversation::handleParticipantChanged(const std::string &nick, Conversatio
 	}
 }
 
+void Conversation::handleParticipantList(const std::list<Participant> &participants) {
+	std::string legacyName = getParticipantNode();
+	std::string domain = m_conversationManager->getComponent()->getJID().toBare();
+
+	// All ordinary participants have one of these two payloads, so they are
+	// created just once instead of once per participant.
+	boost::shared_ptr<Swift::MUCUserPayload> payloads[2];
+	for (int i = 0; i < 2; i++) {
+		Swift::MUCItem item;
+		item.affiliation = i ? Swift::MUCOccupant::Admin : Swift::MUCOccupant::Member;
+		item.role = i ? Swift::MUCOccupant::Moderator : Swift::MUCOccupant::Participant;
+		payloads[i] = boost::shared_ptr<Swift::MUCUserPayload>(new Swift::MUCUserPayload());
+		payloads[i]->addItem(item);
+	}
+
+	std::vector<Swift::Presence::ref> presences;
+	presences.reserve(participants.size());
+	Swift::Presence::ref ownPresence;
+	for (std::list<Participant>::const_iterator it = participants.begin(); it != participants.end(); it++) {
+		Swift::StatusShow s((Swift::StatusShow::Type) it->status);
+
+		// Our own presence, errors and participants who left need special
+		// handling, so they are generated the usual way.
+		if (it->nickname == m_nickname || s.getType() == Swift::StatusShow::None || (it->flag & ~PARTICIPANT_FLAG_MODERATOR) != 0) {
+			Swift::Presence::ref presence = generatePresence(it->nickname, it->flag, it->status, it->statusMessage);
+			if (presence->getType() == Swift::Presence::Unavailable) {
+				m_participants.erase(it->nickname);
+				presences.push_back(presence);
+			}
+			else if (it->nickname == m_nickname) {
+				m_participants[it->nickname] = presence;
+				ownPresence = presence;
+			}
+			else {
+				m_participants[it->nickname] = presence;
+				presences.push_back(presence);
+			}
+			continue;
+		}
+
+		Swift::Presence::ref presence = Swift::Presence::create();
+		presence->setFrom(Swift::JID(legacyName, domain, it->nickname));
+		presence->setType(Swift::Presence::Available);
+		if (!it->statusMessage.empty())
+			presence->setStatus(it->statusMessage);
+		presence->setShow(s.getType());
+		presence->addPayload(payloads[(it->flag & PARTICIPANT_FLAG_MODERATOR) ? 1 : 0]);
+
+		m_participants[it->nickname] = presence;
+		presences.push_back(presence);
+	}
+
+	// XEP-0045 requires the user's own presence to be the last one.
+	if (ownPresence) {
+		presences.push_back(ownPresence);
+	}
+
+	BOOST_FOREACH(const Swift::JID &jid, m_jids) {
+		for (std::vector<Swift::Presence::ref>::const_iterator it = presences.begin(); it != presences.end(); it++) {
+			(*it)->setTo(jid);
+			m_conversationManager->getComponent()->getStanzaChannel()->sendPresence(*it);
+		}
+	}
+
+	if (m_sentInitialPresence && m_subject) {
+		m_conversationManager->getComponent()->getStanzaChannel()->sendMessage(m_subject);
+		m_subject.reset();
+	}
+}
+
 }
@@ -24,10 +24,15 @@
 #include "transport/buddy.h"
 #include "transport/factory.h"
 #include "transport/user.h"
+#include "transport/transport.h"
+#include "transport/messagecache.h"
 #include "transport/logging.h"
 #include "Swiften/Roster/SetRosterRequest.h"
 #include "Swiften/Elements/RosterPayload.h"
 #include "Swiften/Elements/RosterItemPayload.h"
+#include <boost/foreach.hpp>
+#include <set>
+#include <vector>
 
 namespace Transport {
 
@@ -51,6 +56,39 @@ void ConversationManager::sendCachedChatMessages() {
 	}
 }
 
+void ConversationManager::sendSpooledMessages() {
+	MessageCache *cache = m_component->getMessageCache();
+	std::vector<std::string> keys;
+	cache->getKeys(m_user->getJID().toBare().toString(), keys);
+	if (keys.empty()) {
+		return;
+	}
+
+	// Messages of existing conversations are sent by the conversations.
+	std::set<std::string> used;
+	for (std::map<std::string, Conversation *>::const_iterator it = m_convs.begin(); it != m_convs.end(); it++) {
+		used.insert((*it).second->getCacheKey());
+	}
+
+	BOOST_FOREACH(const std::string &key, keys) {
+		if (used.find(key) != used.end()) {
+			continue;
+		}
+
+		boost::shared_ptr<Swift::Message> message;
+		while (cache->pop(key, message)) {
+			if (message->getType() == Swift::Message::Groupchat) {
+				LOG4CXX_INFO(logger, m_user->getJID().toString() << ": Removing cached groupchat messages " << key);
+				cache->remove(key);
+				break;
+			}
+
+			message->setTo(m_user->getJID().toBare());
+			m_component->getStanzaChannel()->sendMessage(message);
+		}
+	}
+}
+
 void ConversationManager::deleteAllConversations() {
 	while(!m_convs.empty()) {
 		LOG4CXX_INFO(logger, m_user->getJID().toString() << ": Removing conversation " << (*m_convs.begin()).first);
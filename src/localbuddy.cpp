@@ -40,8 +40,12 @@ LocalBuddy::~LocalBuddy() {
 void LocalBuddy::setStatus(const Swift::StatusShow &status, const std::string &statusMessage) {
 	bool changed = ((m_status.getType() != status.getType()) || (m_statusMessage != statusMessage));
 	if (changed) {
+		bool wasAvailable = isAvailable();
 		m_status = status;
 		m_statusMessage = statusMessage;
+		if (wasAvailable != isAvailable()) {
+			getRosterManager()->handleBuddyAvailabilityChanged(this);
+		}
 		sendPresence();
 	}
 }
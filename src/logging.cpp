@@ -21,10 +21,15 @@
 #include "transport/logging.h"
 #include "transport/config.h"
 #include "transport/util.h"
+#include "transport/ratelimiter.h"
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include <iostream>
 #include <iterator>
 #include <algorithm>
+#include <deque>
+#include <map>
 
 
 #include <boost/filesystem.hpp>
@@ -43,6 +48,12 @@
 #define getpid _getpid
 #endif
 
+#ifdef WITH_LOG4CXX
+#include "log4cxx/appenderskeleton.h"
+#include "log4cxx/spi/loggingevent.h"
+#include "log4cxx/helpers/pool.h"
+#endif
+
 using namespace boost::filesystem;
 
 
@@ -90,6 +101,225 @@ private:
 static intercept_stream* intercepter_cout;
 static intercept_stream* intercepter_cerr;
 
+// Appender which takes over the appenders of root logger. It limits the number
+// of INFO and DEBUG records per logger and optionally passes the records to
+// the writer thread, so slow disk doesn't block the event loop.
+class QueuedAppender : public AppenderSkeleton {
+	public:
+		DECLARE_LOG4CXX_OBJECT(QueuedAppender)
+		BEGIN_LOG4CXX_CAST_MAP()
+			LOG4CXX_CAST_ENTRY(QueuedAppender)
+			LOG4CXX_CAST_ENTRY_CHAIN(AppenderSkeleton)
+		END_LOG4CXX_CAST_MAP()
+
+		QueuedAppender() : m_rate(0), m_size(0), m_block(false), m_stop(false), m_dropped(0), m_thread(NULL) {
+		}
+
+		~QueuedAppender() {
+			finalize();
+		}
+
+		void setAppenders(const AppenderList &appenders) {
+			m_appenders = appenders;
+		}
+
+		// rate is the number of INFO and DEBUG records per second per logger, 0 means unlimited.
+		void setRateLimit(double rate) {
+			m_rate = rate;
+		}
+
+		// size 0 means the records are written synchronously.
+		void setQueue(size_t size, bool block) {
+			m_size = size;
+			m_block = block;
+		}
+
+		void start() {
+			if (m_size > 0) {
+				m_thread = new boost::thread(boost::bind(&QueuedAppender::run, this));
+			}
+		}
+
+		void close() {
+			if (closed) {
+				return;
+			}
+			closed = true;
+
+			if (m_thread) {
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+					m_stop = true;
+					m_notEmpty.notify_one();
+				}
+				m_thread->join();
+				delete m_thread;
+				m_thread = NULL;
+			}
+
+			BOOST_FOREACH(AppenderPtr &appender, m_appenders) {
+				appender->close();
+			}
+		}
+
+		bool requiresLayout() const {
+			return false;
+		}
+
+	protected:
+		void append(const spi::LoggingEventPtr &event, helpers::Pool &pool) {
+			unsigned long suppressed = 0;
+			if (!sample(event, suppressed)) {
+				return;
+			}
+
+			if (suppressed != 0) {
+				enqueue(createEvent(event->getLoggerName(), Level::getInfo(), boost::lexical_cast<std::string>(suppressed) + " records suppressed by logging.rate_limit"), pool);
+			}
+			enqueue(event, pool);
+		}
+
+	private:
+		struct Sampler {
+			Sampler(double rate) : bucket(rate, rate), suppressed(0) {}
+			TokenBucket bucket;
+			unsigned long suppressed;
+		};
+
+		static bool isDroppable(const spi::LoggingEventPtr &event) {
+			return !event->getLevel()->isGreaterOrEqual(Level::getWarn());
+		}
+
+		static spi::LoggingEventPtr createEvent(const LogString &logger, const LevelPtr &level, const std::string &message) {
+			LogString msg;
+			helpers::Transcoder::decode(message, msg);
+			return new spi::LoggingEvent(logger, level, msg, spi::LocationInfo::getLocationUnavailable());
+		}
+
+		bool sample(const spi::LoggingEventPtr &event, unsigned long &suppressed) {
+			if (m_rate <= 0 || !isDroppable(event)) {
+				return true;
+			}
+
+			std::map<LogString, Sampler>::iterator it = m_samplers.find(event->getLoggerName());
+			if (it == m_samplers.end()) {
+				it = m_samplers.insert(std::make_pair(event->getLoggerName(), Sampler(m_rate))).first;
+			}
+
+			if (!it->second.bucket.consume(event->getTimeStamp() / 1000000.0)) {
+				it->second.suppressed++;
+				return false;
+			}
+
+			suppressed = it->second.suppressed;
+			it->second.suppressed = 0;
+			return true;
+		}
+
+		void enqueue(const spi::LoggingEventPtr &event, helpers::Pool &pool) {
+			if (!m_thread) {
+				dispatch(event, pool);
+				return;
+			}
+
+			// NDC and MDC are thread local, so they have to be copied before
+			// the event is passed to the writer thread.
+			LogString ndc;
+			event->getNDC(ndc);
+			event->getMDCCopy();
+
+			boost::mutex::scoped_lock lock(m_mutex);
+			while (m_queue.size() >= m_size) {
+				if (!m_block) {
+					if (isDroppable(event)) {
+						m_dropped++;
+						return;
+					}
+
+					// Make space for WARN and ERROR by dropping the oldest INFO or DEBUG record.
+					std::deque<spi::LoggingEventPtr>::iterator it = std::find_if(m_queue.begin(), m_queue.end(), &QueuedAppender::isDroppable);
+					if (it != m_queue.end()) {
+						m_queue.erase(it);
+						m_dropped++;
+						break;
+					}
+				}
+				m_notFull.wait(lock);
+			}
+
+			m_queue.push_back(event);
+			m_notEmpty.notify_one();
+		}
+
+		void dispatch(const spi::LoggingEventPtr &event, helpers::Pool &pool) {
+			BOOST_FOREACH(AppenderPtr &appender, m_appenders) {
+				appender->doAppend(event, pool);
+			}
+		}
+
+		void run() {
+			helpers::Pool pool;
+			std::deque<spi::LoggingEventPtr> events;
+			bool stop = false;
+			while (!stop) {
+				unsigned long dropped;
+				{
+					boost::mutex::scoped_lock lock(m_mutex);
+					while (m_queue.empty() && !m_stop) {
+						m_notEmpty.wait(lock);
+					}
+					events.swap(m_queue);
+					dropped = m_dropped;
+					m_dropped = 0;
+					stop = m_stop;
+					m_notFull.notify_all();
+				}
+
+				if (dropped != 0) {
+					dispatch(createEvent(LOG4CXX_STR("Logging"), Level::getWarn(), boost::lexical_cast<std::string>(dropped) + " records dropped because the logging queue was full"), pool);
+				}
+
+				BOOST_FOREACH(spi::LoggingEventPtr &event, events) {
+					dispatch(event, pool);
+				}
+				events.clear();
+			}
+		}
+
+		AppenderList m_appenders;
+		double m_rate;
+		std::map<LogString, Sampler> m_samplers;
+		size_t m_size;
+		bool m_block;
+		bool m_stop;
+		unsigned long m_dropped;
+		std::deque<spi::LoggingEventPtr> m_queue;
+		boost::mutex m_mutex;
+		boost::condition_variable m_notEmpty;
+		boost::condition_variable m_notFull;
+		boost::thread *m_thread;
+};
+
+IMPLEMENT_LOG4CXX_OBJECT(QueuedAppender)
+
+static void initQueuedAppender(Config *config) {
+	size_t size = CONFIG_BOOL(config, "logging.async") ? CONFIG_INT(config, "logging.async_queue_size") : 0;
+	int rate = CONFIG_INT(config, "logging.rate_limit");
+	if (size == 0 && rate <= 0) {
+		return;
+	}
+
+	LoggerPtr rootLogger = log4cxx::Logger::getRootLogger();
+	QueuedAppender *appender = new QueuedAppender();
+	appender->setAppenders(rootLogger->getAllAppenders());
+	appender->setRateLimit(rate);
+	appender->setQueue(size, CONFIG_STRING(config, "logging.async_overflow") == "block");
+	appender->start();
+
+	rootLogger->removeAllAppenders();
+	rootLogger->addAppender(AppenderPtr(appender));
+}
+
 
 static void initLogging(Config *config, std::string key, bool only_create_dir = false) {
 	if (CONFIG_STRING(config, key).empty()) {
@@ -195,12 +425,14 @@ static void initLogging(Config *config, std::string key, bool only_create_dir =
 
 void initBackendLogging(Config *config) {
 	initLogging(config, "logging.backend_config");
+	initQueuedAppender(config);
 
 	redirect_stderr();
 }
 
 void initMainLogging(Config *config) {
 	initLogging(config, "logging.config");
+	initQueuedAppender(config);
 	initLogging(config, "logging.backend_config", true);
 }
 
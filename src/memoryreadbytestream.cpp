@@ -19,55 +19,153 @@
  */
 
 #include "transport/memoryreadbytestream.h"
+#include "transport/logging.h"
+#include <algorithm>
 #include <boost/foreach.hpp>
 
 namespace Transport {
-	
-MemoryReadBytestream::MemoryReadBytestream(unsigned long size) {
+
+DEFINE_LOGGER(logger, "MemoryReadBytestream");
+
+MemoryReadBytestream::MemoryReadBytestream(unsigned long size, unsigned long spoolThreshold, unsigned long spoolLimit) {
 	neededData = false;
 	m_finished = false;
 	m_sent = 0;
 	m_size = size;
+	m_offset = 0;
+	m_memorySize = 0;
+	m_spoolSize = 0;
+	m_spoolThreshold = spoolThreshold;
+	m_spoolLimit = spoolLimit;
+	m_spool = NULL;
+	m_spoolEnd = 0;
 }
 
 MemoryReadBytestream::~MemoryReadBytestream() {
-	
+	if (m_spool) {
+		fclose(m_spool);
+	}
+}
+
+bool MemoryReadBytestream::spool(const std::string &data, long &offset) {
+	if (!m_spool) {
+		// tmpfile() removes the file automatically once it's closed.
+		m_spool = tmpfile();
+		if (!m_spool) {
+			LOG4CXX_ERROR(logger, "Can't create temporary file, keeping file transfer data in memory");
+			m_spoolThreshold = 0;
+			return false;
+		}
+	}
+
+	if (fseek(m_spool, m_spoolEnd, SEEK_SET) != 0 || fwrite(data.c_str(), 1, data.size(), m_spool) != data.size()) {
+		LOG4CXX_ERROR(logger, "Can't write to temporary file, keeping file transfer data in memory");
+		return false;
+	}
+
+	offset = m_spoolEnd;
+	m_spoolEnd += data.size();
+	return true;
 }
 
 unsigned long MemoryReadBytestream::appendData(const std::string &data) {
-	m_data += data;
+	return appendData(boost::shared_ptr<std::string>(new std::string(data)));
+}
+
+unsigned long MemoryReadBytestream::appendData(const boost::shared_ptr<std::string> &data) {
+	if (!data->empty()) {
+		Chunk chunk;
+		chunk.size = data->size();
+		chunk.offset = 0;
+		if (m_spoolThreshold != 0 && m_memorySize + chunk.size > m_spoolThreshold && spool(*data, chunk.offset)) {
+			m_spoolSize += chunk.size;
+		}
+		else {
+			chunk.data = data;
+			m_memorySize += chunk.size;
+		}
+		m_chunks.push_back(chunk);
+	}
+
 	onDataAvailable();
 	neededData = false;
-	return m_data.size();
+	return m_memorySize;
 }
 
-boost::shared_ptr<std::vector<unsigned char> > MemoryReadBytestream::read(size_t size) {
-	if (m_data.empty()) {
-		onDataNeeded();
-		return boost::shared_ptr<std::vector<unsigned char> >(new std::vector<unsigned char>());
+void MemoryReadBytestream::popChunk() {
+	if (m_chunks.front().data) {
+		m_memorySize -= m_chunks.front().size;
 	}
+	else {
+		m_spoolSize -= m_chunks.front().size;
+		// Nothing is stored in the temporary file anymore, so reuse it from the beginning.
+		if (m_spoolSize == 0) {
+			m_spoolEnd = 0;
+		}
+	}
+	m_chunks.pop_front();
+	m_offset = 0;
+}
 
-	if (m_data.size() < size) {
-		boost::shared_ptr<std::vector<unsigned char> > ptr(new std::vector<unsigned char>(m_data.begin(), m_data.end()));
-		m_sent += m_data.size();
-		m_data.clear();
-		if (m_sent == m_size)
-			m_finished = true;
+boost::shared_ptr<std::vector<unsigned char> > MemoryReadBytestream::read(size_t size) {
+	boost::shared_ptr<std::vector<unsigned char> > ptr(new std::vector<unsigned char>());
+	if (m_chunks.empty()) {
 		onDataNeeded();
 		return ptr;
 	}
-	boost::shared_ptr<std::vector<unsigned char> > ptr(new std::vector<unsigned char>(m_data.begin(), m_data.begin() + size));
-	m_data.erase(m_data.begin(), m_data.begin() + size);
-	m_sent += size;
+
+	ptr->reserve(std::min<size_t>(size, m_memorySize + m_spoolSize - m_offset));
+	while (ptr->size() < size && !m_chunks.empty()) {
+		Chunk &chunk = m_chunks.front();
+		size_t len = std::min(size - ptr->size(), chunk.size - m_offset);
+
+		if (chunk.data) {
+			ptr->insert(ptr->end(), chunk.data->begin() + m_offset, chunk.data->begin() + m_offset + len);
+		}
+		else {
+			size_t oldSize = ptr->size();
+			ptr->resize(oldSize + len);
+			if (fseek(m_spool, chunk.offset + m_offset, SEEK_SET) != 0 || fread(&(*ptr)[oldSize], 1, len, m_spool) != len) {
+				LOG4CXX_ERROR(logger, "Can't read from temporary file, file transfer will be incomplete");
+				ptr->resize(oldSize);
+				while (!m_chunks.empty()) {
+					popChunk();
+				}
+				m_finished = true;
+				break;
+			}
+		}
+
+		m_offset += len;
+		if (m_offset == chunk.size) {
+			popChunk();
+		}
+	}
+
+	m_sent += ptr->size();
 	if (m_sent == m_size)
 		m_finished = true;
-	if (m_data.size() < 500000 && !neededData) {
+
+	if (m_chunks.empty()) {
+		onDataNeeded();
+	}
+	else if (m_memorySize + m_spoolSize - m_offset < 500000 && !neededData) {
 		neededData = true;
 		onDataNeeded();
 	}
 	return ptr;
 }
 
+bool MemoryReadBytestream::isFull() const {
+	// Without spooling, keep the old 5 MB memory limit.
+	if (m_memorySize > (m_spoolThreshold != 0 ? m_spoolThreshold : 5000000)) {
+		return true;
+	}
+	// Sent chunks are freed in the temporary file only once all spooled data
+	// are sent, so limit the size of the file, not just the unsent data.
+	return m_spoolLimit != 0 && (unsigned long) m_spoolEnd >= m_spoolLimit;
+}
+
 bool MemoryReadBytestream::isFinished() const {
 // 	std::cout << "finished? " << m_finished << "\n";
 	return m_finished;
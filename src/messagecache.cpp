@@ -0,0 +1,580 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/messagecache.h"
+#include "transport/logging.h"
+
+#include <cstdio>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "Swiften/Elements/Delay.h"
+#include "Swiften/Elements/XHTMLIMPayload.h"
+
+namespace Transport {
+
+DEFINE_LOGGER(logger, "MessageCache");
+
+// Rough size of Swift::Message with Delay payload without the strings.
+#define MESSAGE_OVERHEAD 512
+
+// Spool is compacted when it contains more dead bytes than this and
+// more dead bytes than live ones.
+#define SPOOL_COMPACT_SIZE (1024 * 1024)
+
+#define RECORD_MESSAGE 'M'
+#define RECORD_REMOVED 'R'
+
+static void putInt(std::string &data, unsigned long value) {
+	data += (char) ((value >> 24) & 0xff);
+	data += (char) ((value >> 16) & 0xff);
+	data += (char) ((value >> 8) & 0xff);
+	data += (char) (value & 0xff);
+}
+
+static void putString(std::string &data, const std::string &value) {
+	putInt(data, value.size());
+	data += value;
+}
+
+static bool getInt(const std::string &data, size_t &pos, unsigned long &value) {
+	if (pos + 4 > data.size()) {
+		return false;
+	}
+	value = ((unsigned long) (unsigned char) data[pos] << 24) | ((unsigned long) (unsigned char) data[pos + 1] << 16)
+		| ((unsigned long) (unsigned char) data[pos + 2] << 8) | (unsigned long) (unsigned char) data[pos + 3];
+	pos += 4;
+	return true;
+}
+
+static bool getString(const std::string &data, size_t &pos, std::string &value) {
+	unsigned long size;
+	if (!getInt(data, pos, size) || pos + size > data.size()) {
+		return false;
+	}
+	value = data.substr(pos, size);
+	pos += size;
+	return true;
+}
+
+MessageCache::MessageCache(unsigned long memoryLimit, unsigned long conversationLimit, const std::string &spool) {
+	m_memoryLimit = memoryLimit;
+	m_conversationLimit = conversationLimit;
+	m_spoolPath = spool;
+	m_spoolEnabled = false;
+	m_spoolSize = 0;
+	m_spoolLiveSize = 0;
+	m_spoolCount = 0;
+	m_memoryUsage = 0;
+	m_dropped = 0;
+
+	if (!m_spoolPath.empty()) {
+		loadSpool();
+	}
+}
+
+MessageCache::~MessageCache() {
+	for (std::map<std::string, Queue *>::iterator it = m_queues.begin(); it != m_queues.end(); it++) {
+		spillQueue(it->second);
+		delete it->second;
+	}
+
+	if (m_spoolEnabled) {
+		m_spool.close();
+	}
+}
+
+MessageCache::Queue *MessageCache::getQueue(const std::string &key) {
+	std::map<std::string, Queue *>::iterator it = m_queues.find(key);
+	if (it != m_queues.end()) {
+		return it->second;
+	}
+
+	Queue *queue = new Queue;
+	queue->key = key;
+	queue->popped = 0;
+	m_queues[key] = queue;
+	return queue;
+}
+
+void MessageCache::removeQueueIfEmpty(Queue *queue) {
+	if (!queue->memory.empty() || !queue->spool.empty()) {
+		return;
+	}
+
+	m_queues.erase(queue->key);
+	delete queue;
+}
+
+unsigned long MessageCache::getSize(boost::shared_ptr<Swift::Message> message) {
+	unsigned long size = MESSAGE_OVERHEAD;
+	size += message->getBody().size() + message->getSubject().size();
+	size += message->getFrom().getNode().size() + message->getFrom().getDomain().size() + message->getFrom().getResource().size();
+
+	boost::shared_ptr<Swift::XHTMLIMPayload> xhtml = message->getPayload<Swift::XHTMLIMPayload>();
+	if (xhtml) {
+		size += xhtml->getBody().size();
+	}
+	return size;
+}
+
+void MessageCache::removeMemoryItem(Queue *queue) {
+	std::list<Item>::iterator it = queue->memory.front();
+	queue->memory.pop_front();
+	m_memoryUsage -= it->size;
+	m_memory.erase(it);
+}
+
+void MessageCache::removeOldest(Queue *queue) {
+	m_dropped++;
+	if (!queue->spool.empty()) {
+		m_spoolLiveSize -= queue->spool.front().size;
+		m_spoolCount--;
+		queue->spool.pop_front();
+		writeRemoved(queue, 1);
+	}
+	else {
+		removeMemoryItem(queue);
+	}
+}
+
+void MessageCache::spillOldest() {
+	Queue *queue = m_memory.front().queue;
+	boost::shared_ptr<Swift::Message> message = m_memory.front().message;
+	removeMemoryItem(queue);
+
+	if (!m_spoolEnabled || !writeMessage(queue, message)) {
+		m_dropped++;
+	}
+
+	removeQueueIfEmpty(queue);
+}
+
+void MessageCache::add(const std::string &key, boost::shared_ptr<Swift::Message> message) {
+	Queue *queue = getQueue(key);
+	while (m_conversationLimit != 0 && queue->memory.size() + queue->spool.size() >= m_conversationLimit) {
+		removeOldest(queue);
+	}
+
+	Item item;
+	item.queue = queue;
+	item.message = message;
+	item.size = getSize(message);
+	queue->memory.push_back(m_memory.insert(m_memory.end(), item));
+	m_memoryUsage += item.size;
+
+	while (m_memoryLimit != 0 && m_memoryUsage > m_memoryLimit) {
+		spillOldest();
+	}
+}
+
+bool MessageCache::pop(const std::string &key, boost::shared_ptr<Swift::Message> &message) {
+	std::map<std::string, Queue *>::iterator it = m_queues.find(key);
+	if (it == m_queues.end()) {
+		return false;
+	}
+
+	Queue *queue = it->second;
+
+	// Spooled messages are always older than the ones in memory.
+	while (!queue->spool.empty()) {
+		Record record = queue->spool.front();
+		queue->spool.pop_front();
+		m_spoolLiveSize -= record.size;
+		m_spoolCount--;
+		queue->popped++;
+
+		// Store the removal before the message is handed out, so it's not
+		// delivered again if we crash before the spool is updated.
+		bool read = readMessage(record, message);
+		writeRemoved(queue, 0);
+
+		if (read) {
+			removeQueueIfEmpty(queue);
+			return true;
+		}
+	}
+
+	if (!queue->memory.empty()) {
+		message = queue->memory.front()->message;
+		removeMemoryItem(queue);
+		removeQueueIfEmpty(queue);
+		return true;
+	}
+
+	removeQueueIfEmpty(queue);
+	return false;
+}
+
+void MessageCache::remove(const std::string &key) {
+	std::map<std::string, Queue *>::iterator it = m_queues.find(key);
+	if (it == m_queues.end()) {
+		return;
+	}
+
+	Queue *queue = it->second;
+	unsigned long count = queue->spool.size();
+	while (!queue->spool.empty()) {
+		m_spoolLiveSize -= queue->spool.front().size;
+		m_spoolCount--;
+		queue->spool.pop_front();
+	}
+	writeRemoved(queue, count);
+
+	while (!queue->memory.empty()) {
+		removeMemoryItem(queue);
+	}
+
+	removeQueueIfEmpty(queue);
+}
+
+void MessageCache::getKeys(const std::string &user, std::vector<std::string> &keys) const {
+	std::string prefix = getKey(user, "");
+	for (std::map<std::string, Queue *>::const_iterator it = m_queues.lower_bound(prefix); it != m_queues.end(); it++) {
+		if (it->first.compare(0, prefix.size(), prefix) != 0) {
+			break;
+		}
+		keys.push_back(it->first);
+	}
+}
+
+void MessageCache::release(const std::string &key) {
+	if (!m_spoolEnabled) {
+		remove(key);
+		return;
+	}
+
+	std::map<std::string, Queue *>::iterator it = m_queues.find(key);
+	if (it == m_queues.end()) {
+		return;
+	}
+
+	spillQueue(it->second);
+	removeQueueIfEmpty(it->second);
+}
+
+void MessageCache::spillQueue(Queue *queue) {
+	writeRemoved(queue, 0);
+	while (!queue->memory.empty()) {
+		boost::shared_ptr<Swift::Message> message = queue->memory.front()->message;
+		removeMemoryItem(queue);
+		if (!m_spoolEnabled || !writeMessage(queue, message)) {
+			m_dropped++;
+		}
+	}
+}
+
+void MessageCache::openSpool(bool truncate) {
+	if (m_spool.is_open()) {
+		m_spool.close();
+	}
+	m_spool.clear();
+
+	// std::fstream can't open nonexistent file for both reading and writing,
+	// so create it first.
+	if (!truncate) {
+		m_spool.open(m_spoolPath.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	}
+	if (!m_spool.is_open()) {
+		std::ofstream create(m_spoolPath.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+		create.close();
+		m_spool.clear();
+		m_spool.open(m_spoolPath.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+		m_spoolSize = 0;
+	}
+
+	m_spoolEnabled = m_spool.is_open();
+	if (!m_spoolEnabled) {
+		LOG4CXX_ERROR(logger, "Can't open message spool " << m_spoolPath << ". Cached messages will be dropped when the memory limit is reached.");
+	}
+}
+
+void MessageCache::loadSpool() {
+	openSpool(false);
+	if (!m_spoolEnabled) {
+		return;
+	}
+
+	m_spool.seekg(0, std::ios::end);
+	unsigned long fileSize = m_spool.tellg();
+	m_spool.seekg(0);
+
+	bool broken = false;
+	std::string header(4, 0);
+	std::string data;
+	while (m_spool.read(&header[0], 4)) {
+		size_t pos = 0;
+		unsigned long size;
+		getInt(header, pos, size);
+
+		// Don't trust the length of corrupted record and allocate memory
+		// for more data than the file has.
+		if (size == 0 || size > fileSize - m_spoolSize - 4) {
+			broken = true;
+			break;
+		}
+
+		data.resize(size);
+		if (!m_spool.read(&data[0], size)) {
+			broken = true;
+			break;
+		}
+
+		pos = 1;
+		std::string key;
+		if (!getString(data, pos, key)) {
+			broken = true;
+			break;
+		}
+
+		if (data[0] == RECORD_MESSAGE) {
+			Record record;
+			record.offset = m_spoolSize;
+			record.size = 4 + size;
+			getQueue(key)->spool.push_back(record);
+			m_spoolLiveSize += record.size;
+			m_spoolCount++;
+		}
+		else if (data[0] == RECORD_REMOVED) {
+			unsigned long count;
+			if (!getInt(data, pos, count)) {
+				broken = true;
+				break;
+			}
+
+			Queue *queue = getQueue(key);
+			while (count-- != 0 && !queue->spool.empty()) {
+				m_spoolLiveSize -= queue->spool.front().size;
+				m_spoolCount--;
+				queue->spool.pop_front();
+			}
+			removeQueueIfEmpty(queue);
+		}
+		m_spoolSize += 4 + size;
+	}
+
+	if (!m_spool.eof() || m_spool.gcount() != 0) {
+		broken = true;
+	}
+	m_spool.clear();
+
+	LOG4CXX_INFO(logger, "Loaded " << m_spoolCount << " spooled messages for " << m_queues.size() << " conversations from " << m_spoolPath);
+
+	// Partially written record at the end of the file. Rewrite the spool,
+	// so we don't append new records after it.
+	if (broken) {
+		LOG4CXX_ERROR(logger, "Message spool " << m_spoolPath << " is truncated or corrupted after offset " << m_spoolSize);
+		compactSpool();
+	}
+
+	if (m_conversationLimit != 0) {
+		std::vector<Queue *> queues;
+		for (std::map<std::string, Queue *>::iterator it = m_queues.begin(); it != m_queues.end(); it++) {
+			queues.push_back(it->second);
+		}
+		for (std::vector<Queue *>::iterator it = queues.begin(); it != queues.end(); it++) {
+			while ((*it)->spool.size() > m_conversationLimit) {
+				removeOldest(*it);
+			}
+		}
+	}
+}
+
+bool MessageCache::writeMessage(Queue *queue, boost::shared_ptr<Swift::Message> message) {
+	std::string xhtml;
+	boost::shared_ptr<Swift::XHTMLIMPayload> xhtmlPayload = message->getPayload<Swift::XHTMLIMPayload>();
+	if (xhtmlPayload) {
+		xhtml = xhtmlPayload->getBody();
+	}
+
+	// There's no reason to keep chat states and other messages without
+	// content for later.
+	if (message->getBody().empty() && message->getSubject().empty() && xhtml.empty()) {
+		return false;
+	}
+
+	std::string stamp;
+	boost::shared_ptr<Swift::Delay> delay = message->getPayload<Swift::Delay>();
+	if (delay) {
+		stamp = boost::posix_time::to_iso_string(delay->getStamp());
+	}
+
+	std::string data;
+	data += RECORD_MESSAGE;
+	putString(data, queue->key);
+	putInt(data, message->getType());
+	putString(data, message->getFrom().toString());
+	putString(data, message->getSubject());
+	putString(data, message->getBody());
+	putString(data, xhtml);
+	putString(data, stamp);
+
+	Record record;
+	record.offset = m_spoolSize;
+	record.size = 4 + data.size();
+	if (!appendRecord(data)) {
+		return false;
+	}
+
+	queue->spool.push_back(record);
+	m_spoolLiveSize += record.size;
+	m_spoolCount++;
+	return true;
+}
+
+bool MessageCache::readMessage(const Record &record, boost::shared_ptr<Swift::Message> &message) {
+	std::string data(record.size - 4, 0);
+	m_spool.seekg(record.offset + 4);
+	if (!m_spool.read(&data[0], data.size())) {
+		LOG4CXX_ERROR(logger, "Can't read spooled message at offset " << record.offset);
+		m_spool.clear();
+		return false;
+	}
+
+	size_t pos = 1;
+	std::string key, from, subject, body, xhtml, stamp;
+	unsigned long type;
+	if (data[0] != RECORD_MESSAGE || !getString(data, pos, key) || !getInt(data, pos, type)
+		|| !getString(data, pos, from) || !getString(data, pos, subject) || !getString(data, pos, body)
+		|| !getString(data, pos, xhtml) || !getString(data, pos, stamp)) {
+		LOG4CXX_ERROR(logger, "Corrupted spooled message at offset " << record.offset);
+		return false;
+	}
+
+	message = boost::make_shared<Swift::Message>();
+	message->setType((Swift::Message::Type) type);
+	message->setFrom(Swift::JID(from));
+	if (!subject.empty()) {
+		message->setSubject(subject);
+	}
+	if (!body.empty()) {
+		message->setBody(body);
+	}
+	if (!xhtml.empty()) {
+		message->addPayload(boost::make_shared<Swift::XHTMLIMPayload>(xhtml));
+	}
+	if (!stamp.empty()) {
+		boost::shared_ptr<Swift::Delay> delay(boost::make_shared<Swift::Delay>());
+		delay->setStamp(boost::posix_time::from_iso_string(stamp));
+		message->addPayload(delay);
+	}
+	return true;
+}
+
+void MessageCache::writeRemoved(Queue *queue, unsigned long count) {
+	count += queue->popped;
+	queue->popped = 0;
+	if (count == 0 || !m_spoolEnabled) {
+		return;
+	}
+
+	if (m_spoolCount == 0) {
+		// Nothing alive in the spool, so we can just start again.
+		openSpool(true);
+		m_spoolLiveSize = 0;
+		return;
+	}
+
+	std::string data;
+	data += RECORD_REMOVED;
+	putString(data, queue->key);
+	putInt(data, count);
+	appendRecord(data);
+
+	unsigned long dead = m_spoolSize - m_spoolLiveSize;
+	if (dead > SPOOL_COMPACT_SIZE && dead > m_spoolLiveSize) {
+		compactSpool();
+	}
+}
+
+bool MessageCache::appendRecord(const std::string &data) {
+	std::string header;
+	putInt(header, data.size());
+
+	m_spool.seekp(m_spoolSize);
+	m_spool.write(header.c_str(), header.size());
+	m_spool.write(data.c_str(), data.size());
+	m_spool.flush();
+	if (!m_spool) {
+		// Next record will overwrite whatever has been written.
+		LOG4CXX_ERROR(logger, "Can't write to message spool " << m_spoolPath);
+		m_spool.clear();
+		return false;
+	}
+
+	m_spoolSize += header.size() + data.size();
+	return true;
+}
+
+void MessageCache::compactSpool() {
+	std::string path = m_spoolPath + ".new";
+	std::ofstream compacted(path.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!compacted.is_open()) {
+		LOG4CXX_ERROR(logger, "Can't open " << path << " to compact message spool");
+		return;
+	}
+
+	// Offsets are updated only once the new spool replaces the old one.
+	std::vector<unsigned long> offsets;
+	unsigned long size = 0;
+	std::string data;
+	for (std::map<std::string, Queue *>::iterator it = m_queues.begin(); it != m_queues.end(); it++) {
+		for (std::deque<Record>::iterator r = it->second->spool.begin(); r != it->second->spool.end(); r++) {
+			data.resize(r->size);
+			m_spool.seekg(r->offset);
+			m_spool.read(&data[0], data.size());
+			compacted.write(data.c_str(), data.size());
+			offsets.push_back(size);
+			size += r->size;
+		}
+	}
+	compacted.close();
+
+	if (!m_spool || !compacted) {
+		LOG4CXX_ERROR(logger, "Can't compact message spool " << m_spoolPath);
+		m_spool.clear();
+		std::remove(path.c_str());
+		return;
+	}
+
+	m_spool.close();
+	if (std::rename(path.c_str(), m_spoolPath.c_str()) != 0) {
+		LOG4CXX_ERROR(logger, "Can't rename " << path << " to " << m_spoolPath);
+		std::remove(path.c_str());
+		openSpool(false);
+		return;
+	}
+
+	std::vector<unsigned long>::const_iterator offset = offsets.begin();
+	for (std::map<std::string, Queue *>::iterator it = m_queues.begin(); it != m_queues.end(); it++) {
+		// Popped records are not in the new spool, so there's no need to
+		// store they have been removed.
+		it->second->popped = 0;
+		for (std::deque<Record>::iterator r = it->second->spool.begin(); r != it->second->spool.end(); r++) {
+			r->offset = *offset++;
+		}
+	}
+
+	openSpool(false);
+	m_spoolSize = size;
+	m_spoolLiveSize = size;
+}
+
+}
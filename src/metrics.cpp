@@ -0,0 +1,132 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/metrics.h"
+
+#include <sstream>
+#include <algorithm>
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+namespace Transport {
+
+// Latency buckets in seconds, from fast local operations to slow logins.
+static const double latencyBounds[] = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60 };
+
+Histogram::Histogram(const std::vector<double> &bounds) : m_bounds(bounds), m_counts(bounds.size() + 1, 0) {
+	m_count = 0;
+	m_sum = 0;
+}
+
+void Histogram::observe(double value) {
+	size_t bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) - m_bounds.begin();
+	m_counts[bucket]++;
+	m_count++;
+	m_sum += value;
+}
+
+Metrics::Metrics() : m_latencyBounds(latencyBounds, latencyBounds + sizeof(latencyBounds) / sizeof(double)) {
+}
+
+Metrics::~Metrics() {
+	for (std::map<std::string, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); it++) {
+		delete it->second.counter;
+		delete it->second.histogram;
+	}
+}
+
+Metrics::Entry &Metrics::getEntry(const std::string &name, const std::string &help) {
+	std::map<std::string, Entry>::iterator it = m_entries.find(name);
+	if (it == m_entries.end()) {
+		Entry entry;
+		entry.help = help;
+		entry.gauge = false;
+		entry.counter = NULL;
+		entry.histogram = NULL;
+		it = m_entries.insert(std::make_pair(name, entry)).first;
+	}
+	else if (it->second.help.empty()) {
+		it->second.help = help;
+	}
+	return it->second;
+}
+
+Counter *Metrics::getCounter(const std::string &name, const std::string &help) {
+	Entry &entry = getEntry(name, help);
+	if (!entry.counter) {
+		entry.counter = new Counter();
+	}
+	return entry.counter;
+}
+
+Counter *Metrics::getGauge(const std::string &name, const std::string &help) {
+	Entry &entry = getEntry(name, help);
+	if (!entry.counter) {
+		entry.counter = new Counter();
+		entry.gauge = true;
+	}
+	return entry.counter;
+}
+
+Histogram *Metrics::getHistogram(const std::string &name, const std::string &help) {
+	Entry &entry = getEntry(name, help);
+	if (!entry.histogram) {
+		entry.histogram = new Histogram(m_latencyBounds);
+	}
+	return entry.histogram;
+}
+
+std::string Metrics::toPrometheus() {
+	std::ostringstream out;
+	// Default precision would round sums of long running histograms.
+	out.precision(15);
+	for (std::map<std::string, Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); it++) {
+		const std::string &name = it->first;
+		const Entry &entry = it->second;
+		if (!entry.help.empty()) {
+			out << "# HELP " << name << " " << entry.help << "\n";
+		}
+
+		if (entry.counter) {
+			out << "# TYPE " << name << (entry.gauge ? " gauge" : " counter") << "\n";
+			out << name << " " << entry.counter->getValue() << "\n";
+		}
+		else if (entry.histogram) {
+			out << "# TYPE " << name << " histogram\n";
+			const std::vector<double> &bounds = entry.histogram->getBounds();
+			const std::vector<unsigned long> &counts = entry.histogram->getCounts();
+			unsigned long cumulative = 0;
+			for (size_t i = 0; i < bounds.size(); i++) {
+				cumulative += counts[i];
+				out << name << "_bucket{le=\"" << bounds[i] << "\"} " << cumulative << "\n";
+			}
+			out << name << "_bucket{le=\"+Inf\"} " << entry.histogram->getCount() << "\n";
+			out << name << "_sum " << entry.histogram->getSum() << "\n";
+			out << name << "_count " << entry.histogram->getCount() << "\n";
+		}
+	}
+	return out.str();
+}
+
+double Metrics::getTime() {
+	static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+	return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds() / 1000000.0;
+}
+
+}
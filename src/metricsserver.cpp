@@ -0,0 +1,118 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/metricsserver.h"
+#include "transport/transport.h"
+#include "transport/metrics.h"
+#include "transport/logging.h"
+#include "Swiften/Network/ConnectionServerFactory.h"
+#include "Swiften/Network/NetworkFactories.h"
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace Transport {
+
+DEFINE_LOGGER(logger, "MetricsServer");
+
+// Requests are tiny, so anything bigger is not a valid scrape.
+#define MAX_REQUEST_SIZE 8192
+
+MetricsServer::MetricsServer(Component *component) {
+	m_component = component;
+}
+
+MetricsServer::~MetricsServer() {
+	while (!m_clients.empty()) {
+		removeClient(m_clients.front());
+	}
+
+	if (m_server) {
+		m_server->onNewConnection.disconnect_all_slots();
+		m_server->stop();
+	}
+}
+
+void MetricsServer::start() {
+	int port = CONFIG_INT(m_component->getConfig(), "service.metrics_port");
+	if (port == 0) {
+		return;
+	}
+
+	std::string host = CONFIG_STRING(m_component->getConfig(), "service.metrics_host");
+	m_server = m_component->getNetworkFactories()->getConnectionServerFactory()->createConnectionServer(Swift::HostAddress(host), port);
+	m_server->onNewConnection.connect(boost::bind(&MetricsServer::handleNewConnection, this, _1));
+	m_server->start();
+
+	LOG4CXX_INFO(logger, "Exporting metrics on http://" << host << ":" << port << "/metrics");
+}
+
+void MetricsServer::handleNewConnection(boost::shared_ptr<Swift::Connection> connection) {
+	Client *client = new Client;
+	client->connection = connection;
+	m_clients.push_back(client);
+
+	connection->onDataRead.connect(boost::bind(&MetricsServer::handleDataRead, this, client, _1));
+	connection->onDataWritten.connect(boost::bind(&MetricsServer::handleDataWritten, this, client));
+	connection->onDisconnected.connect(boost::bind(&MetricsServer::removeClient, this, client));
+}
+
+void MetricsServer::handleDataRead(Client *client, boost::shared_ptr<Swift::SafeByteArray> data) {
+	client->request += std::string(data->begin(), data->end());
+	if (client->request.size() > MAX_REQUEST_SIZE) {
+		LOG4CXX_WARN(logger, "Too long HTTP request, closing the connection");
+		removeClient(client);
+		return;
+	}
+
+	// Wait for the whole HTTP header.
+	if (client->request.find("\r\n\r\n") == std::string::npos && client->request.find("\n\n") == std::string::npos) {
+		return;
+	}
+
+	std::string response;
+	if (client->request.find("GET ") == 0) {
+		std::string body = m_component->getMetrics()->toPrometheus();
+		response = "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: " + boost::lexical_cast<std::string>(body.size()) + "\r\n"
+			"Connection: close\r\n\r\n" + body;
+	}
+	else {
+		response = "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n";
+	}
+
+	client->request.clear();
+	client->connection->write(Swift::createSafeByteArray(response));
+}
+
+void MetricsServer::handleDataWritten(Client *client) {
+	removeClient(client);
+}
+
+void MetricsServer::removeClient(Client *client) {
+	client->connection->onDataRead.disconnect_all_slots();
+	client->connection->onDataWritten.disconnect_all_slots();
+	client->connection->onDisconnected.disconnect_all_slots();
+	client->connection->disconnect();
+	m_clients.remove(client);
+	delete client;
+}
+
+}
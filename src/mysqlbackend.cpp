@@ -297,6 +297,7 @@ void MySQLBackend::disconnect() {
 	delete m_getUserSetting;
 	delete m_setUserSetting;
 	delete m_updateUserSetting;
+	delete m_getUsersSetting;
 	delete m_updateBuddySetting;
 	delete m_getBuddySetting;
 	delete m_setUserOnline;
@@ -345,6 +346,7 @@ bool MySQLBackend::connect() {
 	m_getUserSetting = new Statement(&m_conn, "is|is", "SELECT type, value FROM " + m_prefix + "users_settings WHERE user_id=? AND var=?");
 	m_setUserSetting = new Statement(&m_conn, "isis", "INSERT INTO " + m_prefix + "users_settings (user_id, var, type, value) VALUES (?,?,?,?)");
 	m_updateUserSetting = new Statement(&m_conn, "sis", "UPDATE " + m_prefix + "users_settings SET value=? WHERE user_id=? AND var=?");
+	m_getUsersSetting = new Statement(&m_conn, "s|ss", "SELECT u.jid, s.value FROM " + m_prefix + "users u JOIN " + m_prefix + "users_settings s ON s.user_id=u.id WHERE s.var=?");
 
 	m_setUserOnline = new Statement(&m_conn, "bi", "UPDATE " + m_prefix + "users SET online=?, last_login=NOW()  WHERE id=?");
 	m_getOnlineUsers = new Statement(&m_conn, "|s", "SELECT jid FROM " + m_prefix + "users WHERE online=1");
@@ -678,6 +680,23 @@ void MySQLBackend::updateUserSetting(long id, const std::string &variable, const
 	EXEC(m_updateUserSetting, updateUserSetting(id, variable, value));
 }
 
+bool MySQLBackend::getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values) {
+// 	"SELECT u.jid, s.value FROM " + m_prefix + "users u JOIN " + m_prefix + "users_settings s ON s.user_id=u.id WHERE s.var=?"
+	*m_getUsersSetting << variable;
+	EXEC(m_getUsersSetting, getUsersSetting(variable, values));
+	if (!exec_ok)
+		return false;
+
+	std::string jid;
+	std::string value;
+	while (m_getUsersSetting->fetch() == 0) {
+		*m_getUsersSetting >> jid >> value;
+		values[jid] = value;
+	}
+
+	return true;
+}
+
 void MySQLBackend::beginTransaction() {
 	exec("START TRANSACTION;");
 }
@@ -33,6 +33,9 @@
 #include "transport/memoryreadbytestream.h"
 #include "transport/logging.h"
 #include "transport/admininterface.h"
+#include "transport/ratelimiter.h"
+#include "transport/chatstatefilter.h"
+#include "transport/backendcapture.h"
 #include "blockresponder.h"
 #include "Swiften/Server/ServerStanzaChannel.h"
 #include "Swiften/Elements/StreamError.h"
@@ -79,6 +82,16 @@ DEFINE_LOGGER(logger, "NetworkPluginServer");
 
 static NetworkPluginServer *_server;
 
+#define SESSION_INDEX_BITS 20
+#define SESSION_INDEX_MASK ((1 << SESSION_INDEX_BITS) - 1)
+
+// Returns current time in seconds with sub-second precision. Used by RateLimiter
+// and BackendCapture.
+static double getTime() {
+	static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+	return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds() / 1000000.0;
+}
+
 class NetworkConversation : public Conversation {
 	public:
 		NetworkConversation(ConversationManager *conversationManager, const std::string &legacyName, bool muc = false) : Conversation(conversationManager, legacyName, muc) {
@@ -236,6 +249,20 @@ static void SigCatcher(int n) {
 }
 #endif
 
+static pbnetwork::WrapperMessage_Type getChatStateWrapperType(Swift::ChatState::ChatStateType state) {
+	switch (state) {
+		case Swift::ChatState::Active:
+			return pbnetwork::WrapperMessage_Type_TYPE_BUDDY_STOPPED_TYPING;
+		case Swift::ChatState::Composing:
+			return pbnetwork::WrapperMessage_Type_TYPE_BUDDY_TYPING;
+		case Swift::ChatState::Paused:
+			return pbnetwork::WrapperMessage_Type_TYPE_BUDDY_TYPED;
+		default:
+			// Other chat states are not forwarded to backend.
+			return pbnetwork::WrapperMessage_Type_TYPE_BUDDY_CHANGED;
+	}
+}
+
 static void handleBuddyPayload(LocalBuddy *buddy, const pbnetwork::Buddy &payload) {
 	// Set alias only if it's not empty. Backends are allowed to send empty alias if it has
 	// not changed.
@@ -269,6 +296,13 @@ NetworkPluginServer::NetworkPluginServer(Component *component, Config *config, U
 	m_adminInterface = NULL;
 	m_startingBackend = false;
 	m_lastLogin = 0;
+	m_throttledMessages = component->getMetrics()->getCounter("spectrum2_messages_throttled_total", "Messages to backends delayed by rate limiting");
+	m_droppedMessages = component->getMetrics()->getCounter("spectrum2_messages_dropped_total", "Messages to backends dropped by rate limiting");
+	m_runningBackends = component->getMetrics()->getGauge("spectrum2_backends_running", "Backends currently connected");
+	m_crashedBackendsCount = component->getMetrics()->getCounter("spectrum2_backends_crashed_total", "Backends disconnected with active users");
+	m_pingLatency = component->getMetrics()->getHistogram("spectrum2_backend_ping_seconds", "Round-trip time of PING sent to backends");
+	m_deliveryLatency = component->getMetrics()->getHistogram("spectrum2_message_delivery_seconds", "Time spent forwarding a message between XMPP and backend");
+	m_savedPresences = 0;
 	m_xmppParser = new Swift::XMPPParser(this, &m_collection, component->getNetworkFactories()->getXMLParserFactory());
 	m_xmppParser->parse("<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' to='localhost' version='1.0'>");
 	m_serializer = new Swift::XMPPSerializer(&m_collection2, Swift::ClientStreamType);
@@ -287,6 +321,19 @@ NetworkPluginServer::NetworkPluginServer(Component *component, Config *config, U
 	m_loginTimer->onTick.connect(boost::bind(&NetworkPluginServer::loginDelayFinished, this));
 	m_loginTimer->start();
 
+	m_rateLimitTimer = component->getNetworkFactories()->getTimerFactory()->createTimer(100);
+	m_rateLimitTimer->onTick.connect(boost::bind(&NetworkPluginServer::flushRateLimitedQueues, this));
+
+	m_outgoingChatStates = new ChatStateFilter(CONFIG_INT(m_config, "service.chatstate_coalesce_time") / 1000.0);
+	m_incomingChatStates = new ChatStateFilter(CONFIG_INT(m_config, "service.chatstate_coalesce_time") / 1000.0);
+	m_chatStateTimer = component->getNetworkFactories()->getTimerFactory()->createTimer(CONFIG_INT(m_config, "service.chatstate_coalesce_time"));
+	m_chatStateTimer->onTick.connect(boost::bind(&NetworkPluginServer::flushChatStates, this));
+
+	m_capture = NULL;
+	if (!CONFIG_STRING(m_config, "service.backend_capture").empty()) {
+		m_capture = new BackendCapture(CONFIG_STRING(m_config, "service.backend_capture"));
+	}
+
 	if (CONFIG_INT(m_config, "service.memory_collector_time") != 0) {
 		m_collectTimer = component->getNetworkFactories()->getTimerFactory()->createTimer(CONFIG_INT(m_config, "service.memory_collector_time"));
 		m_collectTimer->onTick.connect(boost::bind(&NetworkPluginServer::collectBackend, this));
@@ -325,12 +372,17 @@ NetworkPluginServer::~NetworkPluginServer() {
 	}
 
 	m_pingTimer->stop();
+	m_rateLimitTimer->stop();
+	m_chatStateTimer->stop();
 	m_server->stop();
 	m_server.reset();
 	delete m_component->m_factory;
 	delete m_vcardResponder;
 	delete m_rosterResponder;
 	delete m_blockResponder;
+	delete m_outgoingChatStates;
+	delete m_incomingChatStates;
+	delete m_capture;
 }
 
 void NetworkPluginServer::start() {
@@ -399,12 +451,26 @@ void NetworkPluginServer::handleNewClientConnection(boost::shared_ptr<Swift::Con
 	// Backend does not accept new clients automatically if it's long-running
 	client->acceptUsers = !m_isNextLongRun;
 	client->longRun = m_isNextLongRun;
+	client->limiter = NULL;
+	client->pingSent = 0;
+
+	// Rate limiting is disabled when both limits are 0, so we don't create the
+	// limiter at all in that case and send everything directly.
+	if (CONFIG_INT(m_config, "service.user_rate_limit") > 0 || CONFIG_INT(m_config, "service.backend_rate_limit") > 0) {
+		client->limiter = new RateLimiter(CONFIG_INT(m_config, "service.user_rate_limit"),
+										  CONFIG_INT(m_config, "service.user_rate_burst"),
+										  CONFIG_INT(m_config, "service.backend_rate_limit"),
+										  CONFIG_INT(m_config, "service.backend_rate_burst"),
+										  1024,
+										  CONFIG_INT(m_config, "service.rate_limit_queue_size"));
+	}
 
 	m_startingBackend = false;
 
 	LOG4CXX_INFO(logger, "New" + (client->longRun ? std::string(" long-running") : "") +  " backend " << client << " connected. Current backend count=" << (m_clients.size() + 1));
 
 	m_clients.push_front(client);
+	m_runningBackends->setValue(m_clients.size());
 
 	c->onDisconnected.connect(boost::bind(&NetworkPluginServer::handleSessionFinished, this, client));
 	c->onDataRead.connect(boost::bind(&NetworkPluginServer::handleDataRead, this, client, _1));
@@ -426,6 +492,7 @@ void NetworkPluginServer::handleSessionFinished(Backend *c) {
 	// and disconnect users
 	if (!c->users.empty()) {
 		m_crashedBackends.push_back(c->id);
+		m_crashedBackendsCount->increment();
 	}
 
 	for (std::list<User *>::const_iterator it = c->users.begin(); it != c->users.end(); it++) {
@@ -441,12 +508,21 @@ void NetworkPluginServer::handleSessionFinished(Backend *c) {
 
 	send(c->connection, message);
 
+	if (m_capture) {
+		m_capture->removeBackend(c->connection.get());
+	}
+
 	c->connection->onDisconnected.disconnect_all_slots();
 	c->connection->onDataRead.disconnect_all_slots();
 	c->connection->disconnect();
 	c->connection.reset();
 
 	m_clients.remove(c);
+	m_runningBackends->setValue(m_clients.size());
+	if (c->limiter) {
+		m_droppedMessages->increment(c->limiter->getQueuedCount());
+		delete c->limiter;
+	}
 	delete c;
 }
 
@@ -514,16 +590,18 @@ void NetworkPluginServer::handleAuthorizationPayload(const std::string &data) {
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
+	resolveBuddyName(payload.session(), payload.buddyid(), payload.mutable_buddyname());
+
 	// Create subscribe presence and forward it to XMPP side
 	Swift::Presence::ref response = Swift::Presence::create();
 	response->setTo(user->getJID());
 	std::string name = payload.buddyname();
 
-	if (CONFIG_BOOL_DEFAULTED(m_config, "service.jid_escaping", true)) {
+	if (m_config->getSnapshot()->jidEscaping) {
 		name = Swift::JID::getEscapedNode(name);
 	}
 	else {
@@ -544,37 +622,69 @@ void NetworkPluginServer::handleChatStatePayload(const std::string &data, Swift:
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
+	resolveBuddyName(payload.session(), payload.buddyid(), payload.mutable_buddyname());
+
+	if (!user->getConversationManager()->getConversation(payload.buddyname())) {
+		return;
+	}
+
+	// Backends often resend the same chat state, so forward only the changes.
+	switch (m_incomingChatStates->filter(user->getJID().toBare().toString(), payload.buddyname(), type, getTime())) {
+		case ChatStateFilter::Forward:
+			forwardChatState(user, payload.buddyname(), type);
+			break;
+		case ChatStateFilter::Delay:
+			if (m_incomingChatStates->getPendingCount() == 1) {
+				m_chatStateTimer->start();
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+void NetworkPluginServer::forwardChatState(User *user, const std::string &buddyName, Swift::ChatState::ChatStateType state) {
 	// We're not creating new Conversation just because of chatstates.
 	// Some networks/clients spams with chatstates a lot and it leads to bigger memory usage.
-	NetworkConversation *conv = (NetworkConversation *) user->getConversationManager()->getConversation(payload.buddyname());
+	NetworkConversation *conv = (NetworkConversation *) user->getConversationManager()->getConversation(buddyName);
 	if (!conv) {
 		return;
 	}
 
 	// Forward chatstate
 	boost::shared_ptr<Swift::Message> msg(new Swift::Message());
-	msg->addPayload(boost::make_shared<Swift::ChatState>(type));
+	msg->addPayload(boost::make_shared<Swift::ChatState>(state));
 
 	conv->handleMessage(msg);
 }
 
 void NetworkPluginServer::handleBuddyChangedPayload(const std::string &data) {
-	pbnetwork::Buddy payload;
+	pbnetwork::Buddy &payload = m_buddyPayload;
 	if (payload.ParseFromString(data) == false) {
 		// TODO: ERROR
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
+	resolveBuddyName(payload.session(), payload.buddyid(), payload.mutable_buddyname());
+
 	LocalBuddy *buddy = (LocalBuddy *) user->getRosterManager()->getBuddy(payload.buddyname());
 	if (buddy) {
+		// LocalBuddy does not send presence when status and icon has not changed,
+		// so count it as saved stanza.
+		Swift::StatusShow status;
+		std::string statusMessage;
+		if (buddy->getStatus(status, statusMessage) && status.getType() == (Swift::StatusShow::Type) payload.status()
+			&& statusMessage == payload.statusmessage() && buddy->getIconHash() == payload.iconhash()) {
+			m_savedPresences++;
+		}
 		handleBuddyPayload(buddy, payload);
 	}
 	else {
@@ -586,7 +696,7 @@ void NetworkPluginServer::handleBuddyChangedPayload(const std::string &data) {
 		for (int i = 0; i < payload.group_size(); i++) {
 			groups.push_back(payload.group(i));
 		}
-		if (CONFIG_BOOL_DEFAULTED(m_config, "service.jid_escaping", true)) {
+		if (m_config->getSnapshot()->jidEscaping) {
 			buddy = new LocalBuddy(user->getRosterManager(), -1, payload.buddyname(), payload.alias(), groups, BUDDY_JID_ESCAPING);
 		}
 		else {
@@ -611,21 +721,23 @@ void NetworkPluginServer::handleBuddyRemovedPayload(const std::string &data) {
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
+	resolveBuddyName(payload.session(), payload.buddyid(), payload.mutable_buddyname());
+
 	user->getRosterManager()->removeBuddy(payload.buddyname());
 }
 
 void NetworkPluginServer::handleParticipantChangedPayload(const std::string &data) {
-	pbnetwork::Participant payload;
+	pbnetwork::Participant &payload = m_participantPayload;
 	if (payload.ParseFromString(data) == false) {
 		// TODO: ERROR
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
@@ -637,13 +749,43 @@ void NetworkPluginServer::handleParticipantChangedPayload(const std::string &dat
 	conv->handleParticipantChanged(payload.nickname(), (Conversation::ParticipantFlag) payload.flag(), payload.status(), payload.statusmessage(), payload.newname());
 }
 
+void NetworkPluginServer::handleParticipantListPayload(const std::string &data) {
+	pbnetwork::ParticipantList payload;
+	if (payload.ParseFromString(data) == false) {
+		// TODO: ERROR
+		return;
+	}
+
+	User *user = getSessionUser(payload.session(), payload.username());
+	if (!user)
+		return;
+
+	NetworkConversation *conv = (NetworkConversation *) user->getConversationManager()->getConversation(payload.room());
+	if (!conv) {
+		return;
+	}
+
+	std::list<Conversation::Participant> participants;
+	for (int i = 0; i < payload.participant_size(); i++) {
+		const pbnetwork::ParticipantListItem &item = payload.participant(i);
+		Conversation::Participant participant;
+		participant.nickname = item.nickname();
+		participant.flag = (Conversation::ParticipantFlag) item.flag();
+		participant.status = item.status();
+		participant.statusMessage = item.statusmessage();
+		participants.push_back(participant);
+	}
+
+	conv->handleParticipantList(participants);
+}
+
 void NetworkPluginServer::handleRoomChangedPayload(const std::string &data) {
 	pbnetwork::Room payload;
 	if (payload.ParseFromString(data) == false) {
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
@@ -656,17 +798,20 @@ void NetworkPluginServer::handleRoomChangedPayload(const std::string &data) {
 }
 
 void NetworkPluginServer::handleConvMessagePayload(const std::string &data, bool subject) {
-	pbnetwork::ConversationMessage payload;
+	HistogramTimer timer(m_deliveryLatency);
+	pbnetwork::ConversationMessage &payload = m_convMessagePayload;
 
 	if (payload.ParseFromString(data) == false) {
 		// TODO: ERROR
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
+	resolveBuddyName(payload.session(), payload.buddyid(), payload.mutable_buddyname());
+
 	// Message from legacy network triggers network acticity
 	user->updateLastActivity();
 
@@ -684,7 +829,7 @@ void NetworkPluginServer::handleConvMessagePayload(const std::string &data, bool
 	}
 
 	// Add xhtml-im payload.
-	if (CONFIG_BOOL(m_config, "service.enable_xhtml") && !payload.xhtml().empty()) {
+	if (m_config->getSnapshot()->enableXHTML && !payload.xhtml().empty()) {
 		msg->addPayload(boost::make_shared<Swift::XHTMLIMPayload>(payload.xhtml()));
 	}
 
@@ -726,6 +871,10 @@ void NetworkPluginServer::handleConvMessagePayload(const std::string &data, bool
 	// Forward it
 	conv->handleMessage(msg, payload.nickname());
 	m_userManager->messageToXMPPSent();
+
+	// Message resets the chat state, so next chat state has to be forwarded
+	// even if it's the same as the last one.
+	m_incomingChatStates->reset(user->getJID().toBare().toString(), payload.buddyname());
 }
 
 void NetworkPluginServer::handleConvMessageAckPayload(const std::string &data) {
@@ -736,10 +885,12 @@ void NetworkPluginServer::handleConvMessageAckPayload(const std::string &data) {
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
+	resolveBuddyName(payload.session(), payload.buddyid(), payload.mutable_buddyname());
+
 	if (payload.id().empty()) {
 		LOG4CXX_WARN(logger, "Received message ack with empty ID, not forwarding to XMPP.");
 		return;
@@ -766,10 +917,12 @@ void NetworkPluginServer::handleAttentionPayload(const std::string &data) {
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
+	resolveBuddyName(payload.session(), payload.buddyid(), payload.mutable_buddyname());
+
 	boost::shared_ptr<Swift::Message> msg(new Swift::Message());
 	msg->setBody(payload.message());
 	msg->addPayload(boost::make_shared<Swift::AttentionPayload>());
@@ -805,7 +958,7 @@ void NetworkPluginServer::handleFTStartPayload(const std::string &data) {
 		return;
 	}
 
-	User *user = m_userManager->getUser(payload.username());
+	User *user = getSessionUser(payload.session(), payload.username());
 	if (!user)
 		return;
 
@@ -822,7 +975,8 @@ void NetworkPluginServer::handleFTStartPayload(const std::string &data) {
 	fileInfo.setName(payload.filename());
 
 	Backend *c = (Backend *) user->getData();
-	boost::shared_ptr<MemoryReadBytestream> bytestream(new MemoryReadBytestream(payload.size()));
+	ConfigSnapshot::ref config = m_config->getSnapshot();
+	boost::shared_ptr<MemoryReadBytestream> bytestream(new MemoryReadBytestream(payload.size(), config->ftSpoolThreshold, config->ftSpoolLimit));
 	bytestream->onDataNeeded.connect(boost::bind(&NetworkPluginServer::handleFTDataNeeded, this, c, bytestream_id + 1));
 
 	LOG4CXX_INFO(logger, "jid=" << buddy->getJID());
@@ -834,7 +988,7 @@ void NetworkPluginServer::handleFTStartPayload(const std::string &data) {
 	}
 
 	m_filetransfers[++bytestream_id] = transfer;
-	transfer.ft->onStateChange.connect(boost::bind(&NetworkPluginServer::handleFTStateChanged, this, _1, payload.username(), payload.buddyname(), payload.filename(), payload.size(), bytestream_id));
+	transfer.ft->onStateChange.connect(boost::bind(&NetworkPluginServer::handleFTStateChanged, this, _1, user->getJID().toBare().toString(), payload.buddyname(), payload.filename(), payload.size(), bytestream_id));
 	transfer.ft->start();
 }
 
@@ -876,7 +1030,15 @@ void NetworkPluginServer::handleFTDataPayload(Backend *b, const std::string &dat
 	FileTransferManager::Transfer &transfer = m_filetransfers[payload.ftid()];
 	MemoryReadBytestream *bytestream = (MemoryReadBytestream *) transfer.readByteStream.get();
 
-	if (bytestream->appendData(payload.data()) > 5000000) {
+	// Take over the payload data, so they are not copied again when kept in memory.
+	boost::shared_ptr<std::string> chunk(new std::string());
+	chunk->swap(*payload.mutable_data());
+
+	// Data are stored in temporary file once there is more than ft_spool_threshold
+	// bytes in memory, so the backend is paused only when that's disabled or fails,
+	// or when the temporary file reaches ft_spool_limit.
+	bytestream->appendData(chunk);
+	if (bytestream->isFull()) {
 		pbnetwork::FileTransferData f;
 		f.set_ftid(payload.ftid());
 		f.set_data("");
@@ -927,6 +1089,11 @@ void NetworkPluginServer::connectWaitingUsers() {
 }
 
 void NetworkPluginServer::handlePongReceived(Backend *c) {
+	if (c->pingSent != 0) {
+		m_pingLatency->observe(getTime() - c->pingSent);
+		c->pingSent = 0;
+	}
+
 	// This could be first PONG from the backend
 	if (c->pongReceived == -1) {
 		// Backend is fully ready to handle requests
@@ -998,7 +1165,7 @@ void NetworkPluginServer::handleElement(boost::shared_ptr<Swift::Element> elemen
 		return;
 	}
 
-	User *user = m_userManager->getUser(stanza->getTo().toBare());
+	User *user = m_userManager->getUser(stanza->getTo());
 	if (!user)
 		return;
 
@@ -1023,7 +1190,7 @@ void NetworkPluginServer::handleElement(boost::shared_ptr<Swift::Element> elemen
 			}
 		}
 		else {
-			if (CONFIG_BOOL_DEFAULTED(m_config, "service.jid_escaping", true)) {
+			if (m_config->getSnapshot()->jidEscaping) {
 				name = Swift::JID::getEscapedNode(name);
 			}
 			else {
@@ -1093,7 +1260,7 @@ void NetworkPluginServer::handleRawXML(const std::string &xml) {
 }
 
 void NetworkPluginServer::handleRawPresenceReceived(boost::shared_ptr<Swift::Presence> presence) {
-	User *user = m_userManager->getUser(presence->getFrom().toBare());
+	User *user = m_userManager->getUser(presence->getFrom());
 	if (!user)
 		return;
 
@@ -1116,7 +1283,7 @@ void NetworkPluginServer::handleRawPresenceReceived(boost::shared_ptr<Swift::Pre
 }
 
 void NetworkPluginServer::handleRawIQReceived(boost::shared_ptr<Swift::IQ> iq) {
-	User *user = m_userManager->getUser(iq->getFrom().toBare());
+	User *user = m_userManager->getUser(iq->getFrom());
 	if (!user)
 		return;
 
@@ -1146,33 +1313,39 @@ void NetworkPluginServer::handleDataRead(Backend *c, boost::shared_ptr<Swift::Sa
 	// Append data to buffer
 	c->data.insert(c->data.end(), data->begin(), data->end());
 
-	// Parse data while there are some
-	while (c->data.size() != 0) {
+	// Parse data while there are some. Parsed messages are erased from the
+	// buffer at once at the end, so the rest of the buffer is not moved
+	// after every message.
+	size_t offset = 0;
+	while (c->data.size() - offset != 0) {
 		// expected_size of wrapper message
 		unsigned int expected_size;
 
 		// if data is >= 4, we have whole header and we can
 		// read expected_size.
-		if (c->data.size() >= 4) {
-			expected_size = *((unsigned int*) &c->data[0]);
+		if (c->data.size() - offset >= 4) {
+			expected_size = *((unsigned int*) &c->data[offset]);
 			expected_size = ntohl(expected_size);
 			// If we don't have whole wrapper message, wait for next
 			// handleDataRead call.
-			if (c->data.size() - 4 < expected_size)
-				return;
+			if (c->data.size() - offset - 4 < expected_size)
+				break;
 		}
 		else {
-			return;
+			break;
 		}
 
-		// Parse wrapper message and erase it from buffer.
-		pbnetwork::WrapperMessage wrapper;
-		if (wrapper.ParseFromArray(&c->data[4], expected_size) == false) {
+		// Parse wrapper message and skip it in buffer.
+		const char *frame = (const char *) &c->data[offset + 4];
+		offset += 4 + expected_size;
+		pbnetwork::WrapperMessage &wrapper = m_wrapper;
+		if (wrapper.ParseFromArray(frame, expected_size) == false) {
 			std::cout << "PARSING ERROR " << expected_size << "\n";
-			c->data.erase(c->data.begin(), c->data.begin() + 4 + expected_size);
 			continue;
 		}
-		c->data.erase(c->data.begin(), c->data.begin() + 4 + expected_size);
+		if (m_capture) {
+			m_capture->record(c->connection.get(), BackendCapture::FromBackend, std::string(frame, expected_size), getTime());
+		}
 
 		// If backend is slow and it is sending us lot of message, there is possibility
 		// that we don't receive PONG response before timeout. However, if we received
@@ -1205,6 +1378,9 @@ void NetworkPluginServer::handleDataRead(Backend *c, boost::shared_ptr<Swift::Sa
 			case pbnetwork::WrapperMessage_Type_TYPE_PARTICIPANT_CHANGED:
 				handleParticipantChangedPayload(wrapper.payload());
 				break;
+			case pbnetwork::WrapperMessage_Type_TYPE_PARTICIPANT_LIST:
+				handleParticipantListPayload(wrapper.payload());
+				break;
 			case pbnetwork::WrapperMessage_Type_TYPE_ROOM_NICKNAME_CHANGED:
 				handleRoomChangedPayload(wrapper.payload());
 				break;
@@ -1257,12 +1433,18 @@ void NetworkPluginServer::handleDataRead(Backend *c, boost::shared_ptr<Swift::Sa
 				handleRawXML(wrapper.payload());
 				break;
 			default:
-				return;
+				break;
 		}
 	}
+
+	c->data.erase(c->data.begin(), c->data.begin() + offset);
 }
 
 void NetworkPluginServer::send(boost::shared_ptr<Swift::Connection> &c, const std::string &data) {
+	if (m_capture) {
+		m_capture->record(c.get(), BackendCapture::ToBackend, data, getTime());
+	}
+
 	// generate header - size of wrapper message
 	uint32_t size = htonl(data.size());
 	char *header = (char *) &size;
@@ -1271,6 +1453,199 @@ void NetworkPluginServer::send(boost::shared_ptr<Swift::Connection> &c, const st
 	c->write(Swift::createSafeByteArray(std::string(header, 4) + data));
 }
 
+bool NetworkPluginServer::sendFromUser(User *user, const std::string &data, bool droppable) {
+	Backend *c = (Backend *) user->getData();
+	if (!c) {
+		return true;
+	}
+
+	if (!c->limiter) {
+		send(c->connection, data);
+		return true;
+	}
+
+	switch (c->limiter->push(user->getJID().toBare().toString(), data, droppable, getTime())) {
+		case RateLimiter::Send:
+			send(c->connection, data);
+			break;
+		case RateLimiter::Queued:
+			m_throttledMessages->increment();
+			// First queued message for this backend, start flushing the queue.
+			if (c->limiter->getQueuedCount() == 1) {
+				m_rateLimitTimer->start();
+			}
+			break;
+		case RateLimiter::Dropped:
+			m_droppedMessages->increment();
+			LOG4CXX_WARN(logger, user->getJID().toString() << ": Message to backend dropped because of rate limiting");
+			return false;
+	}
+	return true;
+}
+
+void NetworkPluginServer::flushRateLimitedQueues() {
+	double now = getTime();
+	bool pending = false;
+
+	BOOST_FOREACH(Backend *c, m_clients) {
+		if (!c->limiter) {
+			continue;
+		}
+
+		std::string data;
+		while (c->limiter->pop(data, now)) {
+			send(c->connection, data);
+		}
+
+		if (c->limiter->getQueuedCount() != 0) {
+			pending = true;
+		}
+	}
+
+	if (pending) {
+		m_rateLimitTimer->start();
+	}
+}
+
+void NetworkPluginServer::sendChatState(User *user, const std::string &buddyName, Swift::ChatState::ChatStateType state) {
+	pbnetwork::WrapperMessage_Type type = getChatStateWrapperType(state);
+	if (type == pbnetwork::WrapperMessage_Type_TYPE_BUDDY_CHANGED) {
+		return;
+	}
+
+	pbnetwork::Buddy buddy;
+	buddy.set_username(user->getJID().toBare());
+	buddy.set_buddyname(buddyName);
+
+	std::string message;
+	buddy.SerializeToString(&message);
+
+	WRAP(message, type);
+
+	// Chat states are not important enough to be queued, so drop
+	// them when the user is over the limit. The filter must not think the
+	// backend got the dropped state, otherwise the same state would be
+	// suppressed until it changes.
+	if (!sendFromUser(user, message, true)) {
+		m_outgoingChatStates->reset(user->getJID().toBare().toString(), buddyName);
+	}
+}
+
+void NetworkPluginServer::flushChatStates() {
+	double now = getTime();
+	std::vector<ChatStateFilter::State> states;
+
+	m_outgoingChatStates->flush(now, states);
+	BOOST_FOREACH(const ChatStateFilter::State &state, states) {
+		User *user = m_userManager->getUser(state.user);
+		if (user) {
+			sendChatState(user, state.buddy, (Swift::ChatState::ChatStateType) state.state);
+		}
+	}
+
+	states.clear();
+	m_incomingChatStates->flush(now, states);
+	BOOST_FOREACH(const ChatStateFilter::State &state, states) {
+		User *user = m_userManager->getUser(state.user);
+		if (user) {
+			forwardChatState(user, state.buddy, (Swift::ChatState::ChatStateType) state.state);
+		}
+	}
+
+	if (m_outgoingChatStates->getPendingCount() != 0 || m_incomingChatStates->getPendingCount() != 0) {
+		m_chatStateTimer->start();
+	}
+}
+
+unsigned int NetworkPluginServer::createSession(User *user) {
+	// Every login gets new session, so buddy IDs assigned by previous backend
+	// are forgotten.
+	removeSession(user);
+
+	unsigned int index;
+	if (!m_freeSessions.empty()) {
+		index = m_freeSessions.front();
+		m_freeSessions.pop_front();
+	}
+	else {
+		if (m_sessions.size() > SESSION_INDEX_MASK) {
+			LOG4CXX_ERROR(logger, "Too many sessions, user " << user->getJID().toString() << " will use JID instead of session handle");
+			return 0;
+		}
+		index = m_sessions.size();
+		m_sessions.resize(index + 1);
+		m_sessions[index].generation = 0;
+	}
+
+	Session &session = m_sessions[index];
+	session.user = user;
+	// Generation can't be 0, because then the handle could be 0 which means
+	// "no session".
+	session.generation = (session.generation + 1) & (0xffffffff >> SESSION_INDEX_BITS);
+	if (session.generation == 0) {
+		session.generation = 1;
+	}
+
+	unsigned int handle = (session.generation << SESSION_INDEX_BITS) | index;
+	m_userSessions[user] = handle;
+	return handle;
+}
+
+void NetworkPluginServer::removeSession(User *user) {
+	std::map<User *, unsigned int>::iterator it = m_userSessions.find(user);
+	if (it == m_userSessions.end()) {
+		return;
+	}
+
+	unsigned int index = it->second & SESSION_INDEX_MASK;
+	m_sessions[index].user = NULL;
+	m_sessions[index].buddies.clear();
+	m_freeSessions.push_back(index);
+	m_userSessions.erase(it);
+}
+
+User *NetworkPluginServer::getSessionUser(unsigned int session, const std::string &userName) {
+	if (session == 0) {
+		return m_userManager->getUser(userName);
+	}
+
+	unsigned int index = session & SESSION_INDEX_MASK;
+	if (index >= m_sessions.size() || m_sessions[index].generation != (session >> SESSION_INDEX_BITS)) {
+		return NULL;
+	}
+
+	return m_sessions[index].user;
+}
+
+void NetworkPluginServer::resolveBuddyName(unsigned int session, unsigned int buddyId, std::string *buddyName) {
+	if (session == 0 || buddyId == 0) {
+		return;
+	}
+
+	unsigned int index = session & SESSION_INDEX_MASK;
+	if (index >= m_sessions.size() || m_sessions[index].generation != (session >> SESSION_INDEX_BITS)) {
+		return;
+	}
+
+	// Backend sends buddyName together with buddyId when it uses the buddyId for
+	// the first time, later it sends just buddyId. IDs are stored in map, so
+	// memory used by the session depends only on number of assigned IDs.
+	std::map<unsigned int, std::string> &buddies = m_sessions[index].buddies;
+	if (!buddyName->empty()) {
+		buddies[buddyId] = *buddyName;
+	}
+	else {
+		std::map<unsigned int, std::string>::const_iterator it = buddies.find(buddyId);
+		if (it != buddies.end()) {
+			*buddyName = it->second;
+		}
+	}
+}
+
+unsigned long NetworkPluginServer::getSavedStanzas() {
+	return m_outgoingChatStates->getSavedCount() + m_incomingChatStates->getSavedCount() + m_savedPresences;
+}
+
 void NetworkPluginServer::pingTimeout() {
 	// TODO: move to separate timer, those 2 loops could be expensive
 	// Some users are connected for weeks and they are blocking backend to be destroyed and its memory
@@ -1440,6 +1815,7 @@ void NetworkPluginServer::handleUserReadyToConnect(User *user) {
 	login.set_user(user->getJID().toBare());
 	login.set_legacyname(userInfo.uin);
 	login.set_password(userInfo.password);
+	login.set_session(createSession(user));
 
 	std::string message;
 	login.SerializeToString(&message);
@@ -1542,6 +1918,10 @@ void NetworkPluginServer::handleUserDestroyed(User *user) {
 	user->getRosterManager()->onBuddyAdded.disconnect(boost::bind(&NetworkPluginServer::handleUserBuddyAdded, this, user, _1));
 	user->getRosterManager()->onBuddyRemoved.disconnect(boost::bind(&NetworkPluginServer::handleUserBuddyRemoved, this, user, _1));
 
+	removeSession(user);
+	m_outgoingChatStates->removeUser(user->getJID().toBare().toString());
+	m_incomingChatStates->removeUser(user->getJID().toBare().toString());
+
 	pbnetwork::Logout logout;
 	logout.set_user(user->getJID().toBare());
 	logout.set_legacyname(userInfo.uin);
@@ -1555,23 +1935,30 @@ void NetworkPluginServer::handleUserDestroyed(User *user) {
 	if (!c) {
 		return;
 	}
+
+	// Don't forward queued messages once the user is logged out.
+	if (c->limiter) {
+		m_droppedMessages->increment(c->limiter->removeFlow(user->getJID().toBare().toString()));
+	}
+
 	send(c->connection, message);
 	c->users.remove(user);
 
 	// If backend should handle only one user, it must not accept another one before 
 	// we kill it, so set up willDie to true
-	if (c->users.size() == 0 && CONFIG_INT(m_config, "service.users_per_backend") == 1) {
+	if (c->users.size() == 0 && m_config->getSnapshot()->usersPerBackend == 1) {
 		LOG4CXX_INFO(logger, "Backend " << c->id << " will die, because the last user disconnected");
 		c->willDie = true;
 	}
 }
 
 void NetworkPluginServer::handleMessageReceived(NetworkConversation *conv, boost::shared_ptr<Swift::Message> &msg) {
-	conv->getConversationManager()->getUser()->updateLastActivity();
+	HistogramTimer timer(m_deliveryLatency);
+	User *user = conv->getConversationManager()->getUser();
+	user->updateLastActivity();
 
-	if (CONFIG_BOOL_DEFAULTED(m_config, "features.rawxml", false)) {
-		Backend *c = (Backend *) conv->getConversationManager()->getUser()->getData();
-		if (!c) {
+	if (m_config->getSnapshot()->rawXML) {
+		if (!user->getData()) {
 			return;
 		}
 		Swift::JID legacyname = Swift::JID(Buddy::JIDToLegacyName(msg->getTo()));
@@ -1583,42 +1970,26 @@ void NetworkPluginServer::handleMessageReceived(NetworkConversation *conv, boost
 		}
 		std::string xml = safeByteArrayToString(m_serializer->serializeElement(msg));
 		WRAP(xml, pbnetwork::WrapperMessage_Type_TYPE_RAW_XML);
-		send(c->connection, xml);
+		sendFromUser(user, xml);
 		return;
 	}
 
 	boost::shared_ptr<Swift::ChatState> statePayload = msg->getPayload<Swift::ChatState>();
-	if (statePayload) {
-		pbnetwork::WrapperMessage_Type type = pbnetwork::WrapperMessage_Type_TYPE_BUDDY_CHANGED;
-		switch (statePayload->getChatState()) {
-			case Swift::ChatState::Active:
-				type = pbnetwork::WrapperMessage_Type_TYPE_BUDDY_STOPPED_TYPING;
-				break;
-			case Swift::ChatState::Composing:
-				type = pbnetwork::WrapperMessage_Type_TYPE_BUDDY_TYPING;
+	if (statePayload && getChatStateWrapperType(statePayload->getChatState()) != pbnetwork::WrapperMessage_Type_TYPE_BUDDY_CHANGED) {
+		// Chat state which is part of the message is never delayed.
+		bool coalesce = msg->getBody().empty();
+		switch (m_outgoingChatStates->filter(user->getJID().toBare().toString(), conv->getLegacyName(), statePayload->getChatState(), getTime(), coalesce)) {
+			case ChatStateFilter::Forward:
+				sendChatState(user, conv->getLegacyName(), statePayload->getChatState());
 				break;
-			case Swift::ChatState::Paused:
-				type = pbnetwork::WrapperMessage_Type_TYPE_BUDDY_TYPED;
+			case ChatStateFilter::Delay:
+				if (m_outgoingChatStates->getPendingCount() == 1) {
+					m_chatStateTimer->start();
+				}
 				break;
 			default:
 				break;
 		}
-		if (type != pbnetwork::WrapperMessage_Type_TYPE_BUDDY_CHANGED) {
-			pbnetwork::Buddy buddy;
-			buddy.set_username(conv->getConversationManager()->getUser()->getJID().toBare());
-			buddy.set_buddyname(conv->getLegacyName());
-
-			std::string message;
-			buddy.SerializeToString(&message);
-
-			WRAP(message, type);
-
-			Backend *c = (Backend *) conv->getConversationManager()->getUser()->getData();
-			if (!c) {
-				return;
-			}
-			send(c->connection, message);
-		}
 	}
 
 	boost::shared_ptr<Swift::AttentionPayload> attentionPayload = msg->getPayload<Swift::AttentionPayload>();
@@ -1633,8 +2004,7 @@ void NetworkPluginServer::handleMessageReceived(NetworkConversation *conv, boost
 
 		WRAP(message, pbnetwork::WrapperMessage_Type_TYPE_ATTENTION);
 
-		Backend *c = (Backend *) conv->getConversationManager()->getUser()->getData();
-		send(c->connection, message);
+		sendFromUser(user, message);
 		return;
 	}
 
@@ -1649,8 +2019,7 @@ void NetworkPluginServer::handleMessageReceived(NetworkConversation *conv, boost
 
 		WRAP(message, pbnetwork::WrapperMessage_Type_TYPE_ROOM_SUBJECT_CHANGED);
 
-		Backend *c = (Backend *) conv->getConversationManager()->getUser()->getData();
-		send(c->connection, message);
+		sendFromUser(user, message);
 		return;
 	}
 	
@@ -1678,11 +2047,11 @@ void NetworkPluginServer::handleMessageReceived(NetworkConversation *conv, boost
 
 		WRAP(message, pbnetwork::WrapperMessage_Type_TYPE_CONV_MESSAGE);
 
-		Backend *c = (Backend *) conv->getConversationManager()->getUser()->getData();
-		if (!c) {
-			return;
-		}
-		send(c->connection, message);
+		sendFromUser(user, message);
+
+		// Message resets the chat state, so next chat state has to be forwarded
+		// even if it's the same as the last one.
+		m_outgoingChatStates->reset(user->getJID().toBare().toString(), conv->getLegacyName());
 	}
 }
 
@@ -1896,6 +2265,7 @@ void NetworkPluginServer::sendPing(Backend *c) {
 		LOG4CXX_INFO(logger, "PING to " << c << " (ID=" << c->id << ")");
 		send(c->connection, message);
 		c->pongReceived = false;
+		c->pingSent = getTime();
 	}
 // 	LOG4CXX_INFO(logger, "PING to " << c);
 }
@@ -1970,12 +2340,13 @@ NetworkPluginServer::Backend *NetworkPluginServer::getFreeClient(bool acceptUser
 	}
 
 	// Check all backends and find free one
+	ConfigSnapshot::ref snapshot = m_config->getSnapshot();
 	for (std::list<Backend *>::const_iterator it = m_clients.begin(); it != m_clients.end(); it++) {
-		if ((*it)->willDie == false && (*it)->acceptUsers == acceptUsers && (*it)->users.size() < CONFIG_INT(m_config, "service.users_per_backend") && (*it)->connection && (*it)->longRun == longRun) {
+		if ((*it)->willDie == false && (*it)->acceptUsers == acceptUsers && (*it)->users.size() < snapshot->usersPerBackend && (*it)->connection && (*it)->longRun == longRun) {
 			c = *it;
 			// if we're not reusing all backends and backend is full, stop accepting new users on this backend
-			if (!CONFIG_BOOL(m_config, "service.reuse_old_backends")) {
-				if (!check && c->users.size() + 1 >= CONFIG_INT(m_config, "service.users_per_backend")) {
+			if (!snapshot->reuseOldBackends) {
+				if (!check && c->users.size() + 1 >= snapshot->usersPerBackend) {
 					c->acceptUsers = false;
 				}
 			}
@@ -411,6 +411,23 @@ void PQXXBackend::updateUserSetting(long id, const std::string &variable, const
 	}
 }
 
+bool PQXXBackend::getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values) {
+	try {
+		pqxx::nontransaction txn(*m_conn);
+		pqxx::result r = txn.exec("SELECT u.jid, s.value FROM " + m_prefix + "users u JOIN " + m_prefix + "users_settings s ON s.user_id=u.id WHERE s.var=" + quote(txn, variable));
+
+		for (pqxx::result::const_iterator it = r.begin(); it != r.end(); it++)  {
+			values[(*it)[0].as<std::string>()] = (*it)[1].as<std::string>();
+		}
+	}
+	catch (std::exception& e) {
+		LOG4CXX_ERROR(logger, e.what());
+		return false;
+	}
+
+	return true;
+}
+
 void PQXXBackend::beginTransaction() {
 	exec("BEGIN;");
 }
@@ -0,0 +1,182 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/ratelimiter.h"
+
+namespace Transport {
+
+TokenBucket::TokenBucket(double rate, double burst) {
+	m_last = -1;
+	setLimit(rate, burst);
+}
+
+void TokenBucket::setLimit(double rate, double burst) {
+	m_rate = rate;
+	// Bucket has to be able to hold at least one token, otherwise nothing
+	// could ever pass.
+	m_burst = burst < 1 ? 1 : burst;
+	m_tokens = m_burst;
+}
+
+void TokenBucket::refill(double now) {
+	if (m_last < 0 || now < m_last) {
+		m_last = now;
+		return;
+	}
+
+	m_tokens += (now - m_last) * m_rate;
+	if (m_tokens > m_burst) {
+		m_tokens = m_burst;
+	}
+	m_last = now;
+}
+
+bool TokenBucket::available(double now, double tokens) {
+	if (isUnlimited()) {
+		return true;
+	}
+
+	refill(now);
+	return m_tokens >= tokens;
+}
+
+bool TokenBucket::consume(double now, double tokens) {
+	if (isUnlimited()) {
+		return true;
+	}
+
+	refill(now);
+	if (m_tokens < tokens) {
+		return false;
+	}
+
+	m_tokens -= tokens;
+	return true;
+}
+
+RateLimiter::RateLimiter(double userRate, double userBurst, double backendRate, double backendBurst, unsigned long quantum, unsigned long maxQueued) :
+	m_backend(backendRate, backendBurst) {
+	m_userRate = userRate;
+	m_userBurst = userBurst;
+	m_quantum = quantum == 0 ? 1 : quantum;
+	m_maxQueued = maxQueued;
+	m_queued = 0;
+}
+
+RateLimiter::Flow &RateLimiter::getFlow(const std::string &flow) {
+	std::map<std::string, Flow>::iterator it = m_flows.find(flow);
+	if (it != m_flows.end()) {
+		return it->second;
+	}
+
+	Flow &f = m_flows[flow];
+	f.bucket.setLimit(m_userRate, m_userBurst);
+	f.deficit = 0;
+	f.active = false;
+	return f;
+}
+
+RateLimiter::Result RateLimiter::push(const std::string &flow, const std::string &data, bool droppable, double now) {
+	Flow &f = getFlow(flow);
+
+	// Frames of the same flow have to keep their order, so we can send this
+	// one directly only if there's nothing queued for this flow.
+	if (f.frames.empty() && f.bucket.available(now) && m_backend.available(now)) {
+		f.bucket.consume(now);
+		m_backend.consume(now);
+		return Send;
+	}
+
+	if (droppable || f.frames.size() >= m_maxQueued) {
+		return Dropped;
+	}
+
+	f.frames.push_back(data);
+	m_queued++;
+
+	if (!f.active) {
+		f.active = true;
+		f.deficit = 0;
+		m_active.push_back(flow);
+	}
+
+	return Queued;
+}
+
+bool RateLimiter::pop(std::string &data, double now) {
+	// Number of flows visited in a row which can't send because of their
+	// own TokenBucket. Once we visit all of them, there's nothing to send.
+	unsigned long blocked = 0;
+
+	while (!m_active.empty() && blocked < m_active.size()) {
+		if (!m_backend.available(now)) {
+			return false;
+		}
+
+		Flow &f = m_flows[m_active.front()];
+		const std::string &frame = f.frames.front();
+
+		if (f.deficit < frame.size()) {
+			// This flow has spent its quantum in this round, move to the next one.
+			f.deficit += m_quantum;
+			m_active.splice(m_active.end(), m_active, m_active.begin());
+			blocked = 0;
+			continue;
+		}
+
+		if (!f.bucket.consume(now)) {
+			m_active.splice(m_active.end(), m_active, m_active.begin());
+			blocked++;
+			continue;
+		}
+
+		m_backend.consume(now);
+		f.deficit -= frame.size();
+		data = frame;
+		f.frames.pop_front();
+		m_queued--;
+
+		if (f.frames.empty()) {
+			f.deficit = 0;
+			f.active = false;
+			m_active.pop_front();
+		}
+		return true;
+	}
+
+	return false;
+}
+
+unsigned long RateLimiter::removeFlow(const std::string &flow) {
+	std::map<std::string, Flow>::iterator it = m_flows.find(flow);
+	if (it == m_flows.end()) {
+		return 0;
+	}
+
+	unsigned long removed = it->second.frames.size();
+	m_queued -= removed;
+	if (it->second.active) {
+		m_active.remove(flow);
+	}
+	m_flows.erase(it);
+	return removed;
+}
+
+}
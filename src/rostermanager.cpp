@@ -25,6 +25,7 @@
 #include "transport/usermanager.h"
 #include "transport/buddy.h"
 #include "transport/user.h"
+#include "transport/metrics.h"
 #include "transport/logging.h"
 #include "Swiften/Roster/SetRosterRequest.h"
 #include "Swiften/Elements/RosterPayload.h"
@@ -46,6 +47,9 @@ RosterManager::RosterManager(User *user, Component *component){
 	m_rosterStorage = NULL;
 	m_user = user;
 	m_component = component;
+	m_contactsTotal = m_component->getMetrics()->getGauge("spectrum2_contacts_total", "Contacts in rosters of users currently logged in");
+	m_contactsOnline = m_component->getMetrics()->getGauge("spectrum2_contacts_online", "Available contacts in rosters of users currently logged in");
+	m_storageLatency = m_component->getMetrics()->getHistogram("spectrum2_storage_seconds", "Duration of storage backend calls");
 	m_setBuddyTimer = m_component->getNetworkFactories()->getTimerFactory()->createTimer(1000);
 	m_RIETimer = m_component->getNetworkFactories()->getTimerFactory()->createTimer(5000);
 	m_RIETimer->onTick.connect(boost::bind(&RosterManager::sendRIE, this));
@@ -78,6 +82,10 @@ RosterManager::~RosterManager() {
 		if (!buddy) {
 			continue;
 		}
+		m_contactsTotal->decrement();
+		if (buddy->isAvailable()) {
+			m_contactsOnline->decrement();
+		}
 		delete buddy;
 	}
 
@@ -211,9 +219,37 @@ void RosterManager::sendBuddySubscribePresence(Buddy *buddy) {
 void RosterManager::handleBuddyChanged(Buddy *buddy) {
 }
 
+void RosterManager::handleBuddyAvailabilityChanged(Buddy *buddy) {
+	// Buddies which are not in the roster yet are counted once they are set.
+	BuddiesMap::const_iterator it = m_buddies.find(buddy->getName());
+	if (it == m_buddies.end() || it->second != buddy) {
+		return;
+	}
+
+	if (buddy->isAvailable()) {
+		m_contactsOnline->increment();
+	}
+	else {
+		m_contactsOnline->decrement();
+	}
+}
+
 void RosterManager::setBuddyCallback(Buddy *buddy) {
 	LOG4CXX_INFO(logger, "Associating buddy " << buddy->getName() << " with " << m_user->getJID().toString());
-	m_buddies[buddy->getName()] = buddy;
+	Buddy *&slot = m_buddies[buddy->getName()];
+	if (slot != buddy) {
+		if (slot) {
+			m_contactsTotal->decrement();
+			if (slot->isAvailable()) {
+				m_contactsOnline->decrement();
+			}
+		}
+		m_contactsTotal->increment();
+		if (buddy->isAvailable()) {
+			m_contactsOnline->increment();
+		}
+		slot = buddy;
+	}
 	onBuddySet(buddy);
 
 	// In server mode the only way is to send jabber:iq:roster push.
@@ -240,7 +276,16 @@ void RosterManager::setBuddyCallback(Buddy *buddy) {
 }
 
 void RosterManager::unsetBuddy(Buddy *buddy) {
-	m_buddies.erase(buddy->getName());
+	BuddiesMap::iterator it = m_buddies.find(buddy->getName());
+	if (it != m_buddies.end()) {
+		if (it->second == buddy) {
+			m_contactsTotal->decrement();
+			if (buddy->isAvailable()) {
+				m_contactsOnline->decrement();
+			}
+		}
+		m_buddies.erase(it);
+	}
 	if (m_rosterStorage)
 		m_rosterStorage->removeBuddyFromQueue(buddy);
 	onBuddyUnset(buddy);
@@ -252,6 +297,12 @@ void RosterManager::storeBuddy(Buddy *buddy) {
 	}
 }
 
+void RosterManager::storeBuddies() {
+	if (m_rosterStorage) {
+		m_rosterStorage->storeBuddies();
+	}
+}
+
 void RosterManager::handleBuddyRosterPushResponse(Swift::ErrorPayload::ref error, Swift::SetRosterRequest::ref request, const std::string &key) {
 	LOG4CXX_INFO(logger, "handleBuddyRosterPushResponse called for buddy " << key);
 	if (m_buddies[key] != NULL) {
@@ -548,16 +599,30 @@ void RosterManager::setStorageBackend(StorageBackend *storageBackend) {
 	if (m_rosterStorage || !storageBackend) {
 		return;
 	}
-	RosterStorage *storage = new RosterStorage(m_user, storageBackend);
-
 	std::list<BuddyInfo> roster;
-	storageBackend->getBuddies(m_user->getUserInfo().id, roster);
+	{
+		HistogramTimer timer(m_storageLatency);
+		storageBackend->getBuddies(m_user->getUserInfo().id, roster);
+	}
+
+	setStorageBackend(storageBackend, roster);
+}
+
+void RosterManager::setStorageBackend(StorageBackend *storageBackend, const std::list<BuddyInfo> &roster) {
+	if (m_rosterStorage || !storageBackend) {
+		return;
+	}
+	RosterStorage *storage = new RosterStorage(m_user, storageBackend);
 
 	for (std::list<BuddyInfo>::const_iterator it = roster.begin(); it != roster.end(); it++) {
 		Buddy *buddy = m_component->getFactory()->createBuddy(this, *it);
 		if (buddy) {
 			LOG4CXX_INFO(logger, m_user->getJID().toString() << ": Adding cached buddy " << buddy->getName() << " fom database");
-			m_buddies[buddy->getName()] = buddy;
+			Buddy *&slot = m_buddies[buddy->getName()];
+			if (!slot) {
+				m_contactsTotal->increment();
+			}
+			slot = buddy;
 			onBuddySet(buddy);
 		}
 	}
@@ -46,7 +46,7 @@ RosterResponder::~RosterResponder() {
 bool RosterResponder::handleGetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::RosterPayload> payload) {
 	// Get means we're in server mode and user wants to fetch his roster.
 	// For now we send empty reponse, but TODO: Get buddies from database and send proper stored roster.
-	User *user = m_userManager->getUser(from.toBare().toString());
+	User *user = m_userManager->getUser(from);
 	if (!user) {
 		sendResponse(from, id, boost::shared_ptr<RosterPayload>(new RosterPayload()));
 		LOG4CXX_WARN(logger, from.toBare().toString() << ": User is not logged in");
@@ -60,7 +60,7 @@ bool RosterResponder::handleGetRequest(const Swift::JID& from, const Swift::JID&
 bool RosterResponder::handleSetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::RosterPayload> payload) {
 	sendResponse(from, id, boost::shared_ptr<RosterPayload>(new RosterPayload()));
 
-	User *user = m_userManager->getUser(from.toBare().toString());
+	User *user = m_userManager->getUser(from);
 	if (!user) {
 		LOG4CXX_WARN(logger, from.toBare().toString() << ": User is not logged in");
 		return true;
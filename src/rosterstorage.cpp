@@ -21,11 +21,11 @@
 #include "transport/rosterstorage.h"
 #include "transport/buddy.h"
 #include "transport/user.h"
+#include "transport/transport.h"
 #include "transport/storagebackend.h"
+#include "transport/metrics.h"
 #include "transport/logging.h"
 
-#include "Swiften/Network/NetworkFactories.h"
-
 DEFINE_LOGGER(logger, "RosterStorage");
 
 namespace Transport {
@@ -82,12 +82,11 @@ namespace Transport {
 RosterStorage::RosterStorage(User *user, StorageBackend *storageBackend) {
 	m_user = user;
 	m_storageBackend = storageBackend;
-	m_storageTimer = m_user->getComponent()->getNetworkFactories()->getTimerFactory()->createTimer(5000);
-	m_storageTimer->onTick.connect(boost::bind(&RosterStorage::storeBuddies, this));
+	m_storageTimer = 0;
 }
 
 RosterStorage::~RosterStorage() {
-	m_storageTimer->stop();
+	m_user->getComponent()->getTimerWheel()->cancel(m_storageTimer);
 }
 
 void RosterStorage::removeBuddy(Buddy *buddy) {
@@ -105,14 +104,22 @@ void RosterStorage::storeBuddy(Buddy *buddy) {
 	}
 
 	m_buddies[buddy->getName()] = buddy;
-	m_storageTimer->start();
+
+	// Store the buddies 5 seconds after the last change.
+	TimerWheel *timerWheel = m_user->getComponent()->getTimerWheel();
+	timerWheel->cancel(m_storageTimer);
+	m_storageTimer = timerWheel->schedule(5000, boost::bind(&RosterStorage::storeBuddies, this));
 }
 
 bool RosterStorage::storeBuddies() {
+	m_user->getComponent()->getTimerWheel()->cancel(m_storageTimer);
+	m_storageTimer = 0;
+
 	if (m_buddies.size() == 0) {
 		return false;
 	}
-	
+
+	HistogramTimer timer(m_user->getComponent()->getMetrics()->getHistogram("spectrum2_storage_seconds"));
 	m_storageBackend->beginTransaction();
 
 	for (std::map<std::string, Buddy *>::const_iterator it = m_buddies.begin(); it != m_buddies.end(); it++) {
@@ -0,0 +1,313 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+
+#include "transport/sessionsnapshot.h"
+#include "transport/transport.h"
+#include "transport/usermanager.h"
+#include "transport/user.h"
+#include "transport/rostermanager.h"
+#include "transport/localbuddy.h"
+#include "transport/presenceoracle.h"
+#include "transport/protocol.pb.h"
+#include "transport/logging.h"
+#include "Swiften/Elements/MUCPayload.h"
+#include <fstream>
+#include <cstdio>
+#include <boost/foreach.hpp>
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
+namespace Transport {
+
+DEFINE_LOGGER(logger, "SessionSnapshot");
+
+SessionSnapshot::SessionSnapshot(Component *component, UserManager *userManager, const std::string &path) {
+	m_component = component;
+	m_userManager = userManager;
+	m_path = path;
+}
+
+SessionSnapshot::~SessionSnapshot() {
+}
+
+static void storePresence(pbnetwork::SnapshotUser *user, Swift::Presence::ref presence, bool muc) {
+	pbnetwork::SnapshotPresence *p = user->add_presence();
+	p->set_from(presence->getFrom().toString());
+	p->set_to(presence->getTo().toString());
+	p->set_show((int) presence->getShow());
+	p->set_status(presence->getStatus());
+	p->set_priority(presence->getPriority());
+	p->set_muc(muc);
+
+	boost::shared_ptr<Swift::MUCPayload> mucPayload = presence->getPayload<Swift::MUCPayload>();
+	if (mucPayload && mucPayload->getPassword()) {
+		p->set_password(*mucPayload->getPassword());
+	}
+}
+
+bool SessionSnapshot::save() {
+	pbnetwork::SessionSnapshot snapshot;
+
+	for (std::map<std::string, User *>::const_iterator it = m_userManager->getUsers().begin(); it != m_userManager->getUsers().end(); it++) {
+		User *user = it->second;
+		if (!user) {
+			continue;
+		}
+
+		pbnetwork::SnapshotUser *u = snapshot.add_user();
+		u->set_jid(it->first);
+
+		std::vector<Swift::Presence::ref> presences = m_component->getPresenceOracle()->getAllPresence(user->getJID().toBare());
+		BOOST_FOREACH(Swift::Presence::ref &presence, presences) {
+			if (presence->getType() == Swift::Presence::Available) {
+				storePresence(u, presence, false);
+			}
+		}
+
+		BOOST_FOREACH(const Swift::Presence::ref &presence, user->getJoinedRooms()) {
+			storePresence(u, presence, true);
+		}
+
+		// Buddies get their IDs once they are stored, so store the queued
+		// ones now instead of when the user is removed.
+		user->getRosterManager()->storeBuddies();
+
+		const RosterManager::BuddiesMap &buddies = user->getRosterManager()->getBuddies();
+		for (RosterManager::BuddiesMap::const_iterator bt = buddies.begin(); bt != buddies.end(); bt++) {
+			Buddy *buddy = bt->second;
+			if (!buddy || buddy->getID() == -1) {
+				continue;
+			}
+
+			pbnetwork::SnapshotBuddy *b = u->add_buddy();
+			b->set_id(buddy->getID());
+			b->set_buddyname(buddy->getName());
+			b->set_alias(buddy->getAlias());
+			BOOST_FOREACH(const std::string &group, buddy->getGroups()) {
+				b->add_group(group);
+			}
+			b->set_subscription(buddy->getSubscription() == Buddy::Both ? "both" : "ask");
+			b->set_flags((int) buddy->getFlags());
+			b->set_iconhash(buddy->getIconHash());
+
+			Swift::StatusShow status;
+			std::string statusMessage;
+			if (buddy->getStatus(status, statusMessage)) {
+				b->set_show((int) status.getType());
+				b->set_statusmessage(statusMessage);
+			}
+		}
+	}
+
+	// Write to temporary file first, so there's never half-written snapshot.
+	std::string tmpPath = m_path + ".tmp";
+	{
+#ifndef WIN32
+		// MUC passwords are stored in plain text.
+		mode_t old_cmask = umask(0077);
+#endif
+		std::ofstream file(tmpPath.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+#ifndef WIN32
+		umask(old_cmask);
+		chmod(tmpPath.c_str(), S_IRUSR | S_IWUSR);
+#endif
+		if (!file.is_open() || !snapshot.SerializeToOstream(&file)) {
+			LOG4CXX_ERROR(logger, "Can't write session snapshot " << tmpPath);
+			return false;
+		}
+	}
+
+	if (rename(tmpPath.c_str(), m_path.c_str()) != 0) {
+		LOG4CXX_ERROR(logger, "Can't rename session snapshot " << tmpPath << " to " << m_path);
+		return false;
+	}
+
+	LOG4CXX_INFO(logger, "Stored session snapshot of " << snapshot.user_size() << " users to " << m_path);
+	return true;
+}
+
+bool SessionSnapshot::load() {
+	m_users.clear();
+
+	pbnetwork::SessionSnapshot snapshot;
+	{
+		std::ifstream file(m_path.c_str(), std::ios::in | std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+
+		if (!snapshot.ParseFromIstream(&file)) {
+			LOG4CXX_ERROR(logger, "Can't parse session snapshot " << m_path);
+			remove(m_path.c_str());
+			return false;
+		}
+	}
+
+	// The snapshot is valid only for this start.
+	remove(m_path.c_str());
+
+	for (int i = 0; i < snapshot.user_size(); i++) {
+		const pbnetwork::SnapshotUser &u = snapshot.user(i);
+		UserState &state = m_users[u.jid()];
+
+		for (int j = 0; j < u.presence_size(); j++) {
+			const pbnetwork::SnapshotPresence &p = u.presence(j);
+			Swift::Presence::ref presence = Swift::Presence::create();
+			try {
+				presence->setFrom(p.from());
+				presence->setTo(p.to());
+			}
+			catch (...) {
+				continue;
+			}
+			presence->setShow((Swift::StatusShow::Type) p.show());
+			presence->setStatus(p.status());
+			presence->setPriority(p.priority());
+			if (p.muc()) {
+				boost::shared_ptr<Swift::MUCPayload> mucPayload(new Swift::MUCPayload());
+				if (p.has_password()) {
+					mucPayload->setPassword(p.password());
+				}
+				presence->addPayload(mucPayload);
+			}
+			state.presences.push_back(presence);
+		}
+
+		for (int j = 0; j < u.buddy_size(); j++) {
+			const pbnetwork::SnapshotBuddy &b = u.buddy(j);
+			BuddyState buddy;
+			buddy.info.id = b.id();
+			buddy.info.legacyName = b.buddyname();
+			buddy.info.alias = b.alias();
+			for (int k = 0; k < b.group_size(); k++) {
+				buddy.info.groups.push_back(b.group(k));
+			}
+			buddy.info.subscription = b.subscription();
+			buddy.info.flags = b.flags();
+			if (!b.iconhash().empty()) {
+				SettingVariableInfo var;
+				var.type = TYPE_STRING;
+				var.s = b.iconhash();
+				buddy.info.settings["icon_hash"] = var;
+			}
+			buddy.show = b.has_show() ? b.show() : (int) Swift::StatusShow::None;
+			buddy.statusMessage = b.statusmessage();
+			state.buddies.push_back(buddy);
+		}
+	}
+
+	LOG4CXX_INFO(logger, "Loaded session snapshot of " << m_users.size() << " users from " << m_path);
+	return true;
+}
+
+void SessionSnapshot::getUsers(std::vector<std::string> &users) {
+	for (std::map<std::string, UserState>::const_iterator it = m_users.begin(); it != m_users.end(); it++) {
+		users.push_back(it->first);
+	}
+}
+
+const SessionSnapshot::UserState *SessionSnapshot::getUserState(const std::string &jid) {
+	std::map<std::string, UserState>::const_iterator it = m_users.find(jid);
+	if (it == m_users.end()) {
+		return NULL;
+	}
+	return &it->second;
+}
+
+bool SessionSnapshot::restorePresences(const std::string &jid) {
+	std::map<std::string, UserState>::const_iterator it = m_users.find(jid);
+	if (it == m_users.end()) {
+		return false;
+	}
+
+	// Copy the presences, because the state is forgotten once the user
+	// is created.
+	std::vector<Swift::Presence::ref> presences = it->second.presences;
+	LOG4CXX_INFO(logger, "Restoring " << presences.size() << " presences of user " << jid);
+
+	// In server mode, XMPP clients have been disconnected together with
+	// Spectrum 2, so just log the user in as reconnect_on_start does. They
+	// will join the rooms again once they reconnect.
+	if (m_component->inServerMode()) {
+		Swift::Presence::ref presence = Swift::Presence::create();
+		presence->setTo(m_component->getJID());
+		presence->setFrom(jid);
+		presence->setType(Swift::Presence::Available);
+		BOOST_FOREACH(Swift::Presence::ref &p, presences) {
+			if (!p->getPayload<Swift::MUCPayload>()) {
+				presence->setShow(p->getShow());
+				presence->setStatus(p->getStatus());
+				break;
+			}
+		}
+		presences.clear();
+		presences.push_back(presence);
+	}
+
+	// Pretend the presences have been received again, so PresenceOracle,
+	// UserManager and User see the same state as before the restart.
+	BOOST_FOREACH(Swift::Presence::ref &presence, presences) {
+		m_component->getStanzaChannel()->onPresenceReceived(presence);
+	}
+
+	// Resources could have gone offline or changed their presence while
+	// we were down. Probe the user, so the server sends the current ones.
+	Swift::Presence::ref probe = Swift::Presence::create();
+	probe->setTo(Swift::JID(jid));
+	probe->setFrom(m_component->getJID());
+	probe->setType(Swift::Presence::Probe);
+	m_component->getStanzaChannel()->sendPresence(probe);
+
+	return true;
+}
+
+bool SessionSnapshot::restoreRoster(User *user, StorageBackend *storageBackend) {
+	std::map<std::string, UserState>::iterator it = m_users.find(user->getJID().toBare().toString());
+	if (it == m_users.end() || !storageBackend) {
+		return false;
+	}
+
+	std::list<BuddyInfo> roster;
+	BOOST_FOREACH(const BuddyState &buddy, it->second.buddies) {
+		roster.push_back(buddy.info);
+	}
+
+	LOG4CXX_INFO(logger, user->getJID().toString() << ": Restoring " << roster.size() << " buddies from session snapshot");
+	user->getRosterManager()->setStorageBackend(storageBackend, roster);
+
+	// Restore last known presences of buddies. Backend sends the same presences
+	// once it's logged in again and unchanged presences are not forwarded to
+	// XMPP user then.
+	const RosterManager::BuddiesMap &buddies = user->getRosterManager()->getBuddies();
+	BOOST_FOREACH(const BuddyState &buddy, it->second.buddies) {
+		RosterManager::BuddiesMap::const_iterator bt = buddies.find(buddy.info.legacyName);
+		LocalBuddy *localBuddy = bt != buddies.end() ? dynamic_cast<LocalBuddy *>(bt->second) : NULL;
+		if (localBuddy) {
+			localBuddy->setStatus(Swift::StatusShow((Swift::StatusShow::Type) buddy.show), buddy.statusMessage);
+		}
+	}
+
+	m_users.erase(it);
+	return true;
+}
+
+}
@@ -98,6 +98,7 @@ SQLite3Backend::~SQLite3Backend(){
 		FINALIZE_STMT(m_getUserSetting);
 		FINALIZE_STMT(m_setUserSetting);
 		FINALIZE_STMT(m_updateUserSetting);
+		FINALIZE_STMT(m_getUsersSetting);
 		FINALIZE_STMT(m_updateBuddySetting);
 		FINALIZE_STMT(m_getBuddySetting);
 		FINALIZE_STMT(m_setUserOnline);
@@ -140,6 +141,7 @@ bool SQLite3Backend::connect() {
 	PREP_STMT(m_getUserSetting, "SELECT type, value FROM " + m_prefix + "users_settings WHERE user_id=? AND var=?");
 	PREP_STMT(m_setUserSetting, "INSERT INTO " + m_prefix + "users_settings (user_id, var, type, value) VALUES (?,?,?,?)");
 	PREP_STMT(m_updateUserSetting, "UPDATE " + m_prefix + "users_settings SET value=? WHERE user_id=? AND var=?");
+	PREP_STMT(m_getUsersSetting, "SELECT u.jid, s.value FROM " + m_prefix + "users u JOIN " + m_prefix + "users_settings s ON s.user_id=u.id WHERE s.var=?");
 
 	PREP_STMT(m_setUserOnline, "UPDATE " + m_prefix + "users SET online=?, last_login=DATETIME('NOW') WHERE id=?");
 	PREP_STMT(m_getOnlineUsers, "SELECT jid FROM " + m_prefix + "users WHERE online=1");
@@ -525,6 +527,25 @@ void SQLite3Backend::updateUserSetting(long id, const std::string &variable, con
 	EXECUTE_STATEMENT(m_updateUserSetting, "m_updateUserSetting");
 }
 
+bool SQLite3Backend::getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values) {
+	BEGIN(m_getUsersSetting);
+	BIND_STR(m_getUsersSetting, variable);
+
+	int ret;
+	while((ret = sqlite3_step(m_getUsersSetting)) == SQLITE_ROW) {
+		RESET_GET_COUNTER(m_getUsersSetting);
+		std::string jid = GET_STR(m_getUsersSetting);
+		values[jid] = GET_STR(m_getUsersSetting);
+	}
+
+	if (ret != SQLITE_DONE) {
+		LOG4CXX_ERROR(logger, "getUsersSetting query"<< (sqlite3_errmsg(m_db) == NULL ? "" : sqlite3_errmsg(m_db)));
+		return false;
+	}
+
+	return true;
+}
+
 void SQLite3Backend::getBuddySetting(long userId, long buddyId, const std::string &variable, int &type, std::string &value) {
 	BEGIN(m_getBuddySetting);
 	BIND_INT(m_getBuddySetting, userId);
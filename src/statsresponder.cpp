@@ -33,6 +33,8 @@
 #include "transport/rostermanager.h"
 #include "transport/usermanager.h"
 #include "transport/networkpluginserver.h"
+#include "transport/messagecache.h"
+#include "transport/metrics.h"
 #include "transport/logging.h"
 
 using namespace Swift;
@@ -80,33 +82,20 @@ bool StatsResponder::handleGetRequest(const Swift::JID& from, const Swift::JID&
 		response->addItem(StatsPayload::Item("contacts/total"));
 		response->addItem(StatsPayload::Item("messages/from-xmpp"));
 		response->addItem(StatsPayload::Item("messages/to-xmpp"));
+		response->addItem(StatsPayload::Item("messages/throttled"));
+		response->addItem(StatsPayload::Item("messages/dropped"));
+		response->addItem(StatsPayload::Item("stanzas/saved"));
+		response->addItem(StatsPayload::Item("messages/cached"));
+		response->addItem(StatsPayload::Item("messages/spooled"));
 		response->addItem(StatsPayload::Item("backends/running"));
 		response->addItem(StatsPayload::Item("backends/crashed"));
 		response->addItem(StatsPayload::Item("memory-usage"));
 	}
 	else {
-		unsigned long contactsOnline = 0;
-		unsigned long contactsTotal = 0;
-
-		Swift::StatusShow s;
-		std::string statusMessage;
-		for (std::map<std::string, User *>::const_iterator it = m_userManager->getUsers().begin(); it != m_userManager->getUsers().end(); it++) {
-			if (!(*it).second) {
-				continue;
-			}
-			const RosterManager::BuddiesMap &buddies = (*it).second->getRosterManager()->getBuddies();
-			contactsTotal += buddies.size();
-			for(RosterManager::BuddiesMap::const_iterator bt = buddies.begin(); bt != buddies.end(); bt++) {
-				if (!(*bt).second) {
-					continue;
-				}
-				if (!(*bt).second->getStatus(s, statusMessage))
-					continue;
-				if (s.getType() != Swift::StatusShow::None) {
-					contactsOnline++;
-				}
-			}
-		}
+		// Contacts are counted incrementally by RosterManager, so we don't have
+		// to walk through the rosters of all users here.
+		long contactsOnline = m_component->getMetrics()->getGauge("spectrum2_contacts_online")->getValue();
+		long contactsTotal = m_component->getMetrics()->getGauge("spectrum2_contacts_total")->getValue();
 
 		BOOST_FOREACH(const StatsPayload::Item &item, stats->getItems()) {
 			if (item.getName() == "uptime") {
@@ -136,6 +125,21 @@ bool StatsResponder::handleGetRequest(const Swift::JID& from, const Swift::JID&
 			else if (item.getName() == "messages/to-xmpp") {
 				response->addItem(StatsPayload::Item("messages/to-xmpp", "messages", boost::lexical_cast<std::string>(m_userManager->getMessagesToXMPP())));
 			}
+			else if (item.getName() == "messages/throttled") {
+				response->addItem(StatsPayload::Item("messages/throttled", "messages", boost::lexical_cast<std::string>(m_server->getThrottledMessages())));
+			}
+			else if (item.getName() == "messages/dropped") {
+				response->addItem(StatsPayload::Item("messages/dropped", "messages", boost::lexical_cast<std::string>(m_server->getDroppedMessages())));
+			}
+			else if (item.getName() == "stanzas/saved") {
+				response->addItem(StatsPayload::Item("stanzas/saved", "stanzas", boost::lexical_cast<std::string>(m_server->getSavedStanzas())));
+			}
+			else if (item.getName() == "messages/cached") {
+				response->addItem(StatsPayload::Item("messages/cached", "messages", boost::lexical_cast<std::string>(m_component->getMessageCache()->getMemoryCount())));
+			}
+			else if (item.getName() == "messages/spooled") {
+				response->addItem(StatsPayload::Item("messages/spooled", "messages", boost::lexical_cast<std::string>(m_component->getMessageCache()->getSpoolCount())));
+			}
 		}
 	}
 
@@ -47,7 +47,7 @@ StorageResponder::~StorageResponder() {
 }
 
 bool StorageResponder::handleGetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::PrivateStorage> payload) {
-	User *user = m_userManager->getUser(from.toBare().toString());
+	User *user = m_userManager->getUser(from);
 	if (!user) {
 		LOG4CXX_WARN(logger, from.toBare().toString() << ": User is not logged in");
 		sendError(from, id, ErrorPayload::NotAcceptable, ErrorPayload::Cancel);
@@ -64,7 +64,7 @@ bool StorageResponder::handleGetRequest(const Swift::JID& from, const Swift::JID
 }
 
 bool StorageResponder::handleSetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::PrivateStorage> payload) {
-	User *user = m_userManager->getUser(from.toBare().toString());
+	User *user = m_userManager->getUser(from);
 	if (!user) {
 		sendError(from, id, ErrorPayload::NotAcceptable, ErrorPayload::Cancel);
 		LOG4CXX_WARN(logger, from.toBare().toString() << ": User is not logged in");
@@ -0,0 +1,142 @@
+#include "transport/backendcapture.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+using namespace Transport;
+
+#define CAPTURE "backendcapture.cap"
+
+class BackendCaptureTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(BackendCaptureTest);
+	CPPUNIT_TEST(recordLoad);
+	CPPUNIT_TEST(backendNumbers);
+	CPPUNIT_TEST(truncatedRecord);
+	CPPUNIT_TEST(corruptedFrameSize);
+	CPPUNIT_TEST(notCapture);
+#ifndef WIN32
+	CPPUNIT_TEST(fileMode);
+#endif
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp (void) {
+			std::remove(CAPTURE);
+		}
+
+		void tearDown (void) {
+			std::remove(CAPTURE);
+		}
+
+		void recordLoad() {
+			{
+				BackendCapture capture(CAPTURE);
+				CPPUNIT_ASSERT(capture.isOpen());
+				capture.record((void *) 1, BackendCapture::ToBackend, std::string("login\0frame", 11), 1000.25);
+				capture.record((void *) 1, BackendCapture::FromBackend, "", 1001.5);
+			}
+
+			std::vector<BackendCapture::Record> records;
+			CPPUNIT_ASSERT(BackendCapture::load(CAPTURE, records));
+			CPPUNIT_ASSERT_EQUAL(2, (int) records.size());
+
+			CPPUNIT_ASSERT_EQUAL(BackendCapture::ToBackend, records[0].direction);
+			CPPUNIT_ASSERT_EQUAL(std::string("login\0frame", 11), records[0].frame);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1000.25, records[0].time, 0.000001);
+
+			CPPUNIT_ASSERT_EQUAL(BackendCapture::FromBackend, records[1].direction);
+			CPPUNIT_ASSERT_EQUAL(std::string(""), records[1].frame);
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(1001.5, records[1].time, 0.000001);
+		}
+
+		void backendNumbers() {
+			{
+				BackendCapture capture(CAPTURE);
+				capture.record((void *) 2, BackendCapture::ToBackend, "a", 1);
+				capture.record((void *) 1, BackendCapture::ToBackend, "b", 1);
+				capture.record((void *) 2, BackendCapture::FromBackend, "c", 1);
+				capture.removeBackend((void *) 2);
+				capture.record((void *) 2, BackendCapture::FromBackend, "d", 1);
+			}
+
+			std::vector<BackendCapture::Record> records;
+			CPPUNIT_ASSERT(BackendCapture::load(CAPTURE, records));
+			CPPUNIT_ASSERT_EQUAL(4, (int) records.size());
+			CPPUNIT_ASSERT_EQUAL(0, (int) records[0].backend);
+			CPPUNIT_ASSERT_EQUAL(1, (int) records[1].backend);
+			CPPUNIT_ASSERT_EQUAL(0, (int) records[2].backend);
+			CPPUNIT_ASSERT_EQUAL(2, (int) records[3].backend);
+		}
+
+		void truncatedRecord() {
+			{
+				BackendCapture capture(CAPTURE);
+				capture.record((void *) 1, BackendCapture::ToBackend, "first", 1);
+				capture.record((void *) 1, BackendCapture::ToBackend, "second", 2);
+			}
+
+			// Spectrum 2 killed in the middle of writing the last record.
+			std::ifstream in(CAPTURE, std::ios::in | std::ios::binary);
+			std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			in.close();
+			std::ofstream out(CAPTURE, std::ios::out | std::ios::trunc | std::ios::binary);
+			out.write(data.c_str(), data.size() - 3);
+			out.close();
+
+			std::vector<BackendCapture::Record> records;
+			CPPUNIT_ASSERT(BackendCapture::load(CAPTURE, records));
+			CPPUNIT_ASSERT_EQUAL(1, (int) records.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("first"), records[0].frame);
+		}
+
+		void corruptedFrameSize() {
+			{
+				BackendCapture capture(CAPTURE);
+				capture.record((void *) 1, BackendCapture::ToBackend, "first", 1);
+			}
+
+			// Header of the second record with huge frame size.
+			std::ofstream out(CAPTURE, std::ios::out | std::ios::app | std::ios::binary);
+			std::string header(17, 0);
+			header.replace(13, 4, "\xff\xff\xff\xff");
+			out.write(header.c_str(), header.size());
+			out.close();
+
+			std::vector<BackendCapture::Record> records;
+			CPPUNIT_ASSERT(BackendCapture::load(CAPTURE, records));
+			CPPUNIT_ASSERT_EQUAL(1, (int) records.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("first"), records[0].frame);
+		}
+
+		void notCapture() {
+			std::vector<BackendCapture::Record> records;
+			CPPUNIT_ASSERT(!BackendCapture::load(CAPTURE, records));
+
+			std::ofstream out(CAPTURE, std::ios::out | std::ios::trunc | std::ios::binary);
+			out << "something else";
+			out.close();
+			CPPUNIT_ASSERT(!BackendCapture::load(CAPTURE, records));
+		}
+
+#ifndef WIN32
+		void fileMode() {
+			std::ofstream out(CAPTURE, std::ios::out | std::ios::trunc | std::ios::binary);
+			out.close();
+			chmod(CAPTURE, 0644);
+
+			BackendCapture capture(CAPTURE);
+			CPPUNIT_ASSERT(capture.isOpen());
+
+			struct stat st;
+			CPPUNIT_ASSERT_EQUAL(0, stat(CAPTURE, &st));
+			CPPUNIT_ASSERT_EQUAL(0600, (int) (st.st_mode & 0777));
+		}
+#endif
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (BackendCaptureTest);
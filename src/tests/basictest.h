@@ -167,6 +167,14 @@ class TestingStorageBackend : public StorageBackend {
 			return true;
 		}
 
+		/// getAllUsers
+		virtual bool getAllUsers(std::vector<std::string> &users) {
+			for (std::map<std::string, UserInfo>::const_iterator it = this->users.begin(); it != this->users.end(); it++) {
+				users.push_back(it->first);
+			}
+			return true;
+		}
+
 		virtual long addBuddy(long userId, const BuddyInfo &buddyInfo) {
 			return buddyid++;
 		}
@@ -193,6 +201,15 @@ class TestingStorageBackend : public StorageBackend {
 			settings[userId][variable] = value;
 		}
 
+		virtual bool getUsersSetting(const std::string &variable, std::map<std::string, std::string> &values) {
+			for (std::map<std::string, UserInfo>::const_iterator it = users.begin(); it != users.end(); it++) {
+				if (settings[it->second.id].find(variable) != settings[it->second.id].end()) {
+					values[it->first] = settings[it->second.id][variable];
+				}
+			}
+			return true;
+		}
+
 		void dumpUserSettings() {
 			std::cout << "\n\nUserSettings dump:\n";
 			for (std::map<int, std::map<std::string, std::string> >::const_iterator it = settings.begin(); it != settings.end(); it++) {
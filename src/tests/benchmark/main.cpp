@@ -0,0 +1,552 @@
+#include "../basictest.h"
+#include "transport/networkpluginserver.h"
+#include "transport/protocol.pb.h"
+#include "transport/backendcapture.h"
+#include <Swiften/Network/DummyConnection.h>
+#include <google/protobuf/unknown_field_set.h>
+#include <google/protobuf/wire_format.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+#ifdef WITH_LOG4CXX
+#include "log4cxx/logger.h"
+#include "log4cxx/fileappender.h"
+#include "log4cxx/patternlayout.h"
+
+using namespace log4cxx;
+#endif
+
+using namespace Transport;
+
+// Offline load generator for the Spectrum 2 core. It drives Component,
+// UserManager, RosterManager and NetworkPluginServer with simulated XMPP
+// users and a simulated backend living in the same process. Everything runs
+// in DummyEventLoop, so the numbers show only the CPU time spent in
+// libtransport and they are reproducible between runs.
+//
+// With --replay, traffic recorded using [service] backend_capture is fed
+// to the core instead of the synthetic load.
+
+static double getTime() {
+	static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+	return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds() / 1000000.0;
+}
+
+class Stats {
+	public:
+		Stats(const std::string &name = "") : m_name(name), m_total(0) {}
+
+		void add(double latency) {
+			m_latencies.push_back(latency);
+			m_total += latency;
+		}
+
+		unsigned long getCount() const {
+			return m_latencies.size();
+		}
+
+		void print(unsigned long count) {
+			std::sort(m_latencies.begin(), m_latencies.end());
+			std::cout << std::setw(14) << std::left << m_name << std::right
+					  << std::setw(8) << count << " in " << std::fixed << std::setprecision(3) << m_total << " s, "
+					  << std::setprecision(1) << std::setw(10) << (m_total > 0 ? count / m_total : 0) << "/s, "
+					  << "p50 " << std::setprecision(3) << percentile(0.50) * 1000 << " ms, "
+					  << "p99 " << percentile(0.99) * 1000 << " ms\n";
+		}
+
+	private:
+		double percentile(double p) const {
+			if (m_latencies.empty()) {
+				return 0;
+			}
+			size_t index = std::min(m_latencies.size() - 1, (size_t) (m_latencies.size() * p));
+			return m_latencies[index];
+		}
+
+		std::string m_name;
+		double m_total;
+		std::vector<double> m_latencies;
+};
+
+// Answers the frames NetworkPluginServer sends the same way a real backend
+// does: PING with PONG, Login with Connected and messages are echoed back
+// as if the legacy buddy answered. Frames go through DummyConnection, so
+// NetworkPluginServer::handleDataRead parses them as in production.
+// When replaying, only PINGs are answered, because the answers are part
+// of the capture.
+class SimulatedBackend {
+	public:
+		SimulatedBackend(Swift::EventLoop *loop, bool answer = true) : m_answer(answer) {
+			m_connection = boost::shared_ptr<Swift::DummyConnection>(new Swift::DummyConnection(loop));
+			m_connection->onDataSent.connect(boost::bind(&SimulatedBackend::handleDataSent, this, _1));
+		}
+
+		boost::shared_ptr<Swift::Connection> getConnection() {
+			return m_connection;
+		}
+
+		// Sends buddy to user, as if it had been added on legacy network.
+		void sendBuddy(const std::string &user, const std::string &buddy) {
+			pbnetwork::Buddy payload;
+			payload.set_session(m_sessions[user]);
+			payload.set_buddyname(buddy);
+			payload.set_alias(buddy);
+			payload.add_group("Buddies");
+			payload.set_status(pbnetwork::STATUS_ONLINE);
+
+			std::string message;
+			payload.SerializeToString(&message);
+			send(pbnetwork::WrapperMessage_Type_TYPE_BUDDY_CHANGED, message);
+		}
+
+		// Returns session handle assigned to user in Login message.
+		unsigned int getSession(const std::string &user) {
+			return m_sessions[user];
+		}
+
+		void send(const pbnetwork::WrapperMessage &wrapper) {
+			std::string message;
+			wrapper.SerializeToString(&message);
+
+			uint32_t size = htonl(message.size());
+			m_connection->receive(Swift::createSafeByteArray(std::string((char *) &size, 4) + message));
+		}
+
+	private:
+		void handleDataSent(const Swift::SafeByteArray &data) {
+			m_data.insert(m_data.end(), data.begin(), data.end());
+
+			while (m_data.size() >= 4) {
+				unsigned int expected_size = ntohl(*((unsigned int*) &m_data[0]));
+				if (m_data.size() - 4 < expected_size) {
+					return;
+				}
+
+				pbnetwork::WrapperMessage wrapper;
+				bool parsed = wrapper.ParseFromArray(&m_data[4], expected_size);
+				m_data.erase(m_data.begin(), m_data.begin() + 4 + expected_size);
+				if (parsed) {
+					handleWrapperMessage(wrapper);
+				}
+			}
+		}
+
+		void handleWrapperMessage(const pbnetwork::WrapperMessage &wrapper) {
+			switch (wrapper.type()) {
+				case pbnetwork::WrapperMessage_Type_TYPE_PING:
+					send(pbnetwork::WrapperMessage_Type_TYPE_PONG, "");
+					break;
+				case pbnetwork::WrapperMessage_Type_TYPE_LOGIN: {
+					pbnetwork::Login login;
+					if (!login.ParseFromString(wrapper.payload())) {
+						break;
+					}
+					m_sessions[login.user()] = login.session();
+					if (!m_answer) {
+						break;
+					}
+
+					pbnetwork::Connected connected;
+					connected.set_user(login.user());
+
+					std::string message;
+					connected.SerializeToString(&message);
+					send(pbnetwork::WrapperMessage_Type_TYPE_CONNECTED, message);
+					break;
+				}
+				case pbnetwork::WrapperMessage_Type_TYPE_CONV_MESSAGE: {
+					pbnetwork::ConversationMessage payload;
+					if (!m_answer || !payload.ParseFromString(wrapper.payload())) {
+						break;
+					}
+					payload.set_session(m_sessions[payload.username()]);
+					payload.clear_username();
+
+					std::string message;
+					payload.SerializeToString(&message);
+					send(pbnetwork::WrapperMessage_Type_TYPE_CONV_MESSAGE, message);
+					break;
+				}
+				default:
+					break;
+			}
+		}
+
+		void send(pbnetwork::WrapperMessage_Type type, const std::string &payload) {
+			pbnetwork::WrapperMessage wrapper;
+			wrapper.set_type(type);
+			if (!payload.empty()) {
+				wrapper.set_payload(payload);
+			}
+			send(wrapper);
+		}
+
+		bool m_answer;
+		boost::shared_ptr<Swift::DummyConnection> m_connection;
+		std::vector<char> m_data;
+		std::map<std::string, unsigned int> m_sessions;
+};
+
+// TestingStorageBackend looks users up by ID linearly, which would dominate
+// the login numbers with thousands of users.
+class BenchmarkStorageBackend : public TestingStorageBackend {
+	public:
+		virtual void setUserOnline(long id, bool online) {}
+};
+
+class Benchmark {
+	public:
+		Benchmark(int users, int buddies, int messages) : m_users(users), m_buddies(buddies), m_messages(messages),
+			m_receivedMessages(0), m_receivedRosterPushes(0), m_lastUserId(0) {
+			// All users have to fit into the simulated backend, otherwise
+			// NetworkPluginServer would try to spawn another one.
+			std::istringstream ifs("service.server_mode = 1\nservice.jid=localhost\nservice.more_resources=1\n"
+								   "service.users_per_backend=1000000\n");
+			m_config = new Config();
+			m_config->load(ifs);
+
+			m_factory = new TestingFactory();
+			m_storage = new BenchmarkStorageBackend();
+			m_loop = new Swift::DummyEventLoop();
+			m_factories = new Swift::DummyNetworkFactories(m_loop);
+			m_userRegistry = new UserRegistry(m_config, m_factories);
+			m_component = new Component(m_loop, m_factories, m_config, m_factory, m_userRegistry);
+			m_itemsResponder = new DiscoItemsResponder(m_component);
+			m_itemsResponder->start();
+			m_userManager = new UserManager(m_component, m_userRegistry, m_itemsResponder, m_storage);
+			m_server = new NetworkPluginServer(m_component, m_config, m_userManager, NULL, m_itemsResponder);
+
+			m_payloadSerializers = new Swift::FullPayloadSerializerCollection();
+			m_payloadParserFactories = new Swift::FullPayloadParserFactoryCollection();
+
+			for (int i = 0; i < m_users; i++) {
+				registerUser(getUserJID(i).toBare().toString(), "legacy" + boost::lexical_cast<std::string>(i), "password");
+			}
+		}
+
+		void run() {
+			m_backend = new SimulatedBackend(m_loop);
+			m_server->handleNewClientConnection(m_backend->getConnection());
+			m_loop->processEvents();
+
+			Stats logins("logins");
+			for (int i = 0; i < m_users; i++) {
+				double start = getTime();
+				login(getUserJID(i), "password");
+				logins.add(getTime() - start);
+			}
+
+			Stats rosterPushes("roster pushes");
+			for (int b = 0; b < m_buddies; b++) {
+				for (int i = 0; i < m_users; i++) {
+					double start = getTime();
+					m_backend->sendBuddy(getUserJID(i).toBare().toString(), getBuddyName(b));
+					m_loop->processEvents();
+					rosterPushes.add(getTime() - start);
+				}
+			}
+
+			Stats messages("messages");
+			for (int m = 0; m < m_messages; m++) {
+				double start = getTime();
+				sendMessage(getUserJID(m % m_users), Swift::JID(getBuddyName(m % std::max(m_buddies, 1)), "localhost"), "Hello world");
+				messages.add(getTime() - start);
+			}
+
+			// Every stanza from XMPP user is routed by looking up its full JID,
+			// so compare UserIndex with the std::map lookup it replaced.
+			std::vector<Swift::JID> jids;
+			for (int i = 0; i < m_users; i++) {
+				jids.push_back(getUserJID(i));
+			}
+
+			Stats lookups("user lookups");
+			Stats mapLookups("map lookups");
+			unsigned long found = 0;
+			unsigned long mapFound = 0;
+			const std::map<std::string, User *> &users = m_userManager->getUsers();
+			for (int m = 0; m < m_messages; m++) {
+				const Swift::JID &jid = jids[m % m_users];
+				double start = getTime();
+				found += m_userManager->getUser(jid) != NULL;
+				lookups.add(getTime() - start);
+
+				start = getTime();
+				mapFound += users.find(jid.toBare().toString()) != users.end();
+				mapLookups.add(getTime() - start);
+			}
+
+			std::cout << m_users << " users, " << m_buddies << " buddies per user, " << m_messages << " messages\n";
+			logins.print(m_userManager->getUserCount());
+			rosterPushes.print(m_receivedRosterPushes);
+			messages.print(m_receivedMessages);
+			lookups.print(found);
+			mapLookups.print(mapFound);
+		}
+
+		// Replays captured traffic. Users are logged in when their Login frame
+		// appears in the capture and messages sent by XMPP users are injected
+		// again. Other frames sent to backends are just the responses to the
+		// replayed traffic, so they are skipped. Frames received from backends
+		// are fed to NetworkPluginServer with session handles translated to
+		// the ones assigned in this run. All backends are replayed over single
+		// connection.
+		void replay(const std::vector<BackendCapture::Record> &records, bool realtime) {
+			m_backend = new SimulatedBackend(m_loop, false);
+			m_server->handleNewClientConnection(m_backend->getConnection());
+			m_loop->processEvents();
+
+			std::map<int, Stats> stats;
+			std::map<unsigned int, unsigned int> sessions;
+			double replayStart = getTime();
+			for (std::vector<BackendCapture::Record>::const_iterator it = records.begin(); it != records.end(); it++) {
+				pbnetwork::WrapperMessage wrapper;
+				if (!wrapper.ParseFromString(it->frame)) {
+					continue;
+				}
+
+				if (realtime) {
+					double wait = (it->time - records.front().time) - (getTime() - replayStart);
+					if (wait > 0) {
+						boost::this_thread::sleep(boost::posix_time::microseconds((long) (wait * 1000000)));
+					}
+				}
+
+				double start = getTime();
+				if (it->direction == BackendCapture::ToBackend) {
+					if (wrapper.type() == pbnetwork::WrapperMessage_Type_TYPE_LOGIN) {
+						pbnetwork::Login payload;
+						if (!payload.ParseFromString(wrapper.payload())) {
+							continue;
+						}
+						Swift::JID jid(payload.user());
+						registerUser(jid.toBare().toString(), payload.legacyname(), payload.password());
+						login(Swift::JID(jid.getNode(), jid.getDomain(), "replay"), payload.password());
+						sessions[payload.session()] = m_backend->getSession(payload.user());
+					}
+					else if (wrapper.type() == pbnetwork::WrapperMessage_Type_TYPE_CONV_MESSAGE) {
+						pbnetwork::ConversationMessage payload;
+						if (!payload.ParseFromString(wrapper.payload())) {
+							continue;
+						}
+						Swift::JID jid(payload.username());
+						sendMessage(Swift::JID(jid.getNode(), jid.getDomain(), "replay"), Swift::JID(Swift::JID::getEscapedNode(payload.buddyname()), "localhost"), payload.message());
+					}
+					else {
+						continue;
+					}
+				}
+				else {
+					// SimulatedBackend answers PINGs of this run itself.
+					if (wrapper.type() == pbnetwork::WrapperMessage_Type_TYPE_PONG) {
+						continue;
+					}
+					translateSession(wrapper, sessions);
+					m_backend->send(wrapper);
+					m_loop->processEvents();
+				}
+
+				if (stats.find(wrapper.type()) == stats.end()) {
+					stats.insert(std::make_pair((int) wrapper.type(), Stats(pbnetwork::WrapperMessage_Type_Name(wrapper.type()))));
+				}
+				stats[wrapper.type()].add(getTime() - start);
+			}
+
+			std::cout << records.size() << " frames in capture, " << m_userManager->getUserCount() << " users logged in\n";
+			for (std::map<int, Stats>::iterator it = stats.begin(); it != stats.end(); it++) {
+				it->second.print(it->second.getCount());
+			}
+		}
+
+	private:
+		// Every message sent by backend has session handle in field 15, so
+		// it's replaced without parsing the payload as its concrete type.
+		static void translateSession(pbnetwork::WrapperMessage &wrapper, const std::map<unsigned int, unsigned int> &sessions) {
+			if (!wrapper.has_payload()) {
+				return;
+			}
+
+			google::protobuf::UnknownFieldSet fields;
+			if (!fields.ParseFromString(wrapper.payload())) {
+				return;
+			}
+
+			bool changed = false;
+			for (int i = 0; i < fields.field_count(); i++) {
+				google::protobuf::UnknownField *field = fields.mutable_field(i);
+				if (field->number() != 15 || field->type() != google::protobuf::UnknownField::TYPE_VARINT) {
+					continue;
+				}
+				std::map<unsigned int, unsigned int>::const_iterator it = sessions.find(field->varint());
+				if (it != sessions.end()) {
+					field->set_varint(it->second);
+					changed = true;
+				}
+			}
+
+			if (changed) {
+				std::string payload;
+				{
+					google::protobuf::io::StringOutputStream stream(&payload);
+					google::protobuf::io::CodedOutputStream output(&stream);
+					google::protobuf::internal::WireFormat::SerializeUnknownFields(fields, &output);
+				}
+				wrapper.set_payload(payload);
+			}
+		}
+
+		void registerUser(const std::string &jid, const std::string &uin, const std::string &password) {
+			UserInfo user;
+			if (m_storage->getUser(jid, user)) {
+				return;
+			}
+			user.id = ++m_lastUserId;
+			user.jid = jid;
+			user.uin = uin;
+			user.password = password;
+			user.vip = 0;
+			m_storage->setUser(user);
+		}
+
+		Swift::JID getUserJID(int i) {
+			return Swift::JID("user" + boost::lexical_cast<std::string>(i), "localhost", "bench");
+		}
+
+		std::string getBuddyName(int i) {
+			return "buddy" + boost::lexical_cast<std::string>(i);
+		}
+
+		// Does what XMPP client does: authenticates, which makes Spectrum 2
+		// log the user in to legacy network, and sends initial presence.
+		void login(const Swift::JID &jid, const std::string &password) {
+			boost::shared_ptr<Swift::ServerFromClientSession> session(new Swift::ServerFromClientSession("id", m_factories->getConnectionFactory()->createConnection(),
+					m_payloadParserFactories, m_payloadSerializers, m_userRegistry, m_factories->getXMLParserFactory(), jid));
+			session->startSession();
+			session->onDataWritten.connect(boost::bind(&Benchmark::handleDataWritten, this, _1));
+			dynamic_cast<Swift::ServerStanzaChannel *>(m_component->getStanzaChannel())->addSession(session);
+			m_sessions.push_back(session);
+
+			m_userRegistry->isValidUserPassword(jid, session.get(), Swift::createSafeByteArray(password));
+			m_loop->processEvents();
+
+			Swift::Presence::ref presence = Swift::Presence::create();
+			presence->setFrom(jid);
+			presence->setTo(m_component->getJID());
+			dynamic_cast<Swift::ServerStanzaChannel *>(m_component->getStanzaChannel())->onPresenceReceived(presence);
+			m_loop->processEvents();
+		}
+
+		// Sends message to buddy and waits until the echo from backend (if
+		// any) is forwarded back to the user.
+		void sendMessage(const Swift::JID &from, const Swift::JID &to, const std::string &body) {
+			boost::shared_ptr<Swift::Message> msg(new Swift::Message());
+			msg->setFrom(from);
+			msg->setTo(to);
+			msg->setBody(body);
+			dynamic_cast<Swift::ServerStanzaChannel *>(m_component->getStanzaChannel())->onMessageReceived(msg);
+			m_loop->processEvents();
+		}
+
+		void handleDataWritten(const Swift::SafeByteArray &data) {
+			std::string str = safeByteArrayToString(data);
+			if (str.compare(0, 8, "<message") == 0) {
+				m_receivedMessages++;
+			}
+			else if (str.compare(0, 3, "<iq") == 0 && str.find("jabber:iq:roster") != std::string::npos) {
+				m_receivedRosterPushes++;
+			}
+		}
+
+		int m_users;
+		int m_buddies;
+		int m_messages;
+		unsigned long m_receivedMessages;
+		unsigned long m_receivedRosterPushes;
+		long m_lastUserId;
+		Config *m_config;
+		TestingFactory *m_factory;
+		StorageBackend *m_storage;
+		Swift::DummyEventLoop *m_loop;
+		Swift::DummyNetworkFactories *m_factories;
+		UserRegistry *m_userRegistry;
+		Component *m_component;
+		DiscoItemsResponder *m_itemsResponder;
+		UserManager *m_userManager;
+		NetworkPluginServer *m_server;
+		SimulatedBackend *m_backend;
+		Swift::FullPayloadSerializerCollection *m_payloadSerializers;
+		Swift::FullPayloadParserFactoryCollection *m_payloadParserFactories;
+		std::vector<boost::shared_ptr<Swift::ServerFromClientSession> > m_sessions;
+};
+
+int main(int argc, char **argv) {
+	int users;
+	int buddies;
+	int messages;
+	std::string capture;
+	boost::program_options::options_description desc("Usage: libtransport_benchmark [OPTIONS]\nAllowed options");
+	desc.add_options()
+		("help,h", "Show help output")
+		("users,u", boost::program_options::value<int>(&users)->default_value(2000), "Number of simulated XMPP users")
+		("buddies,b", boost::program_options::value<int>(&buddies)->default_value(20), "Number of buddies pushed to every user")
+		("messages,m", boost::program_options::value<int>(&messages)->default_value(100000), "Number of messages sent and echoed by backend")
+		("replay,r", boost::program_options::value<std::string>(&capture)->default_value(""), "Replay traffic recorded using [service] backend_capture instead")
+		("realtime", "Replay the capture at recorded speed instead of maximum speed")
+		;
+
+	boost::program_options::variables_map vm;
+	try {
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+		boost::program_options::notify(vm);
+	}
+	catch (const boost::program_options::error &e) {
+		std::cerr << e.what() << "\n" << desc << "\n";
+		return 1;
+	}
+
+	if (vm.count("help") || users <= 0) {
+		std::cout << desc << "\n";
+		return 1;
+	}
+
+#ifdef WITH_LOG4CXX
+	// Logging would be the most expensive part otherwise.
+	LoggerPtr root = Logger::getRootLogger();
+	root->setLevel(log4cxx::Level::getError());
+#ifndef _MSC_VER
+	root->addAppender(new FileAppender(new PatternLayout("%d %-5p %c: %m%n"), "libtransport_benchmark.log", false));
+#else
+	root->addAppender(new FileAppender(new PatternLayout(L"%d %-5p %c: %m%n"), L"libtransport_benchmark.log", false));
+#endif
+#endif
+
+	// Objects are not destroyed, the process exits right after the run.
+	if (!capture.empty()) {
+		std::vector<BackendCapture::Record> records;
+		if (!BackendCapture::load(capture, records)) {
+			std::cerr << "Can't load capture file " << capture << "\n";
+			return 1;
+		}
+
+		Benchmark benchmark(0, 0, 0);
+		benchmark.replay(records, vm.count("realtime") != 0);
+		return 0;
+	}
+
+	Benchmark benchmark(users, buddies, messages);
+	benchmark.run();
+	return 0;
+}
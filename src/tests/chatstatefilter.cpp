@@ -0,0 +1,129 @@
+#include "transport/chatstatefilter.h"
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+using namespace Transport;
+
+class ChatStateFilterTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(ChatStateFilterTest);
+	CPPUNIT_TEST(suppressSameState);
+	CPPUNIT_TEST(differentBuddies);
+	CPPUNIT_TEST(reset);
+	CPPUNIT_TEST(coalesce);
+	CPPUNIT_TEST(coalesceBackToSentState);
+	CPPUNIT_TEST(coalesceNotDelayed);
+	CPPUNIT_TEST(removeUser);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp (void) {
+		}
+
+		void tearDown (void) {
+
+		}
+
+	void suppressSameState() {
+		ChatStateFilter filter;
+
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 1.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Suppress, filter.filter("user@localhost", "buddy", 1, 2.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Suppress, filter.filter("user@localhost", "buddy", 1, 3.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 2, 4.0));
+		CPPUNIT_ASSERT_EQUAL(2, (int) filter.getSavedCount());
+	}
+
+	void differentBuddies() {
+		ChatStateFilter filter;
+
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 1.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy2", 1, 1.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user2@localhost", "buddy", 1, 1.0));
+		CPPUNIT_ASSERT_EQUAL(0, (int) filter.getSavedCount());
+	}
+
+	void reset() {
+		ChatStateFilter filter;
+
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 1.0));
+		filter.reset("user@localhost", "buddy");
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 2.0));
+
+		ChatStateFilter coalescing(1.0);
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, coalescing.filter("user@localhost", "buddy", 1, 10.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, coalescing.filter("user@localhost", "buddy", 2, 10.1));
+		coalescing.reset("user@localhost", "buddy");
+		CPPUNIT_ASSERT_EQUAL(0, (int) coalescing.getPendingCount());
+	}
+
+	void coalesce() {
+		ChatStateFilter filter(1.0);
+		std::vector<ChatStateFilter::State> states;
+
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 10.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, filter.filter("user@localhost", "buddy", 2, 10.1));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, filter.filter("user@localhost", "buddy", 3, 10.2));
+		CPPUNIT_ASSERT_EQUAL(1, (int) filter.getPendingCount());
+
+		filter.flush(10.5, states);
+		CPPUNIT_ASSERT_EQUAL(0, (int) states.size());
+
+		filter.flush(11.0, states);
+		CPPUNIT_ASSERT_EQUAL(1, (int) states.size());
+		CPPUNIT_ASSERT_EQUAL(std::string("user@localhost"), states[0].user);
+		CPPUNIT_ASSERT_EQUAL(std::string("buddy"), states[0].buddy);
+		CPPUNIT_ASSERT_EQUAL(3, states[0].state);
+		CPPUNIT_ASSERT_EQUAL(0, (int) filter.getPendingCount());
+		CPPUNIT_ASSERT_EQUAL(1, (int) filter.getSavedCount());
+
+		// window has not expired since the last forwarded state
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, filter.filter("user@localhost", "buddy", 1, 11.5));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user2@localhost", "buddy", 1, 11.5));
+	}
+
+	void coalesceBackToSentState() {
+		ChatStateFilter filter(1.0);
+		std::vector<ChatStateFilter::State> states;
+
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 10.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, filter.filter("user@localhost", "buddy", 2, 10.1));
+		CPPUNIT_ASSERT_EQUAL(1, (int) filter.getPendingCount());
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, filter.filter("user@localhost", "buddy", 1, 10.2));
+		CPPUNIT_ASSERT_EQUAL(0, (int) filter.getPendingCount());
+
+		filter.flush(11.0, states);
+		CPPUNIT_ASSERT_EQUAL(0, (int) states.size());
+		CPPUNIT_ASSERT_EQUAL(2, (int) filter.getSavedCount());
+	}
+
+	void coalesceNotDelayed() {
+		ChatStateFilter filter(1.0);
+		std::vector<ChatStateFilter::State> states;
+
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 10.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, filter.filter("user@localhost", "buddy", 2, 10.1));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 3, 10.2, false));
+		CPPUNIT_ASSERT_EQUAL(0, (int) filter.getPendingCount());
+
+		filter.flush(11.0, states);
+		CPPUNIT_ASSERT_EQUAL(0, (int) states.size());
+		CPPUNIT_ASSERT_EQUAL(0, (int) filter.getPendingCount());
+	}
+
+	void removeUser() {
+		ChatStateFilter filter(1.0);
+		std::vector<ChatStateFilter::State> states;
+
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 10.0));
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Delay, filter.filter("user@localhost", "buddy", 2, 10.1));
+		filter.removeUser("user@localhost");
+		CPPUNIT_ASSERT_EQUAL(0, (int) filter.getPendingCount());
+
+		filter.flush(11.0, states);
+		CPPUNIT_ASSERT_EQUAL(0, (int) states.size());
+		CPPUNIT_ASSERT_EQUAL(ChatStateFilter::Forward, filter.filter("user@localhost", "buddy", 1, 12.0));
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (ChatStateFilterTest);
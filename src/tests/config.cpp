@@ -27,6 +27,8 @@ class ConfigTest : public CPPUNIT_NS :: TestFixture{
 	CPPUNIT_TEST(setStringTwice);
 	CPPUNIT_TEST(updateBackendConfig);
 	CPPUNIT_TEST(updateBackendConfigJIDEscaping);
+	CPPUNIT_TEST(snapshot);
+	CPPUNIT_TEST(snapshotBackendConfig);
 	CPPUNIT_TEST(unregisteredList);
 	CPPUNIT_TEST(unregisteredString);
 	CPPUNIT_TEST(unregisteredListAsString);
@@ -68,6 +70,48 @@ class ConfigTest : public CPPUNIT_NS :: TestFixture{
 		CPPUNIT_ASSERT_EQUAL(false, CONFIG_BOOL(&cfg, "service.jid_escaping"));
 	}
 
+	void snapshot() {
+		Config cfg;
+		std::istringstream ifs("service.jid = localhost\nservice.users_per_backend = 5\nservice.admin_jid = admin@localhost\n");
+		cfg.load(ifs);
+
+		ConfigSnapshot::ref snapshot = cfg.getSnapshot();
+		CPPUNIT_ASSERT_EQUAL(std::string("localhost"), snapshot->jid);
+		CPPUNIT_ASSERT_EQUAL(5, snapshot->usersPerBackend);
+		CPPUNIT_ASSERT_EQUAL(true, snapshot->reuseOldBackends);
+		CPPUNIT_ASSERT_EQUAL(1, (int) snapshot->adminJIDs.size());
+		CPPUNIT_ASSERT_EQUAL(std::string("admin@localhost"), snapshot->adminJIDs[0]);
+		CPPUNIT_ASSERT_EQUAL(1000000, snapshot->ftSpoolThreshold);
+		CPPUNIT_ASSERT_EQUAL(100000000, snapshot->ftSpoolLimit);
+
+		std::istringstream ifs2("service.jid = localhost\nservice.users_per_backend = 1\n");
+		cfg.load(ifs2);
+
+		// Old snapshot is not changed by reload.
+		CPPUNIT_ASSERT_EQUAL(5, snapshot->usersPerBackend);
+		CPPUNIT_ASSERT_EQUAL(1, cfg.getSnapshot()->usersPerBackend);
+		CPPUNIT_ASSERT(cfg.getSnapshot()->adminJIDs.empty());
+	}
+
+	void snapshotBackendConfig() {
+		Config cfg;
+		std::istringstream ifs("service.jid = localhost\n");
+		cfg.load(ifs);
+		CPPUNIT_ASSERT_EQUAL(true, cfg.getSnapshot()->jidEscaping);
+		CPPUNIT_ASSERT_EQUAL(false, cfg.getSnapshot()->rawXML);
+
+		cfg.onBackendConfigUpdated.connect(boost::bind(&ConfigTest::checkBackendConfigSnapshot, this, &cfg));
+		cfg.updateBackendConfig("[features]\nrawxml=1\ndisable_jid_escaping=1\n");
+		CPPUNIT_ASSERT_EQUAL(false, cfg.getSnapshot()->jidEscaping);
+		CPPUNIT_ASSERT_EQUAL(true, cfg.getSnapshot()->rawXML);
+	}
+
+	void checkBackendConfigSnapshot(Config *cfg) {
+		// Handlers have to see the snapshot already updated.
+		CPPUNIT_ASSERT_EQUAL(false, cfg->getSnapshot()->jidEscaping);
+		CPPUNIT_ASSERT_EQUAL(true, cfg->getSnapshot()->rawXML);
+	}
+
 	void unregisteredList() {
 		Config cfg;
 		std::istringstream ifs("service.irc_server = irc.freenode.org\nservice.irc_server=localhost\n");
@@ -7,6 +7,7 @@
 #include "transport/usermanager.h"
 #include "transport/conversationmanager.h"
 #include "transport/localbuddy.h"
+#include "transport/messagecache.h"
 #include <cppunit/TestFixture.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <Swiften/Swiften.h>
@@ -30,10 +31,12 @@ class ConversationManagerTest : public CPPUNIT_NS :: TestFixture, public BasicTe
 	CPPUNIT_TEST(handleGroupchatMessagesBouncer);
 	CPPUNIT_TEST(handleGroupchatMessagesBouncerLeave);
 	CPPUNIT_TEST(handleGroupchatMessagesTwoResources);
+	CPPUNIT_TEST(handleSpooledMessages);
 	CPPUNIT_TEST(handleChatstateMessages);
 	CPPUNIT_TEST(handleSubjectMessages);
 	CPPUNIT_TEST(handleParticipantChanged);
 	CPPUNIT_TEST(handleParticipantChangedTwoResources);
+	CPPUNIT_TEST(handleParticipantList);
 	CPPUNIT_TEST(handlePMFromXMPP);
 	CPPUNIT_TEST(handleGroupchatRemoved);
 	CPPUNIT_TEST(handleNicknameConflict);
@@ -437,6 +440,63 @@ class ConversationManagerTest : public CPPUNIT_NS :: TestFixture, public BasicTe
 
 	}
 
+	void handleSpooledMessages() {
+		User *user = userManager->getUser("user@localhost");
+		user->addUserSetting("stay_connected", "1");
+
+		// disconnectUser
+		userManager->disconnectUser("user@localhost");
+		dynamic_cast<Swift::DummyTimerFactory *>(factories->getTimerFactory())->setTime(10);
+		loop->processEvents();
+		CPPUNIT_ASSERT(user->shouldCacheMessages());
+
+		// Messages spooled for conversations which don't exist anymore, for
+		// example the ones loaded from spool after restart.
+		MessageCache *cache = component->getMessageCache();
+		boost::shared_ptr<Swift::Message> msg(new Swift::Message());
+		msg->setFrom("buddy1@localhost/bot");
+		msg->setType(Swift::Message::Chat);
+		msg->setBody("hi there!");
+		cache->add(MessageCache::getKey("user@localhost", "buddy1"), msg);
+		cache->add(MessageCache::getKey("user2@localhost", "buddy1"), msg);
+
+		boost::shared_ptr<Swift::Message> msg2(new Swift::Message());
+		msg2->setFrom("#room@localhost/anotheruser");
+		msg2->setType(Swift::Message::Groupchat);
+		msg2->setBody("hi room!");
+		cache->add(MessageCache::getKey("user@localhost", "#room"), msg2);
+
+		received.clear();
+		userRegistry->isValidUserPassword(Swift::JID("user@localhost/resource"), serverFromClientSession.get(), Swift::createSafeByteArray("password"));
+		userRegistry->onPasswordValid(Swift::JID("user@localhost/resource"));
+		loop->processEvents();
+
+		Swift::Presence::ref response = Swift::Presence::create();
+		response->setTo("localhost");
+		response->setFrom("user@localhost/resource");
+		injectPresence(response);
+		loop->processEvents();
+		CPPUNIT_ASSERT(!user->shouldCacheMessages());
+
+		std::vector<Swift::Message *> messages;
+		for (size_t i = 0; i < received.size(); i++) {
+			if (dynamic_cast<Swift::Message *>(received[i].get())) {
+				messages.push_back(dynamic_cast<Swift::Message *>(received[i].get()));
+			}
+		}
+
+		CPPUNIT_ASSERT_EQUAL(1, (int) messages.size());
+		CPPUNIT_ASSERT_EQUAL(std::string("hi there!"), messages[0]->getBody());
+		CPPUNIT_ASSERT_EQUAL(std::string("user@localhost"), messages[0]->getTo().toString());
+		CPPUNIT_ASSERT_EQUAL(std::string("buddy1@localhost/bot"), messages[0]->getFrom().toString());
+
+		// Groupchat messages are expired, other users' messages are kept.
+		CPPUNIT_ASSERT(!cache->contains(MessageCache::getKey("user@localhost", "buddy1")));
+		CPPUNIT_ASSERT(!cache->contains(MessageCache::getKey("user@localhost", "#room")));
+		CPPUNIT_ASSERT(cache->contains(MessageCache::getKey("user2@localhost", "buddy1")));
+		cache->remove(MessageCache::getKey("user2@localhost", "buddy1"));
+	}
+
 	void handleGroupchatMessagesTwoResources() {
 		connectSecondResource();
 		received2.clear();
@@ -559,6 +619,55 @@ class ConversationManagerTest : public CPPUNIT_NS :: TestFixture, public BasicTe
 		CPPUNIT_ASSERT_EQUAL(Swift::MUCOccupant::Participant, *getStanza(received2[0])->getPayload<Swift::MUCUserPayload>()->getItems()[0].role);
 	}
 
+	void handleParticipantList() {
+		User *user = userManager->getUser("user@localhost");
+		TestingConversation *conv = new TestingConversation(user->getConversationManager(), "#room", true);
+		
+		conv->onMessageToSend.connect(boost::bind(&ConversationManagerTest::handleMessageReceived, this, _1, _2));
+		conv->setNickname("nickname");
+		conv->addJID("user@localhost/resource");
+
+		std::list<Conversation::Participant> participants;
+		Conversation::Participant participant;
+		participant.nickname = "nickname";
+		participant.flag = Conversation::PARTICIPANT_FLAG_NONE;
+		participant.status = Swift::StatusShow::Online;
+		participants.push_back(participant);
+		participant.nickname = "anotheruser";
+		participant.flag = Conversation::PARTICIPANT_FLAG_MODERATOR;
+		participant.status = Swift::StatusShow::Away;
+		participant.statusMessage = "my status message";
+		participants.push_back(participant);
+		participant.nickname = "thirduser";
+		participant.flag = Conversation::PARTICIPANT_FLAG_NONE;
+		participant.status = Swift::StatusShow::Online;
+		participant.statusMessage = "";
+		participants.push_back(participant);
+
+		conv->handleParticipantList(participants);
+		loop->processEvents();
+
+		// this user presence has to be the last one
+		CPPUNIT_ASSERT_EQUAL(3, (int) received.size());
+		CPPUNIT_ASSERT(dynamic_cast<Swift::Presence *>(getStanza(received[0])));
+		CPPUNIT_ASSERT_EQUAL(Swift::StatusShow::Away, dynamic_cast<Swift::Presence *>(getStanza(received[0]))->getShow());
+		CPPUNIT_ASSERT_EQUAL(std::string("my status message"), dynamic_cast<Swift::Presence *>(getStanza(received[0]))->getStatus());
+		CPPUNIT_ASSERT_EQUAL(std::string("user@localhost/resource"), dynamic_cast<Swift::Presence *>(getStanza(received[0]))->getTo().toString());
+		CPPUNIT_ASSERT_EQUAL(std::string("#room@localhost/anotheruser"), dynamic_cast<Swift::Presence *>(getStanza(received[0]))->getFrom().toString());
+		CPPUNIT_ASSERT_EQUAL(Swift::MUCOccupant::Admin, *getStanza(received[0])->getPayload<Swift::MUCUserPayload>()->getItems()[0].affiliation);
+		CPPUNIT_ASSERT_EQUAL(Swift::MUCOccupant::Moderator, *getStanza(received[0])->getPayload<Swift::MUCUserPayload>()->getItems()[0].role);
+
+		CPPUNIT_ASSERT(dynamic_cast<Swift::Presence *>(getStanza(received[1])));
+		CPPUNIT_ASSERT_EQUAL(Swift::StatusShow::Online, dynamic_cast<Swift::Presence *>(getStanza(received[1]))->getShow());
+		CPPUNIT_ASSERT_EQUAL(std::string("#room@localhost/thirduser"), dynamic_cast<Swift::Presence *>(getStanza(received[1]))->getFrom().toString());
+		CPPUNIT_ASSERT_EQUAL(Swift::MUCOccupant::Member, *getStanza(received[1])->getPayload<Swift::MUCUserPayload>()->getItems()[0].affiliation);
+		CPPUNIT_ASSERT_EQUAL(Swift::MUCOccupant::Participant, *getStanza(received[1])->getPayload<Swift::MUCUserPayload>()->getItems()[0].role);
+
+		CPPUNIT_ASSERT(dynamic_cast<Swift::Presence *>(getStanza(received[2])));
+		CPPUNIT_ASSERT_EQUAL(std::string("#room@localhost/nickname"), dynamic_cast<Swift::Presence *>(getStanza(received[2]))->getFrom().toString());
+		CPPUNIT_ASSERT_EQUAL(110, getStanza(received[2])->getPayload<Swift::MUCUserPayload>()->getStatusCodes()[0].code);
+	}
+
 	void handlePMFromXMPP() {
 		User *user = userManager->getUser("user@localhost");
 		TestingConversation *conv = new TestingConversation(user->getConversationManager(), "#room", true);
@@ -0,0 +1,124 @@
+#include "transport/memoryreadbytestream.h"
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/bind.hpp>
+
+using namespace Transport;
+
+class MemoryReadBytestreamTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(MemoryReadBytestreamTest);
+	CPPUNIT_TEST(readAcrossChunks);
+	CPPUNIT_TEST(spool);
+	CPPUNIT_TEST(requestData);
+	CPPUNIT_TEST(full);
+	CPPUNIT_TEST(fullSpoolFile);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		int dataNeeded;
+
+		void setUp (void) {
+			dataNeeded = 0;
+		}
+
+		void tearDown (void) {
+		}
+
+		void handleDataNeeded() {
+			dataNeeded++;
+		}
+
+		std::string read(MemoryReadBytestream &bytestream, size_t size) {
+			boost::shared_ptr<std::vector<unsigned char> > data = bytestream.read(size);
+			return std::string(data->begin(), data->end());
+		}
+
+		void readAcrossChunks() {
+			MemoryReadBytestream bytestream(10);
+			CPPUNIT_ASSERT_EQUAL(3, (int) bytestream.appendData("abc"));
+			CPPUNIT_ASSERT_EQUAL(7, (int) bytestream.appendData(boost::shared_ptr<std::string>(new std::string("defg"))));
+			CPPUNIT_ASSERT_EQUAL(10, (int) bytestream.appendData("hij"));
+
+			CPPUNIT_ASSERT_EQUAL(std::string("ab"), read(bytestream, 2));
+			CPPUNIT_ASSERT_EQUAL(std::string("cdefgh"), read(bytestream, 6));
+			CPPUNIT_ASSERT(!bytestream.isFinished());
+			CPPUNIT_ASSERT_EQUAL(std::string("ij"), read(bytestream, 100));
+			CPPUNIT_ASSERT(bytestream.isFinished());
+		}
+
+		void spool() {
+			MemoryReadBytestream bytestream(12, 4);
+			CPPUNIT_ASSERT_EQUAL(4, (int) bytestream.appendData("abcd"));
+			CPPUNIT_ASSERT_EQUAL(4, (int) bytestream.appendData("efgh"));
+			CPPUNIT_ASSERT_EQUAL(4, (int) bytestream.appendData("ij"));
+			CPPUNIT_ASSERT_EQUAL(6, (int) bytestream.getSpooledSize());
+
+			CPPUNIT_ASSERT_EQUAL(std::string("abcdefgh"), read(bytestream, 8));
+			CPPUNIT_ASSERT_EQUAL(2, (int) bytestream.getSpooledSize());
+
+			// Memory is free again, so new data are not spooled.
+			CPPUNIT_ASSERT_EQUAL(2, (int) bytestream.appendData("kl"));
+			CPPUNIT_ASSERT_EQUAL(2, (int) bytestream.getSpooledSize());
+
+			CPPUNIT_ASSERT_EQUAL(std::string("ijkl"), read(bytestream, 100));
+			CPPUNIT_ASSERT_EQUAL(0, (int) bytestream.getSpooledSize());
+			CPPUNIT_ASSERT(bytestream.isFinished());
+		}
+
+		void requestData() {
+			MemoryReadBytestream bytestream(100);
+			bytestream.onDataNeeded.connect(boost::bind(&MemoryReadBytestreamTest::handleDataNeeded, this));
+
+			read(bytestream, 10);
+			CPPUNIT_ASSERT_EQUAL(1, dataNeeded);
+
+			bytestream.appendData("abcdef");
+			CPPUNIT_ASSERT_EQUAL(std::string("abc"), read(bytestream, 3));
+			CPPUNIT_ASSERT_EQUAL(2, dataNeeded);
+
+			// Data were already requested, so don't ask again until new data come.
+			read(bytestream, 1);
+			CPPUNIT_ASSERT_EQUAL(2, dataNeeded);
+
+			// Everything has been read.
+			read(bytestream, 10);
+			CPPUNIT_ASSERT_EQUAL(3, dataNeeded);
+		}
+
+		void full() {
+			MemoryReadBytestream bytestream(20, 4, 6);
+			bytestream.appendData("abcd");
+			CPPUNIT_ASSERT(!bytestream.isFull());
+			bytestream.appendData("efgh");
+			CPPUNIT_ASSERT(!bytestream.isFull());
+			bytestream.appendData("ij");
+			CPPUNIT_ASSERT(bytestream.isFull());
+
+			read(bytestream, 10);
+			CPPUNIT_ASSERT(!bytestream.isFull());
+
+			// Without spooling, only memory is limited.
+			MemoryReadBytestream memory(20);
+			memory.appendData("abcdefghij");
+			CPPUNIT_ASSERT(!memory.isFull());
+		}
+
+		void fullSpoolFile() {
+			MemoryReadBytestream bytestream(20, 4, 10);
+			bytestream.appendData("abcd");
+			bytestream.appendData("ef");
+			bytestream.appendData("gh");
+			read(bytestream, 6);
+
+			// Only 8 bytes are waiting in temporary file, but the file has
+			// not been reused yet, so it has 10 bytes.
+			bytestream.appendData("ijklmn");
+			CPPUNIT_ASSERT_EQUAL(8, (int) bytestream.getSpooledSize());
+			CPPUNIT_ASSERT(bytestream.isFull());
+
+			read(bytestream, 8);
+			CPPUNIT_ASSERT(!bytestream.isFull());
+		}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (MemoryReadBytestreamTest);
@@ -0,0 +1,283 @@
+#include "transport/messagecache.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "Swiften/Elements/Delay.h"
+#include "Swiften/Elements/XHTMLIMPayload.h"
+
+using namespace Transport;
+
+#define SPOOL "messagecache.spool"
+
+class MessageCacheTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(MessageCacheTest);
+	CPPUNIT_TEST(addPop);
+	CPPUNIT_TEST(conversationLimit);
+	CPPUNIT_TEST(memoryLimitNoSpool);
+	CPPUNIT_TEST(memoryLimitSpool);
+	CPPUNIT_TEST(spoolMessageContent);
+	CPPUNIT_TEST(spoolConversationLimit);
+	CPPUNIT_TEST(releaseAndLoad);
+	CPPUNIT_TEST(removeAndLoad);
+	CPPUNIT_TEST(truncateWhenDelivered);
+	CPPUNIT_TEST(popAndLoad);
+	CPPUNIT_TEST(corruptedRecordSize);
+	CPPUNIT_TEST(getKeys);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp (void) {
+			std::remove(SPOOL);
+		}
+
+		void tearDown (void) {
+			std::remove(SPOOL);
+		}
+
+	boost::shared_ptr<Swift::Message> createMessage(const std::string &body) {
+		boost::shared_ptr<Swift::Message> msg(new Swift::Message());
+		msg->setFrom(Swift::JID("buddy%test@localhost/bot"));
+		msg->setType(Swift::Message::Chat);
+		msg->setBody(body);
+		return msg;
+	}
+
+	std::string popBody(MessageCache &cache, const std::string &key) {
+		boost::shared_ptr<Swift::Message> msg;
+		if (!cache.pop(key, msg)) {
+			return "";
+		}
+		return msg->getBody();
+	}
+
+	unsigned long spoolSize() {
+		std::ifstream f(SPOOL, std::ios::in | std::ios::binary | std::ios::ate);
+		return f.tellg();
+	}
+
+	void addPop() {
+		MessageCache cache;
+		CPPUNIT_ASSERT(!cache.contains("user@localhost/buddy"));
+
+		cache.add("user@localhost/buddy", createMessage("1"));
+		cache.add("user@localhost/buddy", createMessage("2"));
+		cache.add("user@localhost/buddy2", createMessage("3"));
+		CPPUNIT_ASSERT(cache.contains("user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(3, (int) cache.getMemoryCount());
+
+		CPPUNIT_ASSERT_EQUAL(std::string("1"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string(""), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT(!cache.contains("user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), popBody(cache, "user@localhost/buddy2"));
+		CPPUNIT_ASSERT_EQUAL(0, (int) cache.getMemoryUsage());
+	}
+
+	void conversationLimit() {
+		MessageCache cache(0, 2);
+		cache.add("user@localhost/buddy", createMessage("1"));
+		cache.add("user@localhost/buddy", createMessage("2"));
+		cache.add("user@localhost/buddy", createMessage("3"));
+		CPPUNIT_ASSERT_EQUAL(1, (int) cache.getDroppedCount());
+
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), popBody(cache, "user@localhost/buddy"));
+	}
+
+	void memoryLimitNoSpool() {
+		MessageCache cache(2000, 100);
+		for (int i = 0; i < 10; i++) {
+			cache.add("user@localhost/buddy" + boost::lexical_cast<std::string>(i % 2), createMessage(boost::lexical_cast<std::string>(i)));
+			CPPUNIT_ASSERT(cache.getMemoryUsage() <= 2000);
+		}
+
+		// The oldest messages are dropped regardless of conversation.
+		CPPUNIT_ASSERT(cache.getDroppedCount() > 0);
+		CPPUNIT_ASSERT_EQUAL(10, (int) (cache.getDroppedCount() + cache.getMemoryCount()));
+		CPPUNIT_ASSERT(popBody(cache, "user@localhost/buddy0") != "0");
+		CPPUNIT_ASSERT(popBody(cache, "user@localhost/buddy1") != "1");
+	}
+
+	void memoryLimitSpool() {
+		MessageCache cache(2000, 100, SPOOL);
+		for (int i = 0; i < 20; i++) {
+			cache.add("user@localhost/buddy" + boost::lexical_cast<std::string>(i % 2), createMessage(boost::lexical_cast<std::string>(i)));
+			CPPUNIT_ASSERT(cache.getMemoryUsage() <= 2000);
+		}
+
+		CPPUNIT_ASSERT_EQUAL(0, (int) cache.getDroppedCount());
+		CPPUNIT_ASSERT(cache.getSpoolCount() > 0);
+		CPPUNIT_ASSERT_EQUAL(20, (int) (cache.getSpoolCount() + cache.getMemoryCount()));
+
+		for (int i = 0; i < 20; i += 2) {
+			CPPUNIT_ASSERT_EQUAL(boost::lexical_cast<std::string>(i), popBody(cache, "user@localhost/buddy0"));
+		}
+		CPPUNIT_ASSERT(!cache.contains("user@localhost/buddy0"));
+		for (int i = 1; i < 20; i += 2) {
+			CPPUNIT_ASSERT_EQUAL(boost::lexical_cast<std::string>(i), popBody(cache, "user@localhost/buddy1"));
+		}
+		CPPUNIT_ASSERT_EQUAL(0, (int) cache.getSpoolCount());
+	}
+
+	void spoolMessageContent() {
+		MessageCache cache(1, 100, SPOOL);
+		boost::posix_time::ptime stamp = boost::posix_time::from_iso_string("20120101T101010");
+
+		boost::shared_ptr<Swift::Message> msg = createMessage("body");
+		msg->setType(Swift::Message::Groupchat);
+		msg->setSubject("subject");
+		msg->addPayload(boost::make_shared<Swift::XHTMLIMPayload>("<body>body</body>"));
+		boost::shared_ptr<Swift::Delay> delay(boost::make_shared<Swift::Delay>());
+		delay->setStamp(stamp);
+		msg->addPayload(delay);
+		cache.add("room@irc.freenode.org", msg);
+
+		// message without content is not worth spooling
+		cache.add("room@irc.freenode.org", createMessage(""));
+		CPPUNIT_ASSERT_EQUAL(1, (int) cache.getSpoolCount());
+		CPPUNIT_ASSERT_EQUAL(1, (int) cache.getDroppedCount());
+
+		CPPUNIT_ASSERT(cache.pop("room@irc.freenode.org", msg));
+		CPPUNIT_ASSERT(!cache.contains("room@irc.freenode.org"));
+		CPPUNIT_ASSERT_EQUAL(Swift::Message::Groupchat, msg->getType());
+		CPPUNIT_ASSERT_EQUAL(std::string("buddy%test@localhost/bot"), msg->getFrom().toString());
+		CPPUNIT_ASSERT_EQUAL(std::string("subject"), msg->getSubject());
+		CPPUNIT_ASSERT_EQUAL(std::string("body"), msg->getBody());
+		CPPUNIT_ASSERT(msg->getPayload<Swift::XHTMLIMPayload>());
+		CPPUNIT_ASSERT_EQUAL(std::string("<body>body</body>"), msg->getPayload<Swift::XHTMLIMPayload>()->getBody());
+		CPPUNIT_ASSERT(msg->getPayload<Swift::Delay>());
+		CPPUNIT_ASSERT(stamp == msg->getPayload<Swift::Delay>()->getStamp());
+	}
+
+	void spoolConversationLimit() {
+		MessageCache cache(1, 3, SPOOL);
+		for (int i = 0; i < 5; i++) {
+			cache.add("user@localhost/buddy", createMessage(boost::lexical_cast<std::string>(i)));
+		}
+
+		CPPUNIT_ASSERT_EQUAL(2, (int) cache.getDroppedCount());
+		CPPUNIT_ASSERT_EQUAL(3, (int) (cache.getSpoolCount() + cache.getMemoryCount()));
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("4"), popBody(cache, "user@localhost/buddy"));
+	}
+
+	void releaseAndLoad() {
+		{
+			MessageCache cache(0, 100, SPOOL);
+			cache.add("user@localhost/buddy", createMessage("1"));
+			cache.add("user@localhost/buddy", createMessage("2"));
+			cache.add("user@localhost/buddy2", createMessage("3"));
+			CPPUNIT_ASSERT_EQUAL(std::string("1"), popBody(cache, "user@localhost/buddy"));
+
+			cache.release("user@localhost/buddy");
+			CPPUNIT_ASSERT_EQUAL(1, (int) cache.getSpoolCount());
+			CPPUNIT_ASSERT(cache.contains("user@localhost/buddy"));
+		}
+
+		// Messages cached in memory are spooled when MessageCache is destroyed.
+		MessageCache cache(0, 100, SPOOL);
+		CPPUNIT_ASSERT_EQUAL(2, (int) cache.getSpoolCount());
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT(!cache.contains("user@localhost/buddy"));
+		cache.add("user@localhost/buddy2", createMessage("4"));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), popBody(cache, "user@localhost/buddy2"));
+		CPPUNIT_ASSERT_EQUAL(std::string("4"), popBody(cache, "user@localhost/buddy2"));
+	}
+
+	void removeAndLoad() {
+		{
+			MessageCache cache(1, 100, SPOOL);
+			cache.add("user@localhost/buddy", createMessage("1"));
+			cache.add("user@localhost/buddy", createMessage("2"));
+			cache.add("user@localhost/buddy2", createMessage("3"));
+			cache.remove("user@localhost/buddy");
+			CPPUNIT_ASSERT(!cache.contains("user@localhost/buddy"));
+		}
+
+		MessageCache cache(0, 100, SPOOL);
+		CPPUNIT_ASSERT(!cache.contains("user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), popBody(cache, "user@localhost/buddy2"));
+	}
+
+	void truncateWhenDelivered() {
+		MessageCache cache(1, 100, SPOOL);
+		cache.add("user@localhost/buddy", createMessage("1"));
+		cache.add("user@localhost/buddy", createMessage("2"));
+		CPPUNIT_ASSERT(spoolSize() > 0);
+
+		CPPUNIT_ASSERT_EQUAL(std::string("1"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(0, (int) spoolSize());
+	}
+
+	std::string readSpool() {
+		std::ifstream f(SPOOL, std::ios::in | std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	}
+
+	void popAndLoad() {
+		std::string spool;
+		{
+			MessageCache cache(1, 100, SPOOL);
+			cache.add("user@localhost/buddy", createMessage("1"));
+			cache.add("user@localhost/buddy", createMessage("2"));
+			cache.add("user@localhost/buddy", createMessage("3"));
+			CPPUNIT_ASSERT_EQUAL(std::string("1"), popBody(cache, "user@localhost/buddy"));
+			spool = readSpool();
+		}
+
+		// Simulate crash right after the message has been popped by
+		// restoring the spool as it was before MessageCache was destroyed.
+		std::ofstream f(SPOOL, std::ios::out | std::ios::trunc | std::ios::binary);
+		f.write(spool.c_str(), spool.size());
+		f.close();
+
+		MessageCache cache(0, 100, SPOOL);
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), popBody(cache, "user@localhost/buddy"));
+	}
+
+	void corruptedRecordSize() {
+		{
+			MessageCache cache(1, 100, SPOOL);
+			cache.add("user@localhost/buddy", createMessage("1"));
+			cache.add("user@localhost/buddy", createMessage("2"));
+		}
+
+		std::ofstream f(SPOOL, std::ios::out | std::ios::app | std::ios::binary);
+		f.write("\xff\xff\xff\xff", 4);
+		f.close();
+
+		MessageCache cache(0, 100, SPOOL);
+		CPPUNIT_ASSERT_EQUAL(2, (int) cache.getSpoolCount());
+		CPPUNIT_ASSERT_EQUAL(std::string("1"), popBody(cache, "user@localhost/buddy"));
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), popBody(cache, "user@localhost/buddy"));
+	}
+
+	void getKeys() {
+		MessageCache cache;
+		cache.add(MessageCache::getKey("user@localhost", "buddy1"), createMessage("1"));
+		cache.add(MessageCache::getKey("user@localhost", "buddy2"), createMessage("2"));
+		cache.add(MessageCache::getKey("user@localhost2", "buddy1"), createMessage("3"));
+		cache.add(MessageCache::getKey("auser@localhost", "buddy1"), createMessage("4"));
+
+		std::vector<std::string> keys;
+		cache.getKeys("user@localhost", keys);
+		CPPUNIT_ASSERT_EQUAL(2, (int) keys.size());
+		CPPUNIT_ASSERT_EQUAL(MessageCache::getKey("user@localhost", "buddy1"), keys[0]);
+		CPPUNIT_ASSERT_EQUAL(MessageCache::getKey("user@localhost", "buddy2"), keys[1]);
+
+		keys.clear();
+		cache.getKeys("user3@localhost", keys);
+		CPPUNIT_ASSERT_EQUAL(0, (int) keys.size());
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (MessageCacheTest);
@@ -0,0 +1,109 @@
+#include "transport/metrics.h"
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+using namespace Transport;
+
+class MetricsTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(MetricsTest);
+	CPPUNIT_TEST(counter);
+	CPPUNIT_TEST(sameName);
+	CPPUNIT_TEST(histogram);
+	CPPUNIT_TEST(prometheus);
+	CPPUNIT_TEST(histogramTimer);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		Metrics *metrics;
+
+		void setUp (void) {
+			metrics = new Metrics();
+		}
+
+		void tearDown (void) {
+			delete metrics;
+		}
+
+		void counter() {
+			Counter *counter = metrics->getCounter("test_total");
+			CPPUNIT_ASSERT_EQUAL(0, (int) counter->getValue());
+			counter->increment();
+			counter->increment(5);
+			CPPUNIT_ASSERT_EQUAL(6, (int) counter->getValue());
+
+			Counter *gauge = metrics->getGauge("test_gauge");
+			gauge->setValue(10);
+			gauge->decrement();
+			CPPUNIT_ASSERT_EQUAL(9, (int) gauge->getValue());
+		}
+
+		void sameName() {
+			Counter *counter = metrics->getGauge("test_gauge");
+			CPPUNIT_ASSERT(counter == metrics->getGauge("test_gauge", "Help added later"));
+
+			Histogram *histogram = metrics->getHistogram("test_seconds");
+			CPPUNIT_ASSERT(histogram == metrics->getHistogram("test_seconds"));
+			CPPUNIT_ASSERT(metrics->toPrometheus().find("# HELP test_gauge Help added later\n") != std::string::npos);
+		}
+
+		void histogram() {
+			std::vector<double> bounds;
+			bounds.push_back(0.1);
+			bounds.push_back(1);
+			Histogram histogram(bounds);
+
+			histogram.observe(0.05);
+			histogram.observe(0.1);
+			histogram.observe(0.5);
+			histogram.observe(10);
+
+			CPPUNIT_ASSERT_EQUAL(3, (int) histogram.getCounts().size());
+			CPPUNIT_ASSERT_EQUAL(2, (int) histogram.getCounts()[0]);
+			CPPUNIT_ASSERT_EQUAL(1, (int) histogram.getCounts()[1]);
+			CPPUNIT_ASSERT_EQUAL(1, (int) histogram.getCounts()[2]);
+			CPPUNIT_ASSERT_EQUAL(4, (int) histogram.getCount());
+			CPPUNIT_ASSERT_DOUBLES_EQUAL(10.65, histogram.getSum(), 0.000001);
+		}
+
+		void prometheus() {
+			metrics->getCounter("b_total", "Counter")->increment(3);
+			metrics->getGauge("a_online")->setValue(2);
+			Histogram *histogram = metrics->getHistogram("c_seconds", "Latency");
+			histogram->observe(0.003);
+			histogram->observe(100);
+
+			std::string expected = "# TYPE a_online gauge\n"
+				"a_online 2\n"
+				"# HELP b_total Counter\n"
+				"# TYPE b_total counter\n"
+				"b_total 3\n"
+				"# HELP c_seconds Latency\n"
+				"# TYPE c_seconds histogram\n"
+				"c_seconds_bucket{le=\"0.001\"} 0\n"
+				"c_seconds_bucket{le=\"0.005\"} 1\n"
+				"c_seconds_bucket{le=\"0.01\"} 1\n"
+				"c_seconds_bucket{le=\"0.05\"} 1\n"
+				"c_seconds_bucket{le=\"0.1\"} 1\n"
+				"c_seconds_bucket{le=\"0.5\"} 1\n"
+				"c_seconds_bucket{le=\"1\"} 1\n"
+				"c_seconds_bucket{le=\"5\"} 1\n"
+				"c_seconds_bucket{le=\"10\"} 1\n"
+				"c_seconds_bucket{le=\"30\"} 1\n"
+				"c_seconds_bucket{le=\"60\"} 1\n"
+				"c_seconds_bucket{le=\"+Inf\"} 2\n"
+				"c_seconds_sum 100.003\n"
+				"c_seconds_count 2\n";
+			CPPUNIT_ASSERT_EQUAL(expected, metrics->toPrometheus());
+		}
+
+		void histogramTimer() {
+			Histogram *histogram = metrics->getHistogram("timer_seconds");
+			{
+				HistogramTimer timer(histogram);
+			}
+			CPPUNIT_ASSERT_EQUAL(1, (int) histogram->getCount());
+			CPPUNIT_ASSERT(histogram->getSum() >= 0);
+		}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (MetricsTest);
@@ -52,6 +52,8 @@ class NetworkPluginServerTest : public CPPUNIT_NS :: TestFixture, public BasicTe
 	CPPUNIT_TEST(handleBuddyChangedPayload);
 	CPPUNIT_TEST(handleBuddyChangedPayloadNoEscaping);
 	CPPUNIT_TEST(handleBuddyChangedPayloadUserContactInRoster);
+	CPPUNIT_TEST(handleBuddyChangedPayloadSession);
+	CPPUNIT_TEST(handleDataRead);
 	CPPUNIT_TEST(handleMessageHeadline);
 	CPPUNIT_TEST(handleConvMessageAckPayload);
 	CPPUNIT_TEST(handleRawXML);
@@ -243,6 +245,116 @@ class NetworkPluginServerTest : public CPPUNIT_NS :: TestFixture, public BasicTe
 			CPPUNIT_ASSERT_EQUAL(0, (int) received.size());
 		}
 
+		void handleBuddyChangedPayloadSession() {
+			User *user = userManager->getUser("user@localhost");
+			serv->handleUserReadyToConnect(user);
+			received.clear();
+
+			// The first session gets index 0 and generation 1.
+			unsigned int session = 1 << 20;
+
+			pbnetwork::Buddy buddy;
+			buddy.set_session(session);
+			buddy.set_buddyname("buddy1@test");
+			buddy.set_buddyid(1);
+			buddy.set_status(pbnetwork::STATUS_NONE);
+
+			std::string message;
+			buddy.SerializeToString(&message);
+
+			serv->handleBuddyChangedPayload(message);
+			CPPUNIT_ASSERT_EQUAL(1, (int) received.size());
+			Swift::RosterPayload::ref payload1 = getStanza(received[0])->getPayload<Swift::RosterPayload>();
+			CPPUNIT_ASSERT_EQUAL(1, (int) payload1->getItems().size());
+			CPPUNIT_ASSERT_EQUAL(std::string("buddy1\\40test@localhost"), payload1->getItems()[0].getJID().toString());
+			received.clear();
+
+			// Buddy identified only by buddyId
+			pbnetwork::Buddy buddy2;
+			buddy2.set_session(session);
+			buddy2.set_buddyid(1);
+			buddy2.set_status(pbnetwork::STATUS_ONLINE);
+			buddy2.SerializeToString(&message);
+
+			serv->handleBuddyChangedPayload(message);
+			CPPUNIT_ASSERT_EQUAL(1, (int) received.size());
+			CPPUNIT_ASSERT(dynamic_cast<Swift::Presence *>(getStanza(received[0])));
+			CPPUNIT_ASSERT_EQUAL(std::string("buddy1\\40test@localhost/bot"), dynamic_cast<Swift::Presence *>(getStanza(received[0]))->getFrom().toString());
+			received.clear();
+
+			// High buddyIds are accepted without allocating space for the lower ones
+			buddy.set_buddyname("buddy2@test");
+			buddy.set_buddyid(4000000000u);
+			buddy.SerializeToString(&message);
+			serv->handleBuddyChangedPayload(message);
+			received.clear();
+
+			buddy2.set_buddyid(4000000000u);
+			buddy2.set_status(pbnetwork::STATUS_AWAY);
+			buddy2.SerializeToString(&message);
+			serv->handleBuddyChangedPayload(message);
+			CPPUNIT_ASSERT_EQUAL(1, (int) received.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("buddy2\\40test@localhost/bot"), dynamic_cast<Swift::Presence *>(getStanza(received[0]))->getFrom().toString());
+			received.clear();
+
+			// Session with different generation must not be resolved
+			buddy2.set_session(session + (1 << 20));
+			buddy2.set_status(pbnetwork::STATUS_AWAY);
+			buddy2.SerializeToString(&message);
+
+			serv->handleBuddyChangedPayload(message);
+			CPPUNIT_ASSERT_EQUAL(0, (int) received.size());
+		}
+
+		std::string frame(pbnetwork::WrapperMessage_Type type, const std::string &payload) {
+			pbnetwork::WrapperMessage wrapper;
+			wrapper.set_type(type);
+			wrapper.set_payload(payload);
+
+			std::string message;
+			wrapper.SerializeToString(&message);
+
+			std::string header(4, 0);
+			for (int i = 0; i < 4; i++) {
+				header[i] = (char) ((message.size() >> (24 - i * 8)) & 0xff);
+			}
+			return header + message;
+		}
+
+		std::string buddyChanged(const std::string &buddyName) {
+			pbnetwork::Buddy buddy;
+			buddy.set_username("user@localhost");
+			buddy.set_buddyname(buddyName);
+			buddy.set_status(pbnetwork::STATUS_NONE);
+
+			std::string message;
+			buddy.SerializeToString(&message);
+			return frame(pbnetwork::WrapperMessage_Type_TYPE_BUDDY_CHANGED, message);
+		}
+
+		void handleDataRead() {
+			NetworkPluginServer::Backend backend;
+			backend.pongReceived = 0;
+
+			// Two messages, unknown one and first half of the next one in single read.
+			std::string next = buddyChanged("buddy3@test");
+			std::string data = buddyChanged("buddy1@test") + frame(pbnetwork::WrapperMessage_Type_TYPE_PING, "")
+				+ buddyChanged("buddy2@test") + next.substr(0, next.size() / 2);
+
+			serv->handleDataRead(&backend, boost::make_shared<Swift::SafeByteArray>(data.begin(), data.end()));
+			CPPUNIT_ASSERT_EQUAL(2, (int) received.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("buddy2\\40test@localhost"), getStanza(received[1])->getPayload<Swift::RosterPayload>()->getItems()[0].getJID().toString());
+			// The incomplete message stays in buffer.
+			CPPUNIT_ASSERT_EQUAL(next.size() / 2, backend.data.size());
+			received.clear();
+
+			data = next.substr(next.size() / 2);
+			serv->handleDataRead(&backend, boost::make_shared<Swift::SafeByteArray>(data.begin(), data.end()));
+			CPPUNIT_ASSERT_EQUAL(1, (int) received.size());
+			CPPUNIT_ASSERT_EQUAL(std::string("buddy3\\40test@localhost"), getStanza(received[0])->getPayload<Swift::RosterPayload>()->getItems()[0].getJID().toString());
+			CPPUNIT_ASSERT(backend.data.empty());
+		}
+
 		void handleRawXML() {
 			cfg->updateBackendConfig("[features]\nrawxml=1\n");
 			User *user = userManager->getUser("user@localhost");
@@ -0,0 +1,144 @@
+#include "transport/ratelimiter.h"
+#include <algorithm>
+#include <vector>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+using namespace Transport;
+
+class RateLimiterTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(RateLimiterTest);
+	CPPUNIT_TEST(tokenBucket);
+	CPPUNIT_TEST(tokenBucketUnlimited);
+	CPPUNIT_TEST(userLimit);
+	CPPUNIT_TEST(userLimitDroppable);
+	CPPUNIT_TEST(userLimitQueueFull);
+	CPPUNIT_TEST(backendLimitFairQueue);
+	CPPUNIT_TEST(keepOrder);
+	CPPUNIT_TEST(removeFlow);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp (void) {
+		}
+
+		void tearDown (void) {
+
+		}
+
+	void tokenBucket() {
+		TokenBucket bucket(2, 3);
+		CPPUNIT_ASSERT(bucket.consume(10.0));
+		CPPUNIT_ASSERT(bucket.consume(10.0));
+		CPPUNIT_ASSERT(bucket.consume(10.0));
+		CPPUNIT_ASSERT(!bucket.consume(10.0));
+		CPPUNIT_ASSERT(!bucket.available(10.25));
+		CPPUNIT_ASSERT(bucket.consume(10.5));
+		CPPUNIT_ASSERT(!bucket.consume(10.5));
+
+		// bucket can't hold more than burst tokens
+		CPPUNIT_ASSERT(bucket.consume(100.0, 3));
+		CPPUNIT_ASSERT(!bucket.consume(100.0));
+	}
+
+	void tokenBucketUnlimited() {
+		TokenBucket bucket;
+		CPPUNIT_ASSERT(bucket.isUnlimited());
+		for (int i = 0; i < 1000; i++) {
+			CPPUNIT_ASSERT(bucket.consume(1.0));
+		}
+	}
+
+	void userLimit() {
+		RateLimiter limiter(1, 2, 0, 0);
+		std::string data;
+
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Send, limiter.push("user@localhost", "1", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Send, limiter.push("user@localhost", "2", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Queued, limiter.push("user@localhost", "3", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(1, (int) limiter.getQueuedCount());
+
+		// other users are not affected
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Send, limiter.push("user2@localhost", "1", false, 1.0));
+
+		CPPUNIT_ASSERT(!limiter.pop(data, 1.5));
+		CPPUNIT_ASSERT(limiter.pop(data, 2.0));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), data);
+		CPPUNIT_ASSERT_EQUAL(0, (int) limiter.getQueuedCount());
+		CPPUNIT_ASSERT(!limiter.pop(data, 10.0));
+	}
+
+	void userLimitDroppable() {
+		RateLimiter limiter(1, 1, 0, 0);
+
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Send, limiter.push("user@localhost", "composing", true, 1.0));
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Dropped, limiter.push("user@localhost", "paused", true, 1.0));
+		CPPUNIT_ASSERT_EQUAL(0, (int) limiter.getQueuedCount());
+	}
+
+	void userLimitQueueFull() {
+		RateLimiter limiter(1, 1, 0, 0, 1024, 2);
+
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Send, limiter.push("user@localhost", "1", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Queued, limiter.push("user@localhost", "2", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Queued, limiter.push("user@localhost", "3", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Dropped, limiter.push("user@localhost", "4", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(2, (int) limiter.getQueuedCount());
+	}
+
+	void backendLimitFairQueue() {
+		RateLimiter limiter(0, 0, 1, 1, 1);
+		std::string data;
+
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Send, limiter.push("noisy@localhost", "n0", false, 1.0));
+		for (int i = 1; i < 10; i++) {
+			CPPUNIT_ASSERT_EQUAL(RateLimiter::Queued, limiter.push("noisy@localhost", "n" + std::string(1, '0' + i), false, 1.0));
+		}
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Queued, limiter.push("quiet@localhost", "q1", false, 1.0));
+
+		// quiet user has to get its message through before the noisy user
+		// sends all its queued messages
+		std::vector<std::string> sent;
+		double now = 1.0;
+		while (limiter.getQueuedCount() != 0) {
+			now += 1.0;
+			CPPUNIT_ASSERT(limiter.pop(data, now));
+			CPPUNIT_ASSERT(!limiter.pop(data, now));
+			sent.push_back(data);
+		}
+
+		CPPUNIT_ASSERT_EQUAL(10, (int) sent.size());
+		CPPUNIT_ASSERT(std::find(sent.begin(), sent.begin() + 3, "q1") != sent.begin() + 3);
+	}
+
+	void keepOrder() {
+		RateLimiter limiter(1, 1, 0, 0);
+		std::string data;
+
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Send, limiter.push("user@localhost", "1", false, 1.0));
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Queued, limiter.push("user@localhost", "2", false, 1.0));
+
+		// there are tokens again, but "2" is still queued, so "3" has to wait
+		CPPUNIT_ASSERT_EQUAL(RateLimiter::Queued, limiter.push("user@localhost", "3", false, 2.0));
+		CPPUNIT_ASSERT(limiter.pop(data, 2.0));
+		CPPUNIT_ASSERT_EQUAL(std::string("2"), data);
+		CPPUNIT_ASSERT(limiter.pop(data, 3.0));
+		CPPUNIT_ASSERT_EQUAL(std::string("3"), data);
+	}
+
+	void removeFlow() {
+		RateLimiter limiter(1, 1, 0, 0);
+		std::string data;
+
+		limiter.push("user@localhost", "1", false, 1.0);
+		limiter.push("user@localhost", "2", false, 1.0);
+		limiter.push("user@localhost", "3", false, 1.0);
+		CPPUNIT_ASSERT_EQUAL(2, (int) limiter.removeFlow("user@localhost"));
+		CPPUNIT_ASSERT_EQUAL(0, (int) limiter.getQueuedCount());
+		CPPUNIT_ASSERT(!limiter.pop(data, 10.0));
+		CPPUNIT_ASSERT_EQUAL(0, (int) limiter.removeFlow("user@localhost"));
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (RateLimiterTest);
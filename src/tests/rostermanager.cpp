@@ -6,6 +6,7 @@
 #include "transport/conversation.h"
 #include "transport/usermanager.h"
 #include "transport/localbuddy.h"
+#include "transport/metrics.h"
 #include <cppunit/TestFixture.h>
 #include <cppunit/extensions/HelperMacros.h>
 #include <Swiften/Swiften.h>
@@ -29,6 +30,7 @@ class RosterManagerTest : public CPPUNIT_NS :: TestFixture, public BasicTest {
 	CPPUNIT_TEST(sendCurrentPresence);
 	CPPUNIT_TEST(sendBuddySubscribePresence);
 	CPPUNIT_TEST(removeBuddy);
+	CPPUNIT_TEST(contactsMetrics);
 	CPPUNIT_TEST(subscribeExistingBuddy);
 	CPPUNIT_TEST(subscribeNewBuddy);
 	CPPUNIT_TEST(unsubscribeExistingBuddy);
@@ -195,6 +197,26 @@ class RosterManagerTest : public CPPUNIT_NS :: TestFixture, public BasicTest {
 		CPPUNIT_ASSERT_EQUAL(Swift::RosterItemPayload::Remove, item.getSubscription());
 	}
 
+	void contactsMetrics() {
+		Counter *total = component->getMetrics()->getGauge("spectrum2_contacts_total");
+		Counter *online = component->getMetrics()->getGauge("spectrum2_contacts_online");
+
+		add2Buddies();
+		CPPUNIT_ASSERT_EQUAL(2, (int) total->getValue());
+		CPPUNIT_ASSERT_EQUAL(2, (int) online->getValue());
+
+		User *user = userManager->getUser("user@localhost");
+		LocalBuddy *buddy = (LocalBuddy *) user->getRosterManager()->getBuddy("buddy1");
+		buddy->setStatus(Swift::StatusShow(Swift::StatusShow::Online), "status1");
+		CPPUNIT_ASSERT_EQUAL(2, (int) online->getValue());
+		buddy->setStatus(Swift::StatusShow(Swift::StatusShow::None), "");
+		CPPUNIT_ASSERT_EQUAL(1, (int) online->getValue());
+
+		user->getRosterManager()->removeBuddy("buddy2");
+		CPPUNIT_ASSERT_EQUAL(1, (int) total->getValue());
+		CPPUNIT_ASSERT_EQUAL(0, (int) online->getValue());
+	}
+
 	void subscribeExistingBuddy() {
 		add2Buddies();
 		received.clear();
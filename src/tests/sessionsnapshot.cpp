@@ -0,0 +1,141 @@
+#include "transport/userregistry.h"
+#include "transport/config.h"
+#include "transport/storagebackend.h"
+#include "transport/user.h"
+#include "transport/transport.h"
+#include "transport/usermanager.h"
+#include "transport/rostermanager.h"
+#include "transport/localbuddy.h"
+#include "transport/sessionsnapshot.h"
+#include <cstdio>
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <Swiften/Swiften.h>
+#include <Swiften/EventLoop/DummyEventLoop.h>
+#include <Swiften/Server/Server.h>
+#include <Swiften/Network/DummyNetworkFactories.h>
+#include <Swiften/Network/DummyConnectionServer.h>
+#include "Swiften/Server/ServerStanzaChannel.h"
+#include "Swiften/Server/ServerFromClientSession.h"
+#include "Swiften/Parser/PayloadParsers/FullPayloadParserFactoryCollection.h"
+#include "basictest.h"
+
+using namespace Transport;
+
+#define SNAPSHOT "sessionsnapshot.snapshot"
+
+class SessionSnapshotTest : public CPPUNIT_NS :: TestFixture, public BasicTest {
+	CPPUNIT_TEST_SUITE(SessionSnapshotTest);
+	CPPUNIT_TEST(saveLoad);
+	CPPUNIT_TEST(restore);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp (void) {
+			std::remove(SNAPSHOT);
+			setMeUp();
+			connectUser();
+			add2Buddies();
+
+			// buddy2 waits in the storage queue and gets its ID when
+			// the snapshot is saved.
+			User *user = userManager->getUser("user@localhost");
+			user->getRosterManager()->getBuddy("buddy1")->setID(5);
+			received.clear();
+		}
+
+		void tearDown (void) {
+			userManager->setSessionSnapshot(NULL);
+			tearMeDown();
+			std::remove(SNAPSHOT);
+		}
+
+	void saveLoad() {
+		SessionSnapshot snapshot(component, userManager, SNAPSHOT);
+		CPPUNIT_ASSERT(!snapshot.load());
+		CPPUNIT_ASSERT(snapshot.save());
+
+#ifndef WIN32
+		struct stat st;
+		CPPUNIT_ASSERT_EQUAL(0, stat(SNAPSHOT, &st));
+		CPPUNIT_ASSERT_EQUAL(0600, (int) (st.st_mode & 0777));
+#endif
+
+		CPPUNIT_ASSERT(snapshot.load());
+		const SessionSnapshot::UserState *state = snapshot.getUserState("user@localhost");
+		CPPUNIT_ASSERT(state);
+		CPPUNIT_ASSERT(!state->presences.empty());
+		CPPUNIT_ASSERT_EQUAL(2, (int) state->buddies.size());
+
+		const SessionSnapshot::BuddyState &buddy = state->buddies.front();
+		CPPUNIT_ASSERT_EQUAL(5, (int) buddy.info.id);
+		CPPUNIT_ASSERT_EQUAL(std::string("buddy1"), buddy.info.legacyName);
+		CPPUNIT_ASSERT_EQUAL(std::string("Buddy 1"), buddy.info.alias);
+		CPPUNIT_ASSERT_EQUAL(std::string("group1"), buddy.info.groups[0]);
+		CPPUNIT_ASSERT_EQUAL((int) Swift::StatusShow::Away, buddy.show);
+		CPPUNIT_ASSERT_EQUAL(std::string("status1"), buddy.statusMessage);
+
+		const SessionSnapshot::BuddyState &buddy2 = state->buddies.back();
+		CPPUNIT_ASSERT(buddy2.info.id != -1);
+		CPPUNIT_ASSERT_EQUAL(std::string("buddy2"), buddy2.info.legacyName);
+
+		// Snapshot is removed once it's loaded.
+		CPPUNIT_ASSERT(!snapshot.load());
+		CPPUNIT_ASSERT(!snapshot.getUserState("user@localhost"));
+	}
+
+	void restore() {
+		SessionSnapshot snapshot(component, userManager, SNAPSHOT);
+		CPPUNIT_ASSERT(snapshot.save());
+		long buddy2ID = userManager->getUser("user@localhost")->getRosterManager()->getBuddy("buddy2")->getID();
+		CPPUNIT_ASSERT(buddy2ID != -1);
+		userManager->removeAllUsers(false);
+		loop->processEvents();
+		CPPUNIT_ASSERT_EQUAL(0, userManager->getUserCount());
+
+		CPPUNIT_ASSERT(snapshot.load());
+		userManager->setSessionSnapshot(&snapshot);
+		CPPUNIT_ASSERT(!snapshot.restorePresences("unknown@localhost"));
+		received.clear();
+		CPPUNIT_ASSERT(snapshot.restorePresences("user@localhost"));
+		loop->processEvents();
+
+		bool probed = false;
+		for (size_t i = 0; i < received.size(); i++) {
+			Swift::Presence *presence = dynamic_cast<Swift::Presence *>(getStanza(received[i]));
+			if (presence && presence->getType() == Swift::Presence::Probe) {
+				probed = true;
+			}
+		}
+		CPPUNIT_ASSERT(probed);
+
+		User *user = userManager->getUser("user@localhost");
+		CPPUNIT_ASSERT(user);
+		// Snapshot of the user is used only once.
+		CPPUNIT_ASSERT(!snapshot.getUserState("user@localhost"));
+
+		LocalBuddy *buddy = dynamic_cast<LocalBuddy *>(user->getRosterManager()->getBuddy("buddy1"));
+		CPPUNIT_ASSERT(buddy);
+		CPPUNIT_ASSERT_EQUAL(5, (int) buddy->getID());
+		CPPUNIT_ASSERT_EQUAL(std::string("Buddy 1"), buddy->getAlias());
+
+		Swift::StatusShow status;
+		std::string statusMessage;
+		CPPUNIT_ASSERT(buddy->getStatus(status, statusMessage));
+		CPPUNIT_ASSERT_EQUAL(Swift::StatusShow::Away, status.getType());
+		CPPUNIT_ASSERT_EQUAL(std::string("status1"), statusMessage);
+
+		LocalBuddy *buddy2 = dynamic_cast<LocalBuddy *>(user->getRosterManager()->getBuddy("buddy2"));
+		CPPUNIT_ASSERT(buddy2);
+		CPPUNIT_ASSERT_EQUAL(buddy2ID, (long) buddy2->getID());
+		CPPUNIT_ASSERT_EQUAL(std::string("Buddy 2"), buddy2->getAlias());
+		CPPUNIT_ASSERT(buddy2->getStatus(status, statusMessage));
+		CPPUNIT_ASSERT_EQUAL(Swift::StatusShow::Away, status.getType());
+		CPPUNIT_ASSERT_EQUAL(std::string("status2"), statusMessage);
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (SessionSnapshotTest);
@@ -0,0 +1,199 @@
+#include "transport/threadpool.h"
+#include <vector>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <Swiften/EventLoop/DummyEventLoop.h>
+
+class TestingJob : public Thread {
+	public:
+		TestingJob(int id, std::vector<int> &started, std::vector<int> &finalized, boost::mutex &mutex, bool *wait = NULL, std::vector<int> *cancelled = NULL)
+			: m_id(id), m_started(started), m_finalized(finalized), m_mutex(mutex), m_wait(wait), m_cancelled(cancelled) {}
+
+		void run() {
+			{
+				boost::mutex::scoped_lock l(m_mutex);
+				m_started.push_back(m_id);
+			}
+			// The flag is changed by the test thread, so check it with
+			// the mutex locked.
+			while (true) {
+				{
+					boost::mutex::scoped_lock l(m_mutex);
+					if (!m_wait || !*m_wait) {
+						break;
+					}
+				}
+				boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			}
+		}
+
+		void finalize() {
+			m_finalized.push_back(m_id);
+		}
+
+		void cancel() {
+			if (m_cancelled) {
+				m_cancelled->push_back(m_id);
+			}
+		}
+
+	private:
+		int m_id;
+		std::vector<int> &m_started;
+		std::vector<int> &m_finalized;
+		boost::mutex &m_mutex;
+		bool *m_wait;
+		std::vector<int> *m_cancelled;
+};
+
+class ThreadPoolTest : public CPPUNIT_NS :: TestFixture {
+	CPPUNIT_TEST_SUITE(ThreadPoolTest);
+	CPPUNIT_TEST(runAsThread);
+	CPPUNIT_TEST(interactiveFirst);
+	CPPUNIT_TEST(dropBackground);
+	CPPUNIT_TEST(dropInteractive);
+	CPPUNIT_TEST(cancelUnfinished);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		Swift::DummyEventLoop *loop;
+		std::vector<int> started;
+		std::vector<int> finalized;
+		std::vector<int> cancelled;
+		boost::mutex mutex;
+
+		void setUp (void) {
+			loop = new Swift::DummyEventLoop();
+			started.clear();
+			finalized.clear();
+			cancelled.clear();
+		}
+
+		void tearDown (void) {
+			delete loop;
+		}
+
+	void waitForJobs(ThreadPool &tp, unsigned long count) {
+		for (int i = 0; i < 5000 && tp.getCompletedCount() < count; i++) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+			loop->processEvents();
+		}
+	}
+
+	void waitForStart(unsigned long count) {
+		for (int i = 0; i < 5000; i++) {
+			{
+				boost::mutex::scoped_lock l(mutex);
+				if (started.size() >= count) {
+					return;
+				}
+			}
+			boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+		}
+	}
+
+	void release(bool *wait) {
+		boost::mutex::scoped_lock l(mutex);
+		*wait = false;
+	}
+
+	void releaseLater(bool *wait) {
+		boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+		release(wait);
+	}
+
+	void runAsThread() {
+		ThreadPool tp(loop, 4);
+		for (int i = 0; i < 20; i++) {
+			CPPUNIT_ASSERT(tp.runAsThread(new TestingJob(i, started, finalized, mutex)));
+		}
+
+		waitForJobs(tp, 20);
+		CPPUNIT_ASSERT_EQUAL(20, (int) tp.getCompletedCount());
+		CPPUNIT_ASSERT_EQUAL(20, (int) finalized.size());
+		CPPUNIT_ASSERT_EQUAL(0, tp.getQueuedCount());
+	}
+
+	void interactiveFirst() {
+		ThreadPool tp(loop, 1);
+		bool wait = true;
+
+		// Block the only worker, so the next jobs stay in queue.
+		tp.runAsThread(new TestingJob(0, started, finalized, mutex, &wait));
+		waitForStart(1);
+
+		tp.runAsThread(new TestingJob(1, started, finalized, mutex), ThreadPool::Background);
+		tp.runAsThread(new TestingJob(2, started, finalized, mutex), ThreadPool::Background);
+		tp.runAsThread(new TestingJob(3, started, finalized, mutex));
+		CPPUNIT_ASSERT_EQUAL(3, tp.getQueuedCount());
+
+		release(&wait);
+		waitForJobs(tp, 4);
+		CPPUNIT_ASSERT_EQUAL(4, (int) started.size());
+		CPPUNIT_ASSERT_EQUAL(3, started[1]);
+		CPPUNIT_ASSERT_EQUAL(1, started[2]);
+		CPPUNIT_ASSERT_EQUAL(2, started[3]);
+	}
+
+	void dropBackground() {
+		ThreadPool tp(loop, 1, 1);
+		bool wait = true;
+
+		tp.runAsThread(new TestingJob(0, started, finalized, mutex, &wait));
+		waitForStart(1);
+
+		CPPUNIT_ASSERT(tp.runAsThread(new TestingJob(1, started, finalized, mutex), ThreadPool::Background));
+		CPPUNIT_ASSERT(!tp.runAsThread(new TestingJob(2, started, finalized, mutex), ThreadPool::Background));
+		CPPUNIT_ASSERT(tp.runAsThread(new TestingJob(3, started, finalized, mutex)));
+		CPPUNIT_ASSERT_EQUAL(1, (int) tp.getDroppedCount());
+
+		release(&wait);
+		waitForJobs(tp, 3);
+		CPPUNIT_ASSERT_EQUAL(3, (int) finalized.size());
+	}
+
+	void dropInteractive() {
+		ThreadPool tp(loop, 1, 1);
+		bool wait = true;
+
+		tp.runAsThread(new TestingJob(0, started, finalized, mutex, &wait));
+		waitForStart(1);
+
+		CPPUNIT_ASSERT(tp.runAsThread(new TestingJob(1, started, finalized, mutex)));
+		CPPUNIT_ASSERT(!tp.runAsThread(new TestingJob(2, started, finalized, mutex)));
+		CPPUNIT_ASSERT(tp.runAsThread(new TestingJob(3, started, finalized, mutex), ThreadPool::Background));
+		CPPUNIT_ASSERT_EQUAL(1, (int) tp.getDroppedCount());
+
+		release(&wait);
+		waitForJobs(tp, 3);
+		CPPUNIT_ASSERT_EQUAL(3, (int) finalized.size());
+	}
+
+	void cancelUnfinished() {
+		ThreadPool *tp = new ThreadPool(loop, 1, 1);
+		bool wait = true;
+
+		tp->runAsThread(new TestingJob(0, started, finalized, mutex, &wait, &cancelled));
+		waitForStart(1);
+
+		CPPUNIT_ASSERT(tp->runAsThread(new TestingJob(1, started, finalized, mutex, NULL, &cancelled)));
+		CPPUNIT_ASSERT(!tp->runAsThread(new TestingJob(2, started, finalized, mutex, NULL, &cancelled)));
+		CPPUNIT_ASSERT_EQUAL(1, (int) cancelled.size());
+		CPPUNIT_ASSERT_EQUAL(2, cancelled[0]);
+
+		// The running job is finished while ThreadPool is being destroyed,
+		// so it can't be finalized. The queued one is never started.
+		boost::thread releaser(boost::bind(&ThreadPoolTest::releaseLater, this, &wait));
+		delete tp;
+		releaser.join();
+
+		CPPUNIT_ASSERT_EQUAL(1, (int) started.size());
+		CPPUNIT_ASSERT_EQUAL(0, (int) finalized.size());
+		CPPUNIT_ASSERT_EQUAL(3, (int) cancelled.size());
+		CPPUNIT_ASSERT_EQUAL(0, cancelled[1]);
+		CPPUNIT_ASSERT_EQUAL(1, cancelled[2]);
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (ThreadPoolTest);
@@ -0,0 +1,160 @@
+#include "transport/timerwheel.h"
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/bind.hpp>
+
+using namespace Transport;
+
+class TestTimer : public Swift::Timer {
+	public:
+		TestTimer() : running(false) {}
+
+		void start() { running = true; }
+		void stop() { running = false; }
+
+		void tick() {
+			if (running) {
+				running = false;
+				onTick();
+			}
+		}
+
+		bool running;
+};
+
+class TestTimerFactory : public Swift::TimerFactory {
+	public:
+		Swift::Timer::ref createTimer(int milliseconds) {
+			timer = boost::shared_ptr<TestTimer>(new TestTimer());
+			return timer;
+		}
+
+		boost::shared_ptr<TestTimer> timer;
+};
+
+class TimerWheelTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(TimerWheelTest);
+	CPPUNIT_TEST(schedule);
+	CPPUNIT_TEST(cancel);
+	CPPUNIT_TEST(moreRounds);
+	CPPUNIT_TEST(scheduleWhileRunning);
+	CPPUNIT_TEST(cancelFromCallback);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		TestTimerFactory *factory;
+		TimerWheel *wheel;
+		std::vector<int> called;
+
+		void setUp (void) {
+			factory = new TestTimerFactory();
+			wheel = new TimerWheel(factory, 1000, 4);
+			called.clear();
+		}
+
+		void tearDown (void) {
+			delete wheel;
+			delete factory;
+		}
+
+		void handleTimeout(int id) {
+			called.push_back(id);
+		}
+
+		void ticks(int count) {
+			for (int i = 0; i < count; i++) {
+				factory->timer->tick();
+			}
+		}
+
+		void schedule() {
+			CPPUNIT_ASSERT(!factory->timer->running);
+
+			TimerWheel::ID id = wheel->schedule(2500, boost::bind(&TimerWheelTest::handleTimeout, this, 1));
+			CPPUNIT_ASSERT(factory->timer->running);
+			CPPUNIT_ASSERT(wheel->isScheduled(id));
+
+			ticks(2);
+			CPPUNIT_ASSERT(called.empty());
+
+			ticks(1);
+			CPPUNIT_ASSERT_EQUAL(1, (int) called.size());
+			CPPUNIT_ASSERT(!wheel->isScheduled(id));
+
+			// Nothing is scheduled, so the wheel does not tick anymore.
+			CPPUNIT_ASSERT(!factory->timer->running);
+		}
+
+		void cancel() {
+			TimerWheel::ID id1 = wheel->schedule(1000, boost::bind(&TimerWheelTest::handleTimeout, this, 1));
+			wheel->schedule(1000, boost::bind(&TimerWheelTest::handleTimeout, this, 2));
+			CPPUNIT_ASSERT_EQUAL(2, (int) wheel->getScheduledCount());
+
+			wheel->cancel(id1);
+			wheel->cancel(id1);
+			wheel->cancel(0);
+			CPPUNIT_ASSERT_EQUAL(1, (int) wheel->getScheduledCount());
+
+			ticks(2);
+			CPPUNIT_ASSERT_EQUAL(1, (int) called.size());
+			CPPUNIT_ASSERT_EQUAL(2, called[0]);
+
+			TimerWheel::ID id3 = wheel->schedule(1000, boost::bind(&TimerWheelTest::handleTimeout, this, 3));
+			wheel->cancel(id3);
+			CPPUNIT_ASSERT(!factory->timer->running);
+		}
+
+		void moreRounds() {
+			// 10 ticks on the wheel with 4 slots.
+			wheel->schedule(10000, boost::bind(&TimerWheelTest::handleTimeout, this, 1));
+			wheel->schedule(2000, boost::bind(&TimerWheelTest::handleTimeout, this, 2));
+
+			ticks(3);
+			CPPUNIT_ASSERT_EQUAL(1, (int) called.size());
+			CPPUNIT_ASSERT_EQUAL(2, called[0]);
+
+			ticks(6);
+			CPPUNIT_ASSERT_EQUAL(1, (int) called.size());
+
+			ticks(1);
+			CPPUNIT_ASSERT_EQUAL(2, (int) called.size());
+			CPPUNIT_ASSERT_EQUAL(1, called[1]);
+		}
+
+		void scheduleWhileRunning() {
+			wheel->schedule(5000, boost::bind(&TimerWheelTest::handleTimeout, this, 1));
+
+			// Part of the current tick has already passed, so the callback
+			// has to wait one more tick to not be called too early.
+			wheel->schedule(1000, boost::bind(&TimerWheelTest::handleTimeout, this, 2));
+			ticks(1);
+			CPPUNIT_ASSERT(called.empty());
+
+			ticks(1);
+			CPPUNIT_ASSERT_EQUAL(1, (int) called.size());
+			CPPUNIT_ASSERT_EQUAL(2, called[0]);
+		}
+
+		void handleCancelTimeout(TimerWheel::ID *id) {
+			called.push_back(0);
+			wheel->cancel(*id);
+			*id = wheel->schedule(1000, boost::bind(&TimerWheelTest::handleTimeout, this, 3));
+		}
+
+		void cancelFromCallback() {
+			TimerWheel::ID id = 0;
+			// Both deadlines expire in the same tick.
+			wheel->schedule(2000, boost::bind(&TimerWheelTest::handleCancelTimeout, this, &id));
+			id = wheel->schedule(1000, boost::bind(&TimerWheelTest::handleTimeout, this, 2));
+
+			ticks(2);
+			CPPUNIT_ASSERT_EQUAL(1, (int) called.size());
+			CPPUNIT_ASSERT(factory->timer->running);
+
+			ticks(1);
+			CPPUNIT_ASSERT_EQUAL(2, (int) called.size());
+			CPPUNIT_ASSERT_EQUAL(3, called[1]);
+		}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (TimerWheelTest);
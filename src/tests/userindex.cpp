@@ -0,0 +1,116 @@
+#include "transport/userindex.h"
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <boost/lexical_cast.hpp>
+
+using namespace Transport;
+
+class UserIndexTest : public CPPUNIT_NS :: TestFixture{
+	CPPUNIT_TEST_SUITE(UserIndexTest);
+	CPPUNIT_TEST(addFind);
+	CPPUNIT_TEST(findJID);
+	CPPUNIT_TEST(findDomainJID);
+	CPPUNIT_TEST(replace);
+	CPPUNIT_TEST(remove);
+	CPPUNIT_TEST(removeReuse);
+	CPPUNIT_TEST(many);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp (void) {
+		}
+
+		void tearDown (void) {
+
+		}
+
+	User *user(long i) {
+		return (User *) (i * 16);
+	}
+
+	void addFind() {
+		UserIndex index;
+		CPPUNIT_ASSERT(index.find(std::string("user@localhost")) == NULL);
+
+		index.add("user@localhost", user(1));
+		index.add("user2@localhost", user(2));
+		CPPUNIT_ASSERT_EQUAL(2, (int) index.size());
+		CPPUNIT_ASSERT(index.find(std::string("user@localhost")) == user(1));
+		CPPUNIT_ASSERT(index.find(std::string("user2@localhost")) == user(2));
+		CPPUNIT_ASSERT(index.find(std::string("user3@localhost")) == NULL);
+	}
+
+	void findJID() {
+		UserIndex index;
+		index.add("user@localhost", user(1));
+
+		CPPUNIT_ASSERT(index.find(Swift::JID("user@localhost")) == user(1));
+		CPPUNIT_ASSERT(index.find(Swift::JID("user@localhost/resource")) == user(1));
+		CPPUNIT_ASSERT(index.find(Swift::JID("user@localhost2")) == NULL);
+		CPPUNIT_ASSERT(index.find(Swift::JID("use@rlocalhost")) == NULL);
+		CPPUNIT_ASSERT(index.find(Swift::JID("localhost")) == NULL);
+	}
+
+	void findDomainJID() {
+		UserIndex index;
+		index.add("localhost", user(1));
+
+		CPPUNIT_ASSERT(index.find(Swift::JID("localhost/resource")) == user(1));
+		CPPUNIT_ASSERT(index.find(Swift::JID("user@localhost")) == NULL);
+	}
+
+	void replace() {
+		UserIndex index;
+		index.add("user@localhost", user(1));
+		index.add("user@localhost", user(2));
+		CPPUNIT_ASSERT_EQUAL(1, (int) index.size());
+		CPPUNIT_ASSERT(index.find(std::string("user@localhost")) == user(2));
+	}
+
+	void remove() {
+		UserIndex index;
+		index.add("user@localhost", user(1));
+		index.add("user2@localhost", user(2));
+
+		CPPUNIT_ASSERT(index.remove("user@localhost"));
+		CPPUNIT_ASSERT(!index.remove("user@localhost"));
+		CPPUNIT_ASSERT_EQUAL(1, (int) index.size());
+		CPPUNIT_ASSERT(index.find(std::string("user@localhost")) == NULL);
+		CPPUNIT_ASSERT(index.find(Swift::JID("user@localhost")) == NULL);
+		CPPUNIT_ASSERT(index.find(std::string("user2@localhost")) == user(2));
+	}
+
+	void removeReuse() {
+		UserIndex index;
+		// Users logging in and out all the time must not make the table grow.
+		for (int i = 0; i < 10000; i++) {
+			std::string jid = "user" + boost::lexical_cast<std::string>(i) + "@localhost";
+			index.add(jid, user(i + 1));
+			CPPUNIT_ASSERT(index.find(jid) == user(i + 1));
+			CPPUNIT_ASSERT(index.remove(jid));
+		}
+		CPPUNIT_ASSERT_EQUAL(0, (int) index.size());
+
+		index.add("user@localhost", user(1));
+		CPPUNIT_ASSERT(index.find(std::string("user@localhost")) == user(1));
+	}
+
+	void many() {
+		UserIndex index;
+		for (int i = 0; i < 5000; i++) {
+			index.add("user" + boost::lexical_cast<std::string>(i) + "@localhost", user(i + 1));
+		}
+		for (int i = 0; i < 5000; i += 2) {
+			CPPUNIT_ASSERT(index.remove("user" + boost::lexical_cast<std::string>(i) + "@localhost"));
+		}
+
+		CPPUNIT_ASSERT_EQUAL(2500, (int) index.size());
+		for (int i = 0; i < 5000; i++) {
+			User *u = index.find(Swift::JID("user" + boost::lexical_cast<std::string>(i) + "@localhost/res"));
+			CPPUNIT_ASSERT(u == (i % 2 ? user(i + 1) : NULL));
+		}
+	}
+
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (UserIndexTest);
@@ -0,0 +1,84 @@
+#include "transport/userregistry.h"
+#include "transport/config.h"
+#include "transport/storagebackend.h"
+#include "transport/user.h"
+#include "transport/transport.h"
+#include "transport/usermanager.h"
+#include "transport/usersreconnecter.h"
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+#include <Swiften/Swiften.h>
+#include <Swiften/EventLoop/DummyEventLoop.h>
+#include <Swiften/Server/Server.h>
+#include <Swiften/Network/DummyNetworkFactories.h>
+#include <Swiften/Network/DummyConnectionServer.h>
+#include "Swiften/Server/ServerStanzaChannel.h"
+#include "Swiften/Server/ServerFromClientSession.h"
+#include "Swiften/Parser/PayloadParsers/FullPayloadParserFactoryCollection.h"
+#include "basictest.h"
+
+using namespace Transport;
+
+class UsersReconnecterTest : public CPPUNIT_NS :: TestFixture, public BasicTest {
+	CPPUNIT_TEST_SUITE(UsersReconnecterTest);
+	CPPUNIT_TEST(reconnectInWaves);
+	CPPUNIT_TEST_SUITE_END();
+
+	public:
+		void setUp (void) {
+			setMeUp();
+		}
+
+		void tearDown (void) {
+			tearMeDown();
+		}
+
+	void addUser(int id, const std::string &jid) {
+		UserInfo user;
+		user.id = id;
+		user.jid = jid;
+		user.uin = jid;
+		user.password = "password";
+		user.vip = 0;
+		storage->setUser(user);
+	}
+
+	void reconnectInWaves() {
+		std::istringstream ifs("service.server_mode = 1\nservice.jid=localhost\nservice.more_resources=1\n"
+			"service.reconnect_on_start=1\nservice.users_per_backend=1\nservice.reconnect_concurrency=10\n");
+		cfg->load(ifs);
+
+		addUser(1, "user1@localhost");
+		addUser(2, "user2@localhost");
+		addUser(3, "user3@localhost");
+		addUser(4, "user4@localhost");
+		storage->updateUserSetting(4, "stay_connected", "0");
+
+		UsersReconnecter *reconnecter = new UsersReconnecter(component, userManager, storage);
+		component->onConnected();
+		loop->processEvents();
+
+		// The first wave has users_per_backend users.
+		CPPUNIT_ASSERT_EQUAL(1, reconnecter->getWindow());
+		CPPUNIT_ASSERT_EQUAL(1, reconnecter->getPendingCount());
+		CPPUNIT_ASSERT_EQUAL(1, userManager->getUserCount());
+
+		User *user = userManager->getUser("user3@localhost");
+		CPPUNIT_ASSERT(user);
+		user->setConnected(true);
+
+		// Successful login makes the next wave bigger.
+		reconnecter->reconnectNextUsers();
+		loop->processEvents();
+		CPPUNIT_ASSERT_EQUAL(2, reconnecter->getWindow());
+		CPPUNIT_ASSERT_EQUAL(2, reconnecter->getPendingCount());
+		CPPUNIT_ASSERT_EQUAL(3, userManager->getUserCount());
+
+		// User with stay_connected=0 is not reconnected.
+		CPPUNIT_ASSERT(!userManager->getUser("user4@localhost"));
+
+		delete reconnecter;
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION (UsersReconnecterTest);
@@ -1,123 +1,146 @@
 #include "transport/threadpool.h"
+#include "boost/date_time/posix_time/posix_time.hpp"
 DEFINE_LOGGER(logger, "ThreadPool")
-boost::signals2::signal< void (Thread*, int) > onWorkCompleted;
 
-static void Worker(Thread *t, int wid, Swift::EventLoop *loop)
-{
-	LOG4CXX_INFO(logger, "Starting thread " << wid)
-	t->run();
-	loop->postEvent(boost::bind(boost::ref(onWorkCompleted), t, wid), boost::shared_ptr<Swift::EventOwner>());
-}
-
-
-ThreadPool::ThreadPool(Swift::EventLoop *loop, int maxthreads) : MAX_THREADS(maxthreads)
+ThreadPool::ThreadPool(Swift::EventLoop *loop, int maxthreads, int maxqueued) : MAX_THREADS(maxthreads), MAX_QUEUED(maxqueued)
 {
 	this->loop = loop;
+	owner = boost::shared_ptr<Swift::EventOwner>(new Swift::EventOwner());
 	activeThreads = 0;
-	worker = new boost::thread*[MAX_THREADS];
+	stopped = false;
+	completed = 0;
+	dropped = 0;
+	totalWaitTime = 0;
+	totalRunTime = 0;
+	maxWaitTime = 0;
+
 	for(int i=0 ; i<MAX_THREADS ; i++) {
-		worker[i] = NULL;
-		freeThreads.push(i);
+		workers.push_back(new boost::thread(boost::bind(&ThreadPool::workerLoop, this, i)));
 	}
-	onWorkCompleted.connect(boost::bind(&ThreadPool::cleandUp, this, _1, _2));
-	onWorkerAvailable.connect(boost::bind(&ThreadPool::scheduleFromQueue, this));
 }
 
 ThreadPool::~ThreadPool()
 {
+	lock.lock();
+	stopped = true;
+	lock.unlock();
+	workAvailable.notify_all();
+
+	// Workers finish the jobs they are running just now.
 	for(int i=0; i<MAX_THREADS ; i++) {
-		if(worker[i]) {
-			delete worker[i];
-		}
+		workers[i]->join();
+		delete workers[i];
+	}
+
+	// Jobs finished after the last processed event can't be finalized
+	// anymore, as well as the jobs which have not been started at all.
+	loop->removeEventsFromOwner(owner);
+	for (std::set<Thread *>::iterator it = finished.begin(); it != finished.end(); it++) {
+		(*it)->cancel();
+		delete *it;
 	}
-	delete worker;
 
-	while(!requestQueue.empty()) {
-		Thread *t = requestQueue.front(); requestQueue.pop();
-		delete t;
+	for (int p = 0; p < 2; p++) {
+		while(!requestQueue[p].empty()) {
+			requestQueue[p].front().thread->cancel();
+			delete requestQueue[p].front().thread;
+			requestQueue[p].pop_front();
+		}
 	}
 }
 
-int ThreadPool::getActiveThreadCount()
-{	
-	int res;
-	count_lock.lock(); 
-	res = activeThreads;
-	count_lock.unlock();
-	return res;
+double ThreadPool::getTime()
+{
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	return (now - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_microseconds() / 1000000.0;
 }
 
-void ThreadPool::updateActiveThreadCount(int k)
+int ThreadPool::getActiveThreadCount()
 {
-	count_lock.lock();
-	activeThreads += k;
-	count_lock.unlock();
+	boost::mutex::scoped_lock l(lock);
+	return activeThreads;
 }
 
-int ThreadPool::getFreeThread()
+int ThreadPool::getQueuedCount()
 {
-	int res = -1;
-	pool_lock.lock();
-	if(!freeThreads.empty()){
-		res = freeThreads.front();
-		freeThreads.pop();
-		updateActiveThreadCount(-1);
-	}
-	pool_lock.unlock();
-	return res;
+	boost::mutex::scoped_lock l(lock);
+	return requestQueue[Interactive].size() + requestQueue[Background].size();
 }
 
-void ThreadPool::releaseThread(int i)
+void ThreadPool::workerLoop(int wid)
 {
-	if(i < 0 || i > MAX_THREADS) return;
-	pool_lock.lock();
-
-	delete worker[i];
-	worker[i] = NULL;
-	freeThreads.push(i);
-	
-	updateActiveThreadCount(1);
-	
-	pool_lock.unlock();
+	while (true) {
+		Job job;
+		{
+			boost::mutex::scoped_lock l(lock);
+			while (!stopped && requestQueue[Interactive].empty() && requestQueue[Background].empty()) {
+				workAvailable.wait(l);
+			}
+			if (stopped) {
+				return;
+			}
+
+			std::deque<Job> &queue = requestQueue[Interactive].empty() ? requestQueue[Background] : requestQueue[Interactive];
+			job = queue.front();
+			queue.pop_front();
+			activeThreads++;
+		}
+
+		double start = getTime();
+		job.thread->setThreadID(wid);
+		LOG4CXX_INFO(logger, "Starting thread " << wid)
+		job.thread->run();
+
+		double end = getTime();
+		{
+			boost::mutex::scoped_lock l(lock);
+			finished.insert(job.thread);
+		}
+		loop->postEvent(boost::bind(&ThreadPool::handleWorkCompleted, this, job.thread, start - job.queued, end - start), owner);
+
+		boost::mutex::scoped_lock l(lock);
+		activeThreads--;
+	}
 }
 
-void ThreadPool::cleandUp(Thread *t, int wid)
+void ThreadPool::handleWorkCompleted(Thread *t, double waitTime, double runTime)
 {
 	LOG4CXX_INFO(logger, "Cleaning up thread #" << t->getThreadID())
+	{
+		boost::mutex::scoped_lock l(lock);
+		finished.erase(t);
+	}
+
+	completed++;
+	totalWaitTime += waitTime;
+	totalRunTime += runTime;
+	if (waitTime > maxWaitTime) {
+		maxWaitTime = waitTime;
+	}
+
 	t->finalize();
 	delete t;
-	releaseThread(wid);
-	onWorkerAvailable();	
 }
 
-void ThreadPool::scheduleFromQueue()
+bool ThreadPool::runAsThread(Thread *t, Priority priority)
 {
-	criticalregion.lock();	
-	while(!requestQueue.empty()) {
-		int  w = getFreeThread();
-		if(w == -1) break;
-
-		LOG4CXX_INFO(logger, "Worker Available. Creating thread #" << w)
-		Thread *t = requestQueue.front(); requestQueue.pop();
-		t->setThreadID(w);
-		worker[w] = new boost::thread(Worker, t, w, loop);
-		updateActiveThreadCount(-1);
-	}
-	criticalregion.unlock();
-}
-
+	{
+		boost::mutex::scoped_lock l(lock);
+		if ((int) requestQueue[priority].size() >= MAX_QUEUED) {
+			l.unlock();
+			LOG4CXX_WARN(logger, "Too many " << (priority == Background ? "background" : "interactive") << " jobs queued, dropping the new one.")
+			dropped++;
+			t->cancel();
+			delete t;
+			return false;
+		}
 
-void ThreadPool::runAsThread(Thread *t)
-{
-	int w;
-	if((w = getFreeThread()) != -1) {
-		LOG4CXX_INFO(logger, "Creating thread #" << w)
-		t->setThreadID(w);
-		worker[w] = new boost::thread(Worker, t, w, loop);
-		updateActiveThreadCount(-1);
-	}
-	else {
-		LOG4CXX_INFO(logger, "No workers available! adding to queue.")
-		requestQueue.push(t);
+		Job job;
+		job.thread = t;
+		job.queued = getTime();
+		requestQueue[priority].push_back(job);
 	}
+
+	workAvailable.notify_one();
+	return true;
 }
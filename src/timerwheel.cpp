@@ -0,0 +1,124 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/timerwheel.h"
+#include <boost/bind.hpp>
+
+namespace Transport {
+
+TimerWheel::TimerWheel(Swift::TimerFactory *timerFactory, int resolution, int slots) {
+	m_running = false;
+	m_resolution = resolution;
+	m_cursor = 0;
+	m_lastID = 0;
+	m_slots.resize(slots);
+
+	m_timer = timerFactory->createTimer(resolution);
+	m_timer->onTick.connect(boost::bind(&TimerWheel::handleTick, this));
+}
+
+TimerWheel::~TimerWheel() {
+	m_timer->stop();
+	m_timer->onTick.disconnect_all_slots();
+}
+
+TimerWheel::ID TimerWheel::schedule(int timeout, const Callback &callback) {
+	unsigned long ticks = timeout <= 0 ? 1 : (timeout + m_resolution - 1) / m_resolution;
+	// The running timer has already spent part of the current tick, so wait
+	// one more tick to not call the callback too early.
+	if (m_running) {
+		ticks++;
+	}
+
+	if (++m_lastID == 0) {
+		++m_lastID;
+	}
+
+	Entry entry;
+	entry.id = m_lastID;
+	entry.rounds = (ticks - 1) / m_slots.size();
+	entry.callback = callback;
+
+	Location location;
+	location.slot = (m_cursor + ticks) % m_slots.size();
+	location.entry = m_slots[location.slot].insert(m_slots[location.slot].end(), entry);
+	m_entries[entry.id] = location;
+
+	if (!m_running) {
+		m_running = true;
+		m_timer->start();
+	}
+
+	return entry.id;
+}
+
+void TimerWheel::cancel(ID id) {
+	std::map<ID, Location>::iterator it = m_entries.find(id);
+	if (it == m_entries.end()) {
+		return;
+	}
+
+	if (it->second.slot == m_slots.size()) {
+		m_expired.erase(it->second.entry);
+	}
+	else {
+		m_slots[it->second.slot].erase(it->second.entry);
+	}
+	m_entries.erase(it);
+
+	if (m_entries.empty() && m_running) {
+		m_running = false;
+		m_timer->stop();
+	}
+}
+
+void TimerWheel::handleTick() {
+	m_running = false;
+	m_cursor = (m_cursor + 1) % m_slots.size();
+
+	// Move expired entries out of the wheel first, so callbacks can freely
+	// schedule and cancel other deadlines.
+	std::list<Entry> &slot = m_slots[m_cursor];
+	for (std::list<Entry>::iterator it = slot.begin(); it != slot.end(); ) {
+		if (it->rounds != 0) {
+			it->rounds--;
+			it++;
+			continue;
+		}
+
+		std::list<Entry>::iterator expired = it++;
+		m_entries[expired->id].slot = m_slots.size();
+		m_expired.splice(m_expired.end(), slot, expired);
+	}
+
+	while (!m_expired.empty()) {
+		Entry entry = m_expired.front();
+		m_expired.pop_front();
+		m_entries.erase(entry.id);
+		entry.callback();
+	}
+
+	if (!m_entries.empty() && !m_running) {
+		m_running = true;
+		m_timer->start();
+	}
+}
+
+}
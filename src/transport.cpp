@@ -25,6 +25,9 @@
 #include "transport/storagebackend.h"
 #include "transport/factory.h"
 #include "transport/userregistry.h"
+#include "transport/messagecache.h"
+#include "transport/metrics.h"
+#include "transport/timerwheel.h"
 #include "transport/logging.h"
 #include "storageparser.h"
 #ifdef _WIN32
@@ -75,10 +78,12 @@ Component::Component(Swift::EventLoop *loop, Swift::NetworkFactories *factories,
 	m_loop = loop;
 	m_userRegistry = userRegistry;
 	m_rawXML = false;
+	m_metrics = new Metrics();
 
 	m_jid = Swift::JID(CONFIG_STRING(m_config, "service.jid"));
 
 	m_factories = factories;
+	m_timerWheel = new TimerWheel(m_factories->getTimerFactory());
 
 	m_reconnectTimer = m_factories->getTimerFactory()->createTimer(3000);
 	m_reconnectTimer->onTick.connect(bind(&Component::start, this)); 
@@ -162,6 +167,14 @@ Component::Component(Swift::EventLoop *loop, Swift::NetworkFactories *factories,
 	m_presenceOracle = new Transport::PresenceOracle(m_stanzaChannel);
 	m_presenceOracle->onPresenceChange.connect(bind(&Component::handlePresence, this, _1));
 
+	Counter *stanzas = m_metrics->getCounter("spectrum2_stanzas_received_total", "Stanzas received from XMPP side");
+	m_stanzaChannel->onMessageReceived.connect(boost::bind(&Counter::increment, stanzas, 1));
+	m_stanzaChannel->onPresenceReceived.connect(boost::bind(&Counter::increment, stanzas, 1));
+	m_stanzaChannel->onIQReceived.connect(boost::bind(&Counter::increment, stanzas, 1));
+
+	m_messageCache = new MessageCache(CONFIG_INT(m_config, "service.message_cache_memory") * 1024,
+		CONFIG_INT(m_config, "service.message_cache_max"), CONFIG_STRING(m_config, "service.message_cache_spool"));
+
 
 
 // 
@@ -170,6 +183,9 @@ Component::Component(Swift::EventLoop *loop, Swift::NetworkFactories *factories,
 }
 
 Component::~Component() {
+	delete m_messageCache;
+	delete m_metrics;
+	delete m_timerWheel;
 	delete m_presenceOracle;
 	delete m_entityCapsManager;
 	delete m_capsManager;
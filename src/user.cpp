@@ -25,6 +25,7 @@
 #include "transport/usermanager.h"
 #include "transport/conversationmanager.h"
 #include "transport/presenceoracle.h"
+#include "transport/metrics.h"
 #include "transport/logging.h"
 #include "Swiften/Server/ServerStanzaChannel.h"
 #include "Swiften/Elements/StreamError.h"
@@ -57,9 +58,9 @@ User::User(const Swift::JID &jid, UserInfo &userInfo, Component *component, User
 	m_ignoreDisconnect = false;
 	m_resources = 0;
 	m_reconnectCounter = 0;
+	m_loginStart = Metrics::getTime();
 
-	m_reconnectTimer = m_component->getNetworkFactories()->getTimerFactory()->createTimer(5000);
-	m_reconnectTimer->onTick.connect(boost::bind(&User::onConnectingTimeout, this)); 
+	m_reconnectTimer = 0;
 
 	m_rosterManager = new RosterManager(this, m_component);
 	m_conversationManager = new ConversationManager(this, m_component);
@@ -73,7 +74,7 @@ User::~User(){
 		dynamic_cast<Swift::ServerStanzaChannel *>(m_component->getStanzaChannel())->finishSession(m_jid, boost::shared_ptr<Swift::Element>());
 	}
 
-	m_reconnectTimer->stop();
+	m_component->getTimerWheel()->cancel(m_reconnectTimer);
 	delete m_rosterManager;
 	delete m_conversationManager;
 }
@@ -177,8 +178,20 @@ void User::setConnected(bool connected) {
 	setIgnoreDisconnect(false);
 	updateLastActivity();
 
+	// Time from the first presence to the legacy network login, reconnections are not counted.
+	if (m_connected && m_loginStart != 0) {
+		m_component->getMetrics()->getHistogram("spectrum2_login_seconds", "Duration of the login to legacy network")->observe(Metrics::getTime() - m_loginStart);
+		m_loginStart = 0;
+	}
+
 	sendCurrentPresence();
 
+	// Deliver messages spooled for this user while the user was offline,
+	// for example the ones received before restart.
+	if (m_connected && m_component->inServerMode() && !m_cacheMessages) {
+		m_conversationManager->sendSpooledMessages();
+	}
+
 	if (m_connected) {
 		BOOST_FOREACH(Swift::Presence::ref &presence, m_joinedRooms) {
 			handlePresence(presence, true);
@@ -190,6 +203,10 @@ void User::setCacheMessages(bool cacheMessages) {
 	if (m_component->inServerMode() && !m_cacheMessages && cacheMessages) {
 		m_conversationManager->sendCachedChatMessages();
 	}
+	else if (m_component->inServerMode() && m_cacheMessages && !cacheMessages) {
+		m_conversationManager->sendCachedChatMessages();
+		m_conversationManager->sendSpooledMessages();
+	}
 	m_cacheMessages = cacheMessages;
 }
 
@@ -211,7 +228,7 @@ void User::handlePresence(Swift::Presence::ref presence, bool forceJoin) {
 					onReadyToConnect();
 				}
 				else {
-					m_reconnectTimer->start();
+					startReconnectTimer();
 				}
 			}
 			else if (m_component->inServerMode()) {
@@ -220,7 +237,7 @@ void User::handlePresence(Swift::Presence::ref presence, bool forceJoin) {
 				onReadyToConnect();
 			}
 			else {
-				m_reconnectTimer->start();
+				startReconnectTimer();
 			}
 		}
 	}
@@ -435,7 +452,8 @@ void User::handleDiscoInfo(const Swift::JID& jid, boost::shared_ptr<Swift::Disco
 void User::onConnectingTimeout() {
 	if (m_connected || m_readyForConnect)
 		return;
-	m_reconnectTimer->stop();
+	m_component->getTimerWheel()->cancel(m_reconnectTimer);
+	m_reconnectTimer = 0;
 	m_readyForConnect = true;
 	onReadyToConnect();
 
@@ -446,6 +464,12 @@ void User::onConnectingTimeout() {
 	}
 }
 
+void User::startReconnectTimer() {
+	TimerWheel *timerWheel = m_component->getTimerWheel();
+	timerWheel->cancel(m_reconnectTimer);
+	m_reconnectTimer = timerWheel->schedule(5000, boost::bind(&User::onConnectingTimeout, this));
+}
+
 void User::setIgnoreDisconnect(bool ignoreDisconnect) {
 	m_ignoreDisconnect = ignoreDisconnect;
 	LOG4CXX_INFO(logger, m_jid.toString() << ": Setting ignoreDisconnect=" << m_ignoreDisconnect);
@@ -0,0 +1,212 @@
+/**
+ * libtransport -- C++ library for easy XMPP Transports development
+ *
+ * Copyright (C) 2011, Jan Kaluza <hanzz.k@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#include "transport/userindex.h"
+
+namespace Transport {
+
+#define SLOT_EMPTY -1
+#define SLOT_DELETED -2
+#define INITIAL_CAPACITY 16
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+UserIndex::UserIndex() {
+	m_count = 0;
+	m_used = 0;
+}
+
+unsigned int UserIndex::hash(const std::string &barejid) {
+	unsigned int h = FNV_OFFSET;
+	for (std::string::const_iterator it = barejid.begin(); it != barejid.end(); it++) {
+		h = (h ^ (unsigned char) *it) * FNV_PRIME;
+	}
+	return h;
+}
+
+unsigned int UserIndex::hash(const Swift::JID &jid) {
+	// Has to return the same hash as hash(jid.toBare().toString()).
+	unsigned int h = FNV_OFFSET;
+	const std::string &node = jid.getNode();
+	if (!node.empty()) {
+		for (std::string::const_iterator it = node.begin(); it != node.end(); it++) {
+			h = (h ^ (unsigned char) *it) * FNV_PRIME;
+		}
+		h = (h ^ (unsigned char) '@') * FNV_PRIME;
+	}
+
+	const std::string &domain = jid.getDomain();
+	for (std::string::const_iterator it = domain.begin(); it != domain.end(); it++) {
+		h = (h ^ (unsigned char) *it) * FNV_PRIME;
+	}
+	return h;
+}
+
+bool UserIndex::equals(const std::string &barejid, const Swift::JID &jid) {
+	const std::string &node = jid.getNode();
+	const std::string &domain = jid.getDomain();
+
+	if (node.empty()) {
+		return barejid == domain;
+	}
+
+	if (barejid.size() != node.size() + 1 + domain.size()) {
+		return false;
+	}
+
+	return barejid.compare(0, node.size(), node) == 0 && barejid[node.size()] == '@'
+		&& barejid.compare(node.size() + 1, domain.size(), domain) == 0;
+}
+
+int UserIndex::findSlot(const std::string &barejid, unsigned int h) const {
+	if (m_slots.empty()) {
+		return -1;
+	}
+
+	unsigned long mask = m_slots.size() - 1;
+	for (unsigned long i = h & mask, n = 0; n < m_slots.size(); i = (i + 1) & mask, n++) {
+		const Slot &slot = m_slots[i];
+		if (slot.id == SLOT_EMPTY) {
+			return -1;
+		}
+		if (slot.id >= 0 && slot.hash == h && m_keys[slot.id] == barejid) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int UserIndex::findSlot(const Swift::JID &jid, unsigned int h) const {
+	if (m_slots.empty()) {
+		return -1;
+	}
+
+	unsigned long mask = m_slots.size() - 1;
+	for (unsigned long i = h & mask, n = 0; n < m_slots.size(); i = (i + 1) & mask, n++) {
+		const Slot &slot = m_slots[i];
+		if (slot.id == SLOT_EMPTY) {
+			return -1;
+		}
+		if (slot.id >= 0 && slot.hash == h && equals(m_keys[slot.id], jid)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void UserIndex::insertSlot(unsigned int h, int id) {
+	unsigned long mask = m_slots.size() - 1;
+	unsigned long i = h & mask;
+	while (m_slots[i].id >= 0) {
+		i = (i + 1) & mask;
+	}
+
+	if (m_slots[i].id == SLOT_EMPTY) {
+		m_used++;
+	}
+	m_slots[i].hash = h;
+	m_slots[i].id = id;
+}
+
+void UserIndex::rehash(unsigned long capacity) {
+	std::vector<Slot> old;
+	old.swap(m_slots);
+
+	Slot empty;
+	empty.hash = 0;
+	empty.id = SLOT_EMPTY;
+	m_slots.resize(capacity, empty);
+	m_used = 0;
+
+	for (std::vector<Slot>::const_iterator it = old.begin(); it != old.end(); it++) {
+		if (it->id >= 0) {
+			insertSlot(it->hash, it->id);
+		}
+	}
+}
+
+void UserIndex::add(const std::string &barejid, User *user) {
+	unsigned int h = hash(barejid);
+	int i = findSlot(barejid, h);
+	if (i != -1) {
+		m_users[m_slots[i].id] = user;
+		return;
+	}
+
+	// Keep the load factor (including deleted slots) under 3/4. When we
+	// have to rehash, make the new table at most half full.
+	if (m_slots.empty() || (m_used + 1) * 4 > m_slots.size() * 3) {
+		unsigned long capacity = INITIAL_CAPACITY;
+		while ((m_count + 1) * 2 > capacity) {
+			capacity *= 2;
+		}
+		rehash(capacity);
+	}
+
+	int id;
+	if (!m_freeIDs.empty()) {
+		id = m_freeIDs.back();
+		m_freeIDs.pop_back();
+		m_keys[id] = barejid;
+		m_users[id] = user;
+	}
+	else {
+		id = m_keys.size();
+		m_keys.push_back(barejid);
+		m_users.push_back(user);
+	}
+
+	insertSlot(h, id);
+	m_count++;
+}
+
+bool UserIndex::remove(const std::string &barejid) {
+	int i = findSlot(barejid, hash(barejid));
+	if (i == -1) {
+		return false;
+	}
+
+	int id = m_slots[i].id;
+	m_slots[i].id = SLOT_DELETED;
+	std::string().swap(m_keys[id]);
+	m_users[id] = NULL;
+	m_freeIDs.push_back(id);
+	m_count--;
+	return true;
+}
+
+User *UserIndex::find(const std::string &barejid) const {
+	int i = findSlot(barejid, hash(barejid));
+	if (i == -1) {
+		return NULL;
+	}
+	return m_users[m_slots[i].id];
+}
+
+User *UserIndex::find(const Swift::JID &jid) const {
+	int i = findSlot(jid, hash(jid));
+	if (i == -1) {
+		return NULL;
+	}
+	return m_users[m_slots[i].id];
+}
+
+}
@@ -27,6 +27,7 @@
 #include "transport/userregistry.h"
 #include "transport/logging.h"
 #include "transport/discoitemsresponder.h"
+#include "transport/sessionsnapshot.h"
 #include "storageresponder.h"
 
 #include "Swiften/Server/ServerStanzaChannel.h"
@@ -45,15 +46,17 @@ namespace Transport {
 DEFINE_LOGGER(logger, "UserManager");
 
 UserManager::UserManager(Component *component, UserRegistry *userRegistry, DiscoItemsResponder *discoItemsResponder, StorageBackend *storageBackend) {
-	m_cachedUser = NULL;
 	m_onlineBuddies = 0;
-	m_sentToXMPP = 0;
-	m_sentToBackend = 0;
 	m_component = component;
+	m_sentToXMPP = component->getMetrics()->getCounter("spectrum2_messages_to_xmpp_total", "Messages forwarded from backends to XMPP users");
+	m_sentToBackend = component->getMetrics()->getCounter("spectrum2_messages_from_xmpp_total", "Messages received from XMPP users");
+	m_usersOnline = component->getMetrics()->getGauge("spectrum2_users_online", "Users currently logged in");
+	m_storageLatency = component->getMetrics()->getHistogram("spectrum2_storage_seconds", "Duration of storage backend calls");
 	m_storageBackend = storageBackend;
 	m_storageResponder = NULL;
 	m_userRegistry = userRegistry;
 	m_discoItemsResponder = discoItemsResponder;
+	m_sessionSnapshot = NULL;
 
 	if (m_storageBackend) {
 		m_storageResponder = new StorageResponder(component->getIQRouter(), m_storageBackend, this);
@@ -79,40 +82,39 @@ UserManager::~UserManager(){
 }
 
 void UserManager::addUser(User *user) {
-	m_users[user->getJID().toBare().toString()] = user;
+	std::string barejid = user->getJID().toBare().toString();
+	m_users[barejid] = user;
+	m_index.add(barejid, user);
+	m_usersOnline->setValue(m_users.size());
 	if (m_storageBackend) {
+		HistogramTimer timer(m_storageLatency);
 		m_storageBackend->setUserOnline(user->getUserInfo().id, true);
 	}
 	onUserCreated(user);
 }
 
 User *UserManager::getUser(const std::string &barejid){
-	if (m_cachedUser && barejid == m_cachedUser->getJID().toBare().toString()) {
-		return m_cachedUser;
-	}
+	return m_index.find(barejid);
+}
 
-	if (m_users.find(barejid) != m_users.end()) {
-		User *user = m_users[barejid];
-		m_cachedUser = user;
-		return user;
-	}
-	return NULL;
+User *UserManager::getUser(const Swift::JID &jid){
+	return m_index.find(jid);
 }
 
 Swift::DiscoInfo::ref UserManager::getCaps(const Swift::JID &jid) const {
-	std::map<std::string, User *>::const_iterator it = m_users.find(jid.toBare().toString());
-	if (it == m_users.end()) {
+	User *user = m_index.find(jid);
+	if (!user) {
 		return Swift::DiscoInfo::ref();
 	}
 
-	User *user = it->second;
 	return user->getCaps(jid);
 }
 
 void UserManager::removeUser(User *user, bool onUserBehalf) {
-	m_users.erase(user->getJID().toBare().toString());
-	if (m_cachedUser == user)
-		m_cachedUser = NULL;
+	std::string barejid = user->getJID().toBare().toString();
+	m_users.erase(barejid);
+	m_index.remove(barejid);
+	m_usersOnline->setValue(m_users.size());
 
 	if (m_component->inServerMode()) {
 		disconnectUser(user->getJID());
@@ -125,6 +127,7 @@ void UserManager::removeUser(User *user, bool onUserBehalf) {
 	}
 
 	if (m_storageBackend && onUserBehalf) {
+		HistogramTimer timer(m_storageLatency);
 		m_storageBackend->setUserOnline(user->getUserInfo().id, false);
 	}
 
@@ -151,7 +154,7 @@ int UserManager::getUserCount() {
 }
 
 void UserManager::handleDiscoInfo(const Swift::JID& jid, boost::shared_ptr<Swift::DiscoInfo> info) {
-	User *user = getUser(jid.toBare().toString());
+	User *user = getUser(jid);
 	if (!user) {
 		return;
 	}
@@ -168,7 +171,8 @@ void UserManager::handlePresence(Swift::Presence::ref presence) {
 	if (!user) {
 		// Admin user is not legacy network user, so do not create User class instance for him
 		if (m_component->inServerMode()) {
-			std::vector<std::string> const &x = CONFIG_VECTOR(m_component->getConfig(),"service.admin_jid");
+			ConfigSnapshot::ref snapshot = m_component->getConfig()->getSnapshot();
+			std::vector<std::string> const &x = snapshot->adminJIDs;
 			if (std::find(x.begin(), x.end(), presence->getFrom().toBare().toString()) != x.end()) {
 				// Send admin contact to the user.
 				Swift::RosterPayload::ref payload = Swift::RosterPayload::ref(new Swift::RosterPayload());
@@ -190,7 +194,11 @@ void UserManager::handlePresence(Swift::Presence::ref presence) {
 		}
 
 		UserInfo res;
-		bool registered = m_storageBackend ? m_storageBackend->getUser(userkey, res) : false;
+		bool registered = false;
+		if (m_storageBackend) {
+			HistogramTimer timer(m_storageLatency);
+			registered = m_storageBackend->getUser(userkey, res);
+		}
 
 		// No user and unavailable presence -> answer with unavailable
 		if (presence->getType() == Swift::Presence::Unavailable || presence->getType() == Swift::Presence::Probe) {
@@ -314,7 +322,9 @@ void UserManager::handlePresence(Swift::Presence::ref presence) {
 
 		// Create new user class and set storagebackend
 		user = new User(presence->getFrom(), res, m_component, this);
-		user->getRosterManager()->setStorageBackend(m_storageBackend);
+		if (!m_sessionSnapshot || !m_sessionSnapshot->restoreRoster(user, m_storageBackend)) {
+			user->getRosterManager()->setStorageBackend(m_storageBackend);
+		}
 		addUser(user);
 	}
 
@@ -386,7 +396,7 @@ void UserManager::handleMessageReceived(Swift::Message::ref message) {
 		return;
 	}
 
-	User *user = getUser(message->getFrom().toBare().toString());
+	User *user = getUser(message->getFrom());
 	if (!user){
 		return;
 	}
@@ -441,7 +451,7 @@ void UserManager::handleProbePresence(Swift::Presence::ref presence) {
 		return;
 	}
 
-	User *user = getUser(presence->getFrom().toBare().toString());
+	User *user = getUser(presence->getFrom());
 
  	if (user) {
  		user->getRosterManager()->sendCurrentPresence(presence->getTo(), presence->getFrom());
@@ -517,7 +527,7 @@ void UserManager::handleSubscription(Swift::Presence::ref presence) {
 		return;
 	}
 
-	User *user = getUser(presence->getFrom().toBare().toString());
+	User *user = getUser(presence->getFrom());
 
  	if (user) {
  		user->handleSubscription(presence);
@@ -551,7 +561,7 @@ void UserManager::connectUser(const Swift::JID &user) {
 				m_userRegistry->removeLater(user);
 				return;
 			}
-			if (CONFIG_BOOL(m_component->getConfig(), "service.more_resources")) {
+			if (m_component->getConfig()->getSnapshot()->moreResources) {
 				m_userRegistry->onPasswordValid(user);
 			}
 			else {
@@ -21,10 +21,15 @@
 #include "transport/usersreconnecter.h"
 
 #include <iostream>
+#include <set>
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include "Swiften/Queries/IQRouter.h"
 #include "transport/storagebackend.h"
 #include "transport/transport.h"
+#include "transport/usermanager.h"
+#include "transport/user.h"
+#include "transport/sessionsnapshot.h"
 #include "transport/logging.h"
 
 #include "Swiften/Network/NetworkFactories.h"
@@ -36,71 +41,126 @@ namespace Transport {
 
 DEFINE_LOGGER(logger, "UserReconnecter");
 
-UsersReconnecter::UsersReconnecter(Component *component, StorageBackend *storageBackend) {
+// Login which doesn't finish in this time (in seconds) is considered as failed.
+#define LOGIN_TIMEOUT 60
+
+UsersReconnecter::UsersReconnecter(Component *component, UserManager *userManager, StorageBackend *storageBackend, SessionSnapshot *sessionSnapshot) {
 	m_component = component;
+	m_userManager = userManager;
 	m_storageBackend = storageBackend;
+	m_sessionSnapshot = sessionSnapshot;
 	m_started = false;
 
 	m_nextUserTimer = m_component->getNetworkFactories()->getTimerFactory()->createTimer(1000);
-	m_nextUserTimer->onTick.connect(boost::bind(&UsersReconnecter::reconnectNextUser, this));
+	m_nextUserTimer->onTick.connect(boost::bind(&UsersReconnecter::reconnectNextUsers, this));
 
 	m_component->onConnected.connect(bind(&UsersReconnecter::handleConnected, this));
 
 	m_config = m_component->getConfig();
+
+	// Start with one backend full of users.
+	m_maxWindow = std::max(1, CONFIG_INT(m_config, "service.reconnect_concurrency"));
+	m_window = std::max(1, std::min(m_maxWindow, CONFIG_INT(m_config, "service.users_per_backend")));
 }
 
 UsersReconnecter::~UsersReconnecter() {
 	m_component->onConnected.disconnect(bind(&UsersReconnecter::handleConnected, this));
 	m_nextUserTimer->stop();
-	m_nextUserTimer->onTick.disconnect(boost::bind(&UsersReconnecter::reconnectNextUser, this));
+	m_nextUserTimer->onTick.disconnect(boost::bind(&UsersReconnecter::reconnectNextUsers, this));
+}
+
+void UsersReconnecter::checkPendingLogins() {
+	time_t now = time(NULL);
+	std::vector<std::string> finished;
+	for (std::map<std::string, PendingLogin>::iterator it = m_pending.begin(); it != m_pending.end(); it++) {
+		User *user = m_userManager->getUser(it->first);
+		if (user && user->isConnected()) {
+			// Successful login, let one more user log in at the same time.
+			m_window = std::min(m_maxWindow, m_window + 1);
+			finished.push_back(it->first);
+			continue;
+		}
+
+		if (user) {
+			it->second.seen = true;
+		}
+
+		// User has been created, but it has been removed before the login finished
+		// or it's still logging in for too long. Legacy network or backends are probably
+		// overloaded, so slow down.
+		if ((!user && it->second.seen) || (user && now - it->second.started > LOGIN_TIMEOUT)) {
+			m_window = std::max(1, m_window / 2);
+			finished.push_back(it->first);
+			continue;
+		}
+
+		// User has not been created at all, so it's probably offline or it's not allowed
+		// to log in.
+		if (now - it->second.started > LOGIN_TIMEOUT) {
+			finished.push_back(it->first);
+		}
+	}
+
+	BOOST_FOREACH(const std::string &jid, finished) {
+		m_pending.erase(jid);
+	}
 }
 
-void UsersReconnecter::reconnectNextUser() {
-	if (m_users.empty()) {
+void UsersReconnecter::reconnectNextUsers() {
+	checkPendingLogins();
+
+	if (m_users.empty() && m_pending.empty()) {
 		LOG4CXX_INFO(logger, "All users reconnected, stopping UserReconnecter.");
 		return;
 	}
 
-	std::string jid = m_users.back();
-	m_users.pop_back();
+	int count = 0;
+	while (!m_users.empty() && (int) m_pending.size() < m_window) {
+		std::string jid = m_users.back();
+		m_users.pop_back();
+		reconnectUser(jid);
+		count++;
+	}
+
+	if (count != 0) {
+		LOG4CXX_INFO(logger, "Reconnecting " << count << " users, " << m_pending.size() << " users are logging in, " << m_users.size() << " users remaining.");
+	}
 
-	if (CONFIG_BOOL(m_config, "service.reconnect_on_start")) {
-	    UserInfo userInfo;
-	    bool registered = m_storageBackend ? m_storageBackend->getUser(jid, userInfo) : false;
-
-	    if (registered) {                
-		std::string value = "1";
-		int type = (int) TYPE_BOOLEAN;
-		m_storageBackend->getUserSetting(userInfo.id, "stay_connected", type, value);
-
-		if (value == "1") {
-		    LOG4CXX_INFO(logger, "Reconnecting user " << jid);
-		    Swift::Presence::ref presence = Swift::Presence::create();
-		    presence->setTo(m_component->getJID());
-		    presence->setFrom(jid);
-		    presence->setType(Swift::Presence::Available);
-		    m_component->onUserPresenceReceived(presence);
-		} else {
-			LOG4CXX_INFO(logger, "Skipping user " << jid << " (stay_connected != 1)");
-		}
-	    } else {
-		LOG4CXX_INFO(logger, "Unknown user " << jid);
-	    }
+	m_nextUserTimer->start();
+}
+
+void UsersReconnecter::reconnectUser(const std::string &jid) {
+	PendingLogin login;
+	login.started = time(NULL);
+	login.seen = false;
+
+	if (m_sessionSnapshot && m_sessionSnapshot->getUserState(jid)) {
+		LOG4CXX_INFO(logger, "Restoring user " << jid << " from session snapshot");
+		m_pending[jid] = login;
+		m_sessionSnapshot->restorePresences(jid);
+	}
+	else if (CONFIG_BOOL(m_config, "service.reconnect_on_start")) {
+		LOG4CXX_INFO(logger, "Reconnecting user " << jid);
+		Swift::Presence::ref presence = Swift::Presence::create();
+		presence->setTo(m_component->getJID());
+		presence->setFrom(jid);
+		presence->setType(Swift::Presence::Available);
+		m_pending[jid] = login;
+		m_component->onUserPresenceReceived(presence);
 	} else {
-	    LOG4CXX_INFO(logger, "Sending probe presence to " << jid);
-	    Swift::Presence::ref response = Swift::Presence::create();
-	    try {
-		response->setTo(jid);
-	    }
-	    catch (...) { return; }
+		LOG4CXX_INFO(logger, "Sending probe presence to " << jid);
+		Swift::Presence::ref response = Swift::Presence::create();
+		try {
+			response->setTo(jid);
+		}
+		catch (...) { return; }
 
-	    response->setFrom(m_component->getJID());
-	    response->setType(Swift::Presence::Probe);
+		response->setFrom(m_component->getJID());
+		response->setType(Swift::Presence::Probe);
 
-	    m_component->getStanzaChannel()->sendPresence(response);
+		m_pending[jid] = login;
+		m_component->getStanzaChannel()->sendPresence(response);
 	}
-        
-	m_nextUserTimer->start();
 }
 
 void UsersReconnecter::handleConnected() {
@@ -111,12 +171,44 @@ void UsersReconnecter::handleConnected() {
 	m_started = true;
 
 	if (CONFIG_BOOL(m_config, "service.reconnect_on_start")) {
-		m_storageBackend->getAllUsers(m_users);
+		// Fetch all users and their stay_connected setting at once instead of
+		// querying the storage for every single user.
+		std::vector<std::string> users;
+		std::map<std::string, std::string> stayConnected;
+		m_storageBackend->getAllUsers(users);
+		m_storageBackend->getUsersSetting("stay_connected", stayConnected);
+
+		BOOST_FOREACH(const std::string &jid, users) {
+			std::map<std::string, std::string>::const_iterator it = stayConnected.find(jid);
+			if (it != stayConnected.end() && it->second != "1") {
+				LOG4CXX_INFO(logger, "Skipping user " << jid << " (stay_connected != 1)");
+				continue;
+			}
+			m_users.push_back(jid);
+		}
 	} else {
 		m_storageBackend->getOnlineUsers(m_users);
 	}
-	
-	reconnectNextUser();
+
+	// Users from the snapshot are reconnected first. Users are taken from
+	// the back of m_users.
+	if (m_sessionSnapshot) {
+		std::vector<std::string> restored;
+		m_sessionSnapshot->getUsers(restored);
+		std::set<std::string> restoredSet(restored.begin(), restored.end());
+
+		std::vector<std::string> users;
+		BOOST_FOREACH(const std::string &jid, m_users) {
+			if (restoredSet.find(jid) == restoredSet.end()) {
+				users.push_back(jid);
+			}
+		}
+		users.insert(users.end(), restored.begin(), restored.end());
+		m_users.swap(users);
+	}
+
+	LOG4CXX_INFO(logger, "Reconnecting " << m_users.size() << " users, at most " << m_maxWindow << " at the same time.");
+	reconnectNextUsers();
 }
 
 
@@ -39,12 +39,13 @@ DEFINE_LOGGER(logger, "VCardResponder");
 VCardResponder::VCardResponder(Swift::IQRouter *router, Swift::NetworkFactories *factories, UserManager *userManager) : Swift::Responder<VCard>(router) {
 	m_id = 0;
 	m_userManager = userManager;
-	m_collectTimer = factories->getTimerFactory()->createTimer(20000);
-	m_collectTimer->onTick.connect(boost::bind(&VCardResponder::collectTimeouted, this));
-	m_collectTimer->start();
+	m_timerWheel = userManager->getComponent()->getTimerWheel();
 }
 
 VCardResponder::~VCardResponder() {
+	for (std::map<unsigned int, VCardData>::iterator it = m_queries.begin(); it != m_queries.end(); it++) {
+		m_timerWheel->cancel(it->second.timeout);
+	}
 }
 
 void VCardResponder::sendVCard(unsigned int id, boost::shared_ptr<Swift::VCard> vcard) {
@@ -56,31 +57,18 @@ void VCardResponder::sendVCard(unsigned int id, boost::shared_ptr<Swift::VCard>
 	LOG4CXX_INFO(logger, m_queries[id].from.toString() << ": Forwarding VCard of " << m_queries[id].to.toString() << " from legacy network");
 
 	sendResponse(m_queries[id].from, m_queries[id].to, m_queries[id].id, vcard);
+	m_timerWheel->cancel(m_queries[id].timeout);
 	m_queries.erase(id);
 }
 
-void VCardResponder::collectTimeouted() {
-	time_t now = time(NULL);
-
-	std::vector<unsigned int> candidates;
-	for(std::map<unsigned int, VCardData>::iterator it = m_queries.begin(); it != m_queries.end(); it++) {
-		if (now - (*it).second.received > 40) {
-			candidates.push_back((*it).first);
-		}
-	}
-
-	if (candidates.size() != 0) {
-		LOG4CXX_INFO(logger, "Removing " << candidates.size() << " timeouted VCard requests");
-	}
-
-	BOOST_FOREACH(unsigned int id, candidates) {
-		sendVCard(id, boost::shared_ptr<Swift::VCard>(new Swift::VCard()));
-	}
-	m_collectTimer->start();
+void VCardResponder::handleQueryTimeout(unsigned int id) {
+	LOG4CXX_INFO(logger, "Removing timeouted VCard request " << id);
+	m_queries[id].timeout = 0;
+	sendVCard(id, boost::shared_ptr<Swift::VCard>(new Swift::VCard()));
 }
 
 bool VCardResponder::handleGetRequest(const Swift::JID& from, const Swift::JID& to, const std::string& id, boost::shared_ptr<Swift::VCard> payload) {
-	User *user = m_userManager->getUser(from.toBare().toString());
+	User *user = m_userManager->getUser(from);
 	if (!user) {
 		LOG4CXX_WARN(logger, from.toBare().toString() << ": User is not logged in");
 		return false;
@@ -100,7 +88,7 @@ bool VCardResponder::handleGetRequest(const Swift::JID& from, const Swift::JID&
 	m_queries[m_id].from = from;
 	m_queries[m_id].to = to;
 	m_queries[m_id].id = id; 
-	m_queries[m_id].received = time(NULL);
+	m_queries[m_id].timeout = m_timerWheel->schedule(40000, boost::bind(&VCardResponder::handleQueryTimeout, this, m_id));
 	onVCardRequired(user, name, m_id++);
 	return true;
 }
@@ -111,7 +99,7 @@ bool VCardResponder::handleSetRequest(const Swift::JID& from, const Swift::JID&
 		return false;
 	}
 
-	User *user = m_userManager->getUser(from.toBare().toString());
+	User *user = m_userManager->getUser(from);
 	if (!user) {
 		LOG4CXX_WARN(logger, from.toBare().toString() << ": User is not logged in");
 		return false;